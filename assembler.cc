@@ -30,7 +30,9 @@ AssemblerBuffer::AssemblerBuffer() {
   ASSERT(Size() == 0);
 }
 
-AssemblerBuffer::~AssemblerBuffer() {}
+AssemblerBuffer::~AssemblerBuffer() {
+  free(reinterpret_cast<void *>(contents_));
+}
 
 void AssemblerBuffer::ExtendCapacity() {
   intptr_t old_size = Size();
@@ -41,6 +43,9 @@ void AssemblerBuffer::ExtendCapacity() {
     FATAL("Unexpected overflow in AssemblerBuffer::ExtendCapacity");
   }
 
+  INC_ASSEMBLER_STAT(extend_capacity_calls, 1);
+  INC_ASSEMBLER_STAT(extend_capacity_bytes_copied, old_size);
+
   // Allocate the new data area and copy contents of the old one to it.
   uword new_contents = NewContents(new_capacity);
   memmove(reinterpret_cast<void *>(new_contents),
@@ -48,6 +53,7 @@ void AssemblerBuffer::ExtendCapacity() {
 
   // Compute the relocation delta and switch to the new contents area.
   intptr_t delta = new_contents - contents_;
+  free(reinterpret_cast<void *>(contents_));
   contents_ = new_contents;
 
   // Update the cursor and recompute the limit.
@@ -59,6 +65,28 @@ void AssemblerBuffer::ExtendCapacity() {
   ASSERT(Size() == old_size);
 }
 
+void AssemblerBuffer::Swap(AssemblerBuffer *other) {
+  uword contents = contents_;
+  uword cursor = cursor_;
+  uword limit = limit_;
+  contents_ = other->contents_;
+  cursor_ = other->cursor_;
+  limit_ = other->limit_;
+  other->contents_ = contents;
+  other->cursor_ = cursor;
+  other->limit_ = limit;
+}
+
+void AssemblerBuffer::InsertGap(intptr_t position, intptr_t length) {
+  ASSERT(HasEnsuredCapacity());
+  ASSERT(position >= 0 && position <= Size());
+  ASSERT(length >= 0 && length <= kMinimumGap);
+  uword from = contents_ + position;
+  memmove(reinterpret_cast<void *>(from + length),
+          reinterpret_cast<void *>(from), cursor_ - from);
+  cursor_ += length;
+}
+
 // Shared macros are implemented here.
 void AssemblerBase::Unimplemented(const char *message) {
   const char *format = "Unimplemented: %s";
@@ -4,6 +4,7 @@
 
 #pragma once
 
+#include "assembler_statistics.h"
 #include "globals.h"
 
 // Forward declarations.
@@ -12,7 +13,9 @@ class AssemblerBuffer;
 
 class Label {
 public:
-  Label() : position_(0), unresolved_(0) {
+  Label()
+      : position_(0), unresolved_(0), ymm_upper_dirty_(false),
+        call_frame_index_(0) {
 #ifdef DEBUG
     for (int i = 0; i < kMaxUnresolvedBranches; i++) {
       unresolved_near_positions_[i] = -1;
@@ -64,6 +67,13 @@ private:
   intptr_t position_;
   intptr_t unresolved_;
   intptr_t unresolved_near_positions_[kMaxUnresolvedBranches];
+  // Whether the upper halves of the YMM registers may be dirty on some
+  // branch to this label (x64 only).
+  bool ymm_upper_dirty_;
+  // The call frame on the first branch to this label, if tracked (x64
+  // only): 1 + its index in the branch call frames of the assembler, or 0
+  // for none.
+  int32_t call_frame_index_;
 
   void Reinitialize() { position_ = 0; }
 
@@ -124,6 +134,15 @@ public:
     cursor_ -= sizeof(T);
   }
 
+  // Exchanges the contents of this buffer with |other|.
+  void Swap(AssemblerBuffer *other);
+
+  // Inserts |length| uninitialized bytes at |position|, moving the code
+  // after it up. The moved code must be position independent and must not
+  // contain label links. At most kMinimumGap bytes can be inserted per
+  // ensured capacity.
+  void InsertGap(intptr_t position, intptr_t length);
+
   // Return address to code at |position| bytes.
   uword Address(intptr_t position) { return contents_ + position; }
 
@@ -217,6 +236,8 @@ private:
   }
 
   void ExtendCapacity();
+
+  DISALLOW_COPY_AND_ASSIGN(AssemblerBuffer);
 };
 
 enum RestorePP { kRestoreCallerPP, kKeepCalleePP };
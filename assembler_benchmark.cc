@@ -0,0 +1,576 @@
+// Copyright (c) 2019, the Dart project authors.  Please see the AUTHORS file
+// for details. All rights reserved. Use of this source code is governed by a
+// BSD-style license that can be found in the LICENSE file.
+
+#include "assembler_benchmark.h"
+
+#include <inttypes.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "assembler.h"
+#include "code_cache.h"
+#include "code_heap.h"
+#include "code_snapshot.h"
+
+static int64_t NowNanos() {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return static_cast<int64_t>(now.tv_sec) * 1000000000 + now.tv_nsec;
+}
+
+// Accumulates the time spent in the measured parts of a case.
+class Stopwatch : public ValueObject {
+public:
+  Stopwatch() : start_(0), elapsed_(0) {}
+
+  void Start() { start_ = NowNanos(); }
+  void Stop() { elapsed_ += NowNanos() - start_; }
+  int64_t elapsed() const { return elapsed_; }
+
+private:
+  int64_t start_;
+  int64_t elapsed_;
+
+  DISALLOW_COPY_AND_ASSIGN(Stopwatch);
+};
+
+// Emits about |count| instructions of a case into |assembler|, timing the
+// emission with |stopwatch|. |argument| selects the variant of the case.
+// Returns the number of instructions emitted.
+typedef intptr_t (*CaseFunction)(Assembler *assembler, intptr_t count,
+                                 intptr_t argument, Stopwatch *stopwatch);
+
+// Emits a single instruction.
+typedef void (*EmitFunction)(Assembler *assembler, intptr_t argument);
+
+// A case that repeats a single instruction. The emitter is a template
+// argument so that it is inlined into the timed loop.
+template <EmitFunction emit>
+static intptr_t Repeat(Assembler *assembler, intptr_t count,
+                       intptr_t argument, Stopwatch *stopwatch) {
+  stopwatch->Start();
+  for (intptr_t i = 0; i < count; i++) {
+    emit(assembler, argument);
+  }
+  stopwatch->Stop();
+  return count;
+}
+
+// ALU instructions, in each operand form.
+#define DEFINE_ALU_EMITTERS(op, c)                                             \
+  static void op##q_reg_reg(Assembler *assembler, intptr_t argument) {         \
+    assembler->op##q(RAX, RCX);                                                \
+  }                                                                            \
+  static void op##q_reg_imm8(Assembler *assembler, intptr_t argument) {        \
+    assembler->op##q(RAX, Immediate(0x10));                                    \
+  }                                                                            \
+  static void op##q_reg_imm32(Assembler *assembler, intptr_t argument) {       \
+    assembler->op##q(RAX, Immediate(0x12345));                                 \
+  }                                                                            \
+  static void op##l_reg_imm32(Assembler *assembler, intptr_t argument) {       \
+    assembler->op##l(RAX, Immediate(0x12345));                                 \
+  }                                                                            \
+  static void op##q_reg_mem(Assembler *assembler, intptr_t argument) {         \
+    assembler->op##q(RAX, Address(RBX, 8));                                    \
+  }                                                                            \
+  static void op##q_mem_reg(Assembler *assembler, intptr_t argument) {         \
+    assembler->op##q(Address(RBX, 8), RAX);                                    \
+  }                                                                            \
+  static void op##q_mem_imm8(Assembler *assembler, intptr_t argument) {        \
+    assembler->op##q(Address(RBX, 8), Immediate(0x10));                        \
+  }
+X86_ALU_CODES(DEFINE_ALU_EMITTERS)
+#undef DEFINE_ALU_EMITTERS
+
+// The memory operand forms. The argument of a case packs the base, the
+// index and the displacement, which are decoded for each instruction, as
+// when they are chosen by a register allocator.
+static const intptr_t kNoAddressRegister = 0xFF;
+static const intptr_t kRipRelative = 0xFE;
+
+static intptr_t AddressArgument(intptr_t base, intptr_t index, int32_t disp) {
+  return base | (index << 8) | (static_cast<intptr_t>(disp) << 16);
+}
+
+static Address AddressOf(intptr_t argument) {
+  const intptr_t base = argument & 0xFF;
+  const intptr_t index = (argument >> 8) & 0xFF;
+  const int32_t disp = static_cast<int32_t>(argument >> 16);
+  if (base == kRipRelative) {
+    return Address::AddressRIPRelative(disp);
+  }
+  if (base == kNoAddressRegister) {
+    return Address(static_cast<Register>(index), TIMES_8, disp);
+  }
+  if (index == kNoAddressRegister) {
+    return Address(static_cast<Register>(base), disp);
+  }
+  return Address(static_cast<Register>(base), static_cast<Register>(index),
+                 TIMES_8, disp);
+}
+
+static void movq_reg_address(Assembler *assembler, intptr_t argument) {
+  assembler->movq(RAX, AddressOf(argument));
+}
+
+// XMM ALU instructions; the scalar forms only exist for the arithmetic
+// ones.
+#define DEFINE_XMM_EMITTERS(name, code)                                        \
+  static void name##ps_reg_reg(Assembler *assembler, intptr_t argument) {      \
+    assembler->name##ps(XMM0, XMM1);                                           \
+  }                                                                            \
+  static void name##ps_reg_mem(Assembler *assembler, intptr_t argument) {      \
+    assembler->name##ps(XMM0, Address(RBX, 16));                               \
+  }                                                                            \
+  static void name##sd_reg_reg(Assembler *assembler, intptr_t argument) {      \
+    assembler->name##sd(XMM0, XMM1);                                           \
+  }
+XMM_ALU_CODES(DEFINE_XMM_EMITTERS)
+#undef DEFINE_XMM_EMITTERS
+
+static bool HasScalarForm(int code) {
+  // Not the approximations (rsqrt, rcp) nor the logical operations.
+  return code == 1 || code >= 8;
+}
+
+// The jump cases; the argument is kJmp or kJcc.
+enum { kJmp, kJcc };
+
+static void EmitJump(Assembler *assembler, intptr_t argument, Label *label,
+                     bool near) {
+  if (argument == kJmp) {
+    assembler->jmp(label, near);
+  } else {
+    assembler->j(NOT_ZERO, label, near);
+  }
+}
+
+// Backward jumps with an 8-bit displacement: a label is bound before every
+// few jumps.
+static intptr_t ShortBackwardJumps(Assembler *assembler, intptr_t count,
+                                   intptr_t argument, Stopwatch *stopwatch) {
+  static const intptr_t kJumpsPerLabel = 16;
+  stopwatch->Start();
+  for (intptr_t i = 0; i < count; i += kJumpsPerLabel) {
+    Label label;
+    assembler->Bind(&label);
+    for (intptr_t j = 0; j < kJumpsPerLabel; j++) {
+      EmitJump(assembler, argument, &label, Assembler::kFarJump);
+    }
+  }
+  stopwatch->Stop();
+  return ((count + kJumpsPerLabel - 1) / kJumpsPerLabel) * kJumpsPerLabel;
+}
+
+// Backward jumps with a 32-bit displacement.
+static intptr_t LongBackwardJumps(Assembler *assembler, intptr_t count,
+                                  intptr_t argument, Stopwatch *stopwatch) {
+  Label label;
+  assembler->Bind(&label);
+  for (intptr_t i = 0; i < 256; i += MAX_NOP_SIZE) {
+    assembler->nop(MAX_NOP_SIZE);
+  }
+  stopwatch->Start();
+  for (intptr_t i = 0; i < count; i++) {
+    EmitJump(assembler, argument, &label, Assembler::kFarJump);
+  }
+  stopwatch->Stop();
+  return count;
+}
+
+// Forward jumps to unbound labels, with 8-bit (|near|) or 32-bit
+// displacements, including binding the labels.
+template <bool near>
+static intptr_t ForwardJumps(Assembler *assembler, intptr_t count,
+                             intptr_t argument, Stopwatch *stopwatch) {
+  static const intptr_t kJumpsPerLabel = 8;
+  stopwatch->Start();
+  for (intptr_t i = 0; i < count; i += kJumpsPerLabel) {
+    Label label;
+    for (intptr_t j = 0; j < kJumpsPerLabel; j++) {
+      EmitJump(assembler, argument, &label, near);
+    }
+    assembler->Bind(&label);
+  }
+  stopwatch->Stop();
+  return ((count + kJumpsPerLabel - 1) / kJumpsPerLabel) * kJumpsPerLabel;
+}
+
+// Bind() of a label with |count| pending jumps; only the Bind() is timed.
+static intptr_t BindPendingFixups(Assembler *assembler, intptr_t count,
+                                  intptr_t argument, Stopwatch *stopwatch) {
+  Label label;
+  for (intptr_t i = 0; i < count; i++) {
+    EmitJump(assembler, argument, &label, Assembler::kFarJump);
+  }
+  stopwatch->Start();
+  assembler->Bind(&label);
+  stopwatch->Stop();
+  return count;
+}
+
+// An instruction followed by Align(), with the padding of the argument:
+// the alignment, plus kAlignByLengthening << 8 to lengthen.
+static intptr_t AlignAfterInstruction(Assembler *assembler, intptr_t count,
+                                      intptr_t argument, Stopwatch *stopwatch) {
+  const int alignment = argument & 0xFF;
+  assembler->set_align_padding(
+      static_cast<Assembler::AlignPadding>(argument >> 8));
+  stopwatch->Start();
+  for (intptr_t i = 0; i < count; i++) {
+    assembler->addq(RAX, Immediate(1));
+    assembler->Align(alignment, 0);
+  }
+  stopwatch->Stop();
+  return count;
+}
+
+struct BenchmarkCase {
+  char name[48];
+  CaseFunction function;
+  intptr_t argument;
+};
+
+static const intptr_t kMaxCases = 256;
+
+class CaseList : public ValueObject {
+public:
+  CaseList() : length_(0) {}
+
+  void Add(const char *name, CaseFunction function, intptr_t argument = 0) {
+    ASSERT(length_ < kMaxCases);
+    BenchmarkCase *benchmark_case = &cases_[length_++];
+    snprintf(benchmark_case->name, sizeof(benchmark_case->name), "%s", name);
+    benchmark_case->function = function;
+    benchmark_case->argument = argument;
+  }
+
+  intptr_t length() const { return length_; }
+  const BenchmarkCase &At(intptr_t index) const { return cases_[index]; }
+
+private:
+  BenchmarkCase cases_[kMaxCases];
+  intptr_t length_;
+
+  DISALLOW_COPY_AND_ASSIGN(CaseList);
+};
+
+static void AddAddressCases(CaseList *cases) {
+  static const Register kBases[] = {RAX, RSP, RBP, R12, R13};
+  static const Register kIndexes[] = {RCX, R9};
+  static const int32_t kDisplacements[] = {0, 0x10, 0x1000};
+  static const char *const kDisplacementNames[] = {"", "+disp8", "+disp32"};
+  char name[48];
+  for (intptr_t d = 0; d < 3; d++) {
+    const int32_t disp = kDisplacements[d];
+    for (intptr_t b = 0; b < 5; b++) {
+      const Register base = kBases[b];
+      snprintf(name, sizeof(name), "movq reg,[%s%s]", cpu_reg_names[base],
+               kDisplacementNames[d]);
+      cases->Add(name, Repeat<movq_reg_address>,
+                 AddressArgument(base, kNoAddressRegister, disp));
+      for (intptr_t i = 0; i < 2; i++) {
+        const Register index = kIndexes[i];
+        snprintf(name, sizeof(name), "movq reg,[%s+%s*8%s]",
+                 cpu_reg_names[base], cpu_reg_names[index],
+                 kDisplacementNames[d]);
+        cases->Add(name, Repeat<movq_reg_address>,
+                   AddressArgument(base, index, disp));
+      }
+    }
+  }
+  cases->Add("movq reg,[rcx*8+disp32]", Repeat<movq_reg_address>,
+             AddressArgument(kNoAddressRegister, RCX, 0x1000));
+  cases->Add("movq reg,[rip+disp32]", Repeat<movq_reg_address>,
+             AddressArgument(kRipRelative, kNoAddressRegister, 0x1000));
+}
+
+static void AddCases(CaseList *cases) {
+#define ADD_ALU_CASES(op, c)                                                   \
+  cases->Add(#op "q reg,reg", Repeat<op##q_reg_reg>);                          \
+  cases->Add(#op "q reg,imm8", Repeat<op##q_reg_imm8>);                        \
+  cases->Add(#op "q reg,imm32", Repeat<op##q_reg_imm32>);                      \
+  cases->Add(#op "l reg,imm32", Repeat<op##l_reg_imm32>);                      \
+  cases->Add(#op "q reg,[mem]", Repeat<op##q_reg_mem>);                        \
+  cases->Add(#op "q [mem],reg", Repeat<op##q_mem_reg>);                        \
+  cases->Add(#op "q [mem],imm8", Repeat<op##q_mem_imm8>);
+  X86_ALU_CODES(ADD_ALU_CASES)
+#undef ADD_ALU_CASES
+
+  AddAddressCases(cases);
+
+#define ADD_XMM_CASES(name, code)                                              \
+  if (strncmp(#name, "bad", 3) != 0) {                                         \
+    cases->Add(#name "ps xmm,xmm", Repeat<name##ps_reg_reg>);                  \
+    cases->Add(#name "ps xmm,[mem]", Repeat<name##ps_reg_mem>);                \
+    if (HasScalarForm(code)) {                                                 \
+      cases->Add(#name "sd xmm,xmm", Repeat<name##sd_reg_reg>);                \
+    }                                                                          \
+  }
+  XMM_ALU_CODES(ADD_XMM_CASES)
+#undef ADD_XMM_CASES
+
+  cases->Add("jmp backward rel8", ShortBackwardJumps, kJmp);
+  cases->Add("jcc backward rel8", ShortBackwardJumps, kJcc);
+  cases->Add("jmp backward rel32", LongBackwardJumps, kJmp);
+  cases->Add("jcc backward rel32", LongBackwardJumps, kJcc);
+  cases->Add("jmp forward near, with Bind", ForwardJumps<true>, kJmp);
+  cases->Add("jcc forward near, with Bind", ForwardJumps<true>, kJcc);
+  cases->Add("jmp forward far, with Bind", ForwardJumps<false>, kJmp);
+  cases->Add("jcc forward far, with Bind", ForwardJumps<false>, kJcc);
+  cases->Add("Bind, per pending jmp", BindPendingFixups, kJmp);
+  cases->Add("Bind, per pending jcc", BindPendingFixups, kJcc);
+
+  cases->Add("addq + Align(16), nops", AlignAfterInstruction, 16);
+  cases->Add("addq + Align(32), nops", AlignAfterInstruction, 32);
+  cases->Add("addq + Align(16), lengthening", AlignAfterInstruction,
+             16 | (Assembler::kAlignByLengthening << 8));
+  cases->Add("addq + Align(32), lengthening", AlignAfterInstruction,
+             32 | (Assembler::kAlignByLengthening << 8));
+}
+
+static int CompareDoubles(const void *a, const void *b) {
+  const double left = *reinterpret_cast<const double *>(a);
+  const double right = *reinterpret_cast<const double *>(b);
+  return left < right ? -1 : (left > right ? 1 : 0);
+}
+
+// The nearest-rank |percentile| of the |length| sorted |values|.
+static double Percentile(const double *values, intptr_t length,
+                         intptr_t percentile) {
+  const intptr_t rank = (percentile * length + 99) / 100;
+  ASSERT(rank >= 1 && rank <= length);
+  return values[rank - 1];
+}
+
+bool AssemblerBenchmark::PinToCpu(int cpu) {
+  cpu_set_t cpus;
+  CPU_ZERO(&cpus);
+  CPU_SET(cpu, &cpus);
+  return pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus) == 0;
+}
+
+bool AssemblerBenchmark::Run(const Options &options, FILE *out) {
+  ASSERT(options.samples > 0 && options.block_size > 0);
+  bool pinned = true;
+  if (options.cpu >= 0 && !PinToCpu(options.cpu)) {
+    fprintf(out, "warning: cannot pin to cpu %d\n", options.cpu);
+    pinned = false;
+  }
+  CaseList cases;
+  AddCases(&cases);
+  double *samples =
+      reinterpret_cast<double *>(malloc(options.samples * sizeof(double)));
+  fprintf(out, "%-40s %8s %8s %8s %8s %12s\n", "case (ns/instruction)", "min",
+          "p50", "p90", "p99", "Minstr/s");
+  for (intptr_t c = 0; c < cases.length(); c++) {
+    const BenchmarkCase &benchmark_case = cases.At(c);
+    if (options.filter != NULL &&
+        strstr(benchmark_case.name, options.filter) == NULL) {
+      continue;
+    }
+    for (intptr_t i = -options.warmup_samples; i < options.samples; i++) {
+      Stopwatch stopwatch;
+      intptr_t instructions;
+      {
+        Assembler assembler;
+        instructions =
+            benchmark_case.function(&assembler, options.block_size,
+                                    benchmark_case.argument, &stopwatch);
+      }
+      if (i >= 0) {
+        samples[i] = static_cast<double>(stopwatch.elapsed()) / instructions;
+      }
+    }
+    qsort(samples, options.samples, sizeof(samples[0]), CompareDoubles);
+    const double median = Percentile(samples, options.samples, 50);
+    fprintf(out, "%-40s %8.2f %8.2f %8.2f %8.2f %12.1f\n",
+            benchmark_case.name, samples[0], median,
+            Percentile(samples, options.samples, 90),
+            Percentile(samples, options.samples, 99),
+            median > 0 ? 1e3 / median : 0.0);
+  }
+  free(samples);
+  return pinned;
+}
+
+// The state of a thread of the code heap benchmark.
+struct CodeHeapWorker {
+  CodeHeap *heap;
+  pthread_barrier_t *start;
+  intptr_t installs;
+  int64_t elapsed;
+};
+
+typedef intptr_t (*ReturnFunction)();
+
+static void *CodeHeapWorkerMain(void *argument) {
+  CodeHeapWorker *worker = reinterpret_cast<CodeHeapWorker *>(argument);
+  Assembler assembler;
+  assembler.movq(RAX, Immediate(42));
+  assembler.ret();
+  assembler.FinalizeCode();
+  uword window[AssemblerBenchmark::kCodeHeapWindow];
+  intptr_t sum = 0;
+  {
+    CodeHeap::Thread thread(worker->heap);
+    pthread_barrier_wait(worker->start);
+    Stopwatch stopwatch;
+    stopwatch.Start();
+    for (intptr_t i = 0; i < worker->installs; i++) {
+      const intptr_t slot = i % AssemblerBenchmark::kCodeHeapWindow;
+      if (i >= AssemblerBenchmark::kCodeHeapWindow) {
+        thread.Retire(window[slot], assembler.CodeSize());
+      }
+      window[slot] = thread.Install(&assembler);
+      CodeHeap::CriticalSection section(&thread);
+      sum += reinterpret_cast<ReturnFunction>(window[slot])();
+    }
+    stopwatch.Stop();
+    worker->elapsed = stopwatch.elapsed();
+    const intptr_t live =
+        Utils::Minimum(worker->installs, AssemblerBenchmark::kCodeHeapWindow);
+    for (intptr_t i = 0; i < live; i++) {
+      thread.Retire(window[i], assembler.CodeSize());
+    }
+  }
+  if (sum != 42 * worker->installs) {
+    FATAL("Wrong result from installed code");
+  }
+  return NULL;
+}
+
+void AssemblerBenchmark::RunCodeHeapScaling(intptr_t max_threads,
+                                            intptr_t installs, FILE *out) {
+  ASSERT(max_threads > 0 && installs > 0);
+  CodeHeapWorker *workers = reinterpret_cast<CodeHeapWorker *>(
+      malloc(max_threads * sizeof(CodeHeapWorker)));
+  pthread_t *threads =
+      reinterpret_cast<pthread_t *>(malloc(max_threads * sizeof(pthread_t)));
+  fprintf(out, "%-10s %14s %14s %8s\n", "threads", "installs/s",
+          "per thread", "chunks");
+  for (intptr_t count = 1; count <= max_threads; count *= 2) {
+    CodeHeap heap(count * 64 * CodeHeap::kChunkSize);
+    pthread_barrier_t start;
+    pthread_barrier_init(&start, NULL, count);
+    for (intptr_t i = 0; i < count; i++) {
+      workers[i].heap = &heap;
+      workers[i].start = &start;
+      workers[i].installs = installs;
+      workers[i].elapsed = 0;
+      if (pthread_create(&threads[i], NULL, CodeHeapWorkerMain,
+                         &workers[i]) != 0) {
+        FATAL("Cannot create a benchmark thread");
+      }
+    }
+    // The threads run for about as long; the slowest bounds the total.
+    int64_t elapsed = 0;
+    for (intptr_t i = 0; i < count; i++) {
+      pthread_join(threads[i], NULL);
+      if (workers[i].elapsed > elapsed) {
+        elapsed = workers[i].elapsed;
+      }
+    }
+    pthread_barrier_destroy(&start);
+    const double total = 1e9 * count * installs / elapsed;
+    fprintf(out, "%-10" PRIdPTR " %14.0f %14.0f %8" PRIdPTR "\n", count,
+            total, total / count, heap.UsedChunks());
+  }
+  free(threads);
+  free(workers);
+}
+
+static const intptr_t kSnapshotSymbol = 1;
+
+static intptr_t SnapshotCallee(intptr_t value) { return value + 1; }
+
+// A stub of about 500 bytes, distinct for each |key|, returning key + 1.
+static void EmitSnapshotStub(Assembler *assembler, intptr_t key) {
+  assembler->movq(RAX, Immediate(key));
+  for (intptr_t i = 0; i < 50; i++) {
+    assembler->movq(RDX, Immediate(key * 50 + i));
+    assembler->xorq(RAX, RDX);
+    assembler->xorq(RAX, RDX);
+  }
+  assembler->movq(RDI, RAX);
+  assembler->GenerateUnRelocatedPcRelativeTailCall(kSnapshotSymbol);
+  assembler->FinalizeCode();
+}
+
+// Installs every stub into a new CodeCache, from the snapshot at |path| if
+// |warm|, checks them and releases them. Returns the nanoseconds taken to
+// install them, or -1 if the snapshot could not be opened.
+static int64_t InstallSnapshotStubs(intptr_t stubs, const char *path,
+                                    bool warm) {
+  CodeCache cache;
+  cache.AddExternalSymbol(kSnapshotSymbol,
+                          reinterpret_cast<uword>(&SnapshotCallee));
+  const CachedCode **code = reinterpret_cast<const CachedCode **>(
+      malloc(stubs * sizeof(CachedCode *)));
+  CodeSnapshot snapshot;
+  Stopwatch stopwatch;
+  stopwatch.Start();
+  if (warm) {
+    if (!snapshot.Open(path, &cache)) {
+      free(code);
+      return -1;
+    }
+    for (intptr_t i = 0; i < stubs; i++) {
+      code[i] = snapshot.Install(i);
+    }
+  } else {
+    for (intptr_t i = 0; i < stubs; i++) {
+      Assembler assembler;
+      EmitSnapshotStub(&assembler, i);
+      code[i] = cache.Install(&assembler);
+    }
+  }
+  stopwatch.Stop();
+  for (intptr_t i = 0; i < stubs; i++) {
+    if (code[i] == NULL ||
+        reinterpret_cast<intptr_t (*)()>(code[i]->EntryPoint())() != i + 1) {
+      FATAL("Wrong result from installed code");
+    }
+    cache.Release(code[i]);
+  }
+  free(code);
+  return stopwatch.elapsed();
+}
+
+bool AssemblerBenchmark::RunSnapshotStartup(intptr_t stubs, const char *path,
+                                            FILE *out) {
+  ASSERT(stubs > 0);
+  {
+    CodeSnapshotWriter writer;
+    for (intptr_t i = 0; i < stubs; i++) {
+      Assembler assembler;
+      EmitSnapshotStub(&assembler, i);
+      writer.AddCode(i, &assembler);
+    }
+    if (!writer.WriteToFile(path)) {
+      return false;
+    }
+  }
+  int64_t cold = 0;
+  int64_t warm = 0;
+  for (intptr_t run = 0; run < kSnapshotRuns; run++) {
+    const int64_t cold_run = InstallSnapshotStubs(stubs, path, false);
+    const int64_t warm_run = InstallSnapshotStubs(stubs, path, true);
+    if (warm_run < 0) {
+      unlink(path);
+      return false;
+    }
+    cold = run == 0 ? cold_run : Utils::Minimum(cold, cold_run);
+    warm = run == 0 ? warm_run : Utils::Minimum(warm, warm_run);
+  }
+  unlink(path);
+  fprintf(out, "%-6s %12s %12s\n", "start", "ms", "us/stub");
+  fprintf(out, "%-6s %12.2f %12.2f\n", "cold", cold / 1e6,
+          cold / 1e3 / stubs);
+  fprintf(out, "%-6s %12.2f %12.2f\n", "warm", warm / 1e6,
+          warm / 1e3 / stubs);
+  return true;
+}
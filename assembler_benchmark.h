@@ -0,0 +1,81 @@
+// Copyright (c) 2019, the Dart project authors.  Please see the AUTHORS file
+// for details. All rights reserved. Use of this source code is governed by a
+// BSD-style license that can be found in the LICENSE file.
+
+#pragma once
+
+#include <stdio.h>
+
+#include "globals.h"
+
+// Measures how fast the Assembler emits, per emitter family:
+//   - the X86_ALU_CODES instructions, in all operand forms;
+//   - memory operands, for every base, index and displacement size;
+//   - the XMM_ALU_CODES instructions;
+//   - jumps to bound and unbound labels, and Bind() with many pending
+//     fixups;
+//   - Align(), with NOPs and by lengthening.
+//
+// Each case is sampled a fixed number of times. A sample times the emission
+// of a block of instructions into a new Assembler, and the case reports
+// percentiles over the samples, so runs are comparable and regressions in
+// emission speed show up. Pinning the benchmark to a CPU keeps the samples
+// stable.
+//
+// Run() is the whole benchmark; a driver only needs to call it, e.g.
+//
+//     int main(int argc, char **argv) {
+//       AssemblerBenchmark::Options options;
+//       options.filter = argc > 1 ? argv[1] : NULL;
+//       return AssemblerBenchmark::Run(options, stdout) ? 0 : 1;
+//     }
+class AssemblerBenchmark {
+public:
+  struct Options {
+    Options()
+        : samples(200), warmup_samples(20), block_size(1000), cpu(0),
+          filter(NULL) {}
+
+    // The samples taken of each case, after the warm-up samples.
+    intptr_t samples;
+    intptr_t warmup_samples;
+    // The instructions emitted per sample.
+    intptr_t block_size;
+    // The CPU to pin the calling thread to, or -1 to leave it unpinned.
+    int cpu;
+    // Only the cases whose name contains |filter| are run, if not NULL.
+    const char *filter;
+  };
+
+  // Runs the cases selected by |options| and writes a line per case to
+  // |out|: the minimum and the 50th, 90th and 99th percentiles of the
+  // nanoseconds per instruction, and the instructions per second at the
+  // median. Returns false if the thread could not be pinned to
+  // |options.cpu|; the cases are run anyway.
+  static bool Run(const Options &options, FILE *out);
+
+  // Measures the scaling of the CodeHeap with 1, 2, 4... up to
+  // |max_threads| threads. Each thread installs |installs| small functions,
+  // calls each once in a critical section and retires it after the next
+  // kCodeHeapWindow installs. Writes a line per thread count: the installs
+  // per second in total and per thread, and the chunks used at the end.
+  static void RunCodeHeapScaling(intptr_t max_threads, intptr_t installs,
+                                 FILE *out);
+  static const intptr_t kCodeHeapWindow = 64;
+
+  // Compares the cold and warm startup of |stubs| distinct stubs of about
+  // 500 bytes, each calling an external symbol: generating and installing
+  // them into a CodeCache, against CodeSnapshot::Open() of a snapshot
+  // written to |path| and CodeSnapshot::Install() of each. Writes the best
+  // of kSnapshotRuns runs of each, and removes the file. Returns false if
+  // the snapshot could not be written or opened.
+  static bool RunSnapshotStartup(intptr_t stubs, const char *path,
+                                 FILE *out);
+  static const intptr_t kSnapshotRuns = 5;
+
+  // Pins the calling thread to |cpu|. Returns false on failure.
+  static bool PinToCpu(int cpu);
+
+private:
+  DISALLOW_IMPLICIT_CONSTRUCTORS(AssemblerBenchmark);
+};
@@ -0,0 +1,162 @@
+// Copyright (c) 2019, the Dart project authors.  Please see the AUTHORS file
+// for details. All rights reserved. Use of this source code is governed by a
+// BSD-style license that can be found in the LICENSE file.
+
+#include "assembler_statistics.h"
+
+#include <inttypes.h>
+
+#include "disassembler.h"
+
+static const char *const kByteCategoryNames[] = {
+    "prefix",       "rex",       "opcode",    "modrm",
+    "displacement", "immediate", "undecoded",
+};
+
+#if defined(ASSEMBLER_STATISTICS)
+thread_local AssemblerStatistics::Counters AssemblerStatistics::current_;
+#endif
+
+AssemblerStatistics::Counters AssemblerStatistics::Snapshot() {
+#if defined(ASSEMBLER_STATISTICS)
+  return current_;
+#else
+  Counters counters;
+  memset(&counters, 0, sizeof(counters));
+  return counters;
+#endif
+}
+
+void AssemblerStatistics::Reset() {
+#if defined(ASSEMBLER_STATISTICS)
+  memset(&current_, 0, sizeof(current_));
+#endif
+}
+
+#if defined(ASSEMBLER_STATISTICS)
+// Counts an instruction of mnemonic |name|, of |length| characters.
+static void CountMnemonic(AssemblerStatistics::Counters *counters,
+                          const char *name, intptr_t length) {
+  const intptr_t kMaxMnemonics = AssemblerStatistics::kMaxMnemonics;
+  if (length >= AssemblerStatistics::kMaxMnemonicLength) {
+    counters->other_mnemonics++;
+    return;
+  }
+  uint32_t hash = 2166136261u; // FNV-1a.
+  for (intptr_t i = 0; i < length; i++) {
+    hash = (hash ^ static_cast<uint8_t>(name[i])) * 16777619u;
+  }
+  for (intptr_t i = 0; i < kMaxMnemonics; i++) {
+    AssemblerStatistics::MnemonicCount *entry =
+        &counters->mnemonics[(hash + i) & (kMaxMnemonics - 1)];
+    if (entry->count == 0) {
+      memmove(entry->mnemonic, name, length);
+      entry->mnemonic[length] = '\0';
+      entry->count = 1;
+      return;
+    }
+    if (strncmp(entry->mnemonic, name, length) == 0 &&
+        entry->mnemonic[length] == '\0') {
+      entry->count++;
+      return;
+    }
+  }
+  counters->other_mnemonics++;
+}
+#endif
+
+void AssemblerStatistics::CountInstructions(const uint8_t *code,
+                                            intptr_t length) {
+#if defined(ASSEMBLER_STATISTICS)
+  static_assert((kMaxMnemonics & (kMaxMnemonics - 1)) == 0,
+                "The mnemonic table is indexed by masking");
+  Counters *counters = current();
+  Disassembler::Instruction instruction;
+  for (intptr_t offset = 0; offset < length; offset += instruction.length) {
+    Disassembler::Decode(code, length, offset, &instruction);
+    if (!instruction.is_valid) {
+      counters->bytes[kUndecodedBytes] += instruction.length;
+      continue;
+    }
+    counters->instructions++;
+    counters->bytes[kPrefixBytes] += instruction.prefix_length;
+    counters->bytes[kRexBytes] += instruction.rex_length;
+    counters->bytes[kOpcodeBytes] += instruction.opcode_length;
+    counters->bytes[kModRMBytes] += instruction.modrm_length;
+    counters->bytes[kDisplacementBytes] += instruction.displacement_length;
+    counters->bytes[kImmediateBytes] += instruction.immediate_length;
+    // The mnemonic is the first word of the text, after "lock" or "rep".
+    const char *name = instruction.text;
+    if (strncmp(name, "lock ", 5) == 0) {
+      name += 5;
+    } else if (strncmp(name, "rep ", 4) == 0) {
+      name += 4;
+    }
+    intptr_t name_length = 0;
+    while (name[name_length] != '\0' && name[name_length] != ' ') {
+      name_length++;
+    }
+    CountMnemonic(counters, name, name_length);
+    if (instruction.has_branch_target && name[0] == 'j') {
+      if (instruction.displacement_length == 1) {
+        counters->near_branches++;
+      } else {
+        counters->far_branches++;
+      }
+    }
+  }
+#else
+  (void)code;
+  (void)length;
+#endif
+}
+
+static int CompareMnemonicCounts(const void *a, const void *b) {
+  const AssemblerStatistics::MnemonicCount *left =
+      reinterpret_cast<const AssemblerStatistics::MnemonicCount *>(a);
+  const AssemblerStatistics::MnemonicCount *right =
+      reinterpret_cast<const AssemblerStatistics::MnemonicCount *>(b);
+  if (left->count != right->count) {
+    return left->count > right->count ? -1 : 1;
+  }
+  return strcmp(left->mnemonic, right->mnemonic);
+}
+
+void AssemblerStatistics::WriteJson(const Counters &counters, FILE *out) {
+  static_assert(sizeof(kByteCategoryNames) / sizeof(kByteCategoryNames[0]) ==
+                    kNumByteCategories,
+                "A name per byte category");
+  MnemonicCount sorted[kMaxMnemonics];
+  intptr_t mnemonic_count = 0;
+  for (intptr_t i = 0; i < kMaxMnemonics; i++) {
+    if (counters.mnemonics[i].count != 0) {
+      sorted[mnemonic_count++] = counters.mnemonics[i];
+    }
+  }
+  qsort(sorted, mnemonic_count, sizeof(sorted[0]), CompareMnemonicCounts);
+
+  fprintf(out, "{\n  \"instructions\": %" PRId64 ",\n  \"bytes\": {",
+          counters.instructions);
+  for (intptr_t i = 0; i < kNumByteCategories; i++) {
+    fprintf(out, "%s\"%s\": %" PRId64, i == 0 ? "" : ", ",
+            kByteCategoryNames[i], counters.bytes[i]);
+  }
+  fprintf(out,
+          "},\n"
+          "  \"near_branches\": %" PRId64 ",\n"
+          "  \"far_branches\": %" PRId64 ",\n"
+          "  \"tmp_expansions\": %" PRId64 ",\n"
+          "  \"extend_capacity_calls\": %" PRId64 ",\n"
+          "  \"extend_capacity_bytes_copied\": %" PRId64 ",\n"
+          "  \"mnemonics\": {",
+          counters.near_branches, counters.far_branches,
+          counters.tmp_expansions, counters.extend_capacity_calls,
+          counters.extend_capacity_bytes_copied);
+  // Mnemonics are lower case letters and digits, which need no escaping.
+  for (intptr_t i = 0; i < mnemonic_count; i++) {
+    fprintf(out, "%s\n    \"%s\": %" PRId64, i == 0 ? "" : ",",
+            sorted[i].mnemonic, sorted[i].count);
+  }
+  fprintf(out, "%s},\n  \"other_mnemonics\": %" PRId64 "\n}\n",
+          mnemonic_count == 0 ? "" : "\n  ", counters.other_mnemonics);
+}
@@ -0,0 +1,95 @@
+// Copyright (c) 2019, the Dart project authors.  Please see the AUTHORS file
+// for details. All rights reserved. Use of this source code is governed by a
+// BSD-style license that can be found in the LICENSE file.
+
+#pragma once
+
+#include <stdio.h>
+
+#include "globals.h"
+
+// Statistics of the code emitted by the assemblers of a thread, to find out
+// where the bytes go.
+//
+// The counting is compiled in with ASSEMBLER_STATISTICS defined only. Without
+// it, INC_ASSEMBLER_STAT expands to nothing, nothing is counted and
+// Snapshot() returns zero counters.
+//
+// The instructions, bytes and branches are counted when code is finalized
+// (Assembler::EmitColdCode), by decoding it: they describe the final
+// encodings, after padding and branch displacements are settled, and code
+// that is never finalized is not counted. The other counters are updated as
+// the assembler works.
+#if defined(ASSEMBLER_STATISTICS)
+#define INC_ASSEMBLER_STAT(name, value)                                        \
+  (AssemblerStatistics::current()->name += (value))
+#else
+#define INC_ASSEMBLER_STAT(name, value)
+#endif
+
+class AssemblerStatistics {
+public:
+#if defined(ASSEMBLER_STATISTICS)
+  static const bool kEnabled = true;
+#else
+  static const bool kEnabled = false;
+#endif
+
+  // The parts of instructions whose bytes are counted.
+  enum ByteCategory {
+    kPrefixBytes, // Legacy and VEX prefixes.
+    kRexBytes,
+    kOpcodeBytes,
+    kModRMBytes,        // ModRM and SIB.
+    kDisplacementBytes, // Including branch displacements.
+    kImmediateBytes,
+    kUndecodedBytes, // Bytes that are not instructions.
+    kNumByteCategories,
+  };
+
+  static const intptr_t kMaxMnemonics = 256;
+  static const intptr_t kMaxMnemonicLength = 16;
+
+  struct MnemonicCount {
+    char mnemonic[kMaxMnemonicLength];
+    int64_t count;
+  };
+
+  struct Counters {
+    int64_t instructions;
+    int64_t bytes[kNumByteCategories];
+    int64_t near_branches; // jmp and jcc with an 8-bit displacement.
+    int64_t far_branches;  // jmp and jcc with a 32-bit displacement.
+    // Instructions expanded into a sequence through TMP, e.g. for a 64-bit
+    // immediate.
+    int64_t tmp_expansions;
+    // Of all AssemblerBuffers, including the side tables of the assembler.
+    int64_t extend_capacity_calls;
+    int64_t extend_capacity_bytes_copied;
+    // The instructions by mnemonic, in a hash table. Mnemonics beyond
+    // kMaxMnemonics are counted in other_mnemonics.
+    MnemonicCount mnemonics[kMaxMnemonics];
+    int64_t other_mnemonics;
+  };
+
+  // The counters of the current thread.
+  static Counters Snapshot();
+  static void Reset();
+
+  // Writes |counters| as a JSON object, with the mnemonics sorted by count.
+  static void WriteJson(const Counters &counters, FILE *out);
+
+  // Counts the instructions of the |length| bytes of code at |code|.
+  static void CountInstructions(const uint8_t *code, intptr_t length);
+
+#if defined(ASSEMBLER_STATISTICS)
+  static Counters *current() { return &current_; }
+#endif
+
+private:
+#if defined(ASSEMBLER_STATISTICS)
+  static thread_local Counters current_;
+#endif
+
+  DISALLOW_IMPLICIT_CONSTRUCTORS(AssemblerStatistics);
+};
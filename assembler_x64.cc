@@ -5,20 +5,73 @@
 #include "assembler.h"
 #include "globals.h"
 
-Assembler::Assembler() {}
+Assembler::Assembler() { Reset(); }
+
+void Assembler::Reset() {
+  buffer_.Reset();
+  prologue_offset_ = -1;
+  has_single_entry_point_ = true;
+  constant_pool_allowed_ = false;
+  fusion_lint_ = false;
+  fusion_lint_violations_ = 0;
+  fusion_lint_handler_ = NULL;
+  fusion_lint_argument_ = NULL;
+  padding_candidates_head_ = 0;
+  jcc_erratum_mitigation_ = false;
+  branch_padding_lengthening_bytes_ = 0;
+  branch_padding_nop_bytes_ = 0;
+  align_padding_ = kAlignWithNops;
+  ymm_upper_dirty_ = false;
+  auto_vzeroupper_ = true;
+  vzeroupper_insertions_ = 0;
+  dependency_breaks_ = 0;
+  relocations_.Reset();
+  code_address_ = 0;
+  external_targets_.Reset();
+  external_target_fixups_.Reset();
+  track_call_frame_ = false;
+  call_frame_ = CallFrame();
+  call_frame_.cfa_register = RSP;
+  call_frame_.cfa_offset = 8; // The return address.
+  inactive_call_frame_ = call_frame_;
+  call_frame_rows_.Reset();
+  branch_call_frames_.Reset();
+  inactive_section_.Reset();
+  cross_section_fixups_.Reset();
+  jump_table_fixups_.Reset();
+  in_cold_region_ = false;
+  inactive_ymm_upper_dirty_ = false;
+  cold_code_offset_ = -1;
+  for (intptr_t i = 0; i < kNumPartialWriteInstructions; i++) {
+    break_false_dependency_[i] = false;
+  }
+  ClearFlagsProducer();
+  ClearPaddingCandidates();
+}
 
 void Assembler::InitializeMemoryWithBreakpoints(uword data, intptr_t length) {
   memset(reinterpret_cast<void *>(data), Instr::kBreakPointInstruction, length);
 }
 
 void Assembler::call(Label *label) {
-  AssemblerBuffer::EnsureCapacity ensured(&buffer_);
   static const int kSize = 5;
+  AvoidAvxSseTransition();
+  AlignBranch(buffer_.GetPosition(), kSize);
+  FlagsProducerScope producer(this, kFlagsOther);
+  AssemblerBuffer::EnsureCapacity ensured(&buffer_);
   EmitUint8(0xE8);
-  EmitLabel(label, kSize);
+  // The size of the rest of the instruction, after the opcode.
+  EmitLabel(label, kSize - 1);
 }
 
 void Assembler::call(const ExternalLabel *label) {
+  AvoidAvxSseTransition();
+  if (code_address_ != 0) {
+    FlagsProducerScope producer(this, kFlagsOther);
+    EmitExternalBranch(label->address(), 0xE8, 2);
+    return;
+  }
+  INC_ASSEMBLER_STAT(tmp_expansions, 1);
   { // Encode movq(TMP, Immediate(label->address())), but always as imm64.
     AssemblerBuffer::EnsureCapacity ensured(&buffer_);
     EmitRegisterREX(TMP, REX_W);
@@ -29,9 +82,28 @@ void Assembler::call(const ExternalLabel *label) {
 }
 
 void Assembler::pushq(Register reg) {
-  AssemblerBuffer::EnsureCapacity ensured(&buffer_);
-  EmitRegisterREX(reg, REX_NONE);
-  EmitUint8(0x50 | (reg & 7));
+  {
+    AssemblerBuffer::EnsureCapacity ensured(&buffer_);
+    EmitRegisterREX(reg, REX_NONE);
+    EmitUint8(0x50 | (reg & 7));
+  }
+  if (track_call_frame_) {
+    CallFrame frame = call_frame_;
+    if (frame.cfa_register == RSP) {
+      frame.cfa_offset += 8;
+      if (reg == RBP && frame.rbp_offset == 0) {
+        frame.rbp_offset = frame.cfa_offset;
+      }
+    } else if (frame.rsp_offset != 0) {
+      frame.rsp_offset += 8;
+    }
+    // The first save of a register holds the value of the caller.
+    const intptr_t index = SavedRegisterIndex(reg);
+    if (index >= 0 && frame.saved_offsets[index] == 0) {
+      frame.saved_offsets[index] = StackDepth(frame);
+    }
+    SetCallFrame(frame);
+  }
 }
 
 void Assembler::pushq(const Immediate &imm) {
@@ -44,15 +116,53 @@ void Assembler::pushq(const Immediate &imm) {
     EmitUint8(0x68);
     EmitImmediate(imm);
   } else {
+    INC_ASSEMBLER_STAT(tmp_expansions, 1);
     movq(TMP, imm);
     pushq(TMP);
+    return;
+  }
+  if (track_call_frame_) {
+    AdjustCallFrame(8);
   }
 }
 
 void Assembler::popq(Register reg) {
-  AssemblerBuffer::EnsureCapacity ensured(&buffer_);
-  EmitRegisterREX(reg, REX_NONE);
-  EmitUint8(0x58 | (reg & 7));
+  {
+    AssemblerBuffer::EnsureCapacity ensured(&buffer_);
+    EmitRegisterREX(reg, REX_NONE);
+    EmitUint8(0x58 | (reg & 7));
+  }
+  if (track_call_frame_) {
+    CallFrame frame = call_frame_;
+    const intptr_t index = SavedRegisterIndex(reg);
+    if (index >= 0 && frame.saved_offsets[index] == StackDepth(frame)) {
+      frame.saved_offsets[index] = 0;
+    }
+    if (frame.cfa_register != RSP) {
+      if (reg != RBP) {
+        if (frame.rsp_offset != 0) {
+          frame.rsp_offset -= 8;
+        }
+        SetCallFrame(frame);
+        return;
+      }
+      // Popping the saved RBP leaves RSP just above its slot.
+      if (frame.rbp_offset == 0) {
+        FATAL("Untracked call frame change");
+      }
+      frame.cfa_register = RSP;
+      frame.cfa_offset = frame.rbp_offset - 8;
+      frame.rbp_offset = 0;
+      frame.rsp_offset = 0;
+      SetCallFrame(frame);
+      return;
+    }
+    if (reg == RBP && frame.rbp_offset == frame.cfa_offset) {
+      frame.rbp_offset = 0;
+    }
+    frame.cfa_offset -= 8;
+    SetCallFrame(frame);
+  }
 }
 
 void Assembler::setcc(Condition condition, ByteRegister dst) {
@@ -70,6 +180,7 @@ void Assembler::EmitQ(int reg, const Address &address, int opcode, int prefix2,
                       int prefix1) {
   ASSERT(reg <= XMM15);
   AssemblerBuffer::EnsureCapacity ensured(&buffer_);
+  const intptr_t start = buffer_.GetPosition();
   if (prefix1 >= 0) {
     EmitUint8(prefix1);
   }
@@ -78,13 +189,18 @@ void Assembler::EmitQ(int reg, const Address &address, int opcode, int prefix2,
     EmitUint8(prefix2);
   }
   EmitUint8(opcode);
+  const intptr_t modrm = buffer_.GetPosition();
   EmitOperand(reg & 7, address);
+  if (!IsRIPRelative(address)) {
+    NotePaddingCandidate(start, modrm);
+  }
 }
 
 void Assembler::EmitL(int reg, const Address &address, int opcode, int prefix2,
                       int prefix1) {
   ASSERT(reg <= XMM15);
   AssemblerBuffer::EnsureCapacity ensured(&buffer_);
+  const intptr_t start = buffer_.GetPosition();
   if (prefix1 >= 0) {
     EmitUint8(prefix1);
   }
@@ -93,12 +209,17 @@ void Assembler::EmitL(int reg, const Address &address, int opcode, int prefix2,
     EmitUint8(prefix2);
   }
   EmitUint8(opcode);
+  const intptr_t modrm = buffer_.GetPosition();
   EmitOperand(reg & 7, address);
+  if (!IsRIPRelative(address)) {
+    NotePaddingCandidate(start, modrm);
+  }
 }
 
 void Assembler::EmitW(Register reg, const Address &address, int opcode,
                       int prefix2, int prefix1) {
   AssemblerBuffer::EnsureCapacity ensured(&buffer_);
+  const intptr_t start = buffer_.GetPosition();
   if (prefix1 >= 0) {
     EmitUint8(prefix1);
   }
@@ -108,7 +229,11 @@ void Assembler::EmitW(Register reg, const Address &address, int opcode,
     EmitUint8(prefix2);
   }
   EmitUint8(opcode);
+  const intptr_t modrm = buffer_.GetPosition();
   EmitOperand(reg & 7, address);
+  if (!IsRIPRelative(address)) {
+    NotePaddingCandidate(start, modrm);
+  }
 }
 
 void Assembler::movl(Register dst, const Immediate &imm) {
@@ -122,6 +247,7 @@ void Assembler::movl(Register dst, const Immediate &imm) {
 }
 
 void Assembler::movl(const Address &dst, const Immediate &imm) {
+  INC_ASSEMBLER_STAT(tmp_expansions, 1);
   movl(TMP, imm);
   movl(dst, TMP);
 }
@@ -180,6 +306,7 @@ void Assembler::movq(const Address &dst, const Immediate &imm) {
     EmitOperand(0, dst);
     EmitImmediate(imm);
   } else {
+    INC_ASSEMBLER_STAT(tmp_expansions, 1);
     movq(TMP, imm);
     movq(dst, TMP);
   }
@@ -197,6 +324,7 @@ void Assembler::EmitQ(int dst, int src, int opcode, int prefix2, int prefix1) {
   ASSERT(src <= XMM15);
   ASSERT(dst <= XMM15);
   AssemblerBuffer::EnsureCapacity ensured(&buffer_);
+  const intptr_t start = buffer_.GetPosition();
   if (prefix1 >= 0) {
     EmitUint8(prefix1);
   }
@@ -206,12 +334,14 @@ void Assembler::EmitQ(int dst, int src, int opcode, int prefix2, int prefix1) {
   }
   EmitUint8(opcode);
   EmitRegisterOperand(dst & 7, src);
+  NotePaddingCandidate(start);
 }
 
 void Assembler::EmitL(int dst, int src, int opcode, int prefix2, int prefix1) {
   ASSERT(src <= XMM15);
   ASSERT(dst <= XMM15);
   AssemblerBuffer::EnsureCapacity ensured(&buffer_);
+  const intptr_t start = buffer_.GetPosition();
   if (prefix1 >= 0) {
     EmitUint8(prefix1);
   }
@@ -221,6 +351,7 @@ void Assembler::EmitL(int dst, int src, int opcode, int prefix2, int prefix1) {
   }
   EmitUint8(opcode);
   EmitRegisterOperand(dst & 7, src);
+  NotePaddingCandidate(start);
 }
 
 void Assembler::EmitW(Register dst, Register src, int opcode, int prefix2,
@@ -228,6 +359,7 @@ void Assembler::EmitW(Register dst, Register src, int opcode, int prefix2,
   ASSERT(src <= R15);
   ASSERT(dst <= R15);
   AssemblerBuffer::EnsureCapacity ensured(&buffer_);
+  const intptr_t start = buffer_.GetPosition();
   if (prefix1 >= 0) {
     EmitUint8(prefix1);
   }
@@ -238,9 +370,11 @@ void Assembler::EmitW(Register dst, Register src, int opcode, int prefix2,
   }
   EmitUint8(opcode);
   EmitRegisterOperand(dst & 7, src);
+  NotePaddingCandidate(start);
 }
 
 void Assembler::CmpPS(XmmRegister dst, XmmRegister src, int condition) {
+  AvoidAvxSseTransition();
   EmitL(dst, src, 0xC2, 0x0F);
   AssemblerBuffer::EnsureCapacity ensured(&buffer_);
   EmitUint8(condition);
@@ -256,6 +390,7 @@ void Assembler::set1ps(XmmRegister dst, Register tmp1, const Immediate &imm) {
 }
 
 void Assembler::shufps(XmmRegister dst, XmmRegister src, const Immediate &imm) {
+  AvoidAvxSseTransition();
   EmitL(dst, src, 0xC6, 0x0F);
   AssemblerBuffer::EnsureCapacity ensured(&buffer_);
   ASSERT(imm.is_uint8());
@@ -263,6 +398,7 @@ void Assembler::shufps(XmmRegister dst, XmmRegister src, const Immediate &imm) {
 }
 
 void Assembler::shufpd(XmmRegister dst, XmmRegister src, const Immediate &imm) {
+  AvoidAvxSseTransition();
   EmitL(dst, src, 0xC6, 0x0F, 0x66);
   AssemblerBuffer::EnsureCapacity ensured(&buffer_);
   ASSERT(imm.is_uint8());
@@ -272,6 +408,10 @@ void Assembler::shufpd(XmmRegister dst, XmmRegister src, const Immediate &imm) {
 void Assembler::roundsd(XmmRegister dst, XmmRegister src, RoundingMode mode) {
   ASSERT(src <= XMM15);
   ASSERT(dst <= XMM15);
+  AvoidAvxSseTransition();
+  if (dst != src) {
+    BreakFalseDependency(kRoundsd, dst);
+  }
   AssemblerBuffer::EnsureCapacity ensured(&buffer_);
   EmitUint8(0x66);
   EmitRegRegRex(dst, src);
@@ -283,6 +423,96 @@ void Assembler::roundsd(XmmRegister dst, XmmRegister src, RoundingMode mode) {
   EmitUint8(static_cast<uint8_t>(mode) | 0x8);
 }
 
+void Assembler::vzeroupper() {
+  AssemblerBuffer::EnsureCapacity ensured(&buffer_);
+  EmitUint8(0xC5);
+  EmitUint8(0xF8);
+  EmitUint8(0x77);
+  ymm_upper_dirty_ = false;
+}
+
+void Assembler::EmitVex(int reg, int vvvv, const Operand &operand, int opcode,
+                        VexPrefix prefix, VexLength length, VexMap map,
+                        bool w) {
+  ASSERT(reg <= XMM15);
+  ASSERT(vvvv <= XMM15);
+  AssemblerBuffer::EnsureCapacity ensured(&buffer_);
+  const uint8_t rex = operand.rex() | (reg > 7 ? REX_R : REX_NONE);
+  // R, X, B and vvvv are stored inverted.
+  const uint8_t r_bit = (rex & REX_R) != 0 ? 0x00 : 0x80;
+  const uint8_t vvvv_l_pp = ((~vvvv & 0xF) << 3) | (length << 2) | prefix;
+  if ((rex & (REX_X | REX_B)) == 0 && map == kVex0F && !w) {
+    EmitUint8(0xC5);
+    EmitUint8(r_bit | vvvv_l_pp);
+  } else {
+    EmitUint8(0xC4);
+    EmitUint8(r_bit | ((rex & REX_X) != 0 ? 0x00 : 0x40) |
+              ((rex & REX_B) != 0 ? 0x00 : 0x20) | map);
+    EmitUint8((w ? 0x80 : 0x00) | vvvv_l_pp);
+  }
+  EmitUint8(opcode);
+  EmitOperand(reg & 7, operand);
+  if (length == kVex256) {
+    ymm_upper_dirty_ = true;
+  }
+}
+
+void Assembler::NoteBranchYmmState(Label *label) {
+  if (label->IsBound()) {
+    if (!label->ymm_upper_dirty_) {
+      AvoidAvxSseTransition();
+    }
+  } else {
+    label->ymm_upper_dirty_ = label->ymm_upper_dirty_ || ymm_upper_dirty_;
+  }
+}
+
+void Assembler::popcntq(Register dst, Register src) {
+  if (dst != src) {
+    BreakFalseDependency(kPopcnt, dst);
+  }
+  FlagsProducerScope producer(this, kFlagsOther);
+  EmitQ(dst, src, 0xB8, 0x0F, 0xF3);
+}
+
+void Assembler::popcntq(Register dst, const Address &src) {
+  if (!UsesRegister(src, dst)) {
+    BreakFalseDependency(kPopcnt, dst);
+  }
+  FlagsProducerScope producer(this, kFlagsOther);
+  EmitQ(dst, src, 0xB8, 0x0F, 0xF3);
+}
+
+void Assembler::popcntl(Register dst, Register src) {
+  if (dst != src) {
+    BreakFalseDependency(kPopcnt, dst);
+  }
+  FlagsProducerScope producer(this, kFlagsOther);
+  EmitL(dst, src, 0xB8, 0x0F, 0xF3);
+}
+
+void Assembler::popcntl(Register dst, const Address &src) {
+  if (!UsesRegister(src, dst)) {
+    BreakFalseDependency(kPopcnt, dst);
+  }
+  FlagsProducerScope producer(this, kFlagsOther);
+  EmitL(dst, src, 0xB8, 0x0F, 0xF3);
+}
+
+bool Assembler::UsesRegister(const Operand &operand, Register reg) {
+  if (IsRIPRelative(operand)) {
+    return false;
+  }
+  if ((operand.encoding_at(0) & 7) != 4) {
+    return operand.rm() == reg; // No SIB byte.
+  }
+  if (operand.index() == reg && operand.index() != RSP) {
+    return true; // RSP as index means no index.
+  }
+  const bool no_base = operand.mod() == 0 && (operand.base() & 7) == RBP;
+  return !no_base && operand.base() == reg;
+}
+
 void Assembler::fldl(const Address &src) {
   AssemblerBuffer::EnsureCapacity ensured(&buffer_);
   EmitUint8(0xDD);
@@ -301,15 +531,33 @@ void Assembler::ffree(intptr_t value) {
 }
 
 void Assembler::testb(const Address &address, const Immediate &imm) {
+  FlagsProducerScope producer(this, kFlagsTest, false);
   AssemblerBuffer::EnsureCapacity ensured(&buffer_);
   EmitOperandREX(0, address, REX_NONE);
   EmitUint8(0xF6);
   EmitOperand(0, address);
-  ASSERT(imm.is_int8());
+  ASSERT(imm.is_int8() || imm.is_uint8());
   EmitUint8(imm.value() & 0xFF);
 }
 
+void Assembler::testq(const Address &address, const Immediate &imm) {
+  FlagsProducerScope producer(this, kFlagsTest, false);
+  AssemblerBuffer::EnsureCapacity ensured(&buffer_);
+  // Sign extended version of 32 bit test.
+  ASSERT(imm.is_int32());
+  EmitOperandREX(0, address, REX_W);
+  EmitUint8(0xF7);
+  EmitOperand(0, address);
+  EmitImmediate(imm);
+}
+
+void Assembler::testq(const Address &address, Register reg) {
+  FlagsProducerScope producer(this, kFlagsTest, IsFusibleOperand(address));
+  EmitQ(reg, address, 0x85);
+}
+
 void Assembler::testb(const Address &address, Register reg) {
+  FlagsProducerScope producer(this, kFlagsTest, IsFusibleOperand(address));
   AssemblerBuffer::EnsureCapacity ensured(&buffer_);
   EmitOperandREX(reg, address, REX_NONE);
   EmitUint8(0x84);
@@ -317,6 +565,7 @@ void Assembler::testb(const Address &address, Register reg) {
 }
 
 void Assembler::testq(Register reg, const Immediate &imm) {
+  FlagsProducerScope producer(this, kFlagsTest);
   AssemblerBuffer::EnsureCapacity ensured(&buffer_);
   if (imm.is_uint8()) {
     // Use zero-extended 8-bit immediate.
@@ -357,8 +606,11 @@ void Assembler::testq(Register reg, const Immediate &imm) {
 
 void Assembler::AluL(uint8_t modrm_opcode, Register dst, const Immediate &imm) {
   AssemblerBuffer::EnsureCapacity ensured(&buffer_);
+  const intptr_t start = buffer_.GetPosition();
   EmitRegisterREX(dst, REX_NONE);
+  const intptr_t opcode = buffer_.GetPosition();
   EmitComplex(modrm_opcode, Operand(dst), imm);
+  NotePaddingCandidate(start, -1, imm.is_int8() ? opcode : -1);
 }
 
 void Assembler::AluB(uint8_t modrm_opcode, const Address &dst,
@@ -391,8 +643,13 @@ void Assembler::AluL(uint8_t modrm_opcode, const Address &dst,
                      const Immediate &imm) {
   ASSERT(imm.is_int32());
   AssemblerBuffer::EnsureCapacity ensured(&buffer_);
+  const intptr_t start = buffer_.GetPosition();
   EmitOperandREX(modrm_opcode, dst, REX_NONE);
+  const intptr_t opcode = buffer_.GetPosition();
   EmitComplex(modrm_opcode, dst, imm);
+  if (!IsRIPRelative(dst)) {
+    NotePaddingCandidate(start, opcode + 1, imm.is_int8() ? opcode : -1);
+  }
 }
 
 void Assembler::AluQ(uint8_t modrm_opcode, uint8_t opcode, Register dst,
@@ -401,7 +658,9 @@ void Assembler::AluQ(uint8_t modrm_opcode, uint8_t opcode, Register dst,
   if (modrm_opcode == 4 && imm.is_uint32()) {
     // We can use andl for andq.
     AssemblerBuffer::EnsureCapacity ensured(&buffer_);
+    const intptr_t start = buffer_.GetPosition();
     EmitRegisterREX(dst, REX_NONE);
+    const intptr_t opcode = buffer_.GetPosition();
     // Would like to use EmitComplex here, but it doesn't like uint32
     // immediates.
     if (imm.is_int8()) {
@@ -415,24 +674,50 @@ void Assembler::AluQ(uint8_t modrm_opcode, uint8_t opcode, Register dst,
       }
       EmitUInt32(imm.value());
     }
+    NotePaddingCandidate(start, -1, imm.is_int8() ? opcode : -1);
   } else if (imm.is_int32()) {
     AssemblerBuffer::EnsureCapacity ensured(&buffer_);
+    const intptr_t start = buffer_.GetPosition();
     EmitRegisterREX(dst, REX_W);
+    const intptr_t opcode = buffer_.GetPosition();
     EmitComplex(modrm_opcode, operand, imm);
+    NotePaddingCandidate(start, -1, imm.is_int8() ? opcode : -1);
   } else {
     ASSERT(dst != TMP);
+    INC_ASSEMBLER_STAT(tmp_expansions, 1);
     movq(TMP, imm);
     EmitQ(dst, TMP, opcode);
   }
+  if (track_call_frame_ && dst == RSP) {
+    if (modrm_opcode == 0) { // add
+      AdjustCallFrame(-imm.value());
+    } else if (modrm_opcode == 5) { // sub
+      AdjustCallFrame(imm.value());
+    } else if (modrm_opcode != 7) {
+      if (call_frame_.cfa_register == RSP) {
+        FATAL("Untracked call frame change");
+      }
+      // Such as the alignment of RSP.
+      CallFrame frame = call_frame_;
+      frame.rsp_offset = 0;
+      SetCallFrame(frame);
+    }
+  }
 }
 
 void Assembler::AluQ(uint8_t modrm_opcode, uint8_t opcode, const Address &dst,
                      const Immediate &imm) {
   if (imm.is_int32()) {
     AssemblerBuffer::EnsureCapacity ensured(&buffer_);
+    const intptr_t start = buffer_.GetPosition();
     EmitOperandREX(modrm_opcode, dst, REX_W);
+    const intptr_t opcode = buffer_.GetPosition();
     EmitComplex(modrm_opcode, dst, imm);
+    if (!IsRIPRelative(dst)) {
+      NotePaddingCandidate(start, opcode + 1, imm.is_int8() ? opcode : -1);
+    }
   } else {
+    INC_ASSEMBLER_STAT(tmp_expansions, 1);
     movq(TMP, imm);
     EmitQ(TMP, dst, opcode);
   }
@@ -475,6 +760,7 @@ void Assembler::EmitUnaryL(const Address &address, int opcode, int modrm_code) {
 }
 
 void Assembler::imull(Register reg, const Immediate &imm) {
+  FlagsProducerScope producer(this, kFlagsOther);
   AssemblerBuffer::EnsureCapacity ensured(&buffer_);
   Operand operand(reg);
   EmitOperandREX(reg, operand, REX_NONE);
@@ -485,6 +771,7 @@ void Assembler::imull(Register reg, const Immediate &imm) {
 
 void Assembler::imulq(Register reg, const Immediate &imm) {
   if (imm.is_int32()) {
+    FlagsProducerScope producer(this, kFlagsOther);
     AssemblerBuffer::EnsureCapacity ensured(&buffer_);
     Operand operand(reg);
     EmitOperandREX(reg, operand, REX_W);
@@ -493,6 +780,7 @@ void Assembler::imulq(Register reg, const Immediate &imm) {
     EmitImmediate(imm);
   } else {
     ASSERT(reg != TMP);
+    INC_ASSEMBLER_STAT(tmp_expansions, 1);
     movq(TMP, imm);
     imulq(reg, TMP);
   }
@@ -509,6 +797,7 @@ void Assembler::MulImmediate(Register reg, const Immediate &imm,
   } else {
     ASSERT(reg != TMP);
     ASSERT(width != k32Bit);
+    INC_ASSEMBLER_STAT(tmp_expansions, 1);
     movq(TMP, imm);
     imulq(reg, TMP);
   }
@@ -539,6 +828,7 @@ void Assembler::sarl(Register operand, Register shifter) {
 }
 
 void Assembler::shldl(Register dst, Register src, const Immediate &imm) {
+  FlagsProducerScope producer(this, kFlagsOther);
   EmitL(src, dst, 0xA4, 0x0F);
   AssemblerBuffer::EnsureCapacity ensured(&buffer_);
   ASSERT(imm.is_int8());
@@ -570,6 +860,7 @@ void Assembler::sarq(Register operand, Register shifter) {
 }
 
 void Assembler::shldq(Register dst, Register src, const Immediate &imm) {
+  FlagsProducerScope producer(this, kFlagsOther);
   EmitQ(src, dst, 0xA4, 0x0F);
   AssemblerBuffer::EnsureCapacity ensured(&buffer_);
   ASSERT(imm.is_int8());
@@ -578,6 +869,7 @@ void Assembler::shldq(Register dst, Register src, const Immediate &imm) {
 
 void Assembler::btq(Register base, int bit) {
   ASSERT(bit >= 0 && bit < 64);
+  FlagsProducerScope producer(this, kFlagsOther);
   AssemblerBuffer::EnsureCapacity ensured(&buffer_);
   Operand operand(base);
   EmitOperandREX(4, operand, bit >= 32 ? REX_W : REX_NONE);
@@ -588,82 +880,231 @@ void Assembler::btq(Register base, int bit) {
 }
 
 void Assembler::enter(const Immediate &imm) {
-  AssemblerBuffer::EnsureCapacity ensured(&buffer_);
-  EmitUint8(0xC8);
-  ASSERT(imm.is_uint16());
-  EmitUint8(imm.value() & 0xFF);
-  EmitUint8((imm.value() >> 8) & 0xFF);
-  EmitUint8(0x00);
+  {
+    AssemblerBuffer::EnsureCapacity ensured(&buffer_);
+    EmitUint8(0xC8);
+    ASSERT(imm.is_uint16());
+    EmitUint8(imm.value() & 0xFF);
+    EmitUint8((imm.value() >> 8) & 0xFF);
+    EmitUint8(0x00);
+  }
+  if (track_call_frame_) {
+    // pushq rbp; movq rbp, rsp; subq rsp, imm
+    if (call_frame_.cfa_register != RSP) {
+      FATAL("Untracked call frame change");
+    }
+    CallFrame frame = call_frame_;
+    frame.cfa_register = RBP;
+    frame.cfa_offset += 8;
+    if (frame.rbp_offset == 0) {
+      frame.rbp_offset = frame.cfa_offset;
+    }
+    frame.rsp_offset = frame.cfa_offset + imm.value();
+    SetCallFrame(frame);
+  }
+}
+
+void Assembler::leave() {
+  EmitSimple(0xC9);
+  if (track_call_frame_) {
+    // movq rsp, rbp; popq rbp
+    CallFrame frame = call_frame_;
+    if (frame.cfa_register != RBP) {
+      FATAL("Untracked call frame change");
+    }
+    if (frame.rbp_offset == frame.cfa_offset) {
+      frame.rbp_offset = 0;
+    }
+    frame.cfa_register = RSP;
+    frame.cfa_offset -= 8;
+    frame.rsp_offset = 0;
+    SetCallFrame(frame);
+  }
+}
+
+// Emits |value|, larger than the gap ensured for a single emission, a word
+// at a time.
+template <typename T>
+static void EmitWords(AssemblerBuffer *buffer, const T &value) {
+  static_assert(sizeof(T) % sizeof(uword) == 0, "Whole words");
+  const uword *words = reinterpret_cast<const uword *>(&value);
+  for (size_t i = 0; i < sizeof(T) / sizeof(uword); i++) {
+    AssemblerBuffer::EnsureCapacity ensured(buffer);
+    buffer->Emit<uword>(words[i]);
+  }
+}
+
+static const Register kSavedRegisters[Assembler::kNumSavedRegisters] = {
+    RBX, R12, R13, R14, R15};
+
+Register Assembler::SavedRegisterAt(intptr_t index) {
+  ASSERT(0 <= index && index < kNumSavedRegisters);
+  return kSavedRegisters[index];
+}
+
+intptr_t Assembler::SavedRegisterIndex(Register reg) {
+  for (intptr_t i = 0; i < kNumSavedRegisters; i++) {
+    if (kSavedRegisters[i] == reg) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+bool Assembler::CallFrame::HasSameRules(const CallFrame &other) const {
+  if (cfa_register != other.cfa_register || cfa_offset != other.cfa_offset ||
+      rbp_offset != other.rbp_offset) {
+    return false;
+  }
+  for (intptr_t i = 0; i < kNumSavedRegisters; i++) {
+    if (saved_offsets[i] != other.saved_offsets[i]) {
+      return false;
+    }
+  }
+  return true;
+}
+
+void Assembler::SetCallFrame(const CallFrame &frame) {
+  ASSERT(track_call_frame_);
+  ASSERT(frame.cfa_offset >= 8);
+  const bool same_rules = frame.HasSameRules(call_frame_);
+  call_frame_ = frame;
+  if (same_rules) {
+    return;
+  }
+  const CallFrameRow row = {SectionPosition(), frame};
+  EmitWords(&call_frame_rows_, row);
+  // The row records the position of the code after the change.
+  ClearPaddingCandidates();
+}
+
+void Assembler::AdjustCallFrame(intptr_t delta) {
+  CallFrame frame = call_frame_;
+  if (frame.cfa_register == RSP) {
+    frame.cfa_offset += delta;
+  } else if (frame.rsp_offset != 0) {
+    frame.rsp_offset += delta;
+  }
+  SetCallFrame(frame);
+}
+
+void Assembler::NoteCallFrameMove(Register dst, Register src) {
+  CallFrame frame = call_frame_;
+  if (dst == RBP && src == RSP && frame.cfa_register == RSP) {
+    frame.cfa_register = RBP;
+    frame.rsp_offset = frame.cfa_offset;
+  } else if (dst == RSP && src == RBP && frame.cfa_register == RBP) {
+    frame.cfa_register = RSP;
+    frame.rsp_offset = 0;
+  } else if (dst == frame.cfa_register) {
+    FATAL("Untracked call frame change");
+  } else if (dst == RSP) {
+    frame.rsp_offset = 0;
+  }
+  SetCallFrame(frame);
+}
+
+void Assembler::NoteBranchCallFrame(Label *label) {
+  if (track_call_frame_ && !label->IsBound() &&
+      label->call_frame_index_ == 0) {
+    EmitWords(&branch_call_frames_, call_frame_);
+    label->call_frame_index_ = branch_call_frames_.Size() / sizeof(CallFrame);
+  }
 }
 
+void Assembler::SortCallFrameRows(bool has_cold_code) {
+  AssemblerBuffer sorted;
+  for (intptr_t i = 0; i < call_frame_rows_.Size(); i += sizeof(CallFrameRow)) {
+    const CallFrameRow row = call_frame_rows_.Load<CallFrameRow>(i);
+    // A row at the end of the hot code would apply to the cold code.
+    if ((row.offset & kColdPositionTag) == 0 &&
+        !(has_cold_code && row.offset == cold_code_offset_)) {
+      EmitWords(&sorted, row);
+    }
+  }
+  for (intptr_t i = 0; i < call_frame_rows_.Size(); i += sizeof(CallFrameRow)) {
+    CallFrameRow row = call_frame_rows_.Load<CallFrameRow>(i);
+    if ((row.offset & kColdPositionTag) != 0) {
+      row.offset = ResolvePosition(row.offset);
+      EmitWords(&sorted, row);
+    }
+  }
+  call_frame_rows_.Swap(&sorted);
+}
+
+Assembler::CallFrameRow Assembler::CallFrameRowAt(intptr_t index) {
+  ASSERT(0 <= index && index < CallFrameRowCount());
+  CallFrameRow row =
+      call_frame_rows_.Load<CallFrameRow>(index * sizeof(CallFrameRow));
+  row.offset = ResolvePosition(row.offset);
+  ASSERT((row.offset & kColdPositionTag) == 0);
+  return row;
+}
+
+// The recommended multi-byte NOP sequences (Intel SDM, "NOP"). Sizes 10 and
+// up repeat the 0x66 prefix of the 9 byte form, which decodes as a single
+// instruction on all current cores.
+static const uint8_t kNops[MAX_NOP_SIZE][MAX_NOP_SIZE] = {
+    {0x90},
+    {0x66, 0x90},
+    {0x0F, 0x1F, 0x00},
+    {0x0F, 0x1F, 0x40, 0x00},
+    {0x0F, 0x1F, 0x44, 0x00, 0x00},
+    {0x66, 0x0F, 0x1F, 0x44, 0x00, 0x00},
+    {0x0F, 0x1F, 0x80, 0x00, 0x00, 0x00, 0x00},
+    {0x0F, 0x1F, 0x84, 0x00, 0x00, 0x00, 0x00, 0x00},
+    {0x66, 0x0F, 0x1F, 0x84, 0x00, 0x00, 0x00, 0x00, 0x00},
+    {0x66, 0x66, 0x0F, 0x1F, 0x84, 0x00, 0x00, 0x00, 0x00, 0x00},
+    {0x66, 0x66, 0x66, 0x0F, 0x1F, 0x84, 0x00, 0x00, 0x00, 0x00, 0x00},
+    {0x66, 0x66, 0x66, 0x66, 0x0F, 0x1F, 0x84, 0x00, 0x00, 0x00, 0x00, 0x00},
+    {0x66, 0x66, 0x66, 0x66, 0x66, 0x0F, 0x1F, 0x84, 0x00, 0x00, 0x00, 0x00,
+     0x00},
+    {0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x0F, 0x1F, 0x84, 0x00, 0x00, 0x00,
+     0x00, 0x00},
+    {0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x0F, 0x1F, 0x84, 0x00, 0x00,
+     0x00, 0x00, 0x00},
+};
+
 void Assembler::nop(int size) {
   AssemblerBuffer::EnsureCapacity ensured(&buffer_);
-  // There are nops up to size 15, but for now just provide up to size 8.
   ASSERT(0 < size && size <= MAX_NOP_SIZE);
-  switch (size) {
-  case 1:
-    EmitUint8(0x90);
-    break;
-  case 2:
-    EmitUint8(0x66);
-    EmitUint8(0x90);
-    break;
-  case 3:
-    EmitUint8(0x0F);
-    EmitUint8(0x1F);
-    EmitUint8(0x00);
-    break;
-  case 4:
-    EmitUint8(0x0F);
-    EmitUint8(0x1F);
-    EmitUint8(0x40);
-    EmitUint8(0x00);
-    break;
-  case 5:
-    EmitUint8(0x0F);
-    EmitUint8(0x1F);
-    EmitUint8(0x44);
-    EmitUint8(0x00);
-    EmitUint8(0x00);
-    break;
-  case 6:
-    EmitUint8(0x66);
-    EmitUint8(0x0F);
-    EmitUint8(0x1F);
-    EmitUint8(0x44);
-    EmitUint8(0x00);
-    EmitUint8(0x00);
-    break;
-  case 7:
-    EmitUint8(0x0F);
-    EmitUint8(0x1F);
-    EmitUint8(0x80);
-    EmitUint8(0x00);
-    EmitUint8(0x00);
-    EmitUint8(0x00);
-    EmitUint8(0x00);
-    break;
-  case 8:
-    EmitUint8(0x0F);
-    EmitUint8(0x1F);
-    EmitUint8(0x84);
-    EmitUint8(0x00);
-    EmitUint8(0x00);
-    EmitUint8(0x00);
-    EmitUint8(0x00);
-    EmitUint8(0x00);
-    break;
-  default:
-    UNIMPLEMENTED();
+  for (int i = 0; i < size; i++) {
+    EmitUint8(kNops[size - 1][i]);
   }
 }
 
+void Assembler::StoreNop(uword address, int size) {
+  ASSERT(0 < size && size <= MAX_NOP_SIZE);
+  memmove(reinterpret_cast<void *>(address), kNops[size - 1], size);
+}
+
 void Assembler::j(Condition condition, Label *label, bool near) {
+  static const int kShortSize = 2;
+  static const int kLongSize = 6;
+  NoteBranchYmmState(label);
+  NoteBranchCallFrame(label);
+  if (jcc_erratum_mitigation_) {
+    const intptr_t position = buffer_.GetPosition();
+    intptr_t size = near && !label->IsBound() ? kShortSize : kLongSize;
+    if (IsBoundInCurrentSection(label)) {
+      const intptr_t offset =
+          SectionOffset(ResolvePosition(label->Position())) - position;
+      size = Utils::IsInt(8, offset - kShortSize) ? kShortSize : kLongSize;
+    }
+    const FlagsProducer &producer = flags_producer_;
+    if (producer.end == position && producer.fusible_form &&
+        CanMacroFuse(producer.kind, condition)) {
+      // Keep the fused pair together.
+      AlignBranch(producer.start, position - producer.start + size);
+    } else {
+      AlignBranch(position, size);
+    }
+  }
+  ConsumeFlags(condition);
   AssemblerBuffer::EnsureCapacity ensured(&buffer_);
-  if (label->IsBound()) {
-    static const int kShortSize = 2;
-    static const int kLongSize = 6;
-    intptr_t offset = label->Position() - buffer_.Size();
+  if (IsBoundInCurrentSection(label)) {
+    intptr_t offset =
+        SectionOffset(ResolvePosition(label->Position())) - buffer_.Size();
     ASSERT(offset <= 0);
     if (Utils::IsInt(8, offset - kShortSize)) {
       EmitUint8(0x70 + condition);
@@ -673,7 +1114,7 @@ void Assembler::j(Condition condition, Label *label, bool near) {
       EmitUint8(0x80 + condition);
       EmitInt32(offset - kLongSize);
     }
-  } else if (near) {
+  } else if (near && !label->IsBound()) {
     EmitUint8(0x70 + condition);
     EmitNearLabelLink(label);
   } else {
@@ -684,11 +1125,24 @@ void Assembler::j(Condition condition, Label *label, bool near) {
 }
 
 void Assembler::jmp(Label *label, bool near) {
+  static const int kShortSize = 2;
+  static const int kLongSize = 5;
+  NoteBranchYmmState(label);
+  NoteBranchCallFrame(label);
+  if (jcc_erratum_mitigation_) {
+    const intptr_t position = buffer_.GetPosition();
+    intptr_t size = near && !label->IsBound() ? kShortSize : kLongSize;
+    if (IsBoundInCurrentSection(label)) {
+      const intptr_t offset =
+          SectionOffset(ResolvePosition(label->Position())) - position;
+      size = Utils::IsInt(8, offset - kShortSize) ? kShortSize : kLongSize;
+    }
+    AlignBranch(position, size);
+  }
   AssemblerBuffer::EnsureCapacity ensured(&buffer_);
-  if (label->IsBound()) {
-    static const int kShortSize = 2;
-    static const int kLongSize = 5;
-    intptr_t offset = label->Position() - buffer_.Size();
+  if (IsBoundInCurrentSection(label)) {
+    intptr_t offset =
+        SectionOffset(ResolvePosition(label->Position())) - buffer_.Size();
     ASSERT(offset <= 0);
     if (Utils::IsInt(8, offset - kShortSize)) {
       EmitUint8(0xEB);
@@ -697,7 +1151,7 @@ void Assembler::jmp(Label *label, bool near) {
       EmitUint8(0xE9);
       EmitInt32(offset - kLongSize);
     }
-  } else if (near) {
+  } else if (near && !label->IsBound()) {
     EmitUint8(0xEB);
     EmitNearLabelLink(label);
   } else {
@@ -707,6 +1161,12 @@ void Assembler::jmp(Label *label, bool near) {
 }
 
 void Assembler::jmp(const ExternalLabel *label) {
+  AvoidAvxSseTransition();
+  if (code_address_ != 0) {
+    EmitExternalBranch(label->address(), 0xE9, 4);
+    return;
+  }
+  INC_ASSEMBLER_STAT(tmp_expansions, 1);
   { // Encode movq(TMP, Immediate(label->address())), but always as imm64.
     AssemblerBuffer::EnsureCapacity ensured(&buffer_);
     EmitRegisterREX(TMP, REX_W);
@@ -716,8 +1176,422 @@ void Assembler::jmp(const ExternalLabel *label) {
   jmp(TMP);
 }
 
+void Assembler::EmitExternalBranch(uword target, uint8_t opcode,
+                                   int modrm_code) {
+  static const int kDirectSize = 5;
+  static const int kIndirectSize = 6;
+  ASSERT(code_address_ != 0);
+  // The final position of cold code is not known yet.
+  if (!in_cold_region_) {
+    AlignBranch(buffer_.GetPosition(), kDirectSize);
+    const int64_t offset = static_cast<int64_t>(
+        target - (code_address_ + buffer_.GetPosition() + kDirectSize));
+    if (Utils::IsInt(32, offset)) {
+      AssemblerBuffer::EnsureCapacity ensured(&buffer_);
+      EmitUint8(opcode);
+      EmitInt32(static_cast<int32_t>(offset));
+      // The offset depends on the position of the branch, so the code
+      // before it must not move.
+      ClearPaddingCandidates();
+      return;
+    }
+  }
+  intptr_t index = 0;
+  while (index < external_targets_.Size() / 8 &&
+         external_targets_.Load<uint64_t>(index * 8) != target) {
+    index++;
+  }
+  if (index == external_targets_.Size() / 8) {
+    AssemblerBuffer::EnsureCapacity ensured(&external_targets_);
+    external_targets_.Emit<uint64_t>(target);
+  }
+  AlignBranch(buffer_.GetPosition(), kIndirectSize);
+  AssemblerBuffer::EnsureCapacity ensured(&buffer_);
+  EmitUint8(0xFF);
+  EmitUint8(0x05 | (modrm_code << 3)); // [rip + disp32]
+  {
+    AssemblerBuffer::EnsureCapacity ensured(&external_target_fixups_);
+    external_target_fixups_.Emit<int32_t>(SectionPosition());
+    external_target_fixups_.Emit<int32_t>(index);
+  }
+  EmitInt32(0);
+}
+
+void Assembler::GenerateUnRelocatedPcRelativeCall(intptr_t symbol,
+                                                  intptr_t offset_into_target) {
+  AvoidAvxSseTransition();
+  EmitRelocatedBranch(0xE8, kPcRelativeCall, symbol, offset_into_target);
+}
+
+void Assembler::GenerateUnRelocatedPcRelativeTailCall(
+    intptr_t symbol, intptr_t offset_into_target) {
+  AvoidAvxSseTransition();
+  EmitRelocatedBranch(0xE9, kPcRelativeTailCall, symbol, offset_into_target);
+}
+
+void Assembler::LoadUnRelocatedPcRelativeAddress(Register dst,
+                                                 intptr_t symbol,
+                                                 intptr_t offset_into_target) {
+  leaq(dst, Address::AddressRIPRelative(0));
+  const Relocation relocation = {SectionPosition() - 4, kPcRelativeAddress,
+                                 symbol, offset_into_target};
+  AssemblerBuffer::EnsureCapacity ensured(&relocations_);
+  relocations_.Emit<Relocation>(relocation);
+  // The relocation records the position of the leaq.
+  ClearPaddingCandidates();
+}
+
+void Assembler::EmitRelocatedBranch(uint8_t opcode, RelocationKind kind,
+                                    intptr_t symbol, intptr_t addend) {
+  static const int kSize = 5;
+  AlignBranch(buffer_.GetPosition(), kSize);
+  AssemblerBuffer::EnsureCapacity ensured(&buffer_);
+  EmitUint8(opcode);
+  {
+    const Relocation relocation = {SectionPosition(), kind, symbol, addend};
+    AssemblerBuffer::EnsureCapacity ensured(&relocations_);
+    relocations_.Emit<Relocation>(relocation);
+  }
+  EmitInt32(0);
+  // The relocation records the position of the branch.
+  ClearPaddingCandidates();
+}
+
+Assembler::Relocation Assembler::RelocationAt(intptr_t index) {
+  ASSERT(0 <= index && index < RelocationCount());
+  Relocation relocation =
+      relocations_.Load<Relocation>(index * sizeof(Relocation));
+  relocation.offset = ResolvePosition(relocation.offset);
+  ASSERT((relocation.offset & kColdPositionTag) == 0);
+  return relocation;
+}
+
+void Assembler::ret() {
+  AvoidAvxSseTransition();
+  AlignBranch(buffer_.GetPosition(), 1);
+  EmitSimple(0xC3);
+}
+
+void Assembler::AlignBranch(intptr_t start, intptr_t length) {
+  if (!jcc_erratum_mitigation_) {
+    return;
+  }
+  ASSERT(length < kBranchBoundary);
+  if ((start / kBranchBoundary) == ((start + length) / kBranchBoundary)) {
+    return;
+  }
+  const intptr_t padding = kBranchBoundary - (start % kBranchBoundary);
+  AssemblerBuffer::EnsureCapacity ensured(&buffer_);
+  const intptr_t lengthened = PadByLengthening(start, padding);
+  branch_padding_lengthening_bytes_ += lengthened;
+  if (lengthened < padding) {
+    PadWithNops(start + lengthened, padding - lengthened);
+    branch_padding_nop_bytes_ += padding - lengthened;
+  }
+  ASSERT(((start + padding) % kBranchBoundary) == 0);
+}
+
+intptr_t Assembler::PadByLengthening(intptr_t position, intptr_t length) {
+  intptr_t added = 0;
+  intptr_t end = position;
+  // Walk back from the most recent candidate. Lengthening the most recent
+  // ones first leaves the positions of the older ones unchanged.
+  for (intptr_t i = 0; i < kMaxPaddingCandidates && added < length; i++) {
+    const intptr_t index =
+        (padding_candidates_head_ - i + kMaxPaddingCandidates) %
+        kMaxPaddingCandidates;
+    PaddingCandidate *candidate = &padding_candidates_[index];
+    if (candidate->end < 0 || candidate->end > end) {
+      continue; // Not yet reached the run ending at |position|.
+    }
+    if (candidate->end != end) {
+      break; // Something else was emitted in between.
+    }
+    end = candidate->start;
+    added += Lengthen(candidate, length - added);
+  }
+  return added;
+}
+
+intptr_t Assembler::Lengthen(PaddingCandidate *candidate, intptr_t length) {
+  const intptr_t start = candidate->start;
+  intptr_t added = 0;
+  // Widen an imm8 of the 0x83 group to the equivalent 0x81 imm32 form. The
+  // immediate is always the last byte of the instruction.
+  if (candidate->imm8_opcode_offset >= 0 && length - added >= 3 &&
+      candidate->end - start + 3 <= kMaxInstructionLength) {
+    const intptr_t imm = candidate->end - 1;
+    const int8_t value = buffer_.Load<int8_t>(imm);
+    buffer_.InsertGap(imm + 1, 3);
+    ShiftTrackedPositions(imm + 1, 3, start);
+    buffer_.Store<int32_t>(imm, value);
+    buffer_.Store<uint8_t>(start + candidate->imm8_opcode_offset, 0x81);
+    candidate->imm8_opcode_offset = -1;
+    added += 3;
+  }
+  // Widen no displacement to disp8 or disp32, or disp8 to disp32.
+  while (candidate->modrm_offset >= 0 && added < length) {
+    const intptr_t modrm_position = start + candidate->modrm_offset;
+    const uint8_t modrm = buffer_.Load<uint8_t>(modrm_position);
+    const uint8_t mod = modrm >> 6;
+    const bool has_sib = (modrm & 7) == 4;
+    const intptr_t disp = modrm_position + 1 + (has_sib ? 1 : 0);
+    const intptr_t room = kMaxInstructionLength - (candidate->end - start);
+    if (mod == 0 &&
+        (has_sib && (buffer_.Load<uint8_t>(modrm_position + 1) & 7) == 5)) {
+      break; // [index*scale + disp32] has no shorter form.
+    }
+    if (mod == 0 && length - added >= 4 && room >= 4) {
+      buffer_.InsertGap(disp, 4);
+      ShiftTrackedPositions(disp, 4, start);
+      buffer_.Store<int32_t>(disp, 0);
+      buffer_.Store<uint8_t>(modrm_position, (modrm & 0x3F) | 0x80);
+      added += 4;
+    } else if (mod == 0 && room >= 1) {
+      buffer_.InsertGap(disp, 1);
+      ShiftTrackedPositions(disp, 1, start);
+      buffer_.Store<int8_t>(disp, 0);
+      buffer_.Store<uint8_t>(modrm_position, (modrm & 0x3F) | 0x40);
+      added += 1;
+    } else if (mod == 1 && length - added >= 3 && room >= 3) {
+      const int8_t value = buffer_.Load<int8_t>(disp);
+      buffer_.InsertGap(disp + 1, 3);
+      ShiftTrackedPositions(disp + 1, 3, start);
+      buffer_.Store<int32_t>(disp, value);
+      buffer_.Store<uint8_t>(modrm_position, (modrm & 0x3F) | 0x80);
+      added += 3;
+    } else {
+      break;
+    }
+  }
+  // Redundant segment prefixes for the rest.
+  const intptr_t prefixes = Utils::Minimum<intptr_t>(
+      Utils::Minimum<intptr_t>(length - added,
+                               kMaxPaddingPrefixes - candidate->prefixes),
+      kMaxInstructionLength - (candidate->end - start));
+  if (prefixes > 0) {
+    buffer_.InsertGap(start, prefixes);
+    ShiftTrackedPositions(start, prefixes, start);
+    for (intptr_t i = 0; i < prefixes; i++) {
+      buffer_.Store<uint8_t>(start + i, kPaddingPrefix);
+    }
+    candidate->prefixes += prefixes;
+    if (candidate->modrm_offset >= 0) {
+      candidate->modrm_offset += prefixes;
+    }
+    if (candidate->imm8_opcode_offset >= 0) {
+      candidate->imm8_opcode_offset += prefixes;
+    }
+    added += prefixes;
+  }
+  return added;
+}
+
+void Assembler::PadWithNops(intptr_t position, intptr_t length) {
+  buffer_.InsertGap(position, length);
+  ShiftTrackedPositions(position, length);
+  while (length > 0) {
+    const int size = Utils::Minimum<intptr_t>(length, MAX_NOP_SIZE);
+    StoreNop(buffer_.Address(position), size);
+    position += size;
+    length -= size;
+  }
+}
+
+static void ShiftRange(intptr_t *start, intptr_t *end, intptr_t position,
+                       intptr_t length, intptr_t grown_start) {
+  if (*end < 0) {
+    return; // Not tracked.
+  }
+  if (*start == grown_start || (*start < grown_start && *end > grown_start)) {
+    *end += length; // Is or contains the grown instruction.
+  } else if (*start >= position) {
+    *start += length;
+    *end += length;
+  } else if (*end > position) {
+    *end += length;
+  }
+}
+
+void Assembler::ShiftTrackedPositions(intptr_t position, intptr_t length,
+                                      intptr_t grown_start) {
+  ShiftRange(&flags_producer_.start, &flags_producer_.end, position, length,
+             grown_start);
+  for (intptr_t i = 0; i < kMaxPaddingCandidates; i++) {
+    ShiftRange(&padding_candidates_[i].start, &padding_candidates_[i].end,
+               position, length, grown_start);
+  }
+}
+
 void Assembler::CompareRegisters(Register a, Register b) { cmpq(a, b); }
 
+void Assembler::CompareImmediate(Register reg, const Immediate &imm) {
+  if (imm.is_int32()) {
+    cmpq(reg, imm);
+  } else {
+    ASSERT(reg != TMP);
+    INC_ASSEMBLER_STAT(tmp_expansions, 1);
+    LoadImmediate(TMP, imm);
+    cmpq(reg, TMP);
+  }
+}
+
+void Assembler::CompareImmediate(const Address &address,
+                                 const Immediate &imm) {
+  if (imm.is_int32()) {
+    cmpq(address, imm);
+  } else {
+    INC_ASSEMBLER_STAT(tmp_expansions, 1);
+    LoadImmediate(TMP, imm);
+    cmpq(address, TMP);
+  }
+}
+
+void Assembler::TestImmediate(Register dst, const Immediate &imm) {
+  if (imm.is_int32() || imm.is_uint32()) {
+    testq(dst, imm);
+  } else {
+    ASSERT(dst != TMP);
+    INC_ASSEMBLER_STAT(tmp_expansions, 1);
+    LoadImmediate(TMP, imm);
+    testq(dst, TMP);
+  }
+}
+
+void Assembler::LoadImmediate(Register reg, const Immediate &imm) {
+  if (imm.value() == 0) {
+    xorl(reg, reg);
+  } else {
+    movq(reg, imm);
+  }
+}
+
+void Assembler::CompareAndBranch(Register a, Register b, Condition condition,
+                                 Label *label, bool near) {
+  cmpq(a, b);
+  j(condition, label, near);
+}
+
+void Assembler::CompareAndBranch(Register reg, const Immediate &imm,
+                                 Condition condition, Label *label,
+                                 bool near) {
+  if (imm.value() == 0) {
+    // Same flags as cmp reg, 0 (CF and OF cleared), but shorter and test
+    // fuses with every condition.
+    testq(reg, reg);
+  } else {
+    CompareImmediate(reg, imm);
+  }
+  j(condition, label, near);
+}
+
+void Assembler::CompareAndBranch(const Address &address, const Immediate &imm,
+                                 Condition condition, Label *label, bool near,
+                                 Register scratch) {
+  if (scratch == kNoRegister) {
+    CompareImmediate(address, imm);
+  } else if (imm.is_int32()) {
+    // The load costs no more than the load micro-op of cmp [mem], imm, and
+    // the remaining cmp reg, imm fuses with the jcc.
+    movq(scratch, address);
+    cmpq(scratch, imm);
+  } else {
+    // cmp [mem], reg fuses, unless RIP-relative. Loading the memory operand
+    // instead would take a second register for the immediate.
+    LoadImmediate(scratch, imm);
+    cmpq(address, scratch);
+  }
+  j(condition, label, near);
+}
+
+void Assembler::TestAndBranch(Register a, Register b, Condition condition,
+                              Label *label, bool near) {
+  testq(a, b);
+  j(condition, label, near);
+}
+
+void Assembler::TestAndBranch(Register reg, const Immediate &imm,
+                              Condition condition, Label *label, bool near) {
+  TestImmediate(reg, imm);
+  j(condition, label, near);
+}
+
+void Assembler::TestAndBranch(const Address &address, const Immediate &imm,
+                              Condition condition, Label *label, bool near,
+                              Register scratch) {
+  if (scratch == kNoRegister) {
+    // The low byte alone sets ZF as the full test does.
+    if (imm.is_uint8() && (condition == ZERO || condition == NOT_ZERO)) {
+      testb(address, imm);
+    } else {
+      testq(address, imm);
+    }
+  } else if (imm.is_int32() || imm.is_uint32()) {
+    movq(scratch, address);
+    TestImmediate(scratch, imm);
+  } else {
+    // test [mem], reg fuses, unless RIP-relative.
+    LoadImmediate(scratch, imm);
+    testq(address, scratch);
+  }
+  j(condition, label, near);
+}
+
+bool Assembler::CanMacroFuse(FlagsProducerKind kind, Condition condition) {
+  switch (kind) {
+  case kFlagsTest:
+  case kFlagsAnd:
+    return true;
+  case kFlagsIncDec:
+    if (condition == BELOW || condition == ABOVE_EQUAL ||
+        condition == BELOW_EQUAL || condition == ABOVE) {
+      return false;
+    }
+    // Fall through.
+  case kFlagsCmp:
+  case kFlagsAddSub:
+    return condition != OVERFLOW && condition != NO_OVERFLOW &&
+           condition != SIGN && condition != NOT_SIGN &&
+           condition != PARITY_EVEN && condition != PARITY_ODD;
+  default:
+    return false;
+  }
+}
+
+void Assembler::NoteFlagsProducer(intptr_t start, FlagsProducerKind kind,
+                                  bool fusible_form) {
+  if (kind == kFlagsPreserved) {
+    return;
+  }
+  flags_producer_.start = start;
+  flags_producer_.end = buffer_.GetPosition();
+  flags_producer_.kind = kind;
+  flags_producer_.fusible_form = fusible_form;
+}
+
+void Assembler::ConsumeFlags(Condition condition) {
+  const FlagsProducer &producer = flags_producer_;
+  if (fusion_lint_ && producer.end >= 0 &&
+      (producer.kind == kFlagsCmp || producer.kind == kFlagsTest)) {
+    const char *reason = NULL;
+    if (producer.end != buffer_.GetPosition()) {
+      reason = "code emitted between compare and jcc";
+    } else if (!producer.fusible_form) {
+      reason = "memory-immediate or RIP-relative compare";
+    } else if (!CanMacroFuse(producer.kind, condition)) {
+      reason = "condition does not fuse with compare";
+    }
+    if (reason != NULL) {
+      fusion_lint_violations_++;
+      if (fusion_lint_handler_ != NULL) {
+        fusion_lint_handler_(buffer_.GetPosition(), producer.start, reason,
+                             fusion_lint_argument_);
+      }
+    }
+  }
+  ClearFlagsProducer();
+}
+
 void Assembler::MoveRegister(Register to, Register from) {
   if (to != from) {
     movq(to, from);
@@ -740,21 +1614,219 @@ void Assembler::Drop(intptr_t stack_elements, Register tmp) {
 }
 
 void Assembler::Bind(Label *label) {
-  intptr_t bound = buffer_.Size();
+  intptr_t bound = SectionPosition();
   ASSERT(!label->IsBound()); // Labels can only be bound once.
   while (label->IsLinked()) {
-    intptr_t position = label->LinkPosition();
-    intptr_t next = buffer_.Load<int32_t>(position);
-    buffer_.Store<int32_t>(position, bound - (position + 4));
+    intptr_t position = ResolvePosition(label->LinkPosition());
+    AssemblerBuffer *buffer = SectionBuffer(position);
+    intptr_t next = buffer->Load<int32_t>(SectionOffset(position));
+    if (InCurrentSection(position)) {
+      position = SectionOffset(position);
+      buffer_.Store<int32_t>(position, SectionOffset(bound) - (position + 4));
+    } else {
+      AddCrossSectionFixup(position, bound);
+    }
     label->position_ = next;
   }
   while (label->HasNear()) {
-    intptr_t position = label->NearPosition();
-    intptr_t offset = bound - (position + 1);
-    ASSERT(Utils::IsInt(8, offset));
+    intptr_t position = ResolvePosition(label->NearPosition());
+    if (!InCurrentSection(position)) {
+      FATAL("Near jump between hot and cold code");
+    }
+    position = SectionOffset(position);
+    intptr_t offset = SectionOffset(bound) - (position + 1);
+    // Branch padding and lengthening may push the label out of range.
+    if (!Utils::IsInt(8, offset)) {
+      FATAL("Near jump out of range");
+    }
     buffer_.Store<int8_t>(position, offset);
   }
   label->BindTo(bound);
+  ymm_upper_dirty_ = ymm_upper_dirty_ || label->ymm_upper_dirty_;
+  label->ymm_upper_dirty_ = ymm_upper_dirty_;
+  if (track_call_frame_ && label->call_frame_index_ != 0) {
+    // Code after a label is reached with the call frame of its branches.
+    SetCallFrame(branch_call_frames_.Load<CallFrame>(
+        (label->call_frame_index_ - 1) * sizeof(CallFrame)));
+  }
+  // Flags at a branch target come from all of its predecessors.
+  ClearFlagsProducer();
+  // Code before a bound label can no longer move.
+  ClearPaddingCandidates();
+}
+
+void Assembler::EnterColdRegion() {
+  ASSERT(!in_cold_region_);
+  ASSERT(cold_code_offset_ < 0); // The cold code was already placed.
+  SwitchSection();
+  if (track_call_frame_) {
+    inactive_call_frame_ = call_frame_;
+    // The cold code follows the hot code, so it needs a row of its own.
+    const CallFrameRow row = {SectionPosition(), call_frame_};
+    EmitWords(&call_frame_rows_, row);
+  }
+}
+
+void Assembler::ExitColdRegion() {
+  ASSERT(in_cold_region_);
+  SwitchSection();
+  if (track_call_frame_) {
+    call_frame_ = inactive_call_frame_;
+  }
+}
+
+void Assembler::SwitchSection() {
+  buffer_.Swap(&inactive_section_);
+  in_cold_region_ = !in_cold_region_;
+  const bool ymm_upper_dirty = ymm_upper_dirty_;
+  ymm_upper_dirty_ = inactive_ymm_upper_dirty_;
+  inactive_ymm_upper_dirty_ = ymm_upper_dirty;
+  // Both are tracked by position in the section.
+  ClearFlagsProducer();
+  ClearPaddingCandidates();
+}
+
+void Assembler::AddCrossSectionFixup(intptr_t position, intptr_t target) {
+  AssemblerBuffer::EnsureCapacity ensured(&cross_section_fixups_);
+  cross_section_fixups_.Emit<int32_t>(position);
+  cross_section_fixups_.Emit<int32_t>(target);
+}
+
+void Assembler::EmitColdCode() {
+  ASSERT(!in_cold_region_);
+  ASSERT(cold_code_offset_ < 0);
+#if defined(ASSEMBLER_STATISTICS)
+  const intptr_t hot_code_size = buffer_.Size();
+#endif
+  // The gap is never executed.
+  while (inactive_section_.Size() > 0 &&
+         (buffer_.Size() % kColdCodeAlignment) != 0) {
+    AssemblerBuffer::EnsureCapacity ensured(&buffer_);
+    EmitUint8(Instr::kBreakPointInstruction);
+  }
+  cold_code_offset_ = buffer_.Size();
+  if (track_call_frame_) {
+    SortCallFrameRows(inactive_section_.Size() > 0);
+  }
+  for (intptr_t i = 0; i < inactive_section_.Size(); i++) {
+    AssemblerBuffer::EnsureCapacity ensured(&buffer_);
+    EmitUint8(inactive_section_.Load<uint8_t>(i));
+  }
+  inactive_section_.Reset();
+  for (intptr_t i = 0; i < cross_section_fixups_.Size(); i += 8) {
+    const intptr_t position =
+        ResolvePosition(cross_section_fixups_.Load<int32_t>(i));
+    const intptr_t target =
+        ResolvePosition(cross_section_fixups_.Load<int32_t>(i + 4));
+    buffer_.Store<int32_t>(position, target - (position + 4));
+  }
+  cross_section_fixups_.Reset();
+  for (intptr_t i = 0; i < jump_table_fixups_.Size(); i += 8) {
+    const intptr_t position =
+        ResolvePosition(jump_table_fixups_.Load<int32_t>(i));
+    buffer_.Store<int32_t>(position,
+                           buffer_.Load<int32_t>(position) +
+                               jump_table_fixups_.Load<int32_t>(i + 4));
+  }
+  jump_table_fixups_.Reset();
+  ClearFlagsProducer();
+  ClearPaddingCandidates();
+#if defined(ASSEMBLER_STATISTICS)
+  const uint8_t *code = reinterpret_cast<const uint8_t *>(buffer_.contents());
+  AssemblerStatistics::CountInstructions(code, hot_code_size);
+  AssemblerStatistics::CountInstructions(code + cold_code_offset_,
+                                         buffer_.Size() - cold_code_offset_);
+#endif
+}
+
+void Assembler::FinalizeCode() {
+  if (cold_code_offset_ < 0) {
+    EmitColdCode();
+  }
+  if (external_targets_.Size() == 0) {
+    return;
+  }
+  while ((buffer_.Size() % 8) != 0) {
+    AssemblerBuffer::EnsureCapacity ensured(&buffer_);
+    EmitUint8(Instr::kBreakPointInstruction);
+  }
+  const intptr_t table = buffer_.Size();
+  for (intptr_t i = 0; i < external_targets_.Size(); i += 8) {
+    AssemblerBuffer::EnsureCapacity ensured(&buffer_);
+    EmitInt64(external_targets_.Load<int64_t>(i));
+  }
+  for (intptr_t i = 0; i < external_target_fixups_.Size(); i += 8) {
+    const intptr_t position =
+        ResolvePosition(external_target_fixups_.Load<int32_t>(i));
+    const intptr_t entry =
+        table + external_target_fixups_.Load<int32_t>(i + 4) * 8;
+    buffer_.Store<int32_t>(position, entry - (position + 4));
+  }
+  external_targets_.Reset();
+  external_target_fixups_.Reset();
+}
+
+void Assembler::JumpTable(Register index, Label *const *labels,
+                          intptr_t count, Label *out_of_range,
+                          Register scratch) {
+  ASSERT(count > 0);
+  ASSERT(index != scratch);
+  Label table;
+  CompareAndBranch(index, Immediate(count), ABOVE_EQUAL, out_of_range);
+  {
+    AssemblerBuffer::EnsureCapacity ensured(&buffer_);
+    // leaq scratch, [rip + table]
+    EmitRegRegRex(scratch, 0, REX_W);
+    EmitUint8(0x8D);
+    EmitUint8(0x05 | ((scratch & 7) << 3));
+    EmitLabel(&table, 4);
+  }
+  // The link records the position of the leaq.
+  ClearPaddingCandidates();
+  movsxd(index, Address(scratch, index, TIMES_4, 0));
+  addq(scratch, index);
+  for (intptr_t i = 0; i < count; i++) {
+    NoteBranchYmmState(labels[i]);
+    NoteBranchCallFrame(labels[i]);
+  }
+  // The YMM state is merged into the labels above, not cleaned.
+  EmitIndirectJump(scratch);
+
+  const bool in_cold_region = in_cold_region_;
+  if (!in_cold_region) {
+    EnterColdRegion();
+  }
+  Align(4, 0);
+  Bind(&table);
+  for (intptr_t i = 0; i < count; i++) {
+    AssemblerBuffer::EnsureCapacity ensured(&buffer_);
+    {
+      AssemblerBuffer::EnsureCapacity ensured(&jump_table_fixups_);
+      jump_table_fixups_.Emit<int32_t>(SectionPosition());
+      // From the end of the entry to the table.
+      jump_table_fixups_.Emit<int32_t>((i + 1) * 4);
+    }
+    EmitLabel(labels[i], 4);
+  }
+  if (!in_cold_region) {
+    ExitColdRegion();
+  }
+}
+
+void Assembler::StopIf(Condition condition, const char *message) {
+  if (in_cold_region_) {
+    Label done;
+    j(InvertCondition(condition), &done, kNearJump);
+    Stop(message);
+    Bind(&done);
+    return;
+  }
+  Label stop;
+  j(condition, &stop);
+  EnterColdRegion();
+  Bind(&stop);
+  Stop(message);
+  ExitColdRegion();
 }
 
 const int kMinimumAlignment = 16;
@@ -771,12 +1843,26 @@ void Assembler::ReserveAlignedFrameSpace(intptr_t frame_space) {
 
 void Assembler::Align(int alignment, intptr_t offset) {
   ASSERT(Utils::IsPowerOfTwo(alignment));
+  ASSERT(!in_cold_region_ || alignment <= kColdCodeAlignment);
   intptr_t pos = offset + buffer_.GetPosition();
   int mod = pos & (alignment - 1);
   if (mod == 0) {
     return;
   }
   intptr_t bytes_needed = alignment - mod;
+  if (align_padding_ == kAlignByLengthening) {
+    while (bytes_needed > 0) {
+      // Each step must fit in the gap guaranteed by EnsureCapacity.
+      AssemblerBuffer::EnsureCapacity ensured(&buffer_);
+      const intptr_t added = PadByLengthening(
+          buffer_.GetPosition(),
+          Utils::Minimum<intptr_t>(bytes_needed, MAX_NOP_SIZE));
+      if (added == 0) {
+        break;
+      }
+      bytes_needed -= added;
+    }
+  }
   while (bytes_needed > MAX_NOP_SIZE) {
     nop(MAX_NOP_SIZE);
     bytes_needed -= MAX_NOP_SIZE;
@@ -839,8 +1925,9 @@ void Assembler::EmitComplex(int rm, const Operand &operand,
 }
 
 void Assembler::EmitLabel(Label *label, intptr_t instruction_size) {
-  if (label->IsBound()) {
-    intptr_t offset = label->Position() - buffer_.Size();
+  if (IsBoundInCurrentSection(label)) {
+    intptr_t offset =
+        SectionOffset(ResolvePosition(label->Position())) - buffer_.Size();
     ASSERT(offset <= 0);
     EmitInt32(offset - instruction_size);
   } else {
@@ -849,21 +1936,27 @@ void Assembler::EmitLabel(Label *label, intptr_t instruction_size) {
 }
 
 void Assembler::EmitLabelLink(Label *label) {
-  ASSERT(!label->IsBound());
-  intptr_t position = buffer_.Size();
+  intptr_t position = SectionPosition();
+  if (label->IsBound()) {
+    // Bound in the other section.
+    AddCrossSectionFixup(position, ResolvePosition(label->Position()));
+    EmitInt32(0);
+    return;
+  }
   EmitInt32(label->position_);
   label->LinkTo(position);
 }
 
 void Assembler::EmitNearLabelLink(Label *label) {
   ASSERT(!label->IsBound());
-  intptr_t position = buffer_.Size();
+  intptr_t position = SectionPosition();
   EmitUint8(0);
   label->NearLinkTo(position);
 }
 
 void Assembler::EmitGenericShift(bool wide, int rm, Register reg,
                                  const Immediate &imm) {
+  FlagsProducerScope producer(this, kFlagsOther);
   AssemblerBuffer::EnsureCapacity ensured(&buffer_);
   ASSERT(imm.is_int8());
   if (wide) {
@@ -883,6 +1976,7 @@ void Assembler::EmitGenericShift(bool wide, int rm, Register reg,
 
 void Assembler::EmitGenericShift(bool wide, int rm, Register operand,
                                  Register shifter) {
+  FlagsProducerScope producer(this, kFlagsOther);
   AssemblerBuffer::EnsureCapacity ensured(&buffer_);
   ASSERT(shifter == RCX);
   EmitRegisterREX(operand, wide ? REX_W : REX_NONE);
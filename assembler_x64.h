@@ -251,24 +251,56 @@ public:
 
   ~Assembler() {}
 
+  // Returns to the state of a new Assembler, with the default settings,
+  // keeping the memory of the buffers. The code must have been copied out.
+  void Reset();
+
+  // Near jumps take a rel8, which must still reach the label once branch
+  // padding and lengthening are added in between; Bind() is fatal if not.
   static const bool kNearJump = true;
   static const bool kFarJump = false;
 
   /*
    * Emit Machine Instructions.
    */
-  void call(Register reg) { EmitUnaryL(reg, 0xFF, 2); }
-  void call(const Address &address) { EmitUnaryL(address, 0xFF, 2); }
+  // The flags are undefined after a call.
+  void call(Register reg) {
+    AvoidAvxSseTransition();
+    AlignIndirectBranch(Operand(reg));
+    FlagsProducerScope producer(this, kFlagsOther);
+    EmitUnaryL(reg, 0xFF, 2);
+  }
+  void call(const Address &address) {
+    AvoidAvxSseTransition();
+    AlignIndirectBranch(address);
+    FlagsProducerScope producer(this, kFlagsOther);
+    EmitUnaryL(address, 0xFF, 2);
+  }
   void call(Label *label);
+  // Without a code_address(), calls and jumps to an ExternalLabel load the
+  // target into TMP and branch through it. With one, they are direct rel32
+  // branches when the target is within range, and indirect branches through
+  // the external target table otherwise; the code must then be finished
+  // with FinalizeCode().
   void call(const ExternalLabel *label);
 
   void pushq(Register reg);
-  void pushq(const Address &address) { EmitUnaryL(address, 0xFF, 6); }
+  void pushq(const Address &address) {
+    EmitUnaryL(address, 0xFF, 6);
+    if (track_call_frame_) {
+      AdjustCallFrame(8);
+    }
+  }
   void pushq(const Immediate &imm);
   void PushImmediate(const Immediate &imm);
 
   void popq(Register reg);
-  void popq(const Address &address) { EmitUnaryL(address, 0x8F, 0); }
+  void popq(const Address &address) {
+    EmitUnaryL(address, 0x8F, 0);
+    if (track_call_frame_) {
+      AdjustCallFrame(-8);
+    }
+  }
 
   void setcc(Condition condition, ByteRegister dst);
 
@@ -287,6 +319,22 @@ public:
   void name(const Address &dst, Register src) {                                \
     Emit##width(src, dst, __VA_ARGS__);                                        \
   }
+// Same, for instructions that write the flags without ever macro-fusing.
+#define FLAGS_RR(width, name, ...)                                             \
+  void name(Register dst, Register src) {                                      \
+    FlagsProducerScope producer(this, kFlagsOther);                            \
+    Emit##width(dst, src, __VA_ARGS__);                                        \
+  }
+#define FLAGS_RA(width, name, ...)                                             \
+  void name(Register dst, const Address &src) {                                \
+    FlagsProducerScope producer(this, kFlagsOther);                            \
+    Emit##width(dst, src, __VA_ARGS__);                                        \
+  }
+#define FLAGS_AR(width, name, ...)                                             \
+  void name(const Address &dst, Register src) {                                \
+    FlagsProducerScope producer(this, kFlagsOther);                            \
+    Emit##width(src, dst, __VA_ARGS__);                                        \
+  }
 #define REGULAR_INSTRUCTION(name, ...)                                         \
   RA(W, name##w, __VA_ARGS__)                                                  \
   RA(L, name##l, __VA_ARGS__)                                                  \
@@ -294,11 +342,31 @@ public:
   RR(W, name##w, __VA_ARGS__)                                                  \
   RR(L, name##l, __VA_ARGS__)                                                  \
   RR(Q, name##q, __VA_ARGS__)
-  REGULAR_INSTRUCTION(test, 0x85)
+#define FLAGS_INSTRUCTION(name, ...)                                           \
+  FLAGS_RA(W, name##w, __VA_ARGS__)                                            \
+  FLAGS_RA(L, name##l, __VA_ARGS__)                                            \
+  FLAGS_RA(Q, name##q, __VA_ARGS__)                                            \
+  FLAGS_RR(W, name##w, __VA_ARGS__)                                            \
+  FLAGS_RR(L, name##l, __VA_ARGS__)                                            \
+  FLAGS_RR(Q, name##q, __VA_ARGS__)
   REGULAR_INSTRUCTION(xchg, 0x87)
-  REGULAR_INSTRUCTION(imul, 0xAF, 0x0F)
-  REGULAR_INSTRUCTION(bsr, 0xBD, 0x0F)
+  FLAGS_INSTRUCTION(imul, 0xAF, 0x0F)
+  FLAGS_INSTRUCTION(bsr, 0xBD, 0x0F)
 #undef REGULAR_INSTRUCTION
+#undef FLAGS_INSTRUCTION
+#define DECLARE_TEST(suffix, width)                                            \
+  void test##suffix(Register dst, Register src) {                              \
+    FlagsProducerScope producer(this, kFlagsTest);                             \
+    Emit##width(dst, src, 0x85);                                               \
+  }                                                                            \
+  void test##suffix(Register dst, const Address &src) {                        \
+    FlagsProducerScope producer(this, kFlagsTest, IsFusibleOperand(src));      \
+    Emit##width(dst, src, 0x85);                                               \
+  }
+  DECLARE_TEST(w, W)
+  DECLARE_TEST(l, L)
+  DECLARE_TEST(q, Q)
+#undef DECLARE_TEST
   RA(Q, movsxd, 0x63)
   RR(Q, movsxd, 0x63)
   AR(L, movb, 0x88)
@@ -311,12 +379,12 @@ public:
   RR(L, movl, 0x8B)
   RA(Q, leaq, 0x8D)
   RA(L, leal, 0x8D)
-  AR(L, cmpxchgl, 0xB1, 0x0F)
-  AR(Q, cmpxchgq, 0xB1, 0x0F)
-  RA(L, cmpxchgl, 0xB1, 0x0F)
-  RA(Q, cmpxchgq, 0xB1, 0x0F)
-  RR(L, cmpxchgl, 0xB1, 0x0F)
-  RR(Q, cmpxchgq, 0xB1, 0x0F)
+  FLAGS_AR(L, cmpxchgl, 0xB1, 0x0F)
+  FLAGS_AR(Q, cmpxchgq, 0xB1, 0x0F)
+  FLAGS_RA(L, cmpxchgl, 0xB1, 0x0F)
+  FLAGS_RA(Q, cmpxchgq, 0xB1, 0x0F)
+  FLAGS_RR(L, cmpxchgl, 0xB1, 0x0F)
+  FLAGS_RR(Q, cmpxchgq, 0xB1, 0x0F)
   RA(Q, movzxb, 0xB6, 0x0F)
   RR(Q, movzxb, 0xB6, 0x0F)
   RA(Q, movzxw, 0xB7, 0x0F)
@@ -335,6 +403,9 @@ public:
 #undef AA
 #undef RA
 #undef AR
+#undef FLAGS_RR
+#undef FLAGS_RA
+#undef FLAGS_AR
 
 #define SIMPLE(name, ...)                                                      \
   void name() { EmitSimple(__VA_ARGS__); }
@@ -348,16 +419,35 @@ public:
 // XmmRegister operations with another register or an address.
 #define XX(width, name, ...)                                                   \
   void name(XmmRegister dst, XmmRegister src) {                                \
+    AvoidAvxSseTransition();                                                   \
     Emit##width(dst, src, __VA_ARGS__);                                        \
   }
 #define XA(width, name, ...)                                                   \
   void name(XmmRegister dst, const Address &src) {                             \
+    AvoidAvxSseTransition();                                                   \
     Emit##width(dst, src, __VA_ARGS__);                                        \
   }
 #define AX(width, name, ...)                                                   \
   void name(const Address &dst, XmmRegister src) {                             \
+    AvoidAvxSseTransition();                                                   \
     Emit##width(src, dst, __VA_ARGS__);                                        \
   }
+// Scalar versions that first break the false dependency on dst for sqrt, see
+// set_break_false_dependency.
+#define XXS(name, code, ...)                                                   \
+  void name(XmmRegister dst, XmmRegister src) {                                \
+    AvoidAvxSseTransition();                                                   \
+    if (dst != src) {                                                          \
+      BreakScalarAluDependency(code, dst);                                     \
+    }                                                                          \
+    EmitL(dst, src, __VA_ARGS__);                                              \
+  }
+#define XAS(name, code, ...)                                                   \
+  void name(XmmRegister dst, const Address &src) {                             \
+    AvoidAvxSseTransition();                                                   \
+    BreakScalarAluDependency(code, dst);                                       \
+    EmitL(dst, src, __VA_ARGS__);                                              \
+  }
   // We could add movupd here, but movups does the same and is shorter.
   XA(L, movups, 0x10, 0x0F);
   XA(L, movsd, 0x10, 0x0F, 0xF2)
@@ -372,7 +462,11 @@ public:
   XX(L, unpckhpd, 0x15, 0x0F, 0x66)
   XX(L, movlhps, 0x16, 0x0F)
   XX(L, movaps, 0x28, 0x0F)
-  XX(L, comisd, 0x2F, 0x0F, 0x66)
+  void comisd(XmmRegister a, XmmRegister b) {
+    AvoidAvxSseTransition();
+    FlagsProducerScope producer(this, kFlagsOther);
+    EmitL(a, b, 0x2F, 0x0F, 0x66);
+  }
 #define DECLARE_XMM(name, code)                                                \
   XX(L, name##ps, 0x50 + code, 0x0F)                                           \
   XA(L, name##ps, 0x50 + code, 0x0F)                                           \
@@ -380,11 +474,11 @@ public:
   XX(L, name##pd, 0x50 + code, 0x0F, 0x66)                                     \
   XA(L, name##pd, 0x50 + code, 0x0F, 0x66)                                     \
   AX(L, name##pd, 0x50 + code, 0x0F, 0x66)                                     \
-  XX(L, name##sd, 0x50 + code, 0x0F, 0xF2)                                     \
-  XA(L, name##sd, 0x50 + code, 0x0F, 0xF2)                                     \
+  XXS(name##sd, code, 0x50 + code, 0x0F, 0xF2)                                 \
+  XAS(name##sd, code, 0x50 + code, 0x0F, 0xF2)                                 \
   AX(L, name##sd, 0x50 + code, 0x0F, 0xF2)                                     \
-  XX(L, name##ss, 0x50 + code, 0x0F, 0xF3)                                     \
-  XA(L, name##ss, 0x50 + code, 0x0F, 0xF3)                                     \
+  XXS(name##ss, code, 0x50 + code, 0x0F, 0xF3)                                 \
+  XAS(name##ss, code, 0x50 + code, 0x0F, 0xF3)                                 \
   AX(L, name##ss, 0x50 + code, 0x0F, 0xF3)
   XMM_ALU_CODES(DECLARE_XMM)
 #undef DECLARE_XMM
@@ -398,9 +492,12 @@ public:
 #undef XX
 #undef AX
 #undef XA
+#undef XXS
+#undef XAS
 
 #define DECLARE_CMPPS(name, code)                                              \
   void cmpps##name(XmmRegister dst, XmmRegister src) {                         \
+    AvoidAvxSseTransition();                                                   \
     EmitL(dst, src, 0xC2, 0x0F);                                               \
     AssemblerBuffer::EnsureCapacity ensured(&buffer_);                         \
     EmitUint8(code);                                                           \
@@ -408,10 +505,51 @@ public:
   XMM_CONDITIONAL_CODES(DECLARE_CMPPS)
 #undef DECLARE_CMPPS
 
+  // AVX instructions. The 256-bit forms leave the upper halves of the YMM
+  // registers dirty; see ymm_upper_dirty().
+  void vzeroupper();
+  void vmovups(YmmRegister dst, const Address &src) {
+    EmitVex(dst, 0, src, 0x10, kVexNone, kVex256);
+  }
+  void vmovups(const Address &dst, YmmRegister src) {
+    EmitVex(src, 0, dst, 0x11, kVexNone, kVex256);
+  }
+  void vmovups(YmmRegister dst, YmmRegister src) {
+    EmitVex(dst, 0, src, 0x10, kVexNone, kVex256);
+  }
+  void vsqrtps(YmmRegister dst, YmmRegister src) {
+    EmitVex(dst, 0, src, 0x51, kVexNone, kVex256);
+  }
+  void vsqrtpd(YmmRegister dst, YmmRegister src) {
+    EmitVex(dst, 0, src, 0x51, kVex66, kVex256);
+  }
+#define DECLARE_AVX(name, code)                                                \
+  void v##name##ps(YmmRegister dst, YmmRegister src1, YmmRegister src2) {      \
+    EmitVex(dst, src1, src2, 0x50 + code, kVexNone, kVex256);                  \
+  }                                                                            \
+  void v##name##ps(YmmRegister dst, YmmRegister src1, const Address &src2) {   \
+    EmitVex(dst, src1, src2, 0x50 + code, kVexNone, kVex256);                  \
+  }                                                                            \
+  void v##name##pd(YmmRegister dst, YmmRegister src1, YmmRegister src2) {      \
+    EmitVex(dst, src1, src2, 0x50 + code, kVex66, kVex256);                    \
+  }                                                                            \
+  void v##name##pd(YmmRegister dst, YmmRegister src1, const Address &src2) {   \
+    EmitVex(dst, src1, src2, 0x50 + code, kVex66, kVex256);                    \
+  }
+  AVX_BINARY_ALU_CODES(DECLARE_AVX)
+#undef DECLARE_AVX
+
+// Of these, popfd and sahf write the flags.
 #define DECLARE_SIMPLE(name, opcode)                                           \
-  void name() { EmitSimple(opcode); }
+  void name() {                                                                \
+    FlagsProducerScope producer(this, opcode == 0x9D || opcode == 0x9E         \
+                                          ? kFlagsOther                        \
+                                          : kFlagsPreserved);                  \
+    EmitSimple(opcode);                                                        \
+  }
   X86_ZERO_OPERAND_1_BYTE_INSTRUCTIONS(DECLARE_SIMPLE)
 #undef DECLARE_SIMPLE
+  void ret();
 
   void movl(Register dst, const Immediate &imm);
   void movl(const Address &dst, const Immediate &imm);
@@ -426,15 +564,19 @@ public:
 
   // Destination and source are reversed for some reason.
   void movq(Register dst, XmmRegister src) {
+    AvoidAvxSseTransition();
     EmitQ(src, dst, 0x7E, 0x0F, 0x66);
   }
   void movl(Register dst, XmmRegister src) {
+    AvoidAvxSseTransition();
     EmitL(src, dst, 0x7E, 0x0F, 0x66);
   }
   void movss(XmmRegister dst, XmmRegister src) {
+    AvoidAvxSseTransition();
     EmitL(src, dst, 0x11, 0x0F, 0xF3);
   }
   void movsd(XmmRegister dst, XmmRegister src) {
+    AvoidAvxSseTransition();
     EmitL(src, dst, 0x11, 0x0F, 0xF2);
   }
 
@@ -442,34 +584,62 @@ public:
   // obvious 0x88 encoding for this some, because it is expected by gdb64 older
   // than 7.3.1-gg5 when disassembling a function's prologue (movq rbp, rsp)
   // for proper unwinding of Dart frames (use --generate_gdb_symbols and -O0).
-  void movq(Register dst, Register src) { EmitQ(src, dst, 0x89); }
+  void movq(Register dst, Register src) {
+    EmitQ(src, dst, 0x89);
+    if (track_call_frame_) {
+      NoteCallFrameMove(dst, src);
+    }
+  }
 
   void movq(XmmRegister dst, Register src) {
+    AvoidAvxSseTransition();
     EmitQ(dst, src, 0x6E, 0x0F, 0x66);
   }
 
   void movd(XmmRegister dst, Register src) {
+    AvoidAvxSseTransition();
     EmitL(dst, src, 0x6E, 0x0F, 0x66);
   }
   void cvtsi2sdq(XmmRegister dst, Register src) {
+    AvoidAvxSseTransition();
+    BreakFalseDependency(kCvtsi2sd, dst);
     EmitQ(dst, src, 0x2A, 0x0F, 0xF2);
   }
   void cvtsi2sdl(XmmRegister dst, Register src) {
+    AvoidAvxSseTransition();
+    BreakFalseDependency(kCvtsi2sd, dst);
     EmitL(dst, src, 0x2A, 0x0F, 0xF2);
   }
   void cvttsd2siq(Register dst, XmmRegister src) {
+    AvoidAvxSseTransition();
     EmitQ(dst, src, 0x2C, 0x0F, 0xF2);
   }
   void cvttsd2sil(Register dst, XmmRegister src) {
+    AvoidAvxSseTransition();
     EmitL(dst, src, 0x2C, 0x0F, 0xF2);
   }
   void movmskpd(Register dst, XmmRegister src) {
+    AvoidAvxSseTransition();
     EmitL(dst, src, 0x50, 0x0F, 0x66);
   }
-  void movmskps(Register dst, XmmRegister src) { EmitL(dst, src, 0x50, 0x0F); }
+  void movmskps(Register dst, XmmRegister src) {
+    AvoidAvxSseTransition();
+    EmitL(dst, src, 0x50, 0x0F);
+  }
+
+  void popcntq(Register dst, Register src);
+  void popcntq(Register dst, const Address &src);
+  void popcntl(Register dst, Register src);
+  void popcntl(Register dst, const Address &src);
 
-  void btl(Register dst, Register src) { EmitL(src, dst, 0xA3, 0x0F); }
-  void btq(Register dst, Register src) { EmitQ(src, dst, 0xA3, 0x0F); }
+  void btl(Register dst, Register src) {
+    FlagsProducerScope producer(this, kFlagsOther);
+    EmitL(src, dst, 0xA3, 0x0F);
+  }
+  void btq(Register dst, Register src) {
+    FlagsProducerScope producer(this, kFlagsOther);
+    EmitQ(src, dst, 0xA3, 0x0F);
+  }
 
   void notps(XmmRegister dst, XmmRegister src);
   void negateps(XmmRegister dst, XmmRegister src);
@@ -502,6 +672,8 @@ public:
   void testb(const Address &address, Register reg);
 
   void testq(Register reg, const Immediate &imm);
+  void testq(const Address &address, const Immediate &imm);
+  void testq(const Address &address, Register reg);
   void TestImmediate(Register dst, const Immediate &imm);
 
   void AndImmediate(Register dst, const Immediate &imm);
@@ -510,31 +682,75 @@ public:
 
   void shldq(Register dst, Register src, Register shifter) {
     ASSERT(shifter == RCX);
+    FlagsProducerScope producer(this, kFlagsOther);
     EmitQ(src, dst, 0xA5, 0x0F);
   }
   void shrdq(Register dst, Register src, Register shifter) {
     ASSERT(shifter == RCX);
+    FlagsProducerScope producer(this, kFlagsOther);
     EmitQ(src, dst, 0xAD, 0x0F);
   }
 
 #define DECLARE_ALU(op, c)                                                     \
-  void op##w(Register dst, Register src) { EmitW(dst, src, c * 8 + 3); }       \
-  void op##l(Register dst, Register src) { EmitL(dst, src, c * 8 + 3); }       \
-  void op##q(Register dst, Register src) { EmitQ(dst, src, c * 8 + 3); }       \
-  void op##w(Register dst, const Address &src) { EmitW(dst, src, c * 8 + 3); } \
-  void op##l(Register dst, const Address &src) { EmitL(dst, src, c * 8 + 3); } \
-  void op##q(Register dst, const Address &src) { EmitQ(dst, src, c * 8 + 3); } \
-  void op##w(const Address &dst, Register src) { EmitW(src, dst, c * 8 + 1); } \
-  void op##l(const Address &dst, Register src) { EmitL(src, dst, c * 8 + 1); } \
-  void op##q(const Address &dst, Register src) { EmitQ(src, dst, c * 8 + 1); } \
-  void op##l(Register dst, const Immediate &imm) { AluL(c, dst, imm); }        \
+  void op##w(Register dst, Register src) {                                     \
+    FlagsProducerScope producer(this, AluFlagsKind(c));                        \
+    EmitW(dst, src, c * 8 + 3);                                                \
+  }                                                                            \
+  void op##l(Register dst, Register src) {                                     \
+    FlagsProducerScope producer(this, AluFlagsKind(c));                        \
+    EmitL(dst, src, c * 8 + 3);                                                \
+  }                                                                            \
+  void op##q(Register dst, Register src) {                                     \
+    FlagsProducerScope producer(this, AluFlagsKind(c));                        \
+    EmitQ(dst, src, c * 8 + 3);                                                \
+  }                                                                            \
+  void op##w(Register dst, const Address &src) {                               \
+    FlagsProducerScope producer(this, AluFlagsKind(c), IsFusibleOperand(src)); \
+    EmitW(dst, src, c * 8 + 3);                                                \
+  }                                                                            \
+  void op##l(Register dst, const Address &src) {                               \
+    FlagsProducerScope producer(this, AluFlagsKind(c), IsFusibleOperand(src)); \
+    EmitL(dst, src, c * 8 + 3);                                                \
+  }                                                                            \
+  void op##q(Register dst, const Address &src) {                               \
+    FlagsProducerScope producer(this, AluFlagsKind(c), IsFusibleOperand(src)); \
+    EmitQ(dst, src, c * 8 + 3);                                                \
+  }                                                                            \
+  void op##w(const Address &dst, Register src) {                               \
+    FlagsProducerScope producer(this, AluFlagsKind(c), IsFusibleOperand(dst)); \
+    EmitW(src, dst, c * 8 + 1);                                                \
+  }                                                                            \
+  void op##l(const Address &dst, Register src) {                               \
+    FlagsProducerScope producer(this, AluFlagsKind(c), IsFusibleOperand(dst)); \
+    EmitL(src, dst, c * 8 + 1);                                                \
+  }                                                                            \
+  void op##q(const Address &dst, Register src) {                               \
+    FlagsProducerScope producer(this, AluFlagsKind(c), IsFusibleOperand(dst)); \
+    EmitQ(src, dst, c * 8 + 1);                                                \
+  }                                                                            \
+  void op##l(Register dst, const Immediate &imm) {                             \
+    FlagsProducerScope producer(this, AluFlagsKind(c));                        \
+    AluL(c, dst, imm);                                                         \
+  }                                                                            \
   void op##q(Register dst, const Immediate &imm) {                             \
+    FlagsProducerScope producer(this, AluFlagsKind(c));                        \
     AluQ(c, c * 8 + 3, dst, imm);                                              \
   }                                                                            \
-  void op##b(const Address &dst, const Immediate &imm) { AluB(c, dst, imm); }  \
-  void op##w(const Address &dst, const Immediate &imm) { AluW(c, dst, imm); }  \
-  void op##l(const Address &dst, const Immediate &imm) { AluL(c, dst, imm); }  \
+  /* Memory-immediate forms never macro-fuse with a following jcc. */          \
+  void op##b(const Address &dst, const Immediate &imm) {                       \
+    FlagsProducerScope producer(this, AluFlagsKind(c), false);                 \
+    AluB(c, dst, imm);                                                         \
+  }                                                                            \
+  void op##w(const Address &dst, const Immediate &imm) {                       \
+    FlagsProducerScope producer(this, AluFlagsKind(c), false);                 \
+    AluW(c, dst, imm);                                                         \
+  }                                                                            \
+  void op##l(const Address &dst, const Immediate &imm) {                       \
+    FlagsProducerScope producer(this, AluFlagsKind(c), false);                 \
+    AluL(c, dst, imm);                                                         \
+  }                                                                            \
   void op##q(const Address &dst, const Immediate &imm) {                       \
+    FlagsProducerScope producer(this, AluFlagsKind(c), false);                 \
     AluQ(c, c * 8 + 3, dst, imm);                                              \
   }
 
@@ -545,18 +761,30 @@ public:
 
   void cqo();
 
-#define REGULAR_UNARY(name, opcode, modrm)                                     \
-  void name##q(Register reg) { EmitUnaryQ(reg, opcode, modrm); }               \
-  void name##l(Register reg) { EmitUnaryL(reg, opcode, modrm); }               \
-  void name##q(const Address &address) { EmitUnaryQ(address, opcode, modrm); } \
-  void name##l(const Address &address) { EmitUnaryL(address, opcode, modrm); }
-  REGULAR_UNARY(not, 0xF7, 2)
-  REGULAR_UNARY(neg, 0xF7, 3)
-  REGULAR_UNARY(mul, 0xF7, 4)
-  REGULAR_UNARY(div, 0xF7, 6)
-  REGULAR_UNARY(idiv, 0xF7, 7)
-  REGULAR_UNARY(inc, 0xFF, 0)
-  REGULAR_UNARY(dec, 0xFF, 1)
+#define REGULAR_UNARY(name, opcode, modrm, flags)                              \
+  void name##q(Register reg) {                                                 \
+    FlagsProducerScope producer(this, flags);                                  \
+    EmitUnaryQ(reg, opcode, modrm);                                            \
+  }                                                                            \
+  void name##l(Register reg) {                                                 \
+    FlagsProducerScope producer(this, flags);                                  \
+    EmitUnaryL(reg, opcode, modrm);                                            \
+  }                                                                            \
+  void name##q(const Address &address) {                                       \
+    FlagsProducerScope producer(this, flags, IsFusibleOperand(address));       \
+    EmitUnaryQ(address, opcode, modrm);                                        \
+  }                                                                            \
+  void name##l(const Address &address) {                                       \
+    FlagsProducerScope producer(this, flags, IsFusibleOperand(address));       \
+    EmitUnaryL(address, opcode, modrm);                                        \
+  }
+  REGULAR_UNARY(not, 0xF7, 2, kFlagsPreserved)
+  REGULAR_UNARY(neg, 0xF7, 3, kFlagsOther)
+  REGULAR_UNARY(mul, 0xF7, 4, kFlagsOther)
+  REGULAR_UNARY(div, 0xF7, 6, kFlagsOther)
+  REGULAR_UNARY(idiv, 0xF7, 7, kFlagsOther)
+  REGULAR_UNARY(inc, 0xFF, 0, kFlagsIncDec)
+  REGULAR_UNARY(dec, 0xFF, 1, kFlagsIncDec)
 #undef REGULAR_UNARY
 
   // We could use kWord, kDoubleWord, and kQuadWord here, but it is rather
@@ -588,37 +816,49 @@ public:
   void btq(Register base, int bit);
 
   void enter(const Immediate &imm);
+  void leave();
 
   void fldl(const Address &src);
   void fstpl(const Address &dst);
 
   void ffree(intptr_t value);
 
-  // 'size' indicates size in bytes and must be in the range 1..8.
+  // 'size' indicates size in bytes and must be in the range 1..15.
   void nop(int size = 1);
 
   static uword GetBreakInstructionFiller() { return 0xCCCCCCCCCCCCCCCC; }
 
   void j(Condition condition, Label *label, bool near = kFarJump);
-  void jmp(Register reg) { EmitUnaryL(reg, 0xFF, 4); }
-  void jmp(const Address &address) { EmitUnaryL(address, 0xFF, 4); }
+  // Indirect jumps leave the function, as tail calls do.
+  void jmp(Register reg) {
+    AvoidAvxSseTransition();
+    EmitIndirectJump(reg);
+  }
+  void jmp(const Address &address) {
+    AvoidAvxSseTransition();
+    AlignIndirectBranch(address);
+    EmitUnaryL(address, 0xFF, 4);
+  }
   void jmp(Label *label, bool near = kFarJump);
   void jmp(const ExternalLabel *label);
 
   // Issue memory to memory move through a TMP register.
   // TODO(koda): Assert that these are not used for heap objects.
   void MoveMemoryToMemory(const Address &dst, const Address &src) {
+    INC_ASSEMBLER_STAT(tmp_expansions, 1);
     movq(TMP, src);
     movq(dst, TMP);
   }
 
   void Exchange(Register reg, const Address &mem) {
+    INC_ASSEMBLER_STAT(tmp_expansions, 1);
     movq(TMP, mem);
     movq(mem, reg);
     movq(reg, TMP);
   }
 
   void Exchange(const Address &mem1, const Address &mem2) {
+    INC_ASSEMBLER_STAT(tmp_expansions, 1);
     movq(TMP, mem1);
     xorq(TMP, mem2);
     xorq(mem1, TMP);
@@ -630,6 +870,115 @@ public:
   void CompareRegisters(Register a, Register b);
   void BranchIf(Condition condition, Label *label) { j(condition, label); }
 
+  // Compare-and-branch macros that always emit a compare/test in a form that
+  // macro-fuses with the following jcc (no memory-immediate operands, no
+  // RIP-relative addressing). Memory operands are loaded into [scratch]
+  // first, or 64-bit immediates, which are then compared or tested with
+  // the memory operand; pass kNoRegister to keep the (unfusible) memory
+  // form, which takes no 64-bit immediate in TestAndBranch().
+  void CompareAndBranch(Register a, Register b, Condition condition,
+                        Label *label, bool near = kFarJump);
+  void CompareAndBranch(Register reg, const Immediate &imm,
+                        Condition condition, Label *label,
+                        bool near = kFarJump);
+  void CompareAndBranch(const Address &address, const Immediate &imm,
+                        Condition condition, Label *label,
+                        bool near = kFarJump, Register scratch = TMP);
+  void TestAndBranch(Register a, Register b, Condition condition, Label *label,
+                     bool near = kFarJump);
+  void TestAndBranch(Register reg, const Immediate &imm, Condition condition,
+                     Label *label, bool near = kFarJump);
+  void TestAndBranch(const Address &address, const Immediate &imm,
+                     Condition condition, Label *label, bool near = kFarJump,
+                     Register scratch = TMP);
+
+  // Jumps to labels[index] for an |index| in [0, count), and to
+  // |out_of_range| otherwise (the bounds check is unsigned), in constant
+  // time:
+  //
+  //   cmp index, count; jae out_of_range
+  //   lea scratch, [rip + table]
+  //   movsxd index, [scratch + index * 4]
+  //   add scratch, index
+  //   jmp scratch
+  //
+  // The table holds the 32-bit offsets of the labels from the table, so the
+  // code stays position independent. It goes to the cold section, or after
+  // the jmp in cold code. Clobbers |index| and |scratch|.
+  void JumpTable(Register index, Label *const *labels, intptr_t count,
+                 Label *out_of_range, Register scratch = TMP);
+
+  // When the fusion lint is enabled, every jcc that consumes the flags of a
+  // cmp/test it cannot macro-fuse with (because other code was emitted in
+  // between, or because of the operand form) is counted, and reported to
+  // the handler if any.
+  bool fusion_lint() const { return fusion_lint_; }
+  void set_fusion_lint(bool enable) { fusion_lint_ = enable; }
+  intptr_t fusion_lint_violations() const { return fusion_lint_violations_; }
+  // Called with the offsets of the jcc and of the cmp/test in their
+  // section, and a description of why they do not fuse.
+  typedef void (*FusionLintHandler)(intptr_t jcc_offset,
+                                    intptr_t compare_offset,
+                                    const char *reason, void *argument);
+  void set_fusion_lint_handler(FusionLintHandler handler, void *argument) {
+    fusion_lint_handler_ = handler;
+    fusion_lint_argument_ = argument;
+  }
+
+  // Instructions that write only part of their destination, and so carry a
+  // dependency on its previous value that can serialize otherwise
+  // independent loop iterations.
+  enum PartialWriteInstruction {
+    kCvtsi2sd, // cvtsi2sdq, cvtsi2sdl.
+    kSqrtsd,   // sqrtsd, sqrtss.
+    kRoundsd,
+    kPopcnt, // False output dependency on Intel cores before Cannon Lake.
+    kNumPartialWriteInstructions,
+  };
+  // When enabled for an instruction (all are disabled by default), it is
+  // preceded by a zero idiom (xorps dst, dst or xorl dst, dst) whenever dst
+  // is not also one of its sources. The upper lanes of an XMM destination
+  // are then zeroed instead of preserved.
+  bool break_false_dependency(PartialWriteInstruction instruction) const {
+    return break_false_dependency_[instruction];
+  }
+  void set_break_false_dependency(PartialWriteInstruction instruction,
+                                  bool enable) {
+    break_false_dependency_[instruction] = enable;
+  }
+  // Number of zero idioms inserted to break false dependencies.
+  intptr_t dependency_breaks() const { return dependency_breaks_; }
+
+  // Whether the upper halves of the YMM registers may hold data written by
+  // 256-bit AVX instructions. When automatic insertion is enabled (the
+  // default), a vzeroupper is emitted while they may be dirty before every
+  // call, ret, jmp to an ExternalLabel and legacy SSE instruction, and before
+  // a backward branch to a label that was bound with clean upper halves.
+  bool ymm_upper_dirty() const { return ymm_upper_dirty_; }
+  bool auto_vzeroupper() const { return auto_vzeroupper_; }
+  void set_auto_vzeroupper(bool enable) { auto_vzeroupper_ = enable; }
+  // Number of vzeroupper instructions inserted automatically.
+  intptr_t vzeroupper_insertions() const { return vzeroupper_insertions_; }
+
+  // Mitigation for the Skylake JCC erratum, like GNU as
+  // -mbranches-within-32B-boundaries: every branch (jcc, jmp, call, ret) and
+  // every macro-fused cmp/jcc pair is padded so that it neither crosses nor
+  // ends on a 32-byte boundary. Padding is added by lengthening the
+  // preceding instructions where possible, and as NOPs otherwise.
+  bool jcc_erratum_mitigation() const { return jcc_erratum_mitigation_; }
+  void set_jcc_erratum_mitigation(bool enable) {
+    jcc_erratum_mitigation_ = enable;
+  }
+  intptr_t branch_padding_lengthening_bytes() const {
+    return branch_padding_lengthening_bytes_;
+  }
+  intptr_t branch_padding_nop_bytes() const {
+    return branch_padding_nop_bytes_;
+  }
+  intptr_t branch_padding_bytes() const {
+    return branch_padding_lengthening_bytes_ + branch_padding_nop_bytes_;
+  }
+
   // Issues a move instruction if 'to' is not the same as 'from'.
   void MoveRegister(Register to, Register from);
   void PushRegister(Register r);
@@ -672,26 +1021,139 @@ public:
 
   void ReserveAlignedFrameSpace(intptr_t frame_space);
 
+  // How Align() fills the space up to the aligned position.
+  enum AlignPadding {
+    // Long NOPs, each up to MAX_NOP_SIZE bytes.
+    kAlignWithNops,
+    // Lengthen the preceding instructions (redundant prefixes, wider
+    // displacements and immediates) so no NOP is executed on the fall-through
+    // path; NOPs are only used for what cannot be absorbed that way.
+    kAlignByLengthening,
+  };
+  AlignPadding align_padding() const { return align_padding_; }
+  void set_align_padding(AlignPadding padding) { align_padding_ = padding; }
+
   void Align(int alignment, intptr_t offset);
   void Bind(Label *label);
   void Jump(Label *label) { jmp(label); }
 
-  // This emits an PC-relative call of the form "callq *[rip+<offset>]".  The
-  // offset is not yet known and needs therefore relocation to the right place
-  // before the code can be used.
-  //
-  // The neccessary information for the "linker" (i.e. the relocation
-  // information) is stored in [RawCode::static_calls_target_table_]: an entry
-  // of the form
+  // Hot/cold code splitting. Code emitted between EnterColdRegion() and
+  // ExitColdRegion() (slow paths, error exits) goes to a separate cold
+  // section, which EmitColdCode() appends after all of the hot code. Control
+  // must not fall through the end of a cold region, and near jumps must not
+  // cross between the sections. EmitColdCode() must be called once all code
+  // has been emitted and before the code is copied out; until then labels
+  // bound in cold code have tagged positions.
+  void EnterColdRegion();
+  void ExitColdRegion();
+  bool in_cold_region() const { return in_cold_region_; }
+  void EmitColdCode();
+  // Appends the cold code, if not done yet, and the external target table
+  // after the hot code. Must be called once all code has been emitted.
+  void FinalizeCode();
+
+  // The address the code will be copied to, if known before it is emitted.
+  uword code_address() const { return code_address_; }
+  void set_code_address(uword address) {
+    ASSERT(CodeSize() == 0);
+    code_address_ = address;
+  }
+
+  // Size of the cold code not yet appended by EmitColdCode().
+  intptr_t ColdCodeSize() const {
+    return in_cold_region_ ? buffer_.Size() : inactive_section_.Size();
+  }
+  // Branches to a Stop(message) in the cold section if |condition| holds.
+  void StopIf(Condition condition, const char *message);
+
+  // This emits an PC-relative call of the form "callq <offset>" to the
+  // function [symbol]. The offset is not yet known and needs therefore
+  // relocation to the right place before the code can be used.
   //
-  //   (Code::kPcRelativeCall & pc_offset, <target-code>, <target-function>)
+  // The neccessary information for the linker (CodeRelocator) is recorded as
+  // a Relocation of the form
   //
-  // will be used during relocation to fix the offset.
+  //   (<offset of rel32>, kPcRelativeCall, <symbol>, <offset_into_target>)
   //
   // The provided [offset_into_target] will be added to calculate the final
   // destination.  It can be used e.g. for calling into the middle of a
   // function.
-  void GenerateUnRelocatedPcRelativeCall(intptr_t offset_into_target = 0);
+  void GenerateUnRelocatedPcRelativeCall(intptr_t symbol,
+                                         intptr_t offset_into_target = 0);
+  // Same for a tail call ("jmp <offset>").
+  void GenerateUnRelocatedPcRelativeTailCall(intptr_t symbol,
+                                             intptr_t offset_into_target = 0);
+  // Loads the address of [symbol] + [offset_into_target], such as read-only
+  // data, with "leaq dst, [rip + <offset>]".
+  void LoadUnRelocatedPcRelativeAddress(Register dst, intptr_t symbol,
+                                        intptr_t offset_into_target = 0);
+
+  enum RelocationKind {
+    kPcRelativeCall,
+    kPcRelativeTailCall,
+    kPcRelativeAddress,
+  };
+  struct Relocation {
+    intptr_t offset; // Of the rel32 field.
+    RelocationKind kind;
+    intptr_t symbol;
+    intptr_t addend;
+  };
+  intptr_t RelocationCount() const {
+    return relocations_.Size() / sizeof(Relocation);
+  }
+  // Cold code must have been placed before its relocations are read.
+  Relocation RelocationAt(intptr_t index);
+
+  // Whether FinalizeCode() has been called.
+  bool is_finalized() const { return cold_code_offset_ >= 0; }
+
+  // Call frame tracking, for unwind info (see UnwindInfo). When enabled,
+  // the canonical frame address (CFA) and the slots of the callee-saved
+  // registers pushed are followed through pushq, popq, enter, leave, addq
+  // and subq of RSP with an immediate, and movq between RSP and RBP, and a
+  // row is recorded at every change. Branches carry the call frame to their
+  // label, and cold code starts with the call frame of the code entering
+  // the cold region. Other changes of RSP must not happen while the CFA is
+  // based on RSP; while it is based on RBP, they stop the tracking of saved
+  // registers until RSP is based on the CFA again. Code starts with
+  // CFA = RSP + 8. Must be enabled before emitting code.
+  bool track_call_frame() const { return track_call_frame_; }
+  void set_track_call_frame(bool enable) {
+    ASSERT(buffer_.Size() == 0);
+    track_call_frame_ = enable;
+  }
+  // The callee-saved registers other than RBP.
+  static const intptr_t kNumSavedRegisters = 5;
+  static Register SavedRegisterAt(intptr_t index);
+  // Or -1 for other registers.
+  static intptr_t SavedRegisterIndex(Register reg);
+  struct CallFrame {
+    Register cfa_register; // RSP or RBP.
+    intptr_t cfa_offset;   // CFA = cfa_register + cfa_offset.
+    // The caller's RBP is saved at CFA - rbp_offset, or not if 0.
+    intptr_t rbp_offset;
+    // CFA - RSP while the CFA is based on RBP, or 0 if unknown.
+    intptr_t rsp_offset;
+    // The caller's SavedRegisterAt(i) is saved at CFA - saved_offsets[i],
+    // or not if 0.
+    intptr_t saved_offsets[kNumSavedRegisters];
+
+    // Whether both frames have the same unwind rules.
+    bool HasSameRules(const CallFrame &other) const;
+  };
+  // The call frame from |offset| on.
+  struct CallFrameRow {
+    intptr_t offset;
+    CallFrame frame;
+  };
+  const CallFrame &call_frame() const { return call_frame_; }
+  intptr_t CallFrameRowCount() const {
+    return call_frame_rows_.Size() / sizeof(CallFrameRow);
+  }
+  // Cold code must have been placed before the rows are read. They are
+  // sorted by offset; a later row at the same offset takes precedence.
+  CallFrameRow CallFrameRowAt(intptr_t index);
 
   // Debugging and bringup support.
   void Breakpoint() { int3(); }
@@ -711,6 +1173,306 @@ public:
 private:
   bool constant_pool_allowed_;
 
+  // Classes of flag-producing instructions, by how they macro-fuse with a
+  // following jcc on Sandy Bridge and later cores.
+  enum FlagsProducerKind {
+    kFlagsPreserved, // Does not write the flags (not).
+    kFlagsCmp,       // cmp: fuses with all but jo/jno/js/jns/jp/jnp.
+    kFlagsTest,      // test: fuses with every jcc.
+    kFlagsAnd,       // and: fuses with every jcc.
+    kFlagsAddSub,    // add, sub: same conditions as cmp.
+    kFlagsIncDec,    // inc, dec: additionally not with jb/jae/jbe/ja.
+    kFlagsOther,     // Writes the flags but never fuses.
+  };
+
+  // The most recent flag-producing instruction, occupying [start, end).
+  struct FlagsProducer {
+    intptr_t start;
+    intptr_t end;
+    FlagsProducerKind kind;
+    bool fusible_form;
+  };
+
+  // Records the instruction emitted during its lifetime as the most recent
+  // flags producer.
+  class FlagsProducerScope : public ValueObject {
+  public:
+    FlagsProducerScope(Assembler *assembler, FlagsProducerKind kind,
+                       bool fusible_form = true)
+        : assembler_(assembler), kind_(kind), fusible_form_(fusible_form),
+          start_(assembler->buffer_.GetPosition()) {}
+    ~FlagsProducerScope() {
+      assembler_->NoteFlagsProducer(start_, kind_, fusible_form_);
+    }
+
+  private:
+    Assembler *assembler_;
+    FlagsProducerKind kind_;
+    bool fusible_form_;
+    intptr_t start_;
+  };
+
+  static FlagsProducerKind AluFlagsKind(int alu_code) {
+    switch (alu_code) {
+    case 0: // add
+    case 5: // sub
+      return kFlagsAddSub;
+    case 4:
+      return kFlagsAnd;
+    case 7:
+      return kFlagsCmp;
+    default:
+      return kFlagsOther;
+    }
+  }
+  static bool CanMacroFuse(FlagsProducerKind kind, Condition condition);
+
+  static bool IsRIPRelative(const Operand &operand) {
+    return (operand.encoding_at(0) & 0xC7) == 0x05;
+  }
+  // Memory operands with RIP-relative addressing never macro-fuse.
+  static bool IsFusibleOperand(const Operand &operand) {
+    return !IsRIPRelative(operand);
+  }
+
+  void NoteFlagsProducer(intptr_t start, FlagsProducerKind kind,
+                         bool fusible_form);
+  // Called for every jcc; checks and clears the current flags producer.
+  void ConsumeFlags(Condition condition);
+  void ClearFlagsProducer() { flags_producer_.end = -1; }
+
+  FlagsProducer flags_producer_;
+  bool fusion_lint_;
+  intptr_t fusion_lint_violations_;
+  FusionLintHandler fusion_lint_handler_;
+  void *fusion_lint_argument_;
+
+  static const intptr_t kBranchBoundary = 32;
+  // Matches the GNU as default for -malign-branch-prefix-size.
+  static const int kMaxPaddingPrefixes = 5;
+  static const intptr_t kMaxInstructionLength = 15;
+  static const uint8_t kPaddingPrefix = 0x2E; // CS segment override.
+  static const int kMaxPaddingCandidates = 8;
+
+  // A recently emitted, position independent, non-branch instruction that
+  // can be lengthened to pad the code after it: by redundant segment
+  // prefixes, by widening its displacement, or by widening an imm8 of an
+  // 0x83 group ALU instruction to imm32.
+  struct PaddingCandidate {
+    intptr_t start;
+    intptr_t end;
+    int8_t prefixes;     // Prefixes added so far.
+    int8_t modrm_offset; // Offset of a memory operand ModRM byte, or -1.
+    int8_t imm8_opcode_offset; // Offset of an 0x83 opcode byte, or -1.
+  };
+
+  bool track_padding_candidates() const {
+    return jcc_erratum_mitigation_ || align_padding_ == kAlignByLengthening;
+  }
+  void NotePaddingCandidate(intptr_t start, intptr_t modrm = -1,
+                            intptr_t imm8_opcode = -1) {
+    if (track_padding_candidates()) {
+      padding_candidates_head_ =
+          (padding_candidates_head_ + 1) % kMaxPaddingCandidates;
+      PaddingCandidate *candidate =
+          &padding_candidates_[padding_candidates_head_];
+      candidate->start = start;
+      candidate->end = buffer_.GetPosition();
+      candidate->prefixes = 0;
+      candidate->modrm_offset = modrm < 0 ? -1 : modrm - start;
+      candidate->imm8_opcode_offset =
+          imm8_opcode < 0 ? -1 : imm8_opcode - start;
+    }
+  }
+  void ClearPaddingCandidates() {
+    for (intptr_t i = 0; i < kMaxPaddingCandidates; i++) {
+      padding_candidates_[i].end = -1;
+    }
+  }
+  // Lengthens the contiguous run of candidates ending at |position| by up to
+  // |length| bytes in total. Returns the number of bytes added.
+  intptr_t PadByLengthening(intptr_t position, intptr_t length);
+  // Lengthens |candidate| by up to |length| bytes; returns the bytes added.
+  intptr_t Lengthen(PaddingCandidate *candidate, intptr_t length);
+  // Inserts |length| bytes of NOPs at |position|.
+  void PadWithNops(intptr_t position, intptr_t length);
+  // Accounts for |length| bytes inserted at |position|. Tracked instructions
+  // starting at |grown_start| grow, later ones move.
+  void ShiftTrackedPositions(intptr_t position, intptr_t length,
+                             intptr_t grown_start = -1);
+
+  // Pads, if needed, so that [start, start + length) does not cross or end
+  // on a kBranchBoundary. [start, current position) must be position
+  // independent.
+  void AlignBranch(intptr_t start, intptr_t length);
+  void AlignIndirectBranch(const Operand &operand) {
+    if (jcc_erratum_mitigation_) {
+      const intptr_t rex = operand.rex() != REX_NONE ? 1 : 0;
+      AlignBranch(buffer_.GetPosition(), rex + 1 + operand.length_);
+    }
+  }
+  static void StoreNop(uword address, int size);
+
+  // Ring buffer of the most recent padding candidates.
+  PaddingCandidate padding_candidates_[kMaxPaddingCandidates];
+  intptr_t padding_candidates_head_;
+  bool jcc_erratum_mitigation_;
+  intptr_t branch_padding_lengthening_bytes_;
+  intptr_t branch_padding_nop_bytes_;
+  AlignPadding align_padding_;
+
+  enum VexPrefix { kVexNone = 0, kVex66 = 1, kVexF3 = 2, kVexF2 = 3 };
+  enum VexMap { kVex0F = 1, kVex0F38 = 2, kVex0F3A = 3 };
+  enum VexLength { kVex128 = 0, kVex256 = 1 };
+
+  // Emits the VEX prefix, opcode and ModRM for |reg|, the extra source
+  // register |vvvv| (0 when unused) and |operand|.
+  void EmitVex(int reg, int vvvv, const Operand &operand, int opcode,
+               VexPrefix prefix, VexLength length, VexMap map = kVex0F,
+               bool w = false);
+  void EmitVex(int reg, int vvvv, int rm, int opcode, VexPrefix prefix,
+               VexLength length, VexMap map = kVex0F, bool w = false) {
+    EmitVex(reg, vvvv, Operand(static_cast<Register>(rm)), opcode, prefix,
+            length, map, w);
+  }
+
+  void AvoidAvxSseTransition() {
+    if (ymm_upper_dirty_ && auto_vzeroupper_) {
+      vzeroupper();
+      vzeroupper_insertions_++;
+    }
+  }
+  // Merges the YMM state at a branch to |label| into the label, or, for a
+  // bound label, cleans the upper halves if the label expects them clean.
+  void NoteBranchYmmState(Label *label);
+  // jmp reg, for targets whose YMM state is already taken care of.
+  void EmitIndirectJump(Register reg) {
+    AlignIndirectBranch(Operand(reg));
+    EmitUnaryL(reg, 0xFF, 4);
+  }
+
+  bool ymm_upper_dirty_;
+  bool auto_vzeroupper_;
+  intptr_t vzeroupper_insertions_;
+
+  void BreakFalseDependency(PartialWriteInstruction instruction,
+                            XmmRegister dst) {
+    if (break_false_dependency_[instruction]) {
+      xorps(dst, dst);
+      dependency_breaks_++;
+    }
+  }
+  void BreakFalseDependency(PartialWriteInstruction instruction,
+                            Register dst) {
+    if (break_false_dependency_[instruction]) {
+      xorl(dst, dst);
+      dependency_breaks_++;
+    }
+  }
+  // For the scalar forms of XMM_ALU_CODES.
+  void BreakScalarAluDependency(int code, XmmRegister dst) {
+    if (code == 1) { // sqrt
+      BreakFalseDependency(kSqrtsd, dst);
+    }
+  }
+  // Whether |reg| is the base or index of the memory |operand|.
+  static bool UsesRegister(const Operand &operand, Register reg);
+
+  bool break_false_dependency_[kNumPartialWriteInstructions];
+  intptr_t dependency_breaks_;
+
+  // Positions in the cold section are tagged with kColdPositionTag until
+  // EmitColdCode() places the cold code at cold_code_offset_. Hot positions
+  // must stay below the tag.
+  static const intptr_t kColdPositionTag = static_cast<intptr_t>(1) << 30;
+  // Alignment of the cold code. Keeps Align() and the JCC erratum padding
+  // of cold code valid once it is placed.
+  static const intptr_t kColdCodeAlignment = 32;
+
+  // Tagged position of the next byte emitted.
+  intptr_t SectionPosition() const {
+    ASSERT(buffer_.Size() < kColdPositionTag);
+    return buffer_.Size() | (in_cold_region_ ? kColdPositionTag : 0);
+  }
+  static intptr_t SectionOffset(intptr_t position) {
+    return position & ~kColdPositionTag;
+  }
+  // Maps a tagged cold position to its final one once the cold code has
+  // been placed.
+  intptr_t ResolvePosition(intptr_t position) const {
+    if (cold_code_offset_ >= 0 && (position & kColdPositionTag) != 0) {
+      return cold_code_offset_ + SectionOffset(position);
+    }
+    return position;
+  }
+  // Whether the resolved |position| is in the section being emitted to.
+  bool InCurrentSection(intptr_t position) const {
+    return ((position & kColdPositionTag) != 0) == in_cold_region_;
+  }
+  AssemblerBuffer *SectionBuffer(intptr_t position) {
+    return InCurrentSection(position) ? &buffer_ : &inactive_section_;
+  }
+  // Whether branches to |label| can be encoded directly.
+  bool IsBoundInCurrentSection(Label *label) const {
+    return label->IsBound() &&
+           InCurrentSection(ResolvePosition(label->Position()));
+  }
+  void SwitchSection();
+  // Records that the rel32 at |position| refers to |target| in the other
+  // section (both tagged).
+  void AddCrossSectionFixup(intptr_t position, intptr_t target);
+
+  // Emits a call (|opcode| 0xE8, |modrm_code| 2) or jmp (0xE9, 4) to
+  // |target| without going through TMP. Requires a code_address_.
+  void EmitExternalBranch(uword target, uint8_t opcode, int modrm_code);
+
+  void EmitRelocatedBranch(uint8_t opcode, RelocationKind kind,
+                           intptr_t symbol, intptr_t addend);
+
+  AssemblerBuffer relocations_;
+
+  uword code_address_;
+  // The distinct targets of indirect external branches, as uint64 entries
+  // of the table placed by FinalizeCode().
+  AssemblerBuffer external_targets_;
+  // Pairs of int32 (tagged position of the disp32, table index).
+  AssemblerBuffer external_target_fixups_;
+
+  // Records the row of a call frame change, if any.
+  void SetCallFrame(const CallFrame &frame);
+  // CFA - RSP, or 0 if unknown.
+  static intptr_t StackDepth(const CallFrame &frame) {
+    return frame.cfa_register == RSP ? frame.cfa_offset : frame.rsp_offset;
+  }
+  // For a change of RSP by -|delta|.
+  void AdjustCallFrame(intptr_t delta);
+  void NoteCallFrameMove(Register dst, Register src);
+  void NoteBranchCallFrame(Label *label);
+  // Moves the rows of the cold code after the others once it is placed at
+  // cold_code_offset_.
+  void SortCallFrameRows(bool has_cold_code);
+
+  bool track_call_frame_;
+  CallFrame call_frame_;
+  // The call frame of the hot code while in the cold region.
+  CallFrame inactive_call_frame_;
+  // CallFrameRows, with tagged positions.
+  AssemblerBuffer call_frame_rows_;
+  // The CallFrames on the first branch to unbound labels.
+  AssemblerBuffer branch_call_frames_;
+
+  AssemblerBuffer inactive_section_;
+  // Pairs of int32 tagged positions (rel32 field, target) of the branches
+  // between the sections, resolved by EmitColdCode().
+  AssemblerBuffer cross_section_fixups_;
+  // Pairs of int32 (tagged position of a jump table entry, bias). Entries
+  // are linked to their labels as rel32 fields; the bias turns them into
+  // offsets from the table once EmitColdCode() has resolved them.
+  AssemblerBuffer jump_table_fixups_;
+  bool in_cold_region_;
+  bool inactive_ymm_upper_dirty_;
+  intptr_t cold_code_offset_;
+
   void AluL(uint8_t modrm_opcode, Register dst, const Immediate &imm);
   void AluB(uint8_t modrm_opcode, const Address &dst, const Immediate &imm);
   void AluW(uint8_t modrm_opcode, const Address &dst, const Immediate &imm);
@@ -0,0 +1,348 @@
+// Copyright (c) 2019, the Dart project authors.  Please see the AUTHORS file
+// for details. All rights reserved. Use of this source code is governed by a
+// BSD-style license that can be found in the LICENSE file.
+
+#include "code_benchmark.h"
+
+#include <cpuid.h>
+#include <inttypes.h>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <x86intrin.h>
+
+#include "assembler_benchmark.h"
+
+// The time stamp counter, read once all previous instructions have
+// completed, and before any following instruction starts.
+static inline uint64_t ReadTscBefore() {
+  _mm_lfence();
+  const uint64_t tsc = __rdtsc();
+  _mm_lfence();
+  return tsc;
+}
+
+// rdtscp waits for the previous instructions itself.
+static inline uint64_t ReadTscAfter() {
+  unsigned int processor;
+  const uint64_t tsc = __rdtscp(&processor);
+  _mm_lfence();
+  return tsc;
+}
+
+// The model specific event of the uops, by vendor.
+static bool UopsEventConfig(uint64_t *config) {
+  unsigned int eax, ebx, ecx, edx;
+  if (__get_cpuid(0, &eax, &ebx, &ecx, &edx) == 0) {
+    return false;
+  }
+  char vendor[13];
+  memmove(vendor, &ebx, 4);
+  memmove(vendor + 4, &edx, 4);
+  memmove(vendor + 8, &ecx, 4);
+  vendor[12] = '\0';
+  if (strcmp(vendor, "GenuineIntel") == 0) {
+    *config = 0x010E; // UOPS_ISSUED.ANY.
+    return true;
+  }
+  if (strcmp(vendor, "AuthenticAMD") == 0) {
+    *config = 0x00C1; // Retired Ops.
+    return true;
+  }
+  return false;
+}
+
+// The hardware performance counters of the calling thread, in user mode.
+class EventCounters : public ValueObject {
+public:
+  explicit EventCounters(bool enabled) {
+    for (intptr_t i = 0; i < CodeBenchmark::kNumEvents; i++) {
+      fds_[i] = -1;
+    }
+    if (!enabled) {
+      return;
+    }
+    fds_[CodeBenchmark::kCycles] =
+        Open(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES);
+    fds_[CodeBenchmark::kInstructions] =
+        Open(PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS);
+    uint64_t uops;
+    if (UopsEventConfig(&uops)) {
+      fds_[CodeBenchmark::kUops] = Open(PERF_TYPE_RAW, uops);
+    }
+    fds_[CodeBenchmark::kBranchMisses] =
+        Open(PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES);
+    fds_[CodeBenchmark::kICacheMisses] =
+        Open(PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1I |
+                                     (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                                     (PERF_COUNT_HW_CACHE_RESULT_MISS << 16));
+  }
+
+  ~EventCounters() {
+    for (intptr_t i = 0; i < CodeBenchmark::kNumEvents; i++) {
+      if (fds_[i] >= 0) {
+        close(fds_[i]);
+      }
+    }
+  }
+
+  bool IsAvailable(intptr_t event) const { return fds_[event] >= 0; }
+
+  void Start() {
+    for (intptr_t i = 0; i < CodeBenchmark::kNumEvents; i++) {
+      if (fds_[i] >= 0) {
+        ioctl(fds_[i], PERF_EVENT_IOC_RESET, 0);
+        ioctl(fds_[i], PERF_EVENT_IOC_ENABLE, 0);
+      }
+    }
+  }
+
+  void Stop() {
+    for (intptr_t i = 0; i < CodeBenchmark::kNumEvents; i++) {
+      if (fds_[i] >= 0) {
+        ioctl(fds_[i], PERF_EVENT_IOC_DISABLE, 0);
+      }
+    }
+  }
+
+  uint64_t Read(intptr_t event) const {
+    uint64_t value = 0;
+    if (fds_[event] < 0 ||
+        read(fds_[event], &value, sizeof(value)) != sizeof(value)) {
+      return 0;
+    }
+    return value;
+  }
+
+private:
+  static int Open(uint32_t type, uint64_t config) {
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = type;
+    attr.config = config;
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    return syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+  }
+
+  int fds_[CodeBenchmark::kNumEvents];
+
+  DISALLOW_COPY_AND_ASSIGN(EventCounters);
+};
+
+typedef void (*LoopFunction)(intptr_t iterations, void *data);
+
+// Emits the loop around the snippet of |emit|, or an empty loop if NULL.
+static void EmitLoop(Assembler *assembler, CodeBenchmark::EmitFunction emit,
+                     void *argument, int loop_alignment,
+                     intptr_t *snippet_size) {
+  const intptr_t kCalleeSaveCpuRegisters =
+      CallingConventions::kCalleeSaveCpuRegisters & ~(1 << RBP);
+  const intptr_t kCalleeSaveXmmRegisters =
+      CallingConventions::kCalleeSaveXmmRegisters;
+  assembler->pushq(RBP);
+  assembler->movq(RBP, RSP);
+  intptr_t pushed = 0;
+  for (intptr_t i = 0; i < kNumberOfCpuRegisters; i++) {
+    if ((kCalleeSaveCpuRegisters & (1 << i)) != 0) {
+      assembler->pushq(static_cast<Register>(i));
+      pushed++;
+    }
+  }
+  // Saved XMM registers, and the stack alignment.
+  intptr_t frame_size = (pushed % 2) * kWordSize;
+  for (intptr_t i = 0; i < kNumberOfXmmRegisters; i++) {
+    if ((kCalleeSaveXmmRegisters & (1 << i)) != 0) {
+      frame_size += 16;
+    }
+  }
+  if (frame_size != 0) {
+    assembler->subq(RSP, Immediate(frame_size));
+  }
+  intptr_t offset = 0;
+  for (intptr_t i = 0; i < kNumberOfXmmRegisters; i++) {
+    if ((kCalleeSaveXmmRegisters & (1 << i)) != 0) {
+      assembler->movups(Address(RSP, offset), static_cast<XmmRegister>(i));
+      offset += 16;
+    }
+  }
+  assembler->movq(CodeBenchmark::kCounterRegister,
+                  CallingConventions::kArg1Reg);
+  assembler->movq(CodeBenchmark::kDataRegister, CallingConventions::kArg2Reg);
+
+  if (loop_alignment != 0) {
+    assembler->Align(loop_alignment, 0);
+  }
+  Label loop;
+  assembler->Bind(&loop);
+  const intptr_t snippet_start = assembler->CodeSize();
+  if (emit != NULL) {
+    emit(assembler, argument);
+  }
+  *snippet_size = assembler->CodeSize() - snippet_start;
+  assembler->decq(CodeBenchmark::kCounterRegister);
+  assembler->j(NOT_ZERO, &loop);
+
+  offset = 0;
+  for (intptr_t i = 0; i < kNumberOfXmmRegisters; i++) {
+    if ((kCalleeSaveXmmRegisters & (1 << i)) != 0) {
+      assembler->movups(static_cast<XmmRegister>(i), Address(RSP, offset));
+      offset += 16;
+    }
+  }
+  if (frame_size != 0) {
+    assembler->addq(RSP, Immediate(frame_size));
+  }
+  for (intptr_t i = kNumberOfCpuRegisters - 1; i >= 0; i--) {
+    if ((kCalleeSaveCpuRegisters & (1 << i)) != 0) {
+      assembler->popq(static_cast<Register>(i));
+    }
+  }
+  assembler->popq(RBP);
+  assembler->ret();
+  assembler->FinalizeCode();
+}
+
+static int CompareDoubles(const void *a, const void *b) {
+  const double left = *reinterpret_cast<const double *>(a);
+  const double right = *reinterpret_cast<const double *>(b);
+  return left < right ? -1 : (left > right ? 1 : 0);
+}
+
+static double Median(double *values, intptr_t length) {
+  qsort(values, length, sizeof(values[0]), CompareDoubles);
+  return values[(length - 1) / 2];
+}
+
+// Runs the loop of |emit| and fills in the medians per iteration of
+// |result|.
+static bool Measure(CodeBenchmark::EmitFunction emit, void *argument,
+                    void *data, const CodeBenchmark::Options &options,
+                    EventCounters *counters, CodeBenchmark::Result *result) {
+  Assembler assembler;
+  EmitLoop(&assembler, emit, argument, options.loop_alignment,
+           &result->snippet_size);
+  // The code runs where it is mapped, without relocation.
+  ASSERT(assembler.RelocationCount() == 0);
+  const intptr_t page_size = sysconf(_SC_PAGESIZE);
+  const intptr_t size =
+      (assembler.CodeSize() + page_size - 1) & ~(page_size - 1);
+  void *code = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (code == MAP_FAILED) {
+    return false;
+  }
+  memmove(code, reinterpret_cast<void *>(assembler.CodeAddress(0)),
+          assembler.CodeSize());
+  if (mprotect(code, size, PROT_READ | PROT_EXEC) != 0) {
+    munmap(code, size);
+    return false;
+  }
+  LoopFunction loop = reinterpret_cast<LoopFunction>(code);
+
+  const intptr_t runs = options.runs;
+  double *samples = reinterpret_cast<double *>(
+      malloc((CodeBenchmark::kNumEvents + 1) * runs * sizeof(double)));
+  double *ticks = samples + CodeBenchmark::kNumEvents * runs;
+  const double iterations = static_cast<double>(options.iterations);
+  for (intptr_t run = -options.warmup_runs; run < runs; run++) {
+    counters->Start();
+    const uint64_t start = ReadTscBefore();
+    loop(options.iterations, data);
+    const uint64_t end = ReadTscAfter();
+    counters->Stop();
+    if (run < 0) {
+      continue;
+    }
+    ticks[run] = (end - start) / iterations;
+    for (intptr_t i = 0; i < CodeBenchmark::kNumEvents; i++) {
+      samples[i * runs + run] = counters->Read(i) / iterations;
+    }
+  }
+  result->tsc_ticks = Median(ticks, runs);
+  for (intptr_t i = 0; i < CodeBenchmark::kNumEvents; i++) {
+    result->has_event[i] = counters->IsAvailable(i);
+    result->events[i] = Median(samples + i * runs, runs);
+  }
+  free(samples);
+  munmap(code, size);
+  return true;
+}
+
+bool CodeBenchmark::Run(EmitFunction emit, void *argument, void *data,
+                        const Options &options, Result *result) {
+  ASSERT(options.iterations > 0 && options.runs > 0);
+  if (options.cpu >= 0) {
+    AssemblerBenchmark::PinToCpu(options.cpu);
+  }
+  EventCounters counters(options.count_events);
+  if (!Measure(emit, argument, data, options, &counters, result)) {
+    return false;
+  }
+  if (options.subtract_loop_overhead) {
+    // The empty loop overlaps with the snippet, so this can slightly
+    // undercount, down to negative values for tiny snippets.
+    Result overhead;
+    if (!Measure(NULL, NULL, data, options, &counters, &overhead)) {
+      return false;
+    }
+    result->tsc_ticks -= overhead.tsc_ticks;
+    for (intptr_t i = 0; i < kNumEvents; i++) {
+      result->events[i] -= overhead.events[i];
+    }
+  }
+  return true;
+}
+
+const char *CodeBenchmark::EventName(Event event) {
+  static const char *const kNames[kNumEvents] = {
+      "cycles", "instructions", "uops", "branch-misses", "icache-misses"};
+  return kNames[event];
+}
+
+void CodeBenchmark::Print(const char *name, const Result &result, FILE *out) {
+  fprintf(out, "%s: %" PRIdPTR " bytes, %.2f tsc", name, result.snippet_size,
+          result.tsc_ticks);
+  for (intptr_t i = 0; i < kNumEvents; i++) {
+    if (result.has_event[i]) {
+      fprintf(out, ", %.2f %s", result.events[i],
+              EventName(static_cast<Event>(i)));
+    } else {
+      fprintf(out, ", %s n/a", EventName(static_cast<Event>(i)));
+    }
+  }
+  fprintf(out, " per iteration\n");
+}
+
+// The loop of RunFalseDependency(). |argument| points to whether the
+// policy is enabled.
+static void EmitConversionLoop(Assembler *assembler, void *argument) {
+  const bool enable = *reinterpret_cast<bool *>(argument);
+  assembler->set_break_false_dependency(Assembler::kCvtsi2sd, enable);
+  assembler->set_break_false_dependency(Assembler::kSqrtsd, enable);
+  assembler->cvtsi2sdq(XMM0, CodeBenchmark::kCounterRegister);
+  assembler->sqrtsd(XMM1, XMM0);
+  // Same source and destination: never broken, and long.
+  assembler->sqrtsd(XMM0, XMM0);
+  assembler->set_break_false_dependency(Assembler::kCvtsi2sd, false);
+  assembler->set_break_false_dependency(Assembler::kSqrtsd, false);
+}
+
+bool CodeBenchmark::RunFalseDependency(const Options &options, FILE *out) {
+  bool enable = false;
+  Result result;
+  if (!Run(EmitConversionLoop, &enable, NULL, options, &result)) {
+    return false;
+  }
+  Print("cvtsi2sd/sqrtsd, dependencies kept", result, out);
+  enable = true;
+  if (!Run(EmitConversionLoop, &enable, NULL, options, &result)) {
+    return false;
+  }
+  Print("cvtsi2sd/sqrtsd, dependencies broken", result, out);
+  return true;
+}
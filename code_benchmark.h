@@ -0,0 +1,102 @@
+// Copyright (c) 2019, the Dart project authors.  Please see the AUTHORS file
+// for details. All rights reserved. Use of this source code is governed by a
+// BSD-style license that can be found in the LICENSE file.
+
+#pragma once
+
+#include <stdio.h>
+
+#include "assembler.h"
+#include "globals.h"
+
+// Measures the execution of generated code, to compare encodings (alignment,
+// branch sizes, lea vs imul...) on real hardware.
+//
+// A snippet is emitted into a loop, inside a function following
+// CallingConventions:
+//
+//     entry:  push rbp and the callee-saved registers; align the stack
+//             kCounterRegister = iterations, kDataRegister = data
+//             Align(loop_alignment)
+//     loop:   <snippet>
+//             decq kCounterRegister; jnz loop
+//             restore the registers; ret
+//
+// The snippet may use all registers and the stack (balanced, with RSP 16-byte
+// aligned on entry), except kCounterRegister and kDataRegister, which it may
+// only read. The function is mapped executable and run a number of times;
+// each run is timed with the TSC, serialized by lfence, and counted with the
+// hardware performance counters of perf_event_open where available. The
+// results are the medians per iteration, from which those of the empty loop
+// are subtracted.
+class CodeBenchmark {
+public:
+  static const Register kCounterRegister = R15;
+  static const Register kDataRegister = R14;
+
+  // Emits the snippet into |assembler|. |argument| is that passed to Run(),
+  // e.g. to select between the variants of an A/B test.
+  typedef void (*EmitFunction)(Assembler *assembler, void *argument);
+
+  struct Options {
+    Options()
+        : iterations(100000), runs(21), warmup_runs(3), cpu(0),
+          loop_alignment(32), count_events(true),
+          subtract_loop_overhead(true) {}
+
+    // Of the loop, per run.
+    intptr_t iterations;
+    // The runs of which the medians are taken, after the warm-up runs.
+    intptr_t runs;
+    intptr_t warmup_runs;
+    // The CPU to pin the calling thread to, or -1 to leave it unpinned.
+    int cpu;
+    // The alignment of the loop head, or 0 for none.
+    int loop_alignment;
+    // Whether to use the hardware performance counters.
+    bool count_events;
+    // Whether to subtract the results of the empty loop.
+    bool subtract_loop_overhead;
+  };
+
+  // The hardware events counted.
+  enum Event {
+    kCycles,
+    kInstructions,
+    // The uops issued (Intel) or retired (AMD); a model specific event.
+    kUops,
+    kBranchMisses,
+    kICacheMisses,
+    kNumEvents,
+  };
+
+  struct Result {
+    // Per iteration of the loop.
+    double tsc_ticks;
+    double events[kNumEvents];
+    // Whether the event could be counted.
+    bool has_event[kNumEvents];
+    // The size of the snippet in the loop.
+    intptr_t snippet_size;
+  };
+
+  // Emits the snippet of |emit|, runs it with |data| in kDataRegister and
+  // fills in |result|. Returns false if the code could not be mapped.
+  static bool Run(EmitFunction emit, void *argument, void *data,
+                  const Options &options, Result *result);
+
+  // Writes |result| on a line, after |name|.
+  static void Print(const char *name, const Result &result, FILE *out);
+
+  static const char *EventName(Event event);
+
+  // Runs a conversion loop, cvtsi2sdq then sqrtsd into registers last
+  // written by the long sqrtsd of the previous iteration, without and with
+  // Assembler::set_break_false_dependency() for both instructions, and
+  // prints the two results. With the policy off, each iteration waits for
+  // the previous one.
+  static bool RunFalseDependency(const Options &options, FILE *out);
+
+private:
+  DISALLOW_IMPLICIT_CONSTRUCTORS(CodeBenchmark);
+};
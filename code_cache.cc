@@ -0,0 +1,486 @@
+// Copyright (c) 2019, the Dart project authors.  Please see the AUTHORS file
+// for details. All rights reserved. Use of this source code is governed by a
+// BSD-style license that can be found in the LICENSE file.
+
+#include "code_cache.h"
+
+#include <stddef.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "perf_registry.h"
+
+// The data of an entry thunk. Thunks are allocated in chunks of
+// kThunkAreaSize bytes of code followed by as many bytes of slots, so that
+// every thunk is the same distance from its slot and has the same code:
+//
+//   inc dword [rip + <slot.counter>]
+//   lea r11, [rip + <thunk>]
+//   jmp [rip + <slot.target>]
+struct CodeCacheEntrySlot {
+  uword target;
+  uint32_t counter;      // Incremented on every call through the thunk.
+  uint32_t last_counter; // At the last sweep of the eviction clock.
+  CachedCode *code;      // NULL once released.
+  CodeCacheEntrySlot *next_free;
+};
+
+static const intptr_t kThunkSize = 32;
+static const intptr_t kThunkAreaSize = 16 * 4096;
+
+struct CodeCache::FreeBlock {
+  uword address;
+  intptr_t size;
+  FreeBlock *next;
+};
+
+static intptr_t RoundUp(intptr_t value, intptr_t alignment) {
+  ASSERT(Utils::IsPowerOfTwo(alignment));
+  return (value + alignment - 1) & ~(alignment - 1);
+}
+
+CodeCache::CodeCache()
+    : bucket_count_(kInitialBuckets), length_(0), free_blocks_(NULL),
+      free_slots_(NULL), recompile_stub_(0), budget_(0), clock_hand_(NULL),
+      hits_(0), misses_(0), bytes_saved_(0), resident_bytes_(0),
+      evictions_(0), recompiles_(0) {
+  buckets_ = reinterpret_cast<CachedCode **>(
+      calloc(bucket_count_, sizeof(CachedCode *)));
+  GenerateRecompileStub();
+}
+
+CodeCache::~CodeCache() {
+  // The code and the thunks stay mapped: they may still be running.
+  for (intptr_t i = 0; i < bucket_count_; i++) {
+    CachedCode *code = buckets_[i];
+    while (code != NULL) {
+      CachedCode *next = code->next_;
+      free(code->bytes_);
+      free(code->relocations_);
+      delete code;
+      code = next;
+    }
+  }
+  free(buckets_);
+  while (free_blocks_ != NULL) {
+    FreeBlock *next = free_blocks_->next;
+    free(free_blocks_);
+    free_blocks_ = next;
+  }
+}
+
+void CodeCache::AddExternalSymbol(intptr_t symbol, uword address) {
+  ASSERT(!HasExternalSymbol(symbol));
+  AssemblerBuffer::EnsureCapacity ensured(&external_symbols_);
+  external_symbols_.Emit<intptr_t>(symbol);
+  external_symbols_.Emit<uword>(address);
+}
+
+bool CodeCache::HasExternalSymbol(intptr_t symbol) {
+  for (intptr_t i = 0; i < external_symbols_.Size();
+       i += sizeof(intptr_t) + sizeof(uword)) {
+    if (external_symbols_.Load<intptr_t>(i) == symbol) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// Mixes 8 bytes at a time; collisions are resolved by Matches().
+uint64_t CodeCache::Hash(const uint8_t *bytes, intptr_t size,
+                         const Assembler::Relocation *relocations,
+                         intptr_t relocation_count) {
+  static const uint64_t kMultiplier = 0x9E3779B97F4A7C15ULL;
+  uint64_t hash = size;
+  intptr_t i = 0;
+  for (; i + 8 <= size; i += 8) {
+    uint64_t word;
+    memcpy(&word, bytes + i, sizeof(word));
+    hash = (hash ^ word) * kMultiplier;
+    hash ^= hash >> 29;
+  }
+  for (; i < size; i++) {
+    hash = (hash ^ bytes[i]) * kMultiplier;
+  }
+  for (intptr_t j = 0; j < relocation_count; j++) {
+    const Assembler::Relocation &relocation = relocations[j];
+    hash = (hash ^ relocation.offset) * kMultiplier;
+    hash = (hash ^ relocation.kind) * kMultiplier;
+    hash = (hash ^ relocation.symbol) * kMultiplier;
+    hash = (hash ^ relocation.addend) * kMultiplier;
+    hash ^= hash >> 29;
+  }
+  return hash;
+}
+
+bool CodeCache::Matches(const CachedCode *code, const uint8_t *bytes,
+                        intptr_t size,
+                        const Assembler::Relocation *relocations,
+                        intptr_t relocation_count) {
+  if (code->size_ != size || code->relocation_count_ != relocation_count) {
+    return false;
+  }
+  for (intptr_t j = 0; j < relocation_count; j++) {
+    const Assembler::Relocation &relocation = relocations[j];
+    const Assembler::Relocation &cached = code->relocations_[j];
+    if (relocation.offset != cached.offset ||
+        relocation.kind != cached.kind ||
+        relocation.symbol != cached.symbol ||
+        relocation.addend != cached.addend) {
+      return false;
+    }
+  }
+  return memcmp(code->bytes_, bytes, size) == 0;
+}
+
+const CachedCode *CodeCache::Install(Assembler *assembler) {
+  ASSERT(assembler->is_finalized());
+  ASSERT(assembler->code_address() == 0);
+  const intptr_t relocation_count = assembler->RelocationCount();
+  Assembler::Relocation *relocations =
+      reinterpret_cast<Assembler::Relocation *>(
+          malloc(relocation_count * sizeof(Assembler::Relocation)));
+  for (intptr_t j = 0; j < relocation_count; j++) {
+    relocations[j] = assembler->RelocationAt(j);
+  }
+  const CachedCode *code =
+      Install(reinterpret_cast<const uint8_t *>(assembler->CodeAddress(0)),
+              assembler->CodeSize(), assembler->prologue_offset(),
+              relocations, relocation_count);
+  free(relocations);
+  return code;
+}
+
+const CachedCode *CodeCache::Install(const uint8_t *bytes, intptr_t size,
+                                     intptr_t prologue_offset,
+                                     const Assembler::Relocation *relocations,
+                                     intptr_t relocation_count) {
+  const uint64_t hash = Hash(bytes, size, relocations, relocation_count);
+  CachedCode **bucket = &buckets_[hash & (bucket_count_ - 1)];
+  for (CachedCode *code = *bucket; code != NULL; code = code->next_) {
+    if (code->hash_ == hash &&
+        Matches(code, bytes, size, relocations, relocation_count)) {
+      hits_++;
+      bytes_saved_ += code->size_;
+      code->ref_count_++;
+      return code;
+    }
+  }
+  misses_++;
+
+  CachedCode *code = new CachedCode();
+  code->address_ = 0;
+  code->space_size_ = 0;
+  code->size_ = size;
+  code->prologue_offset_ = prologue_offset;
+  code->ref_count_ = 1;
+  code->hash_ = hash;
+  code->bytes_ = reinterpret_cast<uint8_t *>(malloc(size));
+  memmove(code->bytes_, bytes, size);
+  code->relocation_count_ = relocation_count;
+  code->relocations_ = reinterpret_cast<Assembler::Relocation *>(
+      malloc(relocation_count * sizeof(Assembler::Relocation)));
+  memmove(code->relocations_, relocations,
+          relocation_count * sizeof(Assembler::Relocation));
+  code->clock_prev_ = code->clock_next_ = NULL;
+  AllocateThunk(code);
+  InstallCode(code, true);
+
+  code->next_ = *bucket;
+  *bucket = code;
+  length_++;
+  if (length_ > bucket_count_) {
+    Grow();
+  }
+  return code;
+}
+
+void CodeCache::Release(const CachedCode *released) {
+  ASSERT(released->ref_count_ > 0);
+  CachedCode *code = const_cast<CachedCode *>(released);
+  if (--code->ref_count_ > 0) {
+    return;
+  }
+  CachedCode **link = &buckets_[code->hash_ & (bucket_count_ - 1)];
+  while (*link != code) {
+    link = &(*link)->next_;
+  }
+  *link = code->next_;
+  length_--;
+  if (code->is_resident()) {
+    Evict(code);
+    evictions_--; // Not evicted for space.
+  }
+  FreeThunk(code);
+  free(code->bytes_);
+  free(code->relocations_);
+  delete code;
+}
+
+void CodeCache::Grow() {
+  const intptr_t new_count = bucket_count_ * 2;
+  CachedCode **new_buckets =
+      reinterpret_cast<CachedCode **>(calloc(new_count, sizeof(CachedCode *)));
+  for (intptr_t i = 0; i < bucket_count_; i++) {
+    CachedCode *code = buckets_[i];
+    while (code != NULL) {
+      CachedCode *next = code->next_;
+      CachedCode **bucket = &new_buckets[code->hash_ & (new_count - 1)];
+      code->next_ = *bucket;
+      *bucket = code;
+      code = next;
+    }
+  }
+  free(buckets_);
+  buckets_ = new_buckets;
+  bucket_count_ = new_count;
+}
+
+void CodeCache::InstallCode(CachedCode *code, bool make_room) {
+  ASSERT(!code->is_resident());
+  CodeRelocator relocator;
+  relocator.AddFunction(kInstalledSymbol, code->bytes_, code->size_,
+                        code->relocations_, code->relocation_count_);
+  for (intptr_t i = 0; i < external_symbols_.Size();
+       i += sizeof(intptr_t) + sizeof(uword)) {
+    relocator.AddExternalSymbol(
+        external_symbols_.Load<intptr_t>(i),
+        external_symbols_.Load<uword>(i + sizeof(intptr_t)));
+  }
+  const intptr_t capacity = RoundUp(relocator.MaxSize(), kCodeAlignment);
+  if (make_room) {
+    MakeRoom(capacity);
+  }
+  const uword address = AllocateCode(capacity);
+  const intptr_t size =
+      RoundUp(relocator.Link(address, capacity), kCodeAlignment);
+  // Return what the veneers did not use.
+  if (size < capacity) {
+    FreeCode(address + size, capacity - size);
+  }
+  code->address_ = address;
+  code->space_size_ = size;
+  resident_bytes_ += size;
+  code->slot_->target = address;
+  code->slot_->last_counter = code->slot_->counter;
+
+  // Newly installed code is swept last.
+  if (clock_hand_ == NULL) {
+    code->clock_prev_ = code->clock_next_ = code;
+    clock_hand_ = code;
+  } else {
+    code->clock_next_ = clock_hand_;
+    code->clock_prev_ = clock_hand_->clock_prev_;
+    code->clock_prev_->clock_next_ = code;
+    clock_hand_->clock_prev_ = code;
+  }
+}
+
+void CodeCache::Evict(CachedCode *code) {
+  ASSERT(code->is_resident());
+  code->slot_->target = recompile_stub_;
+  FreeCode(code->address_, code->space_size_);
+  resident_bytes_ -= code->space_size_;
+  code->address_ = 0;
+  code->space_size_ = 0;
+  evictions_++;
+
+  if (code->clock_next_ == code) {
+    clock_hand_ = NULL;
+  } else {
+    code->clock_prev_->clock_next_ = code->clock_next_;
+    code->clock_next_->clock_prev_ = code->clock_prev_;
+    if (clock_hand_ == code) {
+      clock_hand_ = code->clock_next_;
+    }
+  }
+  code->clock_prev_ = code->clock_next_ = NULL;
+}
+
+void CodeCache::MakeRoom(intptr_t size) {
+  if (budget_ == 0) {
+    return;
+  }
+  // Every resident code object is visited at most twice: a second visit
+  // finds its counter unchanged.
+  while (resident_bytes_ + size > budget_ && clock_hand_ != NULL) {
+    CachedCode *code = clock_hand_;
+    CodeCacheEntrySlot *slot = code->slot_;
+    if (slot->counter != slot->last_counter) {
+      // Called since the last sweep.
+      slot->last_counter = slot->counter;
+      clock_hand_ = code->clock_next_;
+    } else {
+      Evict(code);
+    }
+  }
+}
+
+uword CodeCache::AllocateCode(intptr_t size) {
+  ASSERT((size % kCodeAlignment) == 0);
+  for (FreeBlock **link = &free_blocks_; *link != NULL;
+       link = &(*link)->next) {
+    FreeBlock *block = *link;
+    if (block->size >= size) {
+      const uword address = block->address;
+      block->address += size;
+      block->size -= size;
+      if (block->size == 0) {
+        *link = block->next;
+        free(block);
+      }
+      return address;
+    }
+  }
+  const intptr_t chunk_size = RoundUp(size, kChunkSize);
+  void *chunk = mmap(NULL, chunk_size, PROT_READ | PROT_WRITE | PROT_EXEC,
+                     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (chunk == MAP_FAILED) {
+    FATAL("Out of code space");
+  }
+  const uword address = reinterpret_cast<uword>(chunk);
+  if (size < chunk_size) {
+    FreeCode(address + size, chunk_size - size);
+  }
+  return address;
+}
+
+void CodeCache::FreeCode(uword address, intptr_t size) {
+  ASSERT((size % kCodeAlignment) == 0);
+  Assembler::InitializeMemoryWithBreakpoints(address, size);
+  FreeBlock *prev = NULL;
+  FreeBlock *next = free_blocks_;
+  while (next != NULL && next->address < address) {
+    prev = next;
+    next = next->next;
+  }
+  if (prev != NULL && prev->address + prev->size == address) {
+    prev->size += size;
+  } else {
+    FreeBlock *block =
+        reinterpret_cast<FreeBlock *>(malloc(sizeof(FreeBlock)));
+    block->address = address;
+    block->size = size;
+    block->next = next;
+    if (prev != NULL) {
+      prev->next = block;
+    } else {
+      free_blocks_ = block;
+    }
+    prev = block;
+  }
+  if (next != NULL && prev->address + prev->size == next->address) {
+    prev->size += next->size;
+    prev->next = next->next;
+    free(next);
+  }
+}
+
+void CodeCache::AllocateThunk(CachedCode *code) {
+  if (free_slots_ == NULL) {
+    static_assert(sizeof(CodeCacheEntrySlot) == kThunkSize,
+                  "Thunks and slots must have the same size");
+    Assembler assembler;
+    // Displacements are relative to the end of each instruction.
+    assembler.incl(Address::AddressRIPRelative(
+        kThunkAreaSize + offsetof(CodeCacheEntrySlot, counter) - 6));
+    assembler.leaq(TMP, Address::AddressRIPRelative(-13));
+    assembler.jmp(Address::AddressRIPRelative(
+        kThunkAreaSize + offsetof(CodeCacheEntrySlot, target) - 19));
+    ASSERT(assembler.CodeSize() == 19);
+
+    void *chunk = mmap(NULL, 2 * kThunkAreaSize, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (chunk == MAP_FAILED) {
+      FATAL("Out of code space");
+    }
+    const uword thunks = reinterpret_cast<uword>(chunk);
+    Assembler::InitializeMemoryWithBreakpoints(thunks, kThunkAreaSize);
+    for (intptr_t i = 0; i < kThunkAreaSize; i += kThunkSize) {
+      memmove(reinterpret_cast<void *>(thunks + i),
+              reinterpret_cast<void *>(assembler.CodeAddress(0)),
+              assembler.CodeSize());
+      CodeCacheEntrySlot *slot =
+          reinterpret_cast<CodeCacheEntrySlot *>(thunks + kThunkAreaSize + i);
+      slot->next_free = free_slots_;
+      free_slots_ = slot;
+    }
+    // The thunks never change.
+    mprotect(chunk, kThunkAreaSize, PROT_READ | PROT_EXEC);
+    PerfCodeRegistry::AddCode("CodeCache entry thunks", thunks,
+                              kThunkAreaSize);
+  }
+  CodeCacheEntrySlot *slot = free_slots_;
+  free_slots_ = slot->next_free;
+  slot->target = recompile_stub_;
+  slot->counter = 0;
+  slot->last_counter = 0;
+  slot->code = code;
+  code->slot_ = slot;
+  code->thunk_ = reinterpret_cast<uword>(slot) - kThunkAreaSize;
+}
+
+void CodeCache::FreeThunk(CachedCode *code) {
+  CodeCacheEntrySlot *slot = code->slot_;
+  // Calls through a stale entry point fail in Recompile().
+  slot->target = recompile_stub_;
+  slot->code = NULL;
+  slot->next_free = free_slots_;
+  free_slots_ = slot;
+}
+
+uword CodeCache::Recompile(CodeCache *cache, uword thunk) {
+  CodeCacheEntrySlot *slot =
+      reinterpret_cast<CodeCacheEntrySlot *>(thunk + kThunkAreaSize);
+  CachedCode *code = slot->code;
+  if (code == NULL) {
+    FATAL("Call to released code");
+  }
+  ASSERT(!code->is_resident());
+  // The call may come from cached code, which must not be evicted.
+  cache->InstallCode(code, false);
+  cache->recompiles_++;
+  return code->address_;
+}
+
+// Entered from a thunk with R11 holding the thunk address; reinstalls the
+// code and continues into it with the arguments of the call preserved.
+void CodeCache::GenerateRecompileStub() {
+  static const Register kArgumentRegisters[] = {RDI, RSI, RDX, RCX,
+                                                R8,  R9,  RAX, R10};
+  static const intptr_t kNumArgumentRegisters = 8;
+  static const intptr_t kNumXmmArguments = 8;
+  // The pushes keep the stack aligned for the call, so the spill area is
+  // padded to a multiple of 16 bytes.
+  static const intptr_t kSpillSize = kNumXmmArguments * 16 + 8;
+  Assembler assembler;
+  for (intptr_t i = 0; i < kNumArgumentRegisters; i++) {
+    assembler.pushq(kArgumentRegisters[i]);
+  }
+  assembler.subq(RSP, Immediate(kSpillSize));
+  for (intptr_t i = 0; i < kNumXmmArguments; i++) {
+    assembler.movups(Address(RSP, i * 16), static_cast<XmmRegister>(i));
+  }
+  assembler.movq(RDI, Immediate(reinterpret_cast<int64_t>(this)));
+  assembler.movq(RSI, TMP);
+  assembler.movq(RAX, Immediate(reinterpret_cast<int64_t>(&Recompile)));
+  assembler.call(RAX);
+  assembler.movq(TMP, RAX);
+  for (intptr_t i = 0; i < kNumXmmArguments; i++) {
+    assembler.movups(static_cast<XmmRegister>(i), Address(RSP, i * 16));
+  }
+  assembler.addq(RSP, Immediate(kSpillSize));
+  for (intptr_t i = kNumArgumentRegisters - 1; i >= 0; i--) {
+    assembler.popq(kArgumentRegisters[i]);
+  }
+  assembler.jmp(TMP);
+  assembler.FinalizeCode();
+
+  const intptr_t size = RoundUp(assembler.CodeSize(), kCodeAlignment);
+  recompile_stub_ = AllocateCode(size);
+  memmove(reinterpret_cast<void *>(recompile_stub_),
+          reinterpret_cast<void *>(assembler.CodeAddress(0)),
+          assembler.CodeSize());
+  PerfCodeRegistry::AddCode("CodeCache recompile stub", recompile_stub_,
+                            assembler.CodeSize());
+}
@@ -0,0 +1,159 @@
+// Copyright (c) 2019, the Dart project authors.  Please see the AUTHORS file
+// for details. All rights reserved. Use of this source code is governed by a
+// BSD-style license that can be found in the LICENSE file.
+
+#pragma once
+
+#include "assembler.h"
+#include "globals.h"
+#include "relocation.h"
+
+struct CodeCacheEntrySlot;
+
+// A finalized code object installed in a CodeCache.
+class CachedCode {
+public:
+  // The stable entry point of the code: a thunk that counts calls and jumps
+  // to the code, or to the recompile stub once the code has been evicted.
+  uword EntryPoint() const { return thunk_; }
+  intptr_t Size() const { return size_; }
+  intptr_t prologue_offset() const { return prologue_offset_; }
+  intptr_t ref_count() const { return ref_count_; }
+  // Whether the code is in the code space, rather than evicted.
+  bool is_resident() const { return address_ != 0; }
+
+private:
+  CachedCode() {}
+  ~CachedCode() {}
+
+  uword thunk_;
+  CodeCacheEntrySlot *slot_;
+  uword address_;        // Of the installed code, or 0 if evicted.
+  intptr_t space_size_;  // Code space used, including veneers.
+  intptr_t size_;
+  intptr_t prologue_offset_;
+  intptr_t ref_count_;
+  uint64_t hash_;
+  // The unrelocated code, kept to reinstall the code once evicted.
+  uint8_t *bytes_;
+  Assembler::Relocation *relocations_;
+  intptr_t relocation_count_;
+  CachedCode *next_; // In the hash bucket.
+  // Ring of resident code swept by the eviction clock.
+  CachedCode *clock_prev_;
+  CachedCode *clock_next_;
+
+  friend class CodeCache;
+  DISALLOW_COPY_AND_ASSIGN(CachedCode);
+};
+
+// Content-addressed cache of finalized code. Code is keyed by a hash of its
+// bytes and relocations; byte-identical code objects (such as the same stub
+// generated for different call sites) are installed once in executable
+// memory and shared by reference.
+//
+// With a budget, the code space is bounded: installing code beyond it evicts
+// code that has not been called since the last sweep of a clock over the
+// resident code, using the call counters of the entry thunks. Evicted code
+// keeps its entry point, which then reinstalls it on the next call through
+// the recompile stub. Code must not be evicted while it is running, so the
+// cache must only be used when no cached code is on the stack of any
+// thread. Reinstalling code called through its thunk evicts nothing, as
+// its caller may be cached code: the budget is then exceeded until the next
+// Install(). Not thread safe.
+class CodeCache : public ValueObject {
+public:
+  CodeCache();
+  ~CodeCache();
+
+  // Returns the installed copy of the finalized code of |assembler|,
+  // installing it unless identical code is already cached, and adds a
+  // reference to it. The code must be position independent (no
+  // code_address()); its relocations are resolved against the external
+  // symbols of the cache.
+  const CachedCode *Install(Assembler *assembler);
+  // Same for unrelocated code given as bytes and relocations, such as code
+  // read from a CodeSnapshot. The arguments are copied.
+  const CachedCode *Install(const uint8_t *bytes, intptr_t size,
+                            intptr_t prologue_offset,
+                            const Assembler::Relocation *relocations,
+                            intptr_t relocation_count);
+  // Drops a reference. Unreferenced code is removed from the cache.
+  void Release(const CachedCode *code);
+
+  // External symbols must not change once code referring to them has been
+  // installed.
+  void AddExternalSymbol(intptr_t symbol, uword address);
+  bool HasExternalSymbol(intptr_t symbol);
+
+  // The code space budget in bytes, or 0 for no limit.
+  intptr_t budget() const { return budget_; }
+  void set_budget(intptr_t budget) { budget_ = budget; }
+
+  intptr_t hits() const { return hits_; }
+  intptr_t misses() const { return misses_; }
+  // Code bytes not installed again thanks to hits.
+  intptr_t bytes_saved() const { return bytes_saved_; }
+  // Code space used by the resident code objects.
+  intptr_t resident_bytes() const { return resident_bytes_; }
+  intptr_t evictions() const { return evictions_; }
+  // Evicted code objects reinstalled when called.
+  intptr_t recompiles() const { return recompiles_; }
+  intptr_t Length() const { return length_; }
+
+private:
+  static const intptr_t kInitialBuckets = 64;
+  static const intptr_t kChunkSize = 256 * 4096;
+  static const intptr_t kCodeAlignment = CodeRelocator::kFunctionAlignment;
+  // Names the code being installed for the CodeRelocator; not a valid
+  // external symbol.
+  static const intptr_t kInstalledSymbol = kMinInt64;
+
+  static uint64_t Hash(const uint8_t *bytes, intptr_t size,
+                       const Assembler::Relocation *relocations,
+                       intptr_t relocation_count);
+  static bool Matches(const CachedCode *code, const uint8_t *bytes,
+                      intptr_t size, const Assembler::Relocation *relocations,
+                      intptr_t relocation_count);
+  void Grow();
+
+  // Links |code| into the code space and points its thunk at it, evicting
+  // other code as needed to stay within the budget if |make_room|.
+  void InstallCode(CachedCode *code, bool make_room);
+  void Evict(CachedCode *code);
+  // Evicts code until |size| more bytes fit the budget.
+  void MakeRoom(intptr_t size);
+
+  // Code space, in kCodeAlignment units.
+  uword AllocateCode(intptr_t size);
+  void FreeCode(uword address, intptr_t size);
+
+  void AllocateThunk(CachedCode *code);
+  void FreeThunk(CachedCode *code);
+  void GenerateRecompileStub();
+  // Called by the recompile stub with the thunk of evicted code; returns
+  // the address of the reinstalled code.
+  static uword Recompile(CodeCache *cache, uword thunk);
+
+  CachedCode **buckets_;
+  intptr_t bucket_count_;
+  intptr_t length_;
+  // Pairs of (intptr_t symbol, uword address).
+  AssemblerBuffer external_symbols_;
+
+  struct FreeBlock;
+  // Free code space, sorted by address.
+  FreeBlock *free_blocks_;
+  CodeCacheEntrySlot *free_slots_;
+  uword recompile_stub_;
+
+  intptr_t budget_;
+  CachedCode *clock_hand_;
+
+  intptr_t hits_;
+  intptr_t misses_;
+  intptr_t bytes_saved_;
+  intptr_t resident_bytes_;
+  intptr_t evictions_;
+  intptr_t recompiles_;
+};
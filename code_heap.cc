@@ -0,0 +1,378 @@
+// Copyright (c) 2019, the Dart project authors.  Please see the AUTHORS file
+// for details. All rights reserved. Use of this source code is governed by a
+// BSD-style license that can be found in the LICENSE file.
+
+#include "code_heap.h"
+
+#include <sys/mman.h>
+
+struct CodeHeap::Chunk {
+  // The live code objects, plus kOwnerBias while a thread allocates from
+  // the chunk.
+  std::atomic<intptr_t> live;
+  // The chunks in the run starting here, for the first chunk of a run.
+  intptr_t length;
+  // The next chunk in the free list, plus one, or 0.
+  std::atomic<uint32_t> next_free;
+};
+
+struct CodeHeap::ThreadRecord {
+  struct RetiredCode {
+    uint64_t epoch;
+    uword address;
+    intptr_t size;
+  };
+
+  // (epoch << 1) | 1 while in a critical section entered in that epoch, 0
+  // otherwise.
+  std::atomic<uint64_t> state;
+  std::atomic<bool> in_use;
+  ThreadRecord *next;
+  // By increasing epoch. Once its thread leaves, freed by the other threads
+  // as they reclaim.
+  RetiredCode *retired;
+  intptr_t retired_length;
+  intptr_t retired_capacity;
+};
+
+static intptr_t RoundUp(intptr_t value, intptr_t alignment) {
+  ASSERT(Utils::IsPowerOfTwo(alignment));
+  return (value + alignment - 1) & ~(alignment - 1);
+}
+
+static const uint64_t kIndexMask = 0xFFFFFFFF;
+
+CodeHeap::CodeHeap(intptr_t capacity)
+    : chunk_count_(RoundUp(capacity, kChunkSize) / kChunkSize),
+      free_chunks_(0), frontier_(0), used_chunks_(0), epoch_(0),
+      records_(NULL) {
+  ASSERT(chunk_count_ > 0 && static_cast<uint64_t>(chunk_count_) < kIndexMask);
+  void *memory = mmap(NULL, chunk_count_ * kChunkSize,
+                      PROT_READ | PROT_WRITE | PROT_EXEC,
+                      MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  if (memory == MAP_FAILED) {
+    FATAL("Cannot reserve the code heap");
+  }
+  base_ = reinterpret_cast<uword>(memory);
+  chunks_ = new Chunk[chunk_count_];
+  pthread_mutex_init(&free_run_mutex_, NULL);
+}
+
+CodeHeap::~CodeHeap() {
+  ThreadRecord *record = records_.load(std::memory_order_acquire);
+  while (record != NULL) {
+    ASSERT(!record->in_use.load(std::memory_order_relaxed));
+    ThreadRecord *next = record->next;
+    free(record->retired);
+    delete record;
+    record = next;
+  }
+  pthread_mutex_destroy(&free_run_mutex_);
+  delete[] chunks_;
+  munmap(reinterpret_cast<void *>(base_), chunk_count_ * kChunkSize);
+}
+
+void CodeHeap::PushFreeChunk(intptr_t index) {
+  uint64_t top = free_chunks_.load(std::memory_order_relaxed);
+  uint64_t new_top;
+  do {
+    chunks_[index].next_free.store(top & kIndexMask,
+                                   std::memory_order_relaxed);
+    new_top = (((top >> 32) + 1) << 32) | (index + 1);
+  } while (!free_chunks_.compare_exchange_weak(top, new_top,
+                                               std::memory_order_release,
+                                               std::memory_order_relaxed));
+}
+
+intptr_t CodeHeap::PopFreeChunk() {
+  uint64_t top = free_chunks_.load(std::memory_order_acquire);
+  uint64_t new_top;
+  do {
+    if ((top & kIndexMask) == 0) {
+      return -1;
+    }
+    // The chunk may be taken meanwhile, in which case the tag has changed
+    // and the exchange fails.
+    const intptr_t index = (top & kIndexMask) - 1;
+    new_top = (((top >> 32) + 1) << 32) |
+              chunks_[index].next_free.load(std::memory_order_relaxed);
+  } while (!free_chunks_.compare_exchange_weak(top, new_top,
+                                               std::memory_order_acquire,
+                                               std::memory_order_acquire));
+  return (top & kIndexMask) - 1;
+}
+
+intptr_t CodeHeap::AllocateChunks(intptr_t length) {
+  if (length == 1) {
+    const intptr_t index = PopFreeChunk();
+    if (index >= 0) {
+      chunks_[index].length = 1;
+      used_chunks_.fetch_add(1, std::memory_order_relaxed);
+      return index;
+    }
+  } else {
+    // Freed runs go back to the free list one chunk at a time, so they are
+    // put together again here.
+    const intptr_t index = AllocateFreeChunks(length);
+    if (index >= 0) {
+      return index;
+    }
+  }
+  intptr_t first = frontier_.load(std::memory_order_relaxed);
+  do {
+    if (first + length > chunk_count_) {
+      // The free list may be held by AllocateFreeChunks() meanwhile.
+      return length == 1 ? AllocateFreeChunks(1) : -1;
+    }
+  } while (!frontier_.compare_exchange_weak(first, first + length,
+                                            std::memory_order_relaxed));
+  chunks_[first].length = length;
+  used_chunks_.fetch_add(length, std::memory_order_relaxed);
+  // All of the heap not taken by code traps.
+  Assembler::InitializeMemoryWithBreakpoints(ChunkAddress(first),
+                                             length * kChunkSize);
+  return first;
+}
+
+intptr_t CodeHeap::AllocateFreeChunks(intptr_t length) {
+  pthread_mutex_lock(&free_run_mutex_);
+  // Takes the whole free list, which leaves the other threads to the
+  // untouched chunks for as long as the lock is held.
+  bool *is_free = reinterpret_cast<bool *>(calloc(chunk_count_, sizeof(bool)));
+  for (intptr_t index = PopFreeChunk(); index >= 0; index = PopFreeChunk()) {
+    is_free[index] = true;
+  }
+  intptr_t first = -1;
+  intptr_t run = 0;
+  for (intptr_t index = 0; index < chunk_count_; index++) {
+    run = is_free[index] ? run + 1 : 0;
+    if (run == length) {
+      first = index - length + 1;
+      break;
+    }
+  }
+  // Freed chunks keep trapping, as freed code is cleared with breakpoints.
+  for (intptr_t index = chunk_count_ - 1; index >= 0; index--) {
+    if (is_free[index] &&
+        (first < 0 || index < first || index >= first + length)) {
+      PushFreeChunk(index);
+    }
+  }
+  free(is_free);
+  pthread_mutex_unlock(&free_run_mutex_);
+  if (first >= 0) {
+    chunks_[first].length = length;
+    used_chunks_.fetch_add(length, std::memory_order_relaxed);
+  }
+  return first;
+}
+
+void CodeHeap::FreeChunks(intptr_t index) {
+  const intptr_t length = chunks_[index].length;
+  used_chunks_.fetch_sub(length, std::memory_order_relaxed);
+  for (intptr_t i = index; i < index + length; i++) {
+    chunks_[i].length = 1;
+    PushFreeChunk(i);
+  }
+}
+
+void CodeHeap::ReleaseChunk(intptr_t index, intptr_t count) {
+  if (chunks_[index].live.fetch_sub(count, std::memory_order_acq_rel) ==
+      count) {
+    FreeChunks(index);
+  }
+}
+
+void CodeHeap::FreeCode(uword address, intptr_t size) {
+  Assembler::InitializeMemoryWithBreakpoints(address, size);
+  ReleaseChunk(ChunkIndex(address), 1);
+}
+
+uint64_t CodeHeap::TryAdvanceEpoch() {
+  uint64_t epoch = epoch_.load(std::memory_order_seq_cst);
+  for (ThreadRecord *record = records_.load(std::memory_order_acquire);
+       record != NULL; record = record->next) {
+    const uint64_t state = record->state.load(std::memory_order_seq_cst);
+    if ((state & 1) != 0 && (state >> 1) != epoch) {
+      return epoch;
+    }
+  }
+  if (epoch_.compare_exchange_strong(epoch, epoch + 1,
+                                     std::memory_order_seq_cst)) {
+    return epoch + 1;
+  }
+  // Advanced by another thread.
+  return epoch;
+}
+
+intptr_t CodeHeap::FreeRetiredCode(ThreadRecord *record, uint64_t epoch) {
+  // The threads in a critical section when the code was retired entered in
+  // its epoch or before, and the epoch cannot have advanced twice since
+  // without them leaving.
+  intptr_t freed = 0;
+  while (freed < record->retired_length &&
+         record->retired[freed].epoch + 2 <= epoch) {
+    FreeCode(record->retired[freed].address, record->retired[freed].size);
+    freed++;
+  }
+  if (freed > 0) {
+    record->retired_length -= freed;
+    memmove(record->retired, record->retired + freed,
+            record->retired_length * sizeof(ThreadRecord::RetiredCode));
+  }
+  return freed;
+}
+
+CodeHeap::ThreadRecord *CodeHeap::AcquireRecord() {
+  for (ThreadRecord *record = records_.load(std::memory_order_acquire);
+       record != NULL; record = record->next) {
+    bool in_use = false;
+    if (!record->in_use.load(std::memory_order_relaxed) &&
+        record->in_use.compare_exchange_strong(in_use, true,
+                                               std::memory_order_acquire)) {
+      return record;
+    }
+  }
+  ThreadRecord *record = new ThreadRecord();
+  record->state.store(0, std::memory_order_relaxed);
+  record->in_use.store(true, std::memory_order_relaxed);
+  record->retired = NULL;
+  record->retired_length = 0;
+  record->retired_capacity = 0;
+  record->next = records_.load(std::memory_order_relaxed);
+  while (!records_.compare_exchange_weak(record->next, record,
+                                         std::memory_order_release,
+                                         std::memory_order_relaxed)) {
+  }
+  return record;
+}
+
+CodeHeap::Thread::Thread(CodeHeap *heap)
+    : heap_(heap), record_(heap->AcquireRecord()), chunk_(-1), top_(0),
+      limit_(0), allocated_(0), retired_since_reclaim_(0) {}
+
+CodeHeap::Thread::~Thread() {
+  ASSERT(record_->state.load(std::memory_order_relaxed) == 0);
+  ReleaseCurrentChunk();
+  Reclaim();
+  record_->in_use.store(false, std::memory_order_release);
+}
+
+uword CodeHeap::Thread::Allocate(intptr_t size) {
+  ASSERT(size > 0);
+  const intptr_t aligned_size = RoundUp(size, kCodeAlignment);
+  if (aligned_size > kLargeObjectSize) {
+    const intptr_t length = RoundUp(aligned_size, kChunkSize) / kChunkSize;
+    intptr_t index = heap_->AllocateChunks(length);
+    if (index < 0) {
+      Reclaim();
+      index = heap_->AllocateChunks(length);
+      if (index < 0) {
+        FATAL("Out of code space");
+      }
+    }
+    heap_->chunks_[index].live.store(1, std::memory_order_relaxed);
+    return heap_->ChunkAddress(index);
+  }
+  if (top_ + aligned_size > limit_) {
+    Refill();
+  }
+  const uword address = top_;
+  top_ += aligned_size;
+  allocated_++;
+  return address;
+}
+
+uword CodeHeap::Thread::Install(Assembler *assembler) {
+  ASSERT(assembler->is_finalized());
+  ASSERT(assembler->code_address() == 0);
+  ASSERT(assembler->RelocationCount() == 0);
+  const uword address = Allocate(assembler->CodeSize());
+  memmove(reinterpret_cast<void *>(address),
+          reinterpret_cast<void *>(assembler->CodeAddress(0)),
+          assembler->CodeSize());
+  return address;
+}
+
+void CodeHeap::Thread::Refill() {
+  ReleaseCurrentChunk();
+  intptr_t index = heap_->AllocateChunks(1);
+  if (index < 0) {
+    Reclaim();
+    index = heap_->AllocateChunks(1);
+    if (index < 0) {
+      FATAL("Out of code space");
+    }
+  }
+  heap_->chunks_[index].live.store(kOwnerBias, std::memory_order_relaxed);
+  chunk_ = index;
+  top_ = heap_->ChunkAddress(index);
+  limit_ = top_ + kChunkSize;
+  allocated_ = 0;
+}
+
+void CodeHeap::Thread::ReleaseCurrentChunk() {
+  if (chunk_ < 0) {
+    return;
+  }
+  // Leaves the count of the code allocated here, and frees the chunk if it
+  // has all been freed already.
+  heap_->ReleaseChunk(chunk_, kOwnerBias - allocated_);
+  chunk_ = -1;
+  top_ = limit_ = 0;
+  allocated_ = 0;
+}
+
+void CodeHeap::Thread::Retire(uword address, intptr_t size) {
+  ASSERT(heap_->Contains(address));
+  ThreadRecord *record = record_;
+  if (record->retired_length == record->retired_capacity) {
+    record->retired_capacity =
+        record->retired_capacity == 0 ? 16 : 2 * record->retired_capacity;
+    record->retired = reinterpret_cast<ThreadRecord::RetiredCode *>(
+        realloc(record->retired, record->retired_capacity *
+                                     sizeof(ThreadRecord::RetiredCode)));
+  }
+  ThreadRecord::RetiredCode *retired =
+      &record->retired[record->retired_length++];
+  // The code is unreachable, so threads entering a critical section from
+  // now on cannot see it.
+  retired->epoch = heap_->epoch_.load(std::memory_order_seq_cst);
+  retired->address = address;
+  retired->size = size;
+  if (++retired_since_reclaim_ >= kReclaimInterval) {
+    Reclaim();
+  }
+}
+
+intptr_t CodeHeap::Thread::Reclaim() {
+  retired_since_reclaim_ = 0;
+  const uint64_t epoch = heap_->TryAdvanceEpoch();
+  intptr_t freed = heap_->FreeRetiredCode(record_, epoch);
+  // Also that of the threads that left.
+  for (ThreadRecord *record = heap_->records_.load(std::memory_order_acquire);
+       record != NULL; record = record->next) {
+    bool in_use = false;
+    if (!record->in_use.load(std::memory_order_relaxed) &&
+        record->in_use.compare_exchange_strong(in_use, true,
+                                               std::memory_order_acquire)) {
+      freed += heap_->FreeRetiredCode(record, epoch);
+      record->in_use.store(false, std::memory_order_release);
+    }
+  }
+  return freed;
+}
+
+intptr_t CodeHeap::Thread::RetiredCount() const {
+  return record_->retired_length;
+}
+
+void CodeHeap::Thread::Enter() {
+  ASSERT(record_->state.load(std::memory_order_relaxed) == 0);
+  const uint64_t epoch = heap_->epoch_.load(std::memory_order_seq_cst);
+  record_->state.store((epoch << 1) | 1, std::memory_order_seq_cst);
+}
+
+void CodeHeap::Thread::Exit() {
+  record_->state.store(0, std::memory_order_release);
+}
@@ -0,0 +1,198 @@
+// Copyright (c) 2019, the Dart project authors.  Please see the AUTHORS file
+// for details. All rights reserved. Use of this source code is governed by a
+// BSD-style license that can be found in the LICENSE file.
+
+#pragma once
+
+#include <pthread.h>
+
+#include <atomic>
+
+#include "assembler.h"
+#include "globals.h"
+
+// Executable memory shared by compiler threads. Allocation takes no lock,
+// but for large code:
+//
+//   - the heap is a reserved range of address space, divided into chunks of
+//     kChunkSize bytes;
+//   - each thread bump-allocates from a chunk of its own, and takes another
+//     from a global lock-free free list (or the untouched end of the range)
+//     when it runs out. Large code gets a run of chunks of its own, found
+//     under a lock among the free chunks before the untouched ones;
+//   - a chunk counts its live code objects, and goes back to the free list
+//     once its thread has moved on and the last of its code is freed.
+//
+// Code is freed with epoch-based reclamation, so that it is not reused
+// while a thread may still be running it. Threads run heap code (and read
+// the structures from which they find it) inside a CriticalSection. The
+// global epoch only advances once every thread in a critical section has
+// entered it in the current epoch, and retired code is freed two epochs
+// after its retirement, when the threads that could still see it have all
+// left their critical sections:
+//
+//     CodeHeap::Thread thread(&heap);   // Per thread, on its stack.
+//     uword entry = thread.Install(&assembler);
+//     ... publish |entry| ...
+//     {
+//       CodeHeap::CriticalSection section(&thread);
+//       ... call the published code ...
+//     }
+//     ... unpublish |entry| ...
+//     thread.Retire(entry, size);
+//
+// Code is written through a writable and executable mapping, and must be
+// published to other threads with a release store.
+class CodeHeap {
+public:
+  static const intptr_t kChunkSize = 256 * 1024;
+  static const intptr_t kCodeAlignment = 32;
+
+  class Thread;
+  class CriticalSection;
+
+  // Reserves |capacity| bytes, rounded up to whole chunks. Memory is only
+  // committed as chunks are first used.
+  explicit CodeHeap(intptr_t capacity);
+  // All threads must have been destroyed. Frees the retired code and unmaps
+  // the heap.
+  ~CodeHeap();
+
+  intptr_t capacity() const { return chunk_count_ * kChunkSize; }
+  bool Contains(uword address) const {
+    return address >= base_ && address < base_ + capacity();
+  }
+  // Chunks owned by threads or holding live code.
+  intptr_t UsedChunks() const {
+    return used_chunks_.load(std::memory_order_relaxed);
+  }
+  uint64_t epoch() const { return epoch_.load(std::memory_order_relaxed); }
+
+private:
+  struct Chunk;
+  struct ThreadRecord;
+
+  // Objects above this size get chunks of their own, so that at most a
+  // quarter of a chunk is left unused when a thread moves on.
+  static const intptr_t kLargeObjectSize = kChunkSize / 4;
+  // Biases the live count of the chunk of a thread, so that frees can never
+  // bring it to zero before the thread moves on.
+  static const intptr_t kOwnerBias = static_cast<intptr_t>(1) << 40;
+
+  intptr_t ChunkIndex(uword address) const {
+    return (address - base_) / kChunkSize;
+  }
+  uword ChunkAddress(intptr_t index) const {
+    return base_ + index * kChunkSize;
+  }
+
+  // Returns the first of |length| contiguous chunks, or -1 if the heap is
+  // full.
+  intptr_t AllocateChunks(intptr_t length);
+  // Takes |length| contiguous chunks from the free list, or returns -1.
+  intptr_t AllocateFreeChunks(intptr_t length);
+  // Returns the run of chunks starting at |index| to the free list.
+  void FreeChunks(intptr_t index);
+  void PushFreeChunk(intptr_t index);
+  intptr_t PopFreeChunk();
+
+  // Drops a reference to the chunk at |index|; the last frees it.
+  void ReleaseChunk(intptr_t index, intptr_t count);
+
+  // Frees the code at |address|, which no thread can be running.
+  void FreeCode(uword address, intptr_t size);
+
+  // Frees the code of |record| retired at least two epochs before |epoch|.
+  // Returns the number of code objects freed.
+  intptr_t FreeRetiredCode(ThreadRecord *record, uint64_t epoch);
+
+  // Advances the epoch if every thread in a critical section has seen the
+  // current one. Returns the epoch.
+  uint64_t TryAdvanceEpoch();
+
+  ThreadRecord *AcquireRecord();
+
+  uword base_;
+  intptr_t chunk_count_;
+  Chunk *chunks_;
+  // The top of the free list, as (tag << 32) | (index + 1), or a tag alone
+  // when empty. The tag changes on every update, so that a stale top is
+  // never taken for the current one.
+  std::atomic<uint64_t> free_chunks_;
+  // The chunks beyond this one have never been used.
+  std::atomic<intptr_t> frontier_;
+  // Held while the free list is drained to find a run of chunks.
+  pthread_mutex_t free_run_mutex_;
+  std::atomic<intptr_t> used_chunks_;
+
+  std::atomic<uint64_t> epoch_;
+  // Threads register by pushing a record, which is reused once they leave.
+  std::atomic<ThreadRecord *> records_;
+
+  DISALLOW_COPY_AND_ASSIGN(CodeHeap);
+};
+
+// The state of a thread using a CodeHeap: its chunk and the code it retired.
+// Allocation and retirement are not thread safe; each thread has its own.
+class CodeHeap::Thread : public ValueObject {
+public:
+  explicit Thread(CodeHeap *heap);
+  ~Thread();
+
+  // Returns |size| bytes of code space, aligned to kCodeAlignment. Fatal if
+  // the heap is full.
+  uword Allocate(intptr_t size);
+  // Copies the finalized code of |assembler| into the heap. The code must
+  // be position independent, without relocations.
+  uword Install(Assembler *assembler);
+  // Frees the code at |address|, of the |size| passed to Allocate() (or of
+  // the CodeSize() of Install()), once no thread can be running it. It must
+  // no longer be reachable by threads entering a critical section.
+  void Retire(uword address, intptr_t size);
+  // Frees the code retired by this thread, and by the threads that left,
+  // that no thread can be running any more. Returns the number of code
+  // objects freed.
+  intptr_t Reclaim();
+
+  // Retired code not freed yet.
+  intptr_t RetiredCount() const;
+
+private:
+  void Enter();
+  void Exit();
+  // Moves to another chunk.
+  void Refill();
+  // Stops allocating from the current chunk.
+  void ReleaseCurrentChunk();
+
+  // Retire() reclaims every kReclaimInterval retirements.
+  static const intptr_t kReclaimInterval = 64;
+
+  CodeHeap *heap_;
+  ThreadRecord *record_;
+  intptr_t chunk_;
+  uword top_;
+  uword limit_;
+  // Allocated from the current chunk.
+  intptr_t allocated_;
+  intptr_t retired_since_reclaim_;
+
+  friend class CriticalSection;
+  DISALLOW_COPY_AND_ASSIGN(Thread);
+};
+
+// Code of the heap may only be run while in a critical section. Critical
+// sections do not nest, and should be short: the code retired meanwhile by
+// other threads cannot be freed until they end.
+class CodeHeap::CriticalSection : public ValueObject {
+public:
+  explicit CriticalSection(Thread *thread) : thread_(thread) {
+    thread_->Enter();
+  }
+  ~CriticalSection() { thread_->Exit(); }
+
+private:
+  Thread *thread_;
+
+  DISALLOW_COPY_AND_ASSIGN(CriticalSection);
+};
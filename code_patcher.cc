@@ -0,0 +1,420 @@
+// Copyright (c) 2019, the Dart project authors.  Please see the AUTHORS file
+// for details. All rights reserved. Use of this source code is governed by a
+// BSD-style license that can be found in the LICENSE file.
+
+#include "code_patcher.h"
+
+#include <inttypes.h>
+#include <linux/membarrier.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <ucontext.h>
+#include <unistd.h>
+
+#include <atomic>
+
+static pthread_once_t initialize_once = PTHREAD_ONCE_INIT;
+static pthread_mutex_t patch_mutex = PTHREAD_MUTEX_INITIALIZER;
+static bool has_membarrier = false;
+// Without membarrier(), changing the protection of this page interrupts the
+// cores running the other threads, to flush their TLBs.
+static void *shootdown_page = NULL;
+static struct sigaction previous_trap_action;
+// The instruction being patched through an int3, or 0.
+static std::atomic<uword> patching_site(0);
+
+static const uint8_t kCallOpcode = 0xE8;
+static const uint8_t kJumpOpcode = 0xE9;
+// Not Instr::kBreakPointInstruction, a hlt, which faults with SIGSEGV.
+static const uint8_t kInt3Instruction = 0xCC;
+static const intptr_t kMaxInstructionSize = 15;
+
+static void HandleTrap(int signal, siginfo_t *info, void *context) {
+  ucontext_t *ucontext = reinterpret_cast<ucontext_t *>(context);
+  // The int3 is the byte before the pc. Once the patch is done, it is gone.
+  const uword site = ucontext->uc_mcontext.gregs[REG_RIP] - 1;
+  if (site == patching_site.load(std::memory_order_acquire) ||
+      *reinterpret_cast<const uint8_t *>(site) != kInt3Instruction) {
+    ucontext->uc_mcontext.gregs[REG_RIP] = site;
+    return;
+  }
+  if ((previous_trap_action.sa_flags & SA_SIGINFO) != 0) {
+    previous_trap_action.sa_sigaction(signal, info, context);
+  } else if (previous_trap_action.sa_handler == SIG_DFL) {
+    // Delivered with the default action once the handler returns.
+    sigaction(SIGTRAP, &previous_trap_action, NULL);
+    raise(SIGTRAP);
+  } else if (previous_trap_action.sa_handler != SIG_IGN) {
+    previous_trap_action.sa_handler(signal);
+  }
+}
+
+void CodePatcher::Initialize() {
+  has_membarrier =
+      syscall(__NR_membarrier,
+              MEMBARRIER_CMD_REGISTER_PRIVATE_EXPEDITED_SYNC_CORE, 0) == 0;
+  if (!has_membarrier) {
+    shootdown_page = mmap(NULL, 4096, PROT_READ | PROT_WRITE,
+                          MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (shootdown_page == MAP_FAILED) {
+      FATAL("Cannot map the TLB shootdown page");
+    }
+  }
+  struct sigaction action;
+  memset(&action, 0, sizeof(action));
+  action.sa_sigaction = HandleTrap;
+  action.sa_flags = SA_SIGINFO;
+  sigemptyset(&action.sa_mask);
+  if (sigaction(SIGTRAP, &action, &previous_trap_action) != 0) {
+    FATAL("Cannot install the SIGTRAP handler");
+  }
+}
+
+void CodePatcher::SerializeCores() {
+  pthread_once(&initialize_once, Initialize);
+  if (has_membarrier) {
+    syscall(__NR_membarrier, MEMBARRIER_CMD_PRIVATE_EXPEDITED_SYNC_CORE, 0);
+    return;
+  }
+  // The interrupts serialize the cores; returning from them is serializing.
+  mprotect(shootdown_page, 4096, PROT_READ | PROT_WRITE);
+  *reinterpret_cast<volatile intptr_t *>(shootdown_page) += 1;
+  mprotect(shootdown_page, 4096, PROT_NONE);
+}
+
+void CodePatcher::Patch(uword site, intptr_t size,
+                        const uint8_t *instruction) {
+  pthread_once(&initialize_once, Initialize);
+  pthread_mutex_lock(&patch_mutex);
+  uint8_t *code = reinterpret_cast<uint8_t *>(site);
+  intptr_t first = 0;
+  while (first < size && code[first] == instruction[first]) {
+    first++;
+  }
+  if (first == size) {
+    pthread_mutex_unlock(&patch_mutex);
+    return;
+  }
+  intptr_t end = size;
+  while (code[end - 1] == instruction[end - 1]) {
+    end--;
+  }
+  if (IsAtomicallyPatchable(site + first, site + end)) {
+    uint64_t *word = reinterpret_cast<uint64_t *>((site + first) & ~7);
+    uint64_t value = __atomic_load_n(word, __ATOMIC_RELAXED);
+    memmove(reinterpret_cast<uint8_t *>(&value) +
+                (site + first - reinterpret_cast<uword>(word)),
+            instruction + first, end - first);
+    __atomic_store_n(word, value, __ATOMIC_RELEASE);
+  } else {
+    patching_site.store(site, std::memory_order_release);
+    __atomic_store_n(code, kInt3Instruction, __ATOMIC_RELEASE);
+    SerializeCores();
+    memmove(code + 1, instruction + 1, size - 1);
+    SerializeCores();
+    __atomic_store_n(code, instruction[0], __ATOMIC_RELEASE);
+    SerializeCores();
+    patching_site.store(0, std::memory_order_release);
+  }
+  pthread_mutex_unlock(&patch_mutex);
+}
+
+void CodePatcher::PatchBranch(uword site, uint8_t opcode, uword target) {
+  ASSERT(*reinterpret_cast<const uint8_t *>(site) == opcode);
+  const int64_t displacement = target - (site + kCallSize);
+  if (!Utils::IsInt(32, displacement)) {
+    FATAL("Branch target out of rel32 range");
+  }
+  const int32_t rel32 = static_cast<int32_t>(displacement);
+  uint8_t instruction[kCallSize];
+  instruction[0] = opcode;
+  memmove(instruction + 1, &rel32, sizeof(rel32));
+  Patch(site, kCallSize, instruction);
+}
+
+void CodePatcher::PatchCall(uword site, uword target) {
+  PatchBranch(site, kCallOpcode, target);
+}
+
+void CodePatcher::PatchJump(uword site, uword target) {
+  PatchBranch(site, kJumpOpcode, target);
+}
+
+uword CodePatcher::CallTarget(uword site) {
+  int32_t rel32;
+  memmove(&rel32, reinterpret_cast<const void *>(site + 1), sizeof(rel32));
+  return site + kCallSize + rel32;
+}
+
+void CodePatcher::PatchConditionalJump(uword site, uword target) {
+  const uint8_t *code = reinterpret_cast<const uint8_t *>(site);
+  ASSERT(code[0] == 0x0F && (code[1] & 0xF0) == 0x80);
+  const int64_t displacement = target - (site + kConditionalJumpSize);
+  if (!Utils::IsInt(32, displacement)) {
+    FATAL("Branch target out of rel32 range");
+  }
+  const int32_t rel32 = static_cast<int32_t>(displacement);
+  uint8_t instruction[kConditionalJumpSize];
+  instruction[0] = code[0];
+  instruction[1] = code[1];
+  memmove(instruction + 2, &rel32, sizeof(rel32));
+  Patch(site, kConditionalJumpSize, instruction);
+}
+
+uword CodePatcher::ConditionalJumpTarget(uword site) {
+  int32_t rel32;
+  memmove(&rel32, reinterpret_cast<const void *>(site + 2), sizeof(rel32));
+  return site + kConditionalJumpSize + rel32;
+}
+
+void CodePatcher::PatchLoadImmediate(uword site, int64_t value) {
+  const uint8_t *code = reinterpret_cast<const uint8_t *>(site);
+  ASSERT((code[0] & 0xF8) == (REX_PREFIX | REX_W));
+  ASSERT((code[1] & 0xF8) == 0xB8);
+  uint8_t instruction[kLoadImmediateSize];
+  instruction[0] = code[0];
+  instruction[1] = code[1];
+  memmove(instruction + 2, &value, sizeof(value));
+  Patch(site, kLoadImmediateSize, instruction);
+}
+
+int64_t CodePatcher::LoadedImmediate(uword site) {
+  int64_t value;
+  memmove(&value, reinterpret_cast<const void *>(site + 2), sizeof(value));
+  return value;
+}
+
+void CodePatcher::PatchImmediate32(uword site, intptr_t size, int32_t value) {
+  ASSERT(size > 4 && size <= kMaxInstructionSize);
+  uint8_t instruction[kMaxInstructionSize];
+  memmove(instruction, reinterpret_cast<const void *>(site), size - 4);
+  memmove(instruction + size - 4, &value, sizeof(value));
+  Patch(site, size, instruction);
+}
+
+// The code of the stress test: four calls, each to a function returning 1
+// or 2, then two jumps, to code adding 10 or 20 and then 100 or 200.
+enum StressSite {
+  kAtomicCall,
+  kCall,
+  kAtomicLoadImmediate,
+  kLoadImmediate,
+  kJump,
+  kAtomicJump,
+  kNumStressSites,
+};
+
+struct StressCode {
+  uword entry;
+  uword sites[kNumStressSites];
+  // The two targets of each site.
+  uword targets[kNumStressSites][2];
+};
+
+struct StressThread {
+  uword entry;
+  std::atomic<bool> *stop;
+  std::atomic<intptr_t> calls;
+  intptr_t wrong_results;
+};
+
+static bool IsStressResult(intptr_t result) {
+  const intptr_t calls = result % 10;
+  const intptr_t jumps = result - calls;
+  return calls >= 4 && calls <= 8 &&
+         (jumps == 110 || jumps == 120 || jumps == 210 || jumps == 220);
+}
+
+static void *StressThreadMain(void *argument) {
+  StressThread *thread = reinterpret_cast<StressThread *>(argument);
+  typedef intptr_t (*StressFunction)();
+  StressFunction function = reinterpret_cast<StressFunction>(thread->entry);
+  while (!thread->stop->load(std::memory_order_relaxed)) {
+    if (!IsStressResult(function())) {
+      thread->wrong_results++;
+    }
+    thread->calls.fetch_add(1, std::memory_order_relaxed);
+  }
+  return NULL;
+}
+
+// Patches between yields to the stress test threads.
+static const intptr_t kStressYieldInterval = 64;
+
+// The targets of a site are at least 256 bytes apart, so that they differ
+// in more than the low byte of a displacement or immediate, and the sites
+// across aligned words take the int3 protocol.
+static void EmitStressGap(Assembler *assembler) {
+  for (intptr_t i = 0; i < 32; i++) {
+    assembler->nop(8);
+  }
+}
+
+// Emits the stress code at |memory|, and fills in |code|.
+static void EmitStressCode(uword memory, StressCode *code) {
+  intptr_t offsets[kNumStressSites];
+  Label one, two, tail_a, tail_b, final_a, final_b, last_jump;
+  // Its target is patched in once the code is in place.
+  ExternalLabel placeholder(0x100000000);
+  Assembler assembler;
+  assembler.subq(RSP, Immediate(8));
+  assembler.Align(8, CodePatcher::kCallAlignmentOffset);
+  offsets[kAtomicCall] = assembler.CodeSize();
+  assembler.call(&one);
+  assembler.movq(RDX, RAX);
+  // Across an aligned word.
+  assembler.Align(8, 2);
+  offsets[kCall] = assembler.CodeSize();
+  assembler.call(&one);
+  assembler.addq(RDX, RAX);
+  assembler.Align(8, CodePatcher::kLoadImmediateAlignmentOffset);
+  offsets[kAtomicLoadImmediate] = assembler.CodeSize();
+  assembler.call(&placeholder);
+  assembler.addq(RDX, RAX);
+  // The immediate starts in the last byte of a word.
+  assembler.Align(8, 3);
+  offsets[kLoadImmediate] = assembler.CodeSize();
+  assembler.call(&placeholder);
+  assembler.addq(RAX, RDX);
+  assembler.addq(RSP, Immediate(8));
+  assembler.Align(8, 2);
+  offsets[kJump] = assembler.CodeSize();
+  assembler.jmp(&tail_a);
+
+  assembler.Bind(&one);
+  assembler.movl(RAX, Immediate(1));
+  assembler.ret();
+  EmitStressGap(&assembler);
+  assembler.Bind(&two);
+  assembler.movl(RAX, Immediate(2));
+  assembler.ret();
+  assembler.Bind(&tail_b);
+  assembler.addq(RAX, Immediate(20));
+  assembler.jmp(&last_jump);
+  EmitStressGap(&assembler);
+  assembler.Bind(&tail_a);
+  assembler.addq(RAX, Immediate(10));
+  assembler.Bind(&last_jump);
+  assembler.Align(8, CodePatcher::kCallAlignmentOffset);
+  offsets[kAtomicJump] = assembler.CodeSize();
+  assembler.jmp(&final_a);
+  assembler.Bind(&final_a);
+  assembler.addq(RAX, Immediate(100));
+  assembler.ret();
+  assembler.Bind(&final_b);
+  assembler.addq(RAX, Immediate(200));
+  assembler.ret();
+  assembler.FinalizeCode();
+  memmove(reinterpret_cast<void *>(memory),
+          reinterpret_cast<void *>(assembler.CodeAddress(0)),
+          assembler.CodeSize());
+
+  code->entry = memory;
+  for (intptr_t i = 0; i < kNumStressSites; i++) {
+    code->sites[i] = memory + offsets[i];
+  }
+  ASSERT(CodePatcher::IsAtomicallyPatchable(code->sites[kAtomicCall],
+                                            code->sites[kAtomicCall] + 5));
+  ASSERT(!CodePatcher::IsAtomicallyPatchable(code->sites[kCall] + 1,
+                                             code->sites[kCall] + 3));
+  ASSERT(CodePatcher::IsAtomicallyPatchable(
+      code->sites[kAtomicLoadImmediate] + 2,
+      code->sites[kAtomicLoadImmediate] + 10));
+  ASSERT(!CodePatcher::IsAtomicallyPatchable(
+      code->sites[kLoadImmediate] + 2, code->sites[kLoadImmediate] + 4));
+  for (intptr_t i = kAtomicCall; i <= kLoadImmediate; i++) {
+    code->targets[i][0] = memory + one.Position();
+    code->targets[i][1] = memory + two.Position();
+  }
+  code->targets[kJump][0] = memory + tail_a.Position();
+  code->targets[kJump][1] = memory + tail_b.Position();
+  code->targets[kAtomicJump][0] = memory + final_a.Position();
+  code->targets[kAtomicJump][1] = memory + final_b.Position();
+}
+
+static void PatchStressSite(const StressCode &code, intptr_t site,
+                            intptr_t target) {
+  const uword address = code.targets[site][target];
+  switch (site) {
+  case kAtomicCall:
+  case kCall:
+    CodePatcher::PatchCall(code.sites[site], address);
+    break;
+  case kAtomicLoadImmediate:
+  case kLoadImmediate:
+    CodePatcher::PatchLoadImmediate(code.sites[site], address);
+    break;
+  default:
+    CodePatcher::PatchJump(code.sites[site], address);
+    break;
+  }
+}
+
+bool CodePatcher::StressTest(intptr_t thread_count, intptr_t patch_count,
+                             FILE *out) {
+  ASSERT(thread_count > 0);
+  const intptr_t size = 4096;
+  void *memory = mmap(NULL, size, PROT_READ | PROT_WRITE | PROT_EXEC,
+                      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (memory == MAP_FAILED) {
+    FATAL("Cannot map the stress test code");
+  }
+  StressCode code;
+  EmitStressCode(reinterpret_cast<uword>(memory), &code);
+  PatchStressSite(code, kAtomicLoadImmediate, 0);
+  PatchStressSite(code, kLoadImmediate, 0);
+
+  std::atomic<bool> stop(false);
+  StressThread *threads = new StressThread[thread_count];
+  pthread_t *handles =
+      reinterpret_cast<pthread_t *>(malloc(thread_count * sizeof(pthread_t)));
+  for (intptr_t i = 0; i < thread_count; i++) {
+    threads[i].entry = code.entry;
+    threads[i].stop = &stop;
+    threads[i].calls.store(0, std::memory_order_relaxed);
+    threads[i].wrong_results = 0;
+    if (pthread_create(&handles[i], NULL, StressThreadMain, &threads[i]) !=
+        0) {
+      FATAL("Cannot create a stress test thread");
+    }
+  }
+  // Patches start once all threads run the code.
+  for (intptr_t i = 0; i < thread_count; i++) {
+    while (threads[i].calls.load(std::memory_order_relaxed) == 0) {
+      sched_yield();
+    }
+  }
+  intptr_t atomic_patches = 0;
+  for (intptr_t i = 0; i < patch_count; i++) {
+    const intptr_t site = i % kNumStressSites;
+    const intptr_t target = (i / kNumStressSites) % 2 == 0 ? 1 : 0;
+    PatchStressSite(code, site, target);
+    if (site == kAtomicCall || site == kAtomicLoadImmediate ||
+        site == kAtomicJump) {
+      atomic_patches++;
+    }
+    // Lets the threads run between patches with fewer cores than threads.
+    if (i % kStressYieldInterval == 0) {
+      sched_yield();
+    }
+  }
+  stop.store(true, std::memory_order_relaxed);
+  intptr_t calls = 0;
+  intptr_t wrong_results = 0;
+  for (intptr_t i = 0; i < thread_count; i++) {
+    pthread_join(handles[i], NULL);
+    calls += threads[i].calls.load(std::memory_order_relaxed);
+    wrong_results += threads[i].wrong_results;
+  }
+  fprintf(out,
+          "%" PRIdPTR " patches (%" PRIdPTR " atomic), %" PRIdPTR
+          " calls on %" PRIdPTR " threads, %" PRIdPTR " wrong results\n",
+          patch_count, atomic_patches, calls, thread_count, wrong_results);
+  free(handles);
+  delete[] threads;
+  munmap(memory, size);
+  return wrong_results == 0;
+}
@@ -0,0 +1,90 @@
+// Copyright (c) 2019, the Dart project authors.  Please see the AUTHORS file
+// for details. All rights reserved. Use of this source code is governed by a
+// BSD-style license that can be found in the LICENSE file.
+
+#pragma once
+
+#include <stdio.h>
+
+#include "assembler.h"
+#include "globals.h"
+
+// Patches instructions of code that other threads may be running, such as
+// a call site switched from a resolution stub to the compiled function,
+// without stopping them. The sites are:
+//
+//   - call rel32 (E8), jmp rel32 (E9) and jcc rel32 (0F 80+cc);
+//   - movq reg, imm64 (REX.W B8+r), such as the load of the target of an
+//     ExternalLabel into TMP by call() and jmp() without a code_address();
+//   - instructions ending with an imm32, such as the cmp of an inline cache.
+//
+// When the changed bytes lie within an aligned 8-byte word, they are written
+// with a single store of the word, which running threads see either before
+// or after. Otherwise the cross-modifying code protocol is followed:
+//
+//   1. int3 is written over the first byte of the instruction;
+//   2. all cores serialize their instruction stream;
+//   3. the rest of the instruction is written; cores serialize;
+//   4. the first byte is written; cores serialize.
+//
+// A thread reaching the int3 meanwhile returns to the instruction from the
+// SIGTRAP handler installed here, until the patch is done; other traps go
+// to the previous handler. The cores serialize with membarrier() where
+// supported, and through the interrupts of a TLB shootdown otherwise.
+//
+// Emitting a site after Align(8, k<Site>AlignmentOffset) keeps its patched
+// bytes in an aligned word, as the code is copied to 8-byte aligned memory.
+// Code must be writable where it runs. Patches are serialized by a lock.
+class CodePatcher {
+public:
+  static const intptr_t kCallSize = 5;
+  static const intptr_t kLoadImmediateSize = 10;
+  // Place the instruction at 3 modulo 8, and the immediate at 0.
+  static const intptr_t kCallAlignmentOffset = 5;
+  static const intptr_t kLoadImmediateAlignmentOffset = 2;
+  static const intptr_t kConditionalJumpSize = 6;
+  static const intptr_t kConditionalJumpAlignmentOffset = 2;
+
+  // Retarget the call or jump at |site|. Fatal if the target is out of
+  // rel32 range.
+  static void PatchCall(uword site, uword target);
+  static void PatchJump(uword site, uword target);
+  static uword CallTarget(uword site);
+  static uword JumpTarget(uword site) { return CallTarget(site); }
+  static void PatchConditionalJump(uword site, uword target);
+  static uword ConditionalJumpTarget(uword site);
+
+  // Changes the immediate of the movq reg, imm64 at |site|.
+  static void PatchLoadImmediate(uword site, int64_t value);
+  static int64_t LoadedImmediate(uword site);
+
+  // Changes the imm32 ending the |size|-byte instruction at |site|. Emit it
+  // after Align(8, size - 4) to patch it with a single store.
+  static void PatchImmediate32(uword site, intptr_t size, int32_t value);
+
+  // Whether bytes |start| to |end| (exclusive) lie within an aligned 8-byte
+  // word, and can be patched with a single store.
+  static bool IsAtomicallyPatchable(uword start, uword end) {
+    return (start >> 3) == ((end - 1) >> 3);
+  }
+
+  // Patches code run by |thread_count| threads |patch_count| times, with
+  // sites of each kind both within and across aligned words, and checks
+  // that the threads only ever run the code before or after a patch.
+  // Writes the patches and calls made to |out|. Returns false on a wrong
+  // result.
+  static bool StressTest(intptr_t thread_count, intptr_t patch_count,
+                         FILE *out);
+
+  // Makes every core see the patches done so far, for patches that must
+  // be seen in order.
+  static void SerializeCores();
+
+private:
+  // Replaces the |size|-byte instruction at |site| with |instruction|.
+  static void Patch(uword site, intptr_t size, const uint8_t *instruction);
+  static void PatchBranch(uword site, uint8_t opcode, uword target);
+  static void Initialize();
+
+  DISALLOW_IMPLICIT_CONSTRUCTORS(CodePatcher);
+};
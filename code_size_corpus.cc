@@ -0,0 +1,300 @@
+// Copyright (c) 2019, the Dart project authors.  Please see the AUTHORS file
+// for details. All rights reserved. Use of this source code is governed by a
+// BSD-style license that can be found in the LICENSE file.
+
+#include "code_size_corpus.h"
+
+#include <inttypes.h>
+
+#include "assembler.h"
+
+// The snippets are written with explicit registers rather than those of
+// CallingConventions, so that their encodings are the same on all
+// platforms, and never depend on addresses.
+static const uword kRuntimeEntry = 0x00007F0012345678;
+
+// A call into the runtime from generated code, with a fast path.
+static void EmitCallStub(Assembler *assembler) {
+  Label null, done;
+  ExternalLabel runtime_entry(kRuntimeEntry);
+  assembler->pushq(RBP);
+  assembler->movq(RBP, RSP);
+  assembler->pushq(RBX);
+  assembler->pushq(R12);
+  assembler->movq(RBX, RDI);
+  assembler->movq(R12, RSI);
+  assembler->ReserveAlignedFrameSpace(32);
+  assembler->movq(Address(RSP, 0), R12);
+  assembler->movq(RDI, RBX);
+  assembler->call(&runtime_entry);
+  assembler->testq(RAX, RAX);
+  assembler->j(ZERO, &null, Assembler::kNearJump);
+  assembler->movq(RAX, Address(RAX, 8));
+  assembler->Bind(&done);
+  assembler->leaq(RSP, Address(RBP, -16));
+  assembler->popq(R12);
+  assembler->popq(RBX);
+  assembler->popq(RBP);
+  assembler->ret();
+  assembler->Bind(&null);
+  assembler->LoadImmediate(RAX, Immediate(0));
+  assembler->jmp(&done);
+}
+
+// Immediates of all sizes, in moves, ALU operations and pushes.
+static void EmitImmediates(Assembler *assembler) {
+  static const int64_t kValues[] = {
+      0,          1,           -1,          0x7F,
+      0x80,       -0x80,       0x7FFFFFFF,  0x80000000,
+      0xFFFFFFFF, -0x80000000LL, 0x100000000LL, 0x123456789ABCDEFLL,
+      -0x123456789LL,
+  };
+  static const intptr_t kValueCount = sizeof(kValues) / sizeof(kValues[0]);
+  for (intptr_t i = 0; i < kValueCount; i++) {
+    const Immediate imm(kValues[i]);
+    assembler->movq(RAX, imm);
+    assembler->movq(R9, imm);
+    assembler->LoadImmediate(RCX, imm);
+    assembler->addq(RDX, imm);
+    assembler->andq(R10, imm);
+    assembler->cmpq(RSI, imm);
+    assembler->subq(R8, imm);
+    assembler->TestImmediate(RDI, imm);
+    assembler->movq(Address(RSP, 8), imm);
+    assembler->pushq(imm);
+    if (imm.is_int32()) {
+      assembler->movl(RBX, imm);
+      assembler->andl(R12, imm);
+      assembler->imulq(RDX, imm);
+      assembler->cmpq(Address(RBP, -8), imm);
+    }
+  }
+}
+
+// The memory operands, for every base, index and displacement size.
+static void EmitAddressing(Assembler *assembler) {
+  static const Register kBases[] = {RAX, RSP, RBP, R12, R13};
+  static const int32_t kDisplacements[] = {0, 0x10, -0x80, 0x1000};
+  for (intptr_t d = 0; d < 4; d++) {
+    const int32_t disp = kDisplacements[d];
+    for (intptr_t b = 0; b < 5; b++) {
+      const Register base = kBases[b];
+      assembler->movq(RCX, Address(base, disp));
+      assembler->movl(Address(base, disp), R9);
+      assembler->leaq(RDX, Address(base, RCX, TIMES_8, disp));
+      assembler->movq(R10, Address(base, R9, TIMES_4, disp));
+      assembler->addq(Address(base, disp), Immediate(1));
+      assembler->movsd(XMM1, Address(base, RAX, TIMES_1, disp));
+    }
+    assembler->leaq(RAX, Address(RCX, TIMES_8, disp));
+    assembler->movq(RAX, Address::AddressRIPRelative(disp));
+  }
+}
+
+// A sum over an array, and a nested loop with forward branches.
+static void EmitLoops(Assembler *assembler) {
+  Label loop, done;
+  assembler->xorl(RAX, RAX);
+  assembler->xorl(RCX, RCX);
+  assembler->testq(RSI, RSI);
+  assembler->j(ZERO, &done, Assembler::kNearJump);
+  assembler->Align(16, 0);
+  assembler->Bind(&loop);
+  assembler->addq(RAX, Address(RDI, RCX, TIMES_8, 0));
+  assembler->incq(RCX);
+  assembler->cmpq(RCX, RSI);
+  assembler->j(LESS, &loop);
+  assembler->Bind(&done);
+
+  Label outer, inner, skip, next, exit;
+  assembler->xorl(R8, R8);
+  assembler->Bind(&outer);
+  assembler->xorl(R9, R9);
+  assembler->Bind(&inner);
+  assembler->movq(R10, Address(RDI, R9, TIMES_8, 0));
+  assembler->CompareAndBranch(R10, Immediate(0), LESS, &skip);
+  assembler->imulq(R10, R8);
+  assembler->addq(RAX, R10);
+  assembler->Bind(&skip);
+  assembler->incq(R9);
+  assembler->CompareAndBranch(R9, RSI, LESS, &inner);
+  assembler->incq(R8);
+  assembler->cmpq(R8, Immediate(100));
+  assembler->j(GREATER_EQUAL, &exit);
+  assembler->TestAndBranch(RAX, Immediate(1), NOT_ZERO, &next,
+                           Assembler::kNearJump);
+  assembler->shrq(RAX, Immediate(1));
+  assembler->Bind(&next);
+  assembler->jmp(&outer);
+  assembler->Bind(&exit);
+  assembler->ret();
+}
+
+// y = a * x + y in SSE and AVX, and scalar arithmetic.
+static void EmitSimdKernels(Assembler *assembler) {
+  Label sse, avx;
+  assembler->xorl(RCX, RCX);
+  assembler->shufps(XMM0, XMM0, Immediate(0));
+  assembler->Bind(&sse);
+  assembler->movups(XMM1, Address(RDI, RCX, TIMES_4, 0));
+  assembler->mulps(XMM1, XMM0);
+  assembler->addps(XMM1, Address(RSI, RCX, TIMES_4, 0));
+  assembler->movups(Address(RSI, RCX, TIMES_4, 0), XMM1);
+  assembler->addq(RCX, Immediate(4));
+  assembler->cmpq(RCX, RDX);
+  assembler->j(LESS, &sse);
+
+  assembler->xorl(RCX, RCX);
+  assembler->Bind(&avx);
+  assembler->vmovups(YMM1, Address(RDI, RCX, TIMES_4, 0));
+  assembler->vmovups(YMM2, Address(RSI, RCX, TIMES_4, 0));
+  assembler->vmulps(YMM1, YMM1, YMM3);
+  assembler->vaddps(YMM1, YMM1, YMM2);
+  assembler->vmovups(Address(RSI, RCX, TIMES_4, 0), YMM1);
+  assembler->addq(RCX, Immediate(8));
+  assembler->cmpq(RCX, RDX);
+  assembler->j(LESS, &avx);
+
+  assembler->cvtsi2sdq(XMM4, RDX);
+  assembler->mulsd(XMM4, XMM4);
+  assembler->addsd(XMM4, Address(RDI, 0));
+  assembler->sqrtsd(XMM5, XMM4);
+  assembler->divsd(XMM5, XMM8);
+  assembler->movsd(Address(RSI, 0), XMM5);
+  assembler->ret();
+}
+
+// A compare chain dispatching on a small integer.
+static void EmitDispatch(Assembler *assembler) {
+  static const intptr_t kCases = 12;
+  Label cases[kCases], fallback, done;
+  for (intptr_t i = 0; i < kCases; i++) {
+    assembler->CompareAndBranch(RDI, Immediate(i * 3), EQUAL, &cases[i]);
+  }
+  assembler->jmp(&fallback);
+  for (intptr_t i = 0; i < kCases; i++) {
+    assembler->Bind(&cases[i]);
+    assembler->movl(RAX, Immediate(i * 1000));
+    assembler->jmp(&done);
+  }
+  assembler->Bind(&fallback);
+  assembler->movq(RAX, Immediate(-1));
+  assembler->Bind(&done);
+  assembler->ret();
+}
+
+// Overflow and bounds checks, with their failure paths in cold code.
+static void EmitChecks(Assembler *assembler) {
+  assembler->movq(RAX, Address(RDI, 8));
+  assembler->cmpq(RSI, RAX);
+  assembler->StopIf(ABOVE_EQUAL, "index out of range");
+  assembler->movq(RAX, Address(RDI, RSI, TIMES_8, 16));
+  assembler->addq(RAX, RDX);
+  assembler->StopIf(OVERFLOW, "overflow");
+  assembler->imulq(RAX, RCX);
+  assembler->StopIf(OVERFLOW, "overflow");
+  assembler->ret();
+}
+
+struct Snippet {
+  const char *name;
+  void (*emit)(Assembler *assembler);
+};
+
+static const Snippet kSnippets[] = {
+    {"call_stub", EmitCallStub},
+    {"immediates", EmitImmediates},
+    {"addressing", EmitAddressing},
+    {"loops", EmitLoops},
+    {"simd_kernels", EmitSimdKernels},
+    {"dispatch", EmitDispatch},
+    {"checks", EmitChecks},
+};
+static const intptr_t kSnippetCount = sizeof(kSnippets) / sizeof(kSnippets[0]);
+
+struct GoldenEncoding {
+  const char *name;
+  intptr_t size;
+  uint64_t hash;
+};
+
+// Update with the output of PrintGolden() after reviewing size changes.
+static const GoldenEncoding kGolden[] = {
+    {"call_stub", 63, 0xA31A494A7C409169},
+    {"immediates", 1154, 0x0B19F3DFA561CE74},
+    {"addressing", 744, 0x6FF882F3107D79AD},
+    {"loops", 85, 0x405893F124328F95},
+    {"simd_kernels", 94, 0x20232739DC76E627},
+    {"dispatch", 264, 0x11A2BCA16B7E16A4},
+    {"checks", 67, 0x2A1142E1B3A4C8CF},
+};
+static const intptr_t kGoldenCount = sizeof(kGolden) / sizeof(kGolden[0]);
+
+static uint64_t Hash(const uint8_t *bytes, intptr_t size) {
+  uint64_t hash = 0xCBF29CE484222325; // FNV-1a.
+  for (intptr_t i = 0; i < size; i++) {
+    hash = (hash ^ bytes[i]) * 0x100000001B3;
+  }
+  return hash;
+}
+
+static void Emit(const Snippet &snippet, intptr_t *size, uint64_t *hash) {
+  Assembler assembler;
+  snippet.emit(&assembler);
+  assembler.FinalizeCode();
+  *size = assembler.CodeSize();
+  *hash = Hash(reinterpret_cast<const uint8_t *>(assembler.CodeAddress(0)),
+               assembler.CodeSize());
+}
+
+bool CodeSizeCorpus::Check(FILE *out) {
+  bool passed = true;
+  intptr_t golden_total = 0;
+  intptr_t total = 0;
+  for (intptr_t i = 0; i < kSnippetCount; i++) {
+    const Snippet &snippet = kSnippets[i];
+    intptr_t size;
+    uint64_t hash;
+    Emit(snippet, &size, &hash);
+    total += size;
+    const GoldenEncoding *golden = NULL;
+    for (intptr_t j = 0; j < kGoldenCount; j++) {
+      if (strcmp(kGolden[j].name, snippet.name) == 0) {
+        golden = &kGolden[j];
+      }
+    }
+    if (golden == NULL) {
+      fprintf(out, "%s: %" PRIdPTR " bytes, no golden size\n", snippet.name,
+              size);
+      passed = false;
+      continue;
+    }
+    golden_total += golden->size;
+    if (size > golden->size) {
+      fprintf(out, "%s: %" PRIdPTR " -> %" PRIdPTR " bytes (+%" PRIdPTR
+                   "), FAILED\n",
+              snippet.name, golden->size, size, size - golden->size);
+      passed = false;
+    } else if (size < golden->size) {
+      fprintf(out, "%s: %" PRIdPTR " -> %" PRIdPTR " bytes (-%" PRIdPTR
+                   "), update the golden size\n",
+              snippet.name, golden->size, size, golden->size - size);
+    } else if (hash != golden->hash) {
+      fprintf(out, "%s: %" PRIdPTR " bytes, encoding changed\n",
+              snippet.name, size);
+    }
+  }
+  fprintf(out, "total: %" PRIdPTR " -> %" PRIdPTR " bytes, %s\n",
+          golden_total, total, passed ? "passed" : "FAILED");
+  return passed;
+}
+
+void CodeSizeCorpus::PrintGolden(FILE *out) {
+  for (intptr_t i = 0; i < kSnippetCount; i++) {
+    intptr_t size;
+    uint64_t hash;
+    Emit(kSnippets[i], &size, &hash);
+    fprintf(out, "    {\"%s\", %" PRIdPTR ", 0x%016" PRIX64 "},\n",
+            kSnippets[i].name, size, hash);
+  }
+}
@@ -0,0 +1,34 @@
+// Copyright (c) 2019, the Dart project authors.  Please see the AUTHORS file
+// for details. All rights reserved. Use of this source code is governed by a
+// BSD-style license that can be found in the LICENSE file.
+
+#pragma once
+
+#include <stdio.h>
+
+#include "globals.h"
+
+// A corpus of representative code (call stubs, immediates and addressing
+// modes, loops, SIMD kernels, dispatch and checks with cold code), with the
+// size and hash of its encoding when last reviewed: the golden values in
+// code_size_corpus.cc.
+//
+// Check() emits every snippet again and compares. Code that got bigger fails
+// the check, so that changes to the emitters (EmitComplex, AluQ,
+// movq(Register, Immediate), the Address constructors...) cannot grow code
+// unnoticed. Smaller code and encodings that changed at the same size are
+// reported, and the golden values are then updated with the output of
+// PrintGolden().
+class CodeSizeCorpus {
+public:
+  // Writes a line for each snippet whose size or encoding differs from its
+  // golden value to |out|, with the size difference, followed by the total.
+  // Returns false if any snippet got bigger.
+  static bool Check(FILE *out);
+
+  // Writes the current sizes and hashes as the golden table.
+  static void PrintGolden(FILE *out);
+
+private:
+  DISALLOW_IMPLICIT_CONSTRUCTORS(CodeSizeCorpus);
+};
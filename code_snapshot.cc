@@ -0,0 +1,317 @@
+// Copyright (c) 2019, the Dart project authors.  Please see the AUTHORS file
+// for details. All rights reserved. Use of this source code is governed by a
+// BSD-style license that can be found in the LICENSE file.
+
+#include "code_snapshot.h"
+
+#include <cpuid.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static const uint64_t kSnapshotMagic = 0x544F4853444F4323ULL; // "#CODSHOT"
+// Must change whenever the file layout, the layout of
+// Assembler::Relocation or the meaning of the relocations changes.
+static const uint32_t kSnapshotVersion = 1;
+
+struct CodeSnapshot::Header {
+  uint64_t magic;
+  uint32_t version;
+  uint32_t code_count;
+  uint64_t cpu_fingerprint;
+  uint64_t symbol_count;
+  uint64_t file_size;
+};
+
+// Offsets are from the start of the file.
+struct CodeSnapshot::Entry {
+  int64_t key;
+  int64_t code_offset;
+  int64_t size;
+  int64_t prologue_offset;
+  int64_t relocations_offset;
+  int64_t relocation_count;
+};
+
+void CodeSnapshotWriter::AddCode(intptr_t key, Assembler *assembler) {
+  ASSERT(assembler->is_finalized());
+  ASSERT(assembler->code_address() == 0);
+  ASSERT(!HasKey(key));
+  CodeSnapshot::Entry entry;
+  entry.key = key;
+  entry.code_offset = code_.Size();
+  entry.size = assembler->CodeSize();
+  entry.prologue_offset = assembler->prologue_offset();
+  entry.relocations_offset = relocations_.Size();
+  entry.relocation_count = assembler->RelocationCount();
+  {
+    AssemblerBuffer::EnsureCapacity ensured(&entries_);
+    entries_.Emit<CodeSnapshot::Entry>(entry);
+  }
+
+  for (intptr_t j = 0; j < assembler->RelocationCount(); j++) {
+    // Keep the padding of the structure deterministic.
+    Assembler::Relocation relocation;
+    memset(&relocation, 0, sizeof(relocation));
+    const Assembler::Relocation source = assembler->RelocationAt(j);
+    relocation.offset = source.offset;
+    relocation.kind = source.kind;
+    relocation.symbol = source.symbol;
+    relocation.addend = source.addend;
+    AssemblerBuffer::EnsureCapacity ensured(&relocations_);
+    relocations_.Emit<Assembler::Relocation>(relocation);
+    AddSymbol(relocation.symbol);
+  }
+
+  const uint8_t *bytes =
+      reinterpret_cast<const uint8_t *>(assembler->CodeAddress(0));
+  for (intptr_t i = 0; i < assembler->CodeSize(); i++) {
+    AssemblerBuffer::EnsureCapacity ensured(&code_);
+    code_.Emit<uint8_t>(bytes[i]);
+  }
+  while (!Utils::IsAligned(code_.Size(), sizeof(int64_t))) {
+    AssemblerBuffer::EnsureCapacity ensured(&code_);
+    code_.Emit<uint8_t>(Instr::kBreakPointInstruction);
+  }
+}
+
+bool CodeSnapshotWriter::HasKey(intptr_t key) {
+  for (intptr_t i = 0; i < entries_.Size(); i += sizeof(CodeSnapshot::Entry)) {
+    if (entries_.Load<CodeSnapshot::Entry>(i).key == key) {
+      return true;
+    }
+  }
+  return false;
+}
+
+void CodeSnapshotWriter::AddSymbol(intptr_t symbol) {
+  for (intptr_t i = 0; i < symbols_.Size(); i += sizeof(int64_t)) {
+    if (symbols_.Load<int64_t>(i) == symbol) {
+      return;
+    }
+  }
+  AssemblerBuffer::EnsureCapacity ensured(&symbols_);
+  symbols_.Emit<int64_t>(symbol);
+}
+
+static bool WriteFully(int fd, uword data, intptr_t size) {
+  while (size > 0) {
+    const ssize_t written = write(fd, reinterpret_cast<void *>(data), size);
+    if (written < 0) {
+      return false;
+    }
+    data += written;
+    size -= written;
+  }
+  return true;
+}
+
+bool CodeSnapshotWriter::WriteToFile(const char *path) {
+  const intptr_t entry_count = entries_.Size() / sizeof(CodeSnapshot::Entry);
+  const intptr_t entries_offset = sizeof(CodeSnapshot::Header);
+  const intptr_t symbols_offset = entries_offset + entries_.Size();
+  const intptr_t relocations_offset = symbols_offset + symbols_.Size();
+  const intptr_t code_offset = relocations_offset + relocations_.Size();
+  ASSERT(Utils::IsAligned(code_offset, sizeof(int64_t)));
+
+  CodeSnapshot::Header header;
+  memset(&header, 0, sizeof(header));
+  header.magic = kSnapshotMagic;
+  header.version = kSnapshotVersion;
+  header.code_count = entry_count;
+  header.cpu_fingerprint = CodeSnapshot::CpuFingerprint();
+  header.symbol_count = symbols_.Size() / sizeof(int64_t);
+  header.file_size = code_offset + code_.Size();
+
+  for (intptr_t i = 0; i < entries_.Size(); i += sizeof(CodeSnapshot::Entry)) {
+    CodeSnapshot::Entry entry = entries_.Load<CodeSnapshot::Entry>(i);
+    entry.code_offset += code_offset;
+    entry.relocations_offset += relocations_offset;
+    entries_.Store<CodeSnapshot::Entry>(i, entry);
+  }
+
+  // Write a temporary file and rename it, so that a concurrent or crashed
+  // writer never leaves a truncated snapshot behind.
+  char temp_path[PATH_MAX];
+  if (snprintf(temp_path, sizeof(temp_path), "%s.%d", path, getpid()) >=
+      static_cast<int>(sizeof(temp_path))) {
+    return false;
+  }
+  const int fd = open(temp_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) {
+    return false;
+  }
+  bool ok = WriteFully(fd, reinterpret_cast<uword>(&header), sizeof(header)) &&
+            WriteFully(fd, entries_.contents(), entries_.Size()) &&
+            WriteFully(fd, symbols_.contents(), symbols_.Size()) &&
+            WriteFully(fd, relocations_.contents(), relocations_.Size()) &&
+            WriteFully(fd, code_.contents(), code_.Size());
+  ok = (close(fd) == 0) && ok;
+  ok = ok && (rename(temp_path, path) == 0);
+  if (!ok) {
+    unlink(temp_path);
+  }
+
+  for (intptr_t i = 0; i < entries_.Size(); i += sizeof(CodeSnapshot::Entry)) {
+    CodeSnapshot::Entry entry = entries_.Load<CodeSnapshot::Entry>(i);
+    entry.code_offset -= code_offset;
+    entry.relocations_offset -= relocations_offset;
+    entries_.Store<CodeSnapshot::Entry>(i, entry);
+  }
+  return ok;
+}
+
+CodeSnapshot::~CodeSnapshot() { Close(); }
+
+bool CodeSnapshot::Open(const char *path, CodeCache *cache) {
+  Close();
+  const int fd = open(path, O_RDONLY);
+  if (fd < 0) {
+    return false;
+  }
+  struct stat status;
+  if (fstat(fd, &status) != 0 ||
+      status.st_size < static_cast<off_t>(sizeof(Header))) {
+    close(fd);
+    return false;
+  }
+  void *mapping = mmap(NULL, status.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (mapping == MAP_FAILED) {
+    return false;
+  }
+  mapping_ = reinterpret_cast<const uint8_t *>(mapping);
+  mapping_size_ = status.st_size;
+  cache_ = cache;
+  if (!Validate()) {
+    Close();
+    return false;
+  }
+  return true;
+}
+
+void CodeSnapshot::Close() {
+  if (mapping_ != NULL) {
+    munmap(const_cast<uint8_t *>(mapping_), mapping_size_);
+  }
+  mapping_ = NULL;
+  mapping_size_ = 0;
+  cache_ = NULL;
+}
+
+const CodeSnapshot::Header *CodeSnapshot::header() const {
+  return reinterpret_cast<const Header *>(mapping_);
+}
+
+const CodeSnapshot::Entry *CodeSnapshot::EntryAt(intptr_t index) const {
+  ASSERT(0 <= index && index < Length());
+  return reinterpret_cast<const Entry *>(mapping_ + sizeof(Header)) + index;
+}
+
+intptr_t CodeSnapshot::Length() const {
+  return mapping_ != NULL ? header()->code_count : 0;
+}
+
+// Checks everything Install() relies on, so that a stale or damaged file is
+// rejected instead of crashing.
+bool CodeSnapshot::Validate() {
+  const Header *h = header();
+  if (h->magic != kSnapshotMagic || h->version != kSnapshotVersion ||
+      h->file_size != static_cast<uint64_t>(mapping_size_) ||
+      h->cpu_fingerprint != CpuFingerprint()) {
+    return false;
+  }
+  const uint64_t symbols_offset =
+      sizeof(Header) + static_cast<uint64_t>(h->code_count) * sizeof(Entry);
+  if (h->symbol_count > static_cast<uint64_t>(mapping_size_) ||
+      symbols_offset + h->symbol_count * sizeof(int64_t) > h->file_size) {
+    return false;
+  }
+  const int64_t *symbols =
+      reinterpret_cast<const int64_t *>(mapping_ + symbols_offset);
+  for (uint64_t i = 0; i < h->symbol_count; i++) {
+    if (!cache_->HasExternalSymbol(symbols[i])) {
+      return false;
+    }
+  }
+  const int64_t file_size = h->file_size;
+  for (intptr_t i = 0; i < Length(); i++) {
+    const Entry *entry = EntryAt(i);
+    if (entry->size < 0 || entry->code_offset < 0 ||
+        entry->code_offset > file_size - entry->size ||
+        entry->prologue_offset < -1 || entry->prologue_offset > entry->size ||
+        entry->relocation_count < 0 ||
+        entry->relocation_count >
+            file_size / static_cast<int64_t>(sizeof(Assembler::Relocation)) ||
+        entry->relocations_offset < 0 ||
+        !Utils::IsAligned(entry->relocations_offset, sizeof(int64_t)) ||
+        entry->relocations_offset >
+            file_size - entry->relocation_count *
+                            static_cast<int64_t>(
+                                sizeof(Assembler::Relocation))) {
+      return false;
+    }
+    const Assembler::Relocation *relocations =
+        reinterpret_cast<const Assembler::Relocation *>(
+            mapping_ + entry->relocations_offset);
+    for (intptr_t j = 0; j < entry->relocation_count; j++) {
+      const Assembler::Relocation &relocation = relocations[j];
+      if (relocation.offset < 0 || relocation.offset > entry->size - 4 ||
+          (relocation.kind != Assembler::kPcRelativeCall &&
+           relocation.kind != Assembler::kPcRelativeTailCall &&
+           relocation.kind != Assembler::kPcRelativeAddress) ||
+          !cache_->HasExternalSymbol(relocation.symbol)) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+const CachedCode *CodeSnapshot::Install(intptr_t key) {
+  for (intptr_t i = 0; i < Length(); i++) {
+    const Entry *entry = EntryAt(i);
+    if (entry->key == key) {
+      return cache_->Install(
+          mapping_ + entry->code_offset, entry->size, entry->prologue_offset,
+          reinterpret_cast<const Assembler::Relocation *>(
+              mapping_ + entry->relocations_offset),
+          entry->relocation_count);
+    }
+  }
+  return NULL;
+}
+
+// The vendor, family, model and stepping, and the feature flags of the
+// basic and extended feature leaves.
+uint64_t CodeSnapshot::CpuFingerprint() {
+  static const uint64_t kMultiplier = 0x9E3779B97F4A7C15ULL;
+  uint32_t eax, ebx, ecx, edx;
+  uint64_t fingerprint = 0;
+  const uint32_t max_leaf = __get_cpuid_max(0, NULL);
+  __cpuid(0, eax, ebx, ecx, edx);
+  fingerprint = (fingerprint ^ ebx) * kMultiplier;
+  fingerprint = (fingerprint ^ ecx) * kMultiplier;
+  fingerprint = (fingerprint ^ edx) * kMultiplier;
+  if (max_leaf >= 1) {
+    __cpuid(1, eax, ebx, ecx, edx);
+    fingerprint = (fingerprint ^ eax) * kMultiplier;
+    fingerprint = (fingerprint ^ ecx) * kMultiplier;
+    fingerprint = (fingerprint ^ edx) * kMultiplier;
+  }
+  if (max_leaf >= 7) {
+    __cpuid_count(7, 0, eax, ebx, ecx, edx);
+    fingerprint = (fingerprint ^ ebx) * kMultiplier;
+    fingerprint = (fingerprint ^ ecx) * kMultiplier;
+    fingerprint = (fingerprint ^ edx) * kMultiplier;
+  }
+  if (__get_cpuid_max(0x80000000, NULL) >= 0x80000001) {
+    __cpuid(0x80000001, eax, ebx, ecx, edx);
+    fingerprint = (fingerprint ^ ecx) * kMultiplier;
+    fingerprint = (fingerprint ^ edx) * kMultiplier;
+  }
+  return fingerprint;
+}
@@ -0,0 +1,83 @@
+// Copyright (c) 2019, the Dart project authors.  Please see the AUTHORS file
+// for details. All rights reserved. Use of this source code is governed by a
+// BSD-style license that can be found in the LICENSE file.
+
+#pragma once
+
+#include "assembler.h"
+#include "code_cache.h"
+#include "globals.h"
+
+// A snapshot file holds finalized, unrelocated code objects keyed by
+// embedder-chosen integers, so that a process can install them into a
+// CodeCache at startup instead of generating them again.
+//
+// The file is mapped and used in place: a header, the code entries, the
+// external symbols referenced by the code, the relocations and the code
+// bytes. It is only valid for the same snapshot version and on a CPU with
+// the same features, since the code may use any of them; external symbols
+// are resolved again when the code is installed.
+
+// Collects code objects and writes them to a snapshot file.
+class CodeSnapshotWriter : public ValueObject {
+public:
+  CodeSnapshotWriter() {}
+  ~CodeSnapshotWriter() {}
+
+  // Adds the code of |assembler|, which must have been finalized and be
+  // position independent (no code_address()), as |key|.
+  void AddCode(intptr_t key, Assembler *assembler);
+
+  // Writes the file, replacing |path| atomically. Returns false on I/O
+  // errors.
+  bool WriteToFile(const char *path);
+
+private:
+  bool HasKey(intptr_t key);
+  void AddSymbol(intptr_t symbol);
+
+  // Offsets in the entries are relative to relocations_ and code_ until
+  // written.
+  AssemblerBuffer entries_;
+  AssemblerBuffer symbols_;
+  AssemblerBuffer relocations_;
+  AssemblerBuffer code_;
+
+  DISALLOW_COPY_AND_ASSIGN(CodeSnapshotWriter);
+};
+
+// A snapshot file mapped for installing its code.
+class CodeSnapshot : public ValueObject {
+public:
+  CodeSnapshot() : mapping_(NULL), mapping_size_(0), cache_(NULL) {}
+  ~CodeSnapshot();
+
+  // Maps |path| for installing its code into |cache|. Returns false, and
+  // code must be generated instead, if the file is missing or malformed, is
+  // of another version or CPU, or refers to external symbols not in |cache|.
+  bool Open(const char *path, CodeCache *cache);
+
+  intptr_t Length() const;
+  // Installs the code saved as |key| into the cache, as CodeCache::Install.
+  // Returns NULL if there is no such code.
+  const CachedCode *Install(intptr_t key);
+
+  // Identifies the features of the host CPU.
+  static uint64_t CpuFingerprint();
+
+private:
+  struct Header;
+  struct Entry;
+
+  const Header *header() const;
+  const Entry *EntryAt(intptr_t index) const;
+  bool Validate();
+  void Close();
+
+  const uint8_t *mapping_;
+  intptr_t mapping_size_;
+  CodeCache *cache_;
+
+  friend class CodeSnapshotWriter;
+  DISALLOW_COPY_AND_ASSIGN(CodeSnapshot);
+};
@@ -0,0 +1,242 @@
+// Copyright (c) 2019, the Dart project authors.  Please see the AUTHORS file
+// for details. All rights reserved. Use of this source code is governed by a
+// BSD-style license that can be found in the LICENSE file.
+
+#include "compile_scheduler.h"
+
+struct CompileScheduler::Job {
+  EmitFunction emit;
+  void *argument;
+  // The worker that compiled the job, and the code in its buffer.
+  intptr_t worker;
+  intptr_t offset;
+  intptr_t size;
+  uword entry_point;
+};
+
+struct CompileScheduler::Worker {
+  CompileScheduler *scheduler;
+  intptr_t index;
+  pthread_t thread;
+  // The jobs not taken yet, as (begin << 32) | end. The worker takes jobs
+  // from the beginning, and thieves take the end.
+  std::atomic<uint64_t> range;
+  Assembler assembler;
+  // The code of the jobs compiled by the worker in the current batch.
+  uint8_t *code;
+  intptr_t code_size;
+  intptr_t code_capacity;
+};
+
+static uint64_t Range(uint64_t begin, uint64_t end) {
+  return (begin << 32) | end;
+}
+static intptr_t RangeBegin(uint64_t range) { return range >> 32; }
+static intptr_t RangeEnd(uint64_t range) { return range & 0xFFFFFFFF; }
+
+CompileScheduler::CompileScheduler(intptr_t thread_count)
+    : thread_count_(thread_count), jobs_(NULL), job_count_(0),
+      job_capacity_(0), first_pending_(0), batch_(0), running_(0),
+      stopping_(false), steals_(0) {
+  ASSERT(thread_count > 0);
+  pthread_mutex_init(&mutex_, NULL);
+  pthread_cond_init(&condition_, NULL);
+  workers_ = new Worker[thread_count];
+  for (intptr_t i = 0; i < thread_count; i++) {
+    Worker *worker = &workers_[i];
+    worker->scheduler = this;
+    worker->index = i;
+    worker->range.store(0, std::memory_order_relaxed);
+    worker->code = NULL;
+    worker->code_size = 0;
+    worker->code_capacity = 0;
+    // Worker 0 is the calling thread.
+    if (i > 0 &&
+        pthread_create(&worker->thread, NULL, WorkerMain, worker) != 0) {
+      FATAL("Cannot create a compiler thread");
+    }
+  }
+}
+
+CompileScheduler::~CompileScheduler() {
+  pthread_mutex_lock(&mutex_);
+  stopping_ = true;
+  pthread_cond_broadcast(&condition_);
+  pthread_mutex_unlock(&mutex_);
+  for (intptr_t i = 0; i < thread_count_; i++) {
+    if (i > 0) {
+      pthread_join(workers_[i].thread, NULL);
+    }
+    free(workers_[i].code);
+  }
+  delete[] workers_;
+  free(jobs_);
+  pthread_cond_destroy(&condition_);
+  pthread_mutex_destroy(&mutex_);
+}
+
+intptr_t CompileScheduler::AddJob(EmitFunction emit, void *argument) {
+  if (job_count_ == job_capacity_) {
+    job_capacity_ = job_capacity_ == 0 ? 64 : 2 * job_capacity_;
+    jobs_ =
+        reinterpret_cast<Job *>(realloc(jobs_, job_capacity_ * sizeof(Job)));
+  }
+  Job *job = &jobs_[job_count_];
+  job->emit = emit;
+  job->argument = argument;
+  job->worker = -1;
+  job->offset = 0;
+  job->size = 0;
+  job->entry_point = 0;
+  return job_count_++;
+}
+
+void CompileScheduler::Clear() {
+  job_count_ = 0;
+  first_pending_ = 0;
+}
+
+uword CompileScheduler::EntryPoint(intptr_t job) const {
+  ASSERT(job >= 0 && job < first_pending_);
+  return jobs_[job].entry_point;
+}
+
+intptr_t CompileScheduler::CodeSize(intptr_t job) const {
+  ASSERT(job >= 0 && job < first_pending_);
+  return jobs_[job].size;
+}
+
+void CompileScheduler::Compile(CodeHeap::Thread *thread) {
+  const intptr_t begin = first_pending_;
+  const intptr_t count = job_count_ - begin;
+  ASSERT(job_count_ < 0xFFFFFFFF);
+  if (count == 0) {
+    return;
+  }
+  // Contiguous ranges, so that a thread compiles related jobs.
+  for (intptr_t i = 0; i < thread_count_; i++) {
+    Worker *worker = &workers_[i];
+    worker->code_size = 0;
+    worker->range.store(Range(begin + count * i / thread_count_,
+                              begin + count * (i + 1) / thread_count_),
+                        std::memory_order_relaxed);
+  }
+  steals_.store(0, std::memory_order_relaxed);
+
+  pthread_mutex_lock(&mutex_);
+  batch_++;
+  running_ = thread_count_ - 1;
+  pthread_cond_broadcast(&condition_);
+  pthread_mutex_unlock(&mutex_);
+  RunWorker(&workers_[0]);
+  pthread_mutex_lock(&mutex_);
+  while (running_ > 0) {
+    pthread_cond_wait(&condition_, &mutex_);
+  }
+  pthread_mutex_unlock(&mutex_);
+
+  for (intptr_t i = begin; i < job_count_; i++) {
+    Job *job = &jobs_[i];
+    const Worker *worker = &workers_[job->worker];
+    job->entry_point = thread->Allocate(job->size);
+    memmove(reinterpret_cast<void *>(job->entry_point),
+            worker->code + job->offset, job->size);
+  }
+  first_pending_ = job_count_;
+}
+
+void *CompileScheduler::WorkerMain(void *argument) {
+  Worker *worker = reinterpret_cast<Worker *>(argument);
+  CompileScheduler *scheduler = worker->scheduler;
+  intptr_t batch = 0;
+  pthread_mutex_lock(&scheduler->mutex_);
+  for (;;) {
+    while (!scheduler->stopping_ && scheduler->batch_ == batch) {
+      pthread_cond_wait(&scheduler->condition_, &scheduler->mutex_);
+    }
+    if (scheduler->stopping_) {
+      break;
+    }
+    batch = scheduler->batch_;
+    pthread_mutex_unlock(&scheduler->mutex_);
+    scheduler->RunWorker(worker);
+    pthread_mutex_lock(&scheduler->mutex_);
+    if (--scheduler->running_ == 0) {
+      pthread_cond_broadcast(&scheduler->condition_);
+    }
+  }
+  pthread_mutex_unlock(&scheduler->mutex_);
+  return NULL;
+}
+
+void CompileScheduler::RunWorker(Worker *worker) {
+  do {
+    for (intptr_t index = TakeJob(worker); index >= 0;
+         index = TakeJob(worker)) {
+      CompileJob(worker, index);
+    }
+  } while (Steal(worker));
+}
+
+intptr_t CompileScheduler::TakeJob(Worker *worker) {
+  uint64_t range = worker->range.load(std::memory_order_acquire);
+  do {
+    if (RangeBegin(range) == RangeEnd(range)) {
+      return -1;
+    }
+  } while (!worker->range.compare_exchange_weak(
+      range, Range(RangeBegin(range) + 1, RangeEnd(range)),
+      std::memory_order_acquire, std::memory_order_acquire));
+  return RangeBegin(range);
+}
+
+bool CompileScheduler::Steal(Worker *thief) {
+  for (intptr_t i = 1; i < thread_count_; i++) {
+    Worker *victim = &workers_[(thief->index + i) % thread_count_];
+    uint64_t range = victim->range.load(std::memory_order_acquire);
+    for (;;) {
+      const intptr_t begin = RangeBegin(range);
+      const intptr_t end = RangeEnd(range);
+      // The victim keeps the last job, which it may be taking.
+      if (end - begin < 2) {
+        break;
+      }
+      const intptr_t middle = begin + (end - begin + 1) / 2;
+      if (victim->range.compare_exchange_weak(range, Range(begin, middle),
+                                              std::memory_order_acq_rel,
+                                              std::memory_order_acquire)) {
+        // Thieves leave empty ranges alone, so the range of |thief| is only
+        // written here.
+        thief->range.store(Range(middle, end), std::memory_order_release);
+        steals_.fetch_add(1, std::memory_order_relaxed);
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
+void CompileScheduler::CompileJob(Worker *worker, intptr_t index) {
+  Job *job = &jobs_[index];
+  Assembler *assembler = &worker->assembler;
+  assembler->Reset();
+  job->emit(assembler, job->argument);
+  assembler->FinalizeCode();
+  ASSERT(assembler->code_address() == 0);
+  ASSERT(assembler->RelocationCount() == 0);
+  const intptr_t size = assembler->CodeSize();
+  if (worker->code_size + size > worker->code_capacity) {
+    worker->code_capacity = 2 * worker->code_capacity;
+    if (worker->code_capacity < worker->code_size + size) {
+      worker->code_capacity = worker->code_size + size;
+    }
+    worker->code = reinterpret_cast<uint8_t *>(
+        realloc(worker->code, worker->code_capacity));
+  }
+  memmove(worker->code + worker->code_size,
+          reinterpret_cast<void *>(assembler->CodeAddress(0)), size);
+  job->worker = worker->index;
+  job->offset = worker->code_size;
+  job->size = size;
+  worker->code_size += size;
+}
@@ -0,0 +1,95 @@
+// Copyright (c) 2019, the Dart project authors.  Please see the AUTHORS file
+// for details. All rights reserved. Use of this source code is governed by a
+// BSD-style license that can be found in the LICENSE file.
+
+#pragma once
+
+#include <pthread.h>
+
+#include "assembler.h"
+#include "code_heap.h"
+#include "globals.h"
+
+// Compiles batches of independent jobs in parallel, such as the stubs
+// generated at startup, and installs them in a CodeHeap.
+//
+// A job is a function emitting position independent code, without
+// relocations, into an Assembler. The jobs of a batch are divided into
+// ranges, one per thread; each thread compiles the jobs of its range in
+// order, and steals the second half of the range of another thread once
+// its own is empty. Each thread reuses its Assembler, Reset() between jobs,
+// and copies the code it compiled into a buffer of its own.
+//
+// Once all jobs are compiled, the calling thread installs them in the order
+// they were added, whichever thread compiled them, so that the layout of
+// the code in the heap is the same on every run:
+//
+//     CompileScheduler scheduler(thread_count);
+//     for (...) scheduler.AddJob(GenerateStub, &stubs[i]);
+//     scheduler.Compile(&heap_thread);
+//     ... scheduler.EntryPoint(i) ...
+class CompileScheduler {
+public:
+  // Emits the code of a job, with the |argument| passed to AddJob().
+  typedef void (*EmitFunction)(Assembler *assembler, void *argument);
+
+  // Compiles on the calling thread and |thread_count| - 1 worker threads,
+  // started here.
+  explicit CompileScheduler(intptr_t thread_count);
+  // Stops the worker threads.
+  ~CompileScheduler();
+
+  // Adds a job to the next batch. Returns its index.
+  intptr_t AddJob(EmitFunction emit, void *argument);
+
+  // Compiles the jobs added since the last Compile(), and installs them
+  // with |thread|, the CodeHeap::Thread of the calling thread.
+  void Compile(CodeHeap::Thread *thread);
+
+  intptr_t JobCount() const { return job_count_; }
+  // Of a compiled job.
+  uword EntryPoint(intptr_t job) const;
+  intptr_t CodeSize(intptr_t job) const;
+
+  // Drops all jobs; the installed code is not freed.
+  void Clear();
+
+  intptr_t thread_count() const { return thread_count_; }
+  // The ranges of jobs stolen during the last Compile().
+  intptr_t steals() const { return steals_.load(std::memory_order_relaxed); }
+
+private:
+  struct Job;
+  struct Worker;
+
+  static void *WorkerMain(void *worker);
+  // Compiles jobs until none is left to compile or steal.
+  void RunWorker(Worker *worker);
+  void CompileJob(Worker *worker, intptr_t index);
+  // Takes the next job of the range of |worker|, or -1 if none.
+  intptr_t TakeJob(Worker *worker);
+  // Moves half of the range of another worker to |thief|. Returns false if
+  // none has jobs left.
+  bool Steal(Worker *thief);
+
+  intptr_t thread_count_;
+  Worker *workers_;
+
+  Job *jobs_;
+  intptr_t job_count_;
+  intptr_t job_capacity_;
+  // The first job not compiled yet.
+  intptr_t first_pending_;
+
+  pthread_mutex_t mutex_;
+  pthread_cond_t condition_;
+  // Incremented to start a batch; guarded by mutex_.
+  intptr_t batch_;
+  // The worker threads still compiling the batch; guarded by mutex_.
+  intptr_t running_;
+  bool stopping_;
+
+  std::atomic<intptr_t> steals_;
+
+  DISALLOW_COPY_AND_ASSIGN(CompileScheduler);
+};
@@ -84,6 +84,28 @@ enum XmmRegister {
   kNoXmmRegister = -1 // Signals an illegal register.
 };
 
+// The 256-bit AVX registers; YMMn extends XMMn.
+enum YmmRegister {
+  YMM0 = 0,
+  YMM1 = 1,
+  YMM2 = 2,
+  YMM3 = 3,
+  YMM4 = 4,
+  YMM5 = 5,
+  YMM6 = 6,
+  YMM7 = 7,
+  YMM8 = 8,
+  YMM9 = 9,
+  YMM10 = 10,
+  YMM11 = 11,
+  YMM12 = 12,
+  YMM13 = 13,
+  YMM14 = 14,
+  YMM15 = 15,
+  kNumberOfYmmRegisters = 16,
+  kNoYmmRegister = -1 // Signals an illegal register.
+};
+
 // Architecture independent aliases.
 typedef XmmRegister FpuRegister;
 const FpuRegister FpuTMP = XMM15;
@@ -296,6 +318,5 @@ private:
   DISALLOW_IMPLICIT_CONSTRUCTORS(Instr);
 };
 
-// The largest multibyte nop we will emit.  This could go up to 15 if it
-// becomes important to us.
-const int MAX_NOP_SIZE = 8;
+// The largest multibyte nop we will emit.
+const int MAX_NOP_SIZE = 15;
@@ -44,9 +44,12 @@ enum Condition {
   INVALID_CONDITION = 16
 };
 
+static inline Condition InvertCondition(Condition c) {
+  ASSERT(c != INVALID_CONDITION);
+  return static_cast<Condition>(c ^ 1);
+}
+
 #define X86_ZERO_OPERAND_1_BYTE_INSTRUCTIONS(F)                                \
-  F(ret, 0xC3)                                                                 \
-  F(leave, 0xC9)                                                               \
   F(hlt, 0xF4)                                                                 \
   F(cld, 0xFC)                                                                 \
   F(int3, 0xCC)                                                                \
@@ -92,6 +95,18 @@ enum Condition {
   F(max, 0xF)
 // clang-format on
 
+// The subset of XMM_ALU_CODES that take two sources in their VEX form.
+#define AVX_BINARY_ALU_CODES(F)                                                \
+  F(and, 4)                                                                    \
+  F(or, 6)                                                                     \
+  F(xor, 7)                                                                    \
+  F(add, 8)                                                                    \
+  F(mul, 9)                                                                    \
+  F(sub, 0xC)                                                                  \
+  F(min, 0xD)                                                                  \
+  F(div, 0xE)                                                                  \
+  F(max, 0xF)
+
 // Table 3-1, first part
 #define XMM_CONDITIONAL_CODES(F)                                               \
   F(eq, 0)                                                                     \
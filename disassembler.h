@@ -0,0 +1,72 @@
+// Copyright (c) 2019, the Dart project authors.  Please see the AUTHORS file
+// for details. All rights reserved. Use of this source code is governed by a
+// BSD-style license that can be found in the LICENSE file.
+
+#pragma once
+
+#include <stdio.h>
+
+#include "assembler.h"
+#include "globals.h"
+
+// Decodes x86-64 machine code into Intel syntax, for auditing generated code
+// without going through objdump.
+//
+// Every instruction the Assembler can emit is decoded, with its mnemonics
+// (movq, addl, cmovzq, movzxbq...; SSE and AVX instructions use the Intel
+// mnemonics) and the register names of cpu_reg_names and fpu_reg_names.
+// Operands are separated by "," and immediates and displacements are in
+// hex, e.g. "addq [rsp+0x8],-0x1". Bytes that do not decode are "(bad)".
+//
+// Decoding allocates nothing and the output is written in large chunks, so
+// a whole code heap can be disassembled in milliseconds. Since it shares no
+// code with the Assembler, it can serve as an independent check of the
+// emitters: the instruction decoded from the bytes of an emitter must be
+// the one requested, with the length that was emitted.
+class Disassembler {
+public:
+  static const intptr_t kMaxTextLength = 96;
+
+  struct Instruction {
+    intptr_t length; // At least 1.
+    bool is_valid;   // The text of an invalid instruction is "(bad)".
+    // Direct branches (jmp, jcc and call rel) give the offset of their
+    // target relative to the start of the code.
+    bool has_branch_target;
+    int64_t branch_target;
+    // The bytes of each part of a valid instruction: legacy and VEX
+    // prefixes, REX prefix, opcode, ModRM and SIB, displacement (including
+    // that of a branch) and immediate.
+    uint8_t prefix_length;
+    uint8_t rex_length;
+    uint8_t opcode_length;
+    uint8_t modrm_length;
+    uint8_t displacement_length;
+    uint8_t immediate_length;
+    char text[kMaxTextLength];
+  };
+
+  // Decodes the instruction at |offset| in the |length| bytes at |code|.
+  // Branch targets are shown as offsets into |code|.
+  static void Decode(const uint8_t *code, intptr_t length, intptr_t offset,
+                     Instruction *instruction);
+
+  // Writes one line per instruction to |out|: its offset, its bytes and its
+  // text. Branch targets within the code get labels (L1, L2...), which head
+  // the instructions they point to. Targets outside of the code are shown
+  // as addresses if the code is at |base|, and as offsets if |base| is 0.
+  static void Disassemble(const uint8_t *code, intptr_t length, uword base,
+                          FILE *out);
+  static void Disassemble(const AssemblerBuffer &buffer, FILE *out) {
+    Disassemble(reinterpret_cast<const uint8_t *>(buffer.contents()),
+                buffer.Size(), 0, out);
+  }
+  // The code of |assembler|, at its code_address() if set.
+  static void Disassemble(Assembler *assembler, FILE *out) {
+    Disassemble(reinterpret_cast<const uint8_t *>(assembler->CodeAddress(0)),
+                assembler->CodeSize(), assembler->code_address(), out);
+  }
+
+private:
+  DISALLOW_IMPLICIT_CONSTRUCTORS(Disassembler);
+};
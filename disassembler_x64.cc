@@ -0,0 +1,1301 @@
+// Copyright (c) 2019, the Dart project authors.  Please see the AUTHORS file
+// for details. All rights reserved. Use of this source code is governed by a
+// BSD-style license that can be found in the LICENSE file.
+
+#include "disassembler.h"
+
+static const char *const kConditionNames[16] = {
+    "o", "no", "c", "nc", "z", "nz", "na", "a",
+    "s", "ns", "pe", "po", "l", "ge", "le", "g"};
+
+static const char *const kAluNames[8] = {"add", "or",  "adc", "sbb",
+                                         "and", "sub", "xor", "cmp"};
+
+// Group 2; /6 is undefined.
+static const char *const kShiftNames[8] = {"rol", "ror", "rcl", "rcr",
+                                           "shl", "shr", NULL,  "sar"};
+
+// Group 3, without test (/0).
+static const char *const kUnaryNames[8] = {NULL,  NULL,   "not", "neg",
+                                           "mul", "imul", "div", "idiv"};
+
+static const char *const kByteRegisterNames[16] = {
+    "al",  "cl",  "dl",   "bl",   "spl",  "bpl",  "sil",  "dil",
+    "r8b", "r9b", "r10b", "r11b", "r12b", "r13b", "r14b", "r15b"};
+
+// Registers 4 to 7 without a REX prefix.
+static const char *const kHighByteRegisterNames[4] = {"ah", "ch", "dh", "bh"};
+
+static const char *const kYmmRegisterNames[16] = {
+    "ymm0", "ymm1", "ymm2",  "ymm3",  "ymm4",  "ymm5",  "ymm6",  "ymm7",
+    "ymm8", "ymm9", "ymm10", "ymm11", "ymm12", "ymm13", "ymm14", "ymm15"};
+
+// The 0x0F 0x50 + code instructions.
+static const char *const kXmmAluNames[16] = {
+#define XMM_ALU_NAME(name, code) #name,
+    XMM_ALU_CODES(XMM_ALU_NAME)
+#undef XMM_ALU_NAME
+};
+
+static const char *const kXmmConditionNames[8] = {
+#define XMM_CONDITION_NAME(name, code) #name,
+    XMM_CONDITIONAL_CODES(XMM_CONDITION_NAME)
+#undef XMM_CONDITION_NAME
+};
+
+// Indexed by the SSE prefix, in the order of the VEX pp field.
+enum SsePrefix { kNoPrefix = 0, kPrefix66 = 1, kPrefixF3 = 2, kPrefixF2 = 3 };
+static const char *const kSseSuffixes[4] = {"ps", "pd", "ss", "sd"};
+
+static const char kHexDigits[] = "0123456789abcdef";
+
+// The names of the Assembler's zero operand instructions.
+static const char *SimpleInstructionName(uint8_t opcode) {
+  switch (opcode) {
+#define SIMPLE_NAME(name, code)                                                \
+  case code:                                                                   \
+    return #name;
+    X86_ZERO_OPERAND_1_BYTE_INSTRUCTIONS(SIMPLE_NAME)
+#undef SIMPLE_NAME
+  }
+  return NULL;
+}
+
+// Decodes a single instruction into the text of a
+// Disassembler::Instruction.
+class InstructionDecoder : public ValueObject {
+public:
+  enum RegisterKind {
+    kCpuRegister,
+    kByteRegister,
+    kXmmRegister,
+    kYmmRegister,
+  };
+
+  // |labels|, if not NULL, holds the label of each offset of the code
+  // (0 for none); |base| is the address of the code, or 0.
+  InstructionDecoder(const uint8_t *code, intptr_t length, intptr_t offset,
+                     uword base, const int32_t *labels,
+                     Disassembler::Instruction *instruction)
+      : code_(code), length_(length), start_(offset), position_(offset),
+        base_(base), labels_(labels), instruction_(instruction),
+        text_length_(0), operands_(0), bad_(false), rex_(0),
+        operand_size_(false), rep_(false), repne_(false), lock_(false),
+        mod_(0), reg_(0), rm_(0), base_register_(-1), index_(-1), scale_(0),
+        displacement_(0), rip_relative_(false), rex_length_(0),
+        opcode_start_(offset), opcode_end_(offset), modrm_start_(-1),
+        modrm_end_(-1), displacement_end_(-1), is_branch_(false) {}
+
+  void Decode();
+
+private:
+  uint8_t Peek() {
+    if (position_ >= length_) {
+      bad_ = true;
+      return 0;
+    }
+    return code_[position_];
+  }
+  uint8_t Next() {
+    const uint8_t byte = Peek();
+    position_++;
+    return byte;
+  }
+  int8_t NextInt8() { return static_cast<int8_t>(Next()); }
+  uint16_t NextUint16() {
+    const uint16_t low = Next();
+    return low | (static_cast<uint16_t>(Next()) << 8);
+  }
+  int32_t NextInt32() {
+    uint32_t value = 0;
+    for (int i = 0; i < 4; i++) {
+      value |= static_cast<uint32_t>(Next()) << (8 * i);
+    }
+    return static_cast<int32_t>(value);
+  }
+  int64_t NextInt64() {
+    uint64_t value = 0;
+    for (int i = 0; i < 8; i++) {
+      value |= static_cast<uint64_t>(Next()) << (8 * i);
+    }
+    return static_cast<int64_t>(value);
+  }
+
+  bool rex_w() const { return (rex_ & REX_W) != 0; }
+  // The operand size suffix of general purpose register instructions.
+  char Suffix() const { return rex_w() ? 'q' : (operand_size_ ? 'w' : 'l'); }
+  // The mandatory prefix of an SSE instruction.
+  SsePrefix sse_prefix() const {
+    return repne_ ? kPrefixF2
+                  : (rep_ ? kPrefixF3
+                          : (operand_size_ ? kPrefix66 : kNoPrefix));
+  }
+
+  void Print(const char *string) {
+    while (*string != '\0' && text_length_ < Disassembler::kMaxTextLength - 1) {
+      instruction_->text[text_length_++] = *string++;
+    }
+  }
+  void PrintChar(char c) {
+    if (text_length_ < Disassembler::kMaxTextLength - 1) {
+      instruction_->text[text_length_++] = c;
+    }
+  }
+  void PrintHex(uint64_t value);
+  void PrintSigned(int64_t value) {
+    if (value < 0) {
+      PrintChar('-');
+      PrintHex(-static_cast<uint64_t>(value));
+    } else {
+      PrintHex(value);
+    }
+  }
+  void PrintDecimal(int64_t value);
+
+  // Starts a mnemonic, optionally with a suffix.
+  void Mnemonic(const char *name, char suffix = '\0') {
+    Print(name);
+    if (suffix != '\0') {
+      PrintChar(suffix);
+    }
+  }
+  void Mnemonic(const char *name, const char *suffix) {
+    Print(name);
+    Print(suffix);
+  }
+  // Starts the next operand.
+  void Operand() {
+    PrintChar(operands_ == 0 ? ' ' : ',');
+    operands_++;
+  }
+  void PrintRegister(RegisterKind kind, int reg);
+  void PrintRm(RegisterKind kind);
+  void PrintMemory();
+  void PrintTarget(int64_t target);
+
+  void RegisterOperand(RegisterKind kind, int reg) {
+    Operand();
+    PrintRegister(kind, reg);
+  }
+  void RmOperand(RegisterKind kind) {
+    Operand();
+    PrintRm(kind);
+  }
+  void ImmediateOperand(uint64_t value) {
+    Operand();
+    PrintHex(value);
+  }
+  void SignedImmediateOperand(int64_t value) {
+    Operand();
+    PrintSigned(value);
+  }
+  // The immediate of a general purpose register instruction, of size
+  // Suffix() but at most 32 bits.
+  void SizedImmediateOperand() {
+    if (operand_size_ && !rex_w()) {
+      ImmediateOperand(NextUint16());
+    } else {
+      SignedImmediateOperand(NextInt32());
+    }
+  }
+  void BranchOperand(int64_t displacement) {
+    const int64_t target = position_ + displacement;
+    is_branch_ = true;
+    instruction_->has_branch_target = true;
+    instruction_->branch_target = target;
+    Operand();
+    PrintTarget(target);
+  }
+
+  // Reads the ModRM byte and the SIB byte and displacement that follow it.
+  void DecodeModRM();
+  bool IsRegisterOperand() const { return mod_ == 3; }
+
+  // An instruction with operands reg, rm (|reversed|: rm, reg).
+  void RegRm(const char *name, char suffix, RegisterKind reg_kind,
+             RegisterKind rm_kind, bool reversed = false) {
+    DecodeModRM();
+    Mnemonic(name, suffix);
+    if (reversed) {
+      RmOperand(rm_kind);
+      RegisterOperand(reg_kind, reg_);
+    } else {
+      RegisterOperand(reg_kind, reg_);
+      RmOperand(rm_kind);
+    }
+  }
+  void XmmRegRm(const char *name, const char *suffix, bool reversed = false) {
+    DecodeModRM();
+    Mnemonic(name, suffix);
+    if (reversed) {
+      RmOperand(kXmmRegister);
+      RegisterOperand(kXmmRegister, reg_);
+    } else {
+      RegisterOperand(kXmmRegister, reg_);
+      RmOperand(kXmmRegister);
+    }
+  }
+
+  void DecodeOneByte(uint8_t opcode);
+  void DecodeTwoByte(uint8_t opcode);
+  void DecodeSse(uint8_t opcode);
+  void DecodeVex(uint8_t opcode);
+  void SetPartLengths();
+
+  const uint8_t *code_;
+  const intptr_t length_;
+  const intptr_t start_;
+  intptr_t position_;
+  const uword base_;
+  const int32_t *labels_;
+  Disassembler::Instruction *instruction_;
+  intptr_t text_length_;
+  int operands_;
+  bool bad_;
+
+  // Prefixes.
+  uint8_t rex_;
+  bool operand_size_;
+  bool rep_;
+  bool repne_;
+  bool lock_;
+
+  // The ModRM operands: reg_ and, for a register, rm_, including their REX
+  // bits; for memory, the base (-1 for none), the index (-1 for none),
+  // scale and displacement.
+  int mod_;
+  int reg_;
+  int rm_;
+  int base_register_;
+  int index_;
+  int scale_;
+  int32_t displacement_;
+  bool rip_relative_;
+
+  // Where the parts of the instruction start and end, for the part lengths
+  // of the Instruction; the ModRM positions are -1 without a ModRM byte.
+  intptr_t rex_length_;
+  intptr_t opcode_start_;
+  intptr_t opcode_end_;
+  intptr_t modrm_start_;
+  intptr_t modrm_end_;
+  intptr_t displacement_end_;
+  bool is_branch_;
+};
+
+void InstructionDecoder::PrintHex(uint64_t value) {
+  char digits[16];
+  int count = 0;
+  do {
+    digits[count++] = kHexDigits[value & 0xF];
+    value >>= 4;
+  } while (value != 0);
+  Print("0x");
+  while (count > 0) {
+    PrintChar(digits[--count]);
+  }
+}
+
+void InstructionDecoder::PrintDecimal(int64_t value) {
+  ASSERT(value >= 0);
+  char digits[20];
+  int count = 0;
+  do {
+    digits[count++] = '0' + value % 10;
+    value /= 10;
+  } while (value != 0);
+  while (count > 0) {
+    PrintChar(digits[--count]);
+  }
+}
+
+void InstructionDecoder::PrintRegister(RegisterKind kind, int reg) {
+  ASSERT(0 <= reg && reg < 16);
+  switch (kind) {
+  case kCpuRegister:
+    Print(cpu_reg_names[reg]);
+    break;
+  case kByteRegister:
+    if (rex_ == 0 && reg >= 4 && reg < 8) {
+      Print(kHighByteRegisterNames[reg - 4]);
+    } else {
+      Print(kByteRegisterNames[reg]);
+    }
+    break;
+  case kXmmRegister:
+    Print(fpu_reg_names[reg]);
+    break;
+  case kYmmRegister:
+    Print(kYmmRegisterNames[reg]);
+    break;
+  }
+}
+
+void InstructionDecoder::PrintRm(RegisterKind kind) {
+  if (IsRegisterOperand()) {
+    PrintRegister(kind, rm_);
+  } else {
+    PrintMemory();
+  }
+}
+
+void InstructionDecoder::PrintMemory() {
+  PrintChar('[');
+  bool empty = true;
+  if (rip_relative_) {
+    Print("rip");
+    empty = false;
+  } else if (base_register_ >= 0) {
+    Print(cpu_reg_names[base_register_]);
+    empty = false;
+  }
+  if (index_ >= 0) {
+    if (!empty) {
+      PrintChar('+');
+    }
+    Print(cpu_reg_names[index_]);
+    if (scale_ != 0) {
+      PrintChar('*');
+      PrintChar('0' + (1 << scale_));
+    }
+    empty = false;
+  }
+  if (empty) {
+    // An absolute address.
+    PrintHex(static_cast<uint32_t>(displacement_));
+  } else if (displacement_ < 0) {
+    PrintChar('-');
+    PrintHex(-static_cast<int64_t>(displacement_));
+  } else if (displacement_ > 0) {
+    PrintChar('+');
+    PrintHex(displacement_);
+  }
+  PrintChar(']');
+}
+
+void InstructionDecoder::PrintTarget(int64_t target) {
+  if (labels_ != NULL && target >= 0 && target < length_ &&
+      labels_[target] != 0) {
+    PrintChar('L');
+    PrintDecimal(labels_[target]);
+  } else if (base_ != 0 && (target < 0 || target >= length_)) {
+    PrintHex(base_ + target);
+  } else {
+    PrintSigned(target);
+  }
+}
+
+void InstructionDecoder::DecodeModRM() {
+  modrm_start_ = position_;
+  const uint8_t modrm = Next();
+  mod_ = modrm >> 6;
+  reg_ = ((modrm >> 3) & 7) | ((rex_ & REX_R) != 0 ? 8 : 0);
+  const int rm = modrm & 7;
+  const int rex_b = (rex_ & REX_B) != 0 ? 8 : 0;
+  if (mod_ == 3) {
+    rm_ = rm | rex_b;
+    modrm_end_ = displacement_end_ = position_;
+    return;
+  }
+  base_register_ = -1;
+  index_ = -1;
+  scale_ = 0;
+  displacement_ = 0;
+  rip_relative_ = false;
+  if (rm == 4) {
+    const uint8_t sib = Next();
+    modrm_end_ = position_;
+    scale_ = sib >> 6;
+    const int index = ((sib >> 3) & 7) | ((rex_ & REX_X) != 0 ? 8 : 0);
+    // RSP as index means no index; R12 is a valid one.
+    if (index != RSP) {
+      index_ = index;
+    }
+    const int base = sib & 7;
+    if (base == 5 && mod_ == 0) {
+      displacement_ = NextInt32(); // No base.
+    } else {
+      base_register_ = base | rex_b;
+    }
+  } else if (rm == 5 && mod_ == 0) {
+    modrm_end_ = position_;
+    rip_relative_ = true;
+    displacement_ = NextInt32();
+  } else {
+    modrm_end_ = position_;
+    base_register_ = rm | rex_b;
+  }
+  if (mod_ == 1) {
+    displacement_ = NextInt8();
+  } else if (mod_ == 2) {
+    displacement_ = NextInt32();
+  }
+  displacement_end_ = position_;
+}
+
+void InstructionDecoder::Decode() {
+  instruction_->has_branch_target = false;
+  instruction_->branch_target = 0;
+  // Legacy prefixes. The CS segment override is the padding prefix of the
+  // JCC erratum mitigation and has no effect in 64-bit mode.
+  while (!bad_) {
+    const uint8_t byte = Peek();
+    if (byte == 0x66) {
+      operand_size_ = true;
+    } else if (byte == 0xF3) {
+      rep_ = true;
+    } else if (byte == 0xF2) {
+      repne_ = true;
+    } else if (byte == 0xF0) {
+      lock_ = true;
+    } else if (byte != 0x2E && byte != 0x3E) {
+      break;
+    }
+    position_++;
+  }
+  if (lock_) {
+    Print("lock ");
+  }
+  if ((Peek() & 0xF0) == 0x40) {
+    rex_ = Next();
+    rex_length_ = 1;
+  }
+  opcode_start_ = position_;
+  const uint8_t opcode = Next();
+  opcode_end_ = position_;
+  if (opcode == 0x0F) {
+    const uint8_t second = Next();
+    opcode_end_ = position_;
+    DecodeTwoByte(second);
+  } else if (opcode == 0xC4 || opcode == 0xC5) {
+    DecodeVex(opcode);
+  } else {
+    DecodeOneByte(opcode);
+  }
+  if (bad_ || position_ - start_ > 15) {
+    text_length_ = 0;
+    Print("(bad)");
+    instruction_->length = 1;
+    instruction_->is_valid = false;
+    instruction_->has_branch_target = false;
+  } else {
+    instruction_->length = position_ - start_;
+    instruction_->is_valid = true;
+  }
+  SetPartLengths();
+  instruction_->text[text_length_] = '\0';
+}
+
+void InstructionDecoder::SetPartLengths() {
+  Disassembler::Instruction *instruction = instruction_;
+  instruction->prefix_length = 0;
+  instruction->rex_length = 0;
+  instruction->opcode_length = 0;
+  instruction->modrm_length = 0;
+  instruction->displacement_length = 0;
+  instruction->immediate_length = 0;
+  if (!instruction->is_valid) {
+    return;
+  }
+  instruction->prefix_length = opcode_start_ - start_ - rex_length_;
+  instruction->rex_length = rex_length_;
+  if (modrm_start_ >= 0) {
+    instruction->opcode_length = modrm_start_ - opcode_start_;
+    instruction->modrm_length = modrm_end_ - modrm_start_;
+    instruction->displacement_length = displacement_end_ - modrm_end_;
+    instruction->immediate_length = position_ - displacement_end_;
+  } else {
+    instruction->opcode_length = opcode_end_ - opcode_start_;
+    if (is_branch_) {
+      instruction->displacement_length = position_ - opcode_end_;
+    } else {
+      instruction->immediate_length = position_ - opcode_end_;
+    }
+  }
+}
+
+void InstructionDecoder::DecodeOneByte(uint8_t opcode) {
+  if (opcode < 0x40 && (opcode & 7) < 6) {
+    const char *name = kAluNames[opcode >> 3];
+    switch (opcode & 7) {
+    case 0:
+      RegRm(name, 'b', kByteRegister, kByteRegister, true);
+      return;
+    case 1:
+      RegRm(name, Suffix(), kCpuRegister, kCpuRegister, true);
+      return;
+    case 2:
+      RegRm(name, 'b', kByteRegister, kByteRegister);
+      return;
+    case 3:
+      RegRm(name, Suffix(), kCpuRegister, kCpuRegister);
+      return;
+    case 4:
+      Mnemonic(name, 'b');
+      RegisterOperand(kByteRegister, RAX);
+      ImmediateOperand(Next());
+      return;
+    case 5:
+      Mnemonic(name, Suffix());
+      RegisterOperand(kCpuRegister, RAX);
+      SizedImmediateOperand();
+      return;
+    }
+  }
+  const char *simple_name = SimpleInstructionName(opcode);
+  if (simple_name != NULL) {
+    if (rep_) {
+      Print("rep ");
+    }
+    if (opcode == 0x99 && rex_w()) {
+      Mnemonic("cqo");
+    } else if (opcode == 0xA5 && rex_w()) {
+      Mnemonic("movsq");
+    } else if (opcode == 0xA7 && rex_w()) {
+      Mnemonic("cmpsq");
+    } else {
+      Mnemonic(simple_name);
+    }
+    return;
+  }
+  switch (opcode) {
+  case 0x50:
+  case 0x51:
+  case 0x52:
+  case 0x53:
+  case 0x54:
+  case 0x55:
+  case 0x56:
+  case 0x57:
+    Mnemonic("pushq");
+    RegisterOperand(kCpuRegister, (opcode & 7) | ((rex_ & REX_B) ? 8 : 0));
+    return;
+  case 0x58:
+  case 0x59:
+  case 0x5A:
+  case 0x5B:
+  case 0x5C:
+  case 0x5D:
+  case 0x5E:
+  case 0x5F:
+    Mnemonic("popq");
+    RegisterOperand(kCpuRegister, (opcode & 7) | ((rex_ & REX_B) ? 8 : 0));
+    return;
+  case 0x63:
+    RegRm("movsxd", '\0', kCpuRegister, kCpuRegister);
+    return;
+  case 0x68:
+    Mnemonic("pushq");
+    SignedImmediateOperand(NextInt32());
+    return;
+  case 0x6A:
+    Mnemonic("pushq");
+    SignedImmediateOperand(NextInt8());
+    return;
+  case 0x69:
+    RegRm("imul", Suffix(), kCpuRegister, kCpuRegister);
+    SizedImmediateOperand();
+    return;
+  case 0x6B:
+    RegRm("imul", Suffix(), kCpuRegister, kCpuRegister);
+    SignedImmediateOperand(NextInt8());
+    return;
+  case 0x80:
+  case 0x81:
+  case 0x83:
+    DecodeModRM();
+    Mnemonic(kAluNames[reg_ & 7], opcode == 0x80 ? 'b' : Suffix());
+    RmOperand(opcode == 0x80 ? kByteRegister : kCpuRegister);
+    if (opcode == 0x80) {
+      ImmediateOperand(Next());
+    } else if (opcode == 0x81) {
+      SizedImmediateOperand();
+    } else {
+      SignedImmediateOperand(NextInt8());
+    }
+    return;
+  case 0x84:
+    RegRm("test", 'b', kByteRegister, kByteRegister, true);
+    return;
+  case 0x85:
+    RegRm("test", Suffix(), kCpuRegister, kCpuRegister, true);
+    return;
+  case 0x86:
+    RegRm("xchg", 'b', kByteRegister, kByteRegister);
+    return;
+  case 0x87:
+    RegRm("xchg", Suffix(), kCpuRegister, kCpuRegister);
+    return;
+  case 0x88:
+    RegRm("mov", 'b', kByteRegister, kByteRegister, true);
+    return;
+  case 0x89:
+    RegRm("mov", Suffix(), kCpuRegister, kCpuRegister, true);
+    return;
+  case 0x8A:
+    RegRm("mov", 'b', kByteRegister, kByteRegister);
+    return;
+  case 0x8B:
+    RegRm("mov", Suffix(), kCpuRegister, kCpuRegister);
+    return;
+  case 0x8D:
+    RegRm("lea", Suffix(), kCpuRegister, kCpuRegister);
+    bad_ = bad_ || IsRegisterOperand();
+    return;
+  case 0x8F:
+    DecodeModRM();
+    Mnemonic("popq");
+    RmOperand(kCpuRegister);
+    bad_ = bad_ || (reg_ & 7) != 0;
+    return;
+  case 0x90:
+    if ((rex_ & REX_B) != 0) {
+      Mnemonic("xchg", Suffix());
+      RegisterOperand(kCpuRegister, R8);
+      RegisterOperand(kCpuRegister, RAX);
+    } else {
+      Mnemonic(rep_ ? "pause" : "nop");
+    }
+    return;
+  case 0xA8:
+    Mnemonic("test", 'b');
+    RegisterOperand(kByteRegister, RAX);
+    ImmediateOperand(Next());
+    return;
+  case 0xA9:
+    Mnemonic("test", Suffix());
+    RegisterOperand(kCpuRegister, RAX);
+    SizedImmediateOperand();
+    return;
+  case 0xB0:
+  case 0xB1:
+  case 0xB2:
+  case 0xB3:
+  case 0xB4:
+  case 0xB5:
+  case 0xB6:
+  case 0xB7:
+    Mnemonic("movb");
+    RegisterOperand(kByteRegister, (opcode & 7) | ((rex_ & REX_B) ? 8 : 0));
+    ImmediateOperand(Next());
+    return;
+  case 0xB8:
+  case 0xB9:
+  case 0xBA:
+  case 0xBB:
+  case 0xBC:
+  case 0xBD:
+  case 0xBE:
+  case 0xBF: {
+    const int reg = (opcode & 7) | ((rex_ & REX_B) ? 8 : 0);
+    Mnemonic("mov", Suffix());
+    RegisterOperand(kCpuRegister, reg);
+    if (rex_w()) {
+      SignedImmediateOperand(NextInt64());
+    } else if (operand_size_) {
+      ImmediateOperand(NextUint16());
+    } else {
+      ImmediateOperand(static_cast<uint32_t>(NextInt32()));
+    }
+    return;
+  }
+  case 0xC0:
+  case 0xC1:
+  case 0xD0:
+  case 0xD1:
+  case 0xD2:
+  case 0xD3: {
+    const bool byte = (opcode & 1) == 0;
+    DecodeModRM();
+    const char *name = kShiftNames[reg_ & 7];
+    if (name == NULL) {
+      bad_ = true;
+      return;
+    }
+    Mnemonic(name, byte ? 'b' : Suffix());
+    RmOperand(byte ? kByteRegister : kCpuRegister);
+    if (opcode <= 0xC1) {
+      ImmediateOperand(Next());
+    } else if (opcode <= 0xD1) {
+      Operand();
+      PrintChar('1');
+    } else {
+      RegisterOperand(kByteRegister, RCX);
+    }
+    return;
+  }
+  case 0xC2:
+    Mnemonic("ret");
+    ImmediateOperand(NextUint16());
+    return;
+  case 0xC3:
+    Mnemonic("ret");
+    return;
+  case 0xC6:
+  case 0xC7:
+    DecodeModRM();
+    bad_ = bad_ || (reg_ & 7) != 0;
+    Mnemonic("mov", opcode == 0xC6 ? 'b' : Suffix());
+    RmOperand(opcode == 0xC6 ? kByteRegister : kCpuRegister);
+    if (opcode == 0xC6) {
+      ImmediateOperand(Next());
+    } else {
+      SizedImmediateOperand();
+    }
+    return;
+  case 0xC8: {
+    Mnemonic("enter");
+    ImmediateOperand(NextUint16());
+    ImmediateOperand(Next());
+    return;
+  }
+  case 0xC9:
+    Mnemonic("leave");
+    return;
+  case 0xD9:
+    switch (Next()) {
+    case 0xF7:
+      Mnemonic("fincstp");
+      return;
+    case 0xFE:
+      Mnemonic("fsin");
+      return;
+    case 0xFF:
+      Mnemonic("fcos");
+      return;
+    }
+    bad_ = true;
+    return;
+  case 0xDD:
+    DecodeModRM();
+    if (IsRegisterOperand()) {
+      if ((reg_ & 7) != 0) {
+        bad_ = true;
+        return;
+      }
+      Mnemonic("ffree");
+      Operand();
+      Print("st(");
+      PrintDecimal(rm_ & 7);
+      PrintChar(')');
+    } else if ((reg_ & 7) == 0) {
+      Mnemonic("fldl");
+      RmOperand(kCpuRegister);
+    } else if ((reg_ & 7) == 3) {
+      Mnemonic("fstpl");
+      RmOperand(kCpuRegister);
+    } else {
+      bad_ = true;
+    }
+    return;
+  case 0xE8:
+    Mnemonic("call");
+    BranchOperand(NextInt32());
+    return;
+  case 0xE9:
+    Mnemonic("jmp");
+    BranchOperand(NextInt32());
+    return;
+  case 0xEB:
+    Mnemonic("jmp");
+    BranchOperand(NextInt8());
+    return;
+  case 0xF6:
+  case 0xF7: {
+    const bool byte = opcode == 0xF6;
+    const RegisterKind kind = byte ? kByteRegister : kCpuRegister;
+    DecodeModRM();
+    if ((reg_ & 7) == 0) {
+      Mnemonic("test", byte ? 'b' : Suffix());
+      RmOperand(kind);
+      if (byte) {
+        ImmediateOperand(Next());
+      } else {
+        SizedImmediateOperand();
+      }
+    } else if (kUnaryNames[reg_ & 7] != NULL) {
+      Mnemonic(kUnaryNames[reg_ & 7], byte ? 'b' : Suffix());
+      RmOperand(kind);
+    } else {
+      bad_ = true;
+    }
+    return;
+  }
+  case 0xFE:
+    DecodeModRM();
+    if ((reg_ & 7) > 1) {
+      bad_ = true;
+      return;
+    }
+    Mnemonic((reg_ & 7) == 0 ? "inc" : "dec", 'b');
+    RmOperand(kByteRegister);
+    return;
+  case 0xFF:
+    DecodeModRM();
+    switch (reg_ & 7) {
+    case 0:
+      Mnemonic("inc", Suffix());
+      break;
+    case 1:
+      Mnemonic("dec", Suffix());
+      break;
+    case 2:
+      Mnemonic("call");
+      break;
+    case 4:
+      Mnemonic("jmp");
+      break;
+    case 6:
+      Mnemonic("pushq");
+      break;
+    default:
+      bad_ = true;
+      return;
+    }
+    RmOperand(kCpuRegister);
+    return;
+  }
+  if (opcode >= 0x70 && opcode <= 0x7F) {
+    Mnemonic("j", kConditionNames[opcode & 0xF]);
+    BranchOperand(NextInt8());
+    return;
+  }
+  bad_ = true;
+}
+
+void InstructionDecoder::DecodeTwoByte(uint8_t opcode) {
+  if (opcode >= 0x40 && opcode <= 0x4F) {
+    DecodeModRM();
+    Print("cmov");
+    Mnemonic(kConditionNames[opcode & 0xF], Suffix());
+    RegisterOperand(kCpuRegister, reg_);
+    RmOperand(kCpuRegister);
+    return;
+  }
+  if (opcode >= 0x80 && opcode <= 0x8F) {
+    Mnemonic("j", kConditionNames[opcode & 0xF]);
+    BranchOperand(NextInt32());
+    return;
+  }
+  if (opcode >= 0x90 && opcode <= 0x9F) {
+    DecodeModRM();
+    Mnemonic("set", kConditionNames[opcode & 0xF]);
+    RmOperand(kByteRegister);
+    return;
+  }
+  switch (opcode) {
+  case 0x0B:
+    Mnemonic("ud2");
+    return;
+  case 0x1F:
+    // The operand of a long NOP only sets its length.
+    DecodeModRM();
+    Mnemonic("nop");
+    return;
+  case 0xA2:
+    Mnemonic("cpuid");
+    return;
+  case 0xA3:
+    RegRm("bt", Suffix(), kCpuRegister, kCpuRegister, true);
+    return;
+  case 0xA4:
+  case 0xAC:
+    RegRm(opcode == 0xA4 ? "shld" : "shrd", Suffix(), kCpuRegister,
+          kCpuRegister, true);
+    ImmediateOperand(Next());
+    return;
+  case 0xA5:
+  case 0xAD:
+    RegRm(opcode == 0xA5 ? "shld" : "shrd", Suffix(), kCpuRegister,
+          kCpuRegister, true);
+    RegisterOperand(kByteRegister, RCX);
+    return;
+  case 0xAF:
+    RegRm("imul", Suffix(), kCpuRegister, kCpuRegister);
+    return;
+  case 0xB0:
+    RegRm("cmpxchg", 'b', kByteRegister, kByteRegister, true);
+    return;
+  case 0xB1:
+    RegRm("cmpxchg", Suffix(), kCpuRegister, kCpuRegister, true);
+    return;
+  case 0xB6:
+    RegRm("movzxb", Suffix(), kCpuRegister, kByteRegister);
+    return;
+  case 0xB7:
+    RegRm("movzxw", Suffix(), kCpuRegister, kCpuRegister);
+    return;
+  case 0xBE:
+    RegRm("movsxb", Suffix(), kCpuRegister, kByteRegister);
+    return;
+  case 0xBF:
+    RegRm("movsxw", Suffix(), kCpuRegister, kCpuRegister);
+    return;
+  case 0xB8:
+    if (!rep_) {
+      bad_ = true;
+      return;
+    }
+    RegRm("popcnt", Suffix(), kCpuRegister, kCpuRegister);
+    return;
+  case 0xBA: {
+    static const char *const kBitTestNames[4] = {"bt", "bts", "btr", "btc"};
+    DecodeModRM();
+    if ((reg_ & 7) < 4) {
+      bad_ = true;
+      return;
+    }
+    Mnemonic(kBitTestNames[(reg_ & 7) - 4], Suffix());
+    RmOperand(kCpuRegister);
+    ImmediateOperand(Next());
+    return;
+  }
+  case 0xBC:
+  case 0xBD:
+    if (rep_) {
+      RegRm(opcode == 0xBC ? "tzcnt" : "lzcnt", Suffix(), kCpuRegister,
+            kCpuRegister);
+    } else {
+      RegRm(opcode == 0xBC ? "bsf" : "bsr", Suffix(), kCpuRegister,
+            kCpuRegister);
+    }
+    return;
+  }
+  DecodeSse(opcode);
+}
+
+void InstructionDecoder::DecodeSse(uint8_t opcode) {
+  const SsePrefix prefix = sse_prefix();
+  const bool packed = prefix == kNoPrefix || prefix == kPrefix66;
+  const char *suffix = kSseSuffixes[prefix];
+  switch (opcode) {
+  case 0x10:
+  case 0x11:
+    XmmRegRm(prefix == kNoPrefix || prefix == kPrefix66 ? "movu" : "mov",
+             suffix, opcode == 0x11);
+    return;
+  case 0x12:
+  case 0x16:
+    DecodeModRM();
+    if (prefix == kNoPrefix && IsRegisterOperand()) {
+      Mnemonic(opcode == 0x12 ? "movhlps" : "movlhps");
+    } else if (packed && !IsRegisterOperand()) {
+      Mnemonic(opcode == 0x12 ? "movl" : "movh", suffix);
+    } else {
+      bad_ = true;
+      return;
+    }
+    RegisterOperand(kXmmRegister, reg_);
+    RmOperand(kXmmRegister);
+    return;
+  case 0x14:
+  case 0x15:
+    if (!packed) {
+      bad_ = true;
+      return;
+    }
+    XmmRegRm(opcode == 0x14 ? "unpckl" : "unpckh", suffix);
+    return;
+  case 0x28:
+  case 0x29:
+    if (!packed) {
+      bad_ = true;
+      return;
+    }
+    XmmRegRm("mova", suffix, opcode == 0x29);
+    return;
+  case 0x2A:
+  case 0x2C:
+  case 0x2D: {
+    if (packed) {
+      bad_ = true;
+      return;
+    }
+    const char *name = opcode == 0x2A
+                           ? (prefix == kPrefixF2 ? "cvtsi2sd" : "cvtsi2ss")
+                           : opcode == 0x2C
+                                 ? (prefix == kPrefixF2 ? "cvttsd2si"
+                                                        : "cvttss2si")
+                                 : (prefix == kPrefixF2 ? "cvtsd2si"
+                                                        : "cvtss2si");
+    if (opcode == 0x2A) {
+      RegRm(name, rex_w() ? 'q' : 'l', kXmmRegister, kCpuRegister);
+    } else {
+      RegRm(name, rex_w() ? 'q' : 'l', kCpuRegister, kXmmRegister);
+    }
+    return;
+  }
+  case 0x2E:
+  case 0x2F:
+    if (!packed) {
+      bad_ = true;
+      return;
+    }
+    XmmRegRm(opcode == 0x2E ? "ucomi" : "comi",
+             prefix == kPrefix66 ? "sd" : "ss");
+    return;
+  case 0x50:
+    if (!packed) {
+      bad_ = true;
+      return;
+    }
+    DecodeModRM();
+    Mnemonic("movmsk", suffix);
+    RegisterOperand(kCpuRegister, reg_);
+    RmOperand(kXmmRegister);
+    bad_ = bad_ || !IsRegisterOperand();
+    return;
+  case 0x5A: {
+    static const char *const kConversionNames[4] = {"cvtps2pd", "cvtpd2ps",
+                                                    "cvtss2sd", "cvtsd2ss"};
+    XmmRegRm(kConversionNames[prefix], "");
+    return;
+  }
+  case 0x5B: {
+    static const char *const kConversionNames[4] = {"cvtdq2ps", "cvtps2dq",
+                                                    "cvttps2dq", NULL};
+    if (kConversionNames[prefix] == NULL) {
+      bad_ = true;
+      return;
+    }
+    XmmRegRm(kConversionNames[prefix], "");
+    return;
+  }
+  case 0x6E:
+  case 0x7E:
+    if (prefix != kPrefix66) {
+      bad_ = true;
+      return;
+    }
+    RegRm(rex_w() ? "movq" : "movd", '\0', kXmmRegister, kCpuRegister,
+          opcode == 0x7E);
+    return;
+  case 0xC2: {
+    DecodeModRM();
+    const uint8_t predicate = Next();
+    if (predicate < 8) {
+      Print("cmp");
+      Mnemonic(kXmmConditionNames[predicate], suffix);
+      RegisterOperand(kXmmRegister, reg_);
+      RmOperand(kXmmRegister);
+    } else {
+      Mnemonic("cmp", suffix);
+      RegisterOperand(kXmmRegister, reg_);
+      RmOperand(kXmmRegister);
+      ImmediateOperand(predicate);
+    }
+    return;
+  }
+  case 0xC6:
+    if (!packed) {
+      bad_ = true;
+      return;
+    }
+    XmmRegRm("shuf", suffix);
+    ImmediateOperand(Next());
+    return;
+  case 0xEF:
+  case 0xFA:
+  case 0xFE:
+    if (prefix != kPrefix66) {
+      bad_ = true;
+      return;
+    }
+    XmmRegRm(opcode == 0xEF ? "pxor" : (opcode == 0xFA ? "psubd" : "paddd"),
+             "");
+    return;
+  case 0x3A:
+    if (prefix != kPrefix66) {
+      bad_ = true;
+      return;
+    }
+    switch (Next()) {
+    case 0x0A:
+      XmmRegRm("roundss", "");
+      ImmediateOperand(Next());
+      return;
+    case 0x0B:
+      XmmRegRm("roundsd", "");
+      ImmediateOperand(Next());
+      return;
+    }
+    bad_ = true;
+    return;
+  }
+  if (opcode > 0x50 && opcode <= 0x5F) {
+    const int code = opcode - 0x50;
+    const char *name = kXmmAluNames[code];
+    const bool logical = code == 4 || code == 6 || code == 7;
+    const bool approximation = code == 2 || code == 3;
+    if (strncmp(name, "bad", 3) == 0 || (logical && !packed) ||
+        (approximation && (prefix == kPrefix66 || prefix == kPrefixF2))) {
+      bad_ = true;
+      return;
+    }
+    XmmRegRm(name, suffix);
+    return;
+  }
+  bad_ = true;
+}
+
+void InstructionDecoder::DecodeVex(uint8_t opcode) {
+  // VEX cannot follow legacy SSE or REX prefixes.
+  if (rex_ != 0 || operand_size_ || rep_ || repne_ || lock_) {
+    bad_ = true;
+    return;
+  }
+  // R, X, B and vvvv are stored inverted.
+  const uint8_t byte1 = Next();
+  uint8_t byte2 = byte1;
+  int map = 1; // 0x0F.
+  rex_ = (byte1 & 0x80) == 0 ? REX_R : 0;
+  if (opcode == 0xC4) {
+    map = byte1 & 0x1F;
+    rex_ |= (byte1 & 0x40) == 0 ? REX_X : 0;
+    rex_ |= (byte1 & 0x20) == 0 ? REX_B : 0;
+    byte2 = Next();
+    rex_ |= (byte2 & 0x80) != 0 ? REX_W : 0;
+  }
+  const int vvvv = (~byte2 >> 3) & 0xF;
+  const bool vex256 = (byte2 & 0x04) != 0;
+  const SsePrefix prefix = static_cast<SsePrefix>(byte2 & 3);
+  const bool packed = prefix == kNoPrefix || prefix == kPrefix66;
+  if (map != 1) {
+    bad_ = true;
+    return;
+  }
+  opcode_start_ = position_;
+  const uint8_t vex_opcode = Next();
+  opcode_end_ = position_;
+  if (vex_opcode == 0x77) {
+    Mnemonic(vex256 ? "vzeroall" : "vzeroupper");
+    bad_ = bad_ || vvvv != 0;
+    return;
+  }
+  const RegisterKind kind = vex256 && packed ? kYmmRegister : kXmmRegister;
+  const char *suffix = kSseSuffixes[prefix];
+  if (vex_opcode == 0x10 || vex_opcode == 0x11) {
+    if (!packed || vvvv != 0) {
+      bad_ = true;
+      return;
+    }
+    DecodeModRM();
+    Mnemonic("vmovu", suffix);
+    if (vex_opcode == 0x11) {
+      RmOperand(kind);
+      RegisterOperand(kind, reg_);
+    } else {
+      RegisterOperand(kind, reg_);
+      RmOperand(kind);
+    }
+    return;
+  }
+  if (vex_opcode >= 0x51 && vex_opcode <= 0x5F) {
+    const int code = vex_opcode - 0x50;
+    const char *name = kXmmAluNames[code];
+    const bool logical = code == 4 || code == 6 || code == 7;
+    const bool approximation = code == 2 || code == 3;
+    const bool unary = code <= 3;
+    if (strncmp(name, "bad", 3) == 0 || (logical && !packed) ||
+        (approximation && (prefix == kPrefix66 || prefix == kPrefixF2)) ||
+        (unary && packed && vvvv != 0)) {
+      bad_ = true;
+      return;
+    }
+    DecodeModRM();
+    PrintChar('v');
+    Mnemonic(name, suffix);
+    RegisterOperand(kind, reg_);
+    if (!unary || !packed) {
+      RegisterOperand(kind, vvvv);
+    }
+    RmOperand(kind);
+    return;
+  }
+  bad_ = true;
+}
+
+void Disassembler::Decode(const uint8_t *code, intptr_t length,
+                          intptr_t offset, Instruction *instruction) {
+  ASSERT(0 <= offset && offset < length);
+  InstructionDecoder decoder(code, length, offset, 0, NULL, instruction);
+  decoder.Decode();
+}
+
+// Appends |value| in hex with at least |digits| digits to |line|.
+static char *AppendHex(char *line, uint64_t value, int digits) {
+  char reversed[16];
+  int count = 0;
+  do {
+    reversed[count++] = kHexDigits[value & 0xF];
+    value >>= 4;
+  } while (value != 0 || count < digits);
+  while (count > 0) {
+    *line++ = reversed[--count];
+  }
+  return line;
+}
+
+void Disassembler::Disassemble(const uint8_t *code, intptr_t length,
+                               uword base, FILE *out) {
+  // The label of each branch target in the code, numbered in code order.
+  int32_t *labels =
+      reinterpret_cast<int32_t *>(calloc(length + 1, sizeof(int32_t)));
+  Instruction instruction;
+  for (intptr_t offset = 0; offset < length; offset += instruction.length) {
+    InstructionDecoder decoder(code, length, offset, base, NULL, &instruction);
+    decoder.Decode();
+    if (instruction.has_branch_target && instruction.branch_target >= 0 &&
+        instruction.branch_target < length) {
+      labels[instruction.branch_target] = 1;
+    }
+  }
+  int32_t label_count = 0;
+  for (intptr_t offset = 0; offset < length; offset++) {
+    if (labels[offset] != 0) {
+      labels[offset] = ++label_count;
+    }
+  }
+
+  // Lines are formatted into |output| and written in large chunks.
+  static const intptr_t kOutputSize = 64 * kKiB;
+  static const intptr_t kMaxLineLength = 32 + 2 * 15 + kMaxTextLength;
+  static const intptr_t kBytesColumns = 2 * 10;
+  char *output = reinterpret_cast<char *>(malloc(kOutputSize));
+  char *cursor = output;
+  for (intptr_t offset = 0; offset < length; offset += instruction.length) {
+    InstructionDecoder decoder(code, length, offset, base, labels,
+                               &instruction);
+    decoder.Decode();
+    if (cursor - output > kOutputSize - 2 * kMaxLineLength) {
+      fwrite(output, 1, cursor - output, out);
+      cursor = output;
+    }
+    if (labels[offset] != 0) {
+      *cursor++ = 'L';
+      cursor += snprintf(cursor, kMaxLineLength, "%d:\n", labels[offset]);
+    }
+    *cursor++ = ' ';
+    *cursor++ = ' ';
+    *cursor++ = '0';
+    *cursor++ = 'x';
+    cursor = AppendHex(cursor, offset, 4);
+    *cursor++ = ' ';
+    *cursor++ = ' ';
+    for (intptr_t i = 0; i < instruction.length; i++) {
+      cursor = AppendHex(cursor, code[offset + i], 2);
+    }
+    for (intptr_t i = 2 * instruction.length; i < kBytesColumns; i++) {
+      *cursor++ = ' ';
+    }
+    *cursor++ = ' ';
+    *cursor++ = ' ';
+    const intptr_t text_length = strlen(instruction.text);
+    memmove(cursor, instruction.text, text_length);
+    cursor += text_length;
+    *cursor++ = '\n';
+  }
+  fwrite(output, 1, cursor - output, out);
+  free(output);
+  free(labels);
+}
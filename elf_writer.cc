@@ -0,0 +1,295 @@
+// Copyright (c) 2019, the Dart project authors.  Please see the AUTHORS file
+// for details. All rights reserved. Use of this source code is governed by a
+// BSD-style license that can be found in the LICENSE file.
+
+#include "elf_writer.h"
+
+#include <elf.h>
+#include <stdio.h>
+
+#include "unwind_info.h"
+
+// Section indices.
+enum {
+  kNullSection,
+  kTextSection,
+  kRodataSection,
+  kEhFrameSection,
+  kRelaTextSection,
+  kRelaEhFrameSection,
+  kSymtabSection,
+  kStrtabSection,
+  kShstrtabSection,
+  kNoteGnuStackSection,
+  kNumSections,
+};
+
+static const intptr_t kTextAlignment = 32;
+
+static void EmitBytes(AssemblerBuffer *buffer, const void *data,
+                      intptr_t size) {
+  const uint8_t *bytes = reinterpret_cast<const uint8_t *>(data);
+  for (intptr_t i = 0; i < size; i++) {
+    AssemblerBuffer::EnsureCapacity ensured(buffer);
+    buffer->Emit<uint8_t>(bytes[i]);
+  }
+}
+
+static void EmitPadding(AssemblerBuffer *buffer, intptr_t alignment,
+                        uint8_t value) {
+  while (!Utils::IsAligned(buffer->Size(), alignment)) {
+    AssemblerBuffer::EnsureCapacity ensured(buffer);
+    buffer->Emit<uint8_t>(value);
+  }
+}
+
+void ElfWriter::AddFunction(intptr_t symbol, const char *name,
+                            Assembler *assembler) {
+  ASSERT(assembler->is_finalized());
+  ASSERT(assembler->code_address() == 0);
+  // Keep the alignment done by the assembler valid, as CodeRelocator does.
+  EmitPadding(&text_, kTextAlignment, Instr::kBreakPointInstruction);
+  const intptr_t offset = text_.Size();
+  EmitBytes(&text_, reinterpret_cast<const void *>(assembler->CodeAddress(0)),
+            assembler->CodeSize());
+  AddSymbol(symbol, name, kTextSection, offset, assembler->CodeSize());
+  for (intptr_t j = 0; j < assembler->RelocationCount(); j++) {
+    Assembler::Relocation relocation = assembler->RelocationAt(j);
+    relocation.offset += offset;
+    AssemblerBuffer::EnsureCapacity ensured(&relocations_);
+    relocations_.Emit<Assembler::Relocation>(relocation);
+  }
+  if (assembler->track_call_frame()) {
+    if (eh_frame_.Size() == 0) {
+      UnwindInfo::WriteCie(&eh_frame_, UnwindInfo::kPcRelative);
+    }
+    const intptr_t pc_begin = UnwindInfo::WriteFde(
+        &eh_frame_, 0, UnwindInfo::kPcRelative, assembler, 0);
+    AssemblerBuffer::EnsureCapacity ensured(&eh_frame_relocations_);
+    eh_frame_relocations_.Emit<intptr_t>(pc_begin);
+    eh_frame_relocations_.Emit<intptr_t>(offset);
+  }
+}
+
+void ElfWriter::AddData(intptr_t symbol, const char *name, const void *data,
+                        intptr_t size, intptr_t alignment) {
+  EmitPadding(&rodata_, alignment, 0);
+  if (alignment > rodata_alignment_) {
+    rodata_alignment_ = alignment;
+  }
+  const intptr_t offset = rodata_.Size();
+  EmitBytes(&rodata_, data, size);
+  AddSymbol(symbol, name, kRodataSection, offset, size);
+}
+
+void ElfWriter::AddExternalSymbol(intptr_t symbol, const char *name) {
+  AddSymbol(symbol, name, SHN_UNDEF, 0, 0);
+}
+
+intptr_t ElfWriter::AddName(const char *name) {
+  if (strtab_.Size() == 0) {
+    // The empty name.
+    AssemblerBuffer::EnsureCapacity ensured(&strtab_);
+    strtab_.Emit<uint8_t>(0);
+  }
+  const intptr_t offset = strtab_.Size();
+  EmitBytes(&strtab_, name, strlen(name) + 1);
+  return offset;
+}
+
+void ElfWriter::AddSymbol(intptr_t symbol, const char *name,
+                          intptr_t section_index, intptr_t offset,
+                          intptr_t size) {
+  ASSERT(LookupSymbol(symbol) < 0);
+  const Symbol entry = {symbol, AddName(name), section_index, offset, size};
+  AssemblerBuffer::EnsureCapacity ensured(&symbols_);
+  symbols_.Emit<Symbol>(entry);
+}
+
+intptr_t ElfWriter::LookupSymbol(intptr_t symbol) {
+  for (intptr_t i = 0; i < SymbolCount(); i++) {
+    if (symbols_.Load<Symbol>(i * sizeof(Symbol)).symbol == symbol) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+bool ElfWriter::WriteToFile(const char *path) {
+  // The null symbol and the section symbols of .text and .rodata are local
+  // and come first.
+  static const intptr_t kFirstGlobalSymbol = 3;
+  AssemblerBuffer symtab;
+  {
+    Elf64_Sym null_symbol;
+    memset(&null_symbol, 0, sizeof(null_symbol));
+    EmitBytes(&symtab, &null_symbol, sizeof(null_symbol));
+    const intptr_t sections[] = {kTextSection, kRodataSection};
+    for (intptr_t i = 0; i < 2; i++) {
+      Elf64_Sym symbol;
+      memset(&symbol, 0, sizeof(symbol));
+      symbol.st_info = ELF64_ST_INFO(STB_LOCAL, STT_SECTION);
+      symbol.st_shndx = sections[i];
+      EmitBytes(&symtab, &symbol, sizeof(symbol));
+    }
+  }
+  for (intptr_t i = 0; i < SymbolCount(); i++) {
+    const Symbol entry = symbols_.Load<Symbol>(i * sizeof(Symbol));
+    Elf64_Sym symbol;
+    memset(&symbol, 0, sizeof(symbol));
+    symbol.st_name = entry.name;
+    uint8_t type = STT_NOTYPE;
+    if (entry.section_index == kTextSection) {
+      type = STT_FUNC;
+    } else if (entry.section_index == kRodataSection) {
+      type = STT_OBJECT;
+    }
+    symbol.st_info = ELF64_ST_INFO(STB_GLOBAL, type);
+    symbol.st_shndx = entry.section_index;
+    symbol.st_value = entry.offset;
+    symbol.st_size = entry.size;
+    EmitBytes(&symtab, &symbol, sizeof(symbol));
+  }
+
+  AssemblerBuffer rela;
+  for (intptr_t i = 0; i < relocations_.Size();
+       i += sizeof(Assembler::Relocation)) {
+    const Assembler::Relocation relocation =
+        relocations_.Load<Assembler::Relocation>(i);
+    const intptr_t index = LookupSymbol(relocation.symbol);
+    if (index < 0) {
+      FATAL("Undefined symbol");
+    }
+    Elf64_Rela entry;
+    entry.r_offset = relocation.offset;
+    const uint32_t type = relocation.kind == Assembler::kPcRelativeAddress
+                              ? R_X86_64_PC32
+                              : R_X86_64_PLT32;
+    entry.r_info = ELF64_R_INFO(kFirstGlobalSymbol + index, type);
+    // Relative to the end of the rel32 field.
+    entry.r_addend = relocation.addend - 4;
+    EmitBytes(&rela, &entry, sizeof(entry));
+  }
+
+  // The FDEs refer to their function relative to the .text section symbol.
+  AssemblerBuffer rela_eh_frame;
+  for (intptr_t i = 0; i < eh_frame_relocations_.Size();
+       i += 2 * sizeof(intptr_t)) {
+    Elf64_Rela entry;
+    entry.r_offset = eh_frame_relocations_.Load<intptr_t>(i);
+    entry.r_info = ELF64_R_INFO(kTextSection, R_X86_64_PC32);
+    entry.r_addend =
+        eh_frame_relocations_.Load<intptr_t>(i + sizeof(intptr_t));
+    EmitBytes(&rela_eh_frame, &entry, sizeof(entry));
+  }
+
+  AssemblerBuffer shstrtab;
+  intptr_t section_names[kNumSections];
+  {
+    static const char *const kSectionNames[kNumSections] = {
+        "",
+        ".text",
+        ".rodata",
+        ".eh_frame",
+        ".rela.text",
+        ".rela.eh_frame",
+        ".symtab",
+        ".strtab",
+        ".shstrtab",
+        ".note.GNU-stack"};
+    for (intptr_t i = 0; i < kNumSections; i++) {
+      section_names[i] = shstrtab.Size();
+      EmitBytes(&shstrtab, kSectionNames[i], strlen(kSectionNames[i]) + 1);
+    }
+  }
+  if (strtab_.Size() == 0) {
+    // Starts with the empty name.
+    AddName("");
+  }
+
+  // The file: the ELF header, the contents of the sections, and the
+  // section header table.
+  AssemblerBuffer file;
+  {
+    Elf64_Ehdr header;
+    memset(&header, 0, sizeof(header));
+    EmitBytes(&file, &header, sizeof(header));
+  }
+  Elf64_Shdr sections[kNumSections];
+  memset(sections, 0, sizeof(sections));
+  struct {
+    intptr_t index;
+    AssemblerBuffer *contents;
+    uint32_t type;
+    uint64_t flags;
+    intptr_t alignment;
+  } const kContents[] = {
+      {kTextSection, &text_, SHT_PROGBITS, SHF_ALLOC | SHF_EXECINSTR,
+       kTextAlignment},
+      {kRodataSection, &rodata_, SHT_PROGBITS, SHF_ALLOC, rodata_alignment_},
+      {kEhFrameSection, &eh_frame_, SHT_X86_64_UNWIND, SHF_ALLOC, 8},
+      {kRelaTextSection, &rela, SHT_RELA, SHF_INFO_LINK, 8},
+      {kRelaEhFrameSection, &rela_eh_frame, SHT_RELA, SHF_INFO_LINK, 8},
+      {kSymtabSection, &symtab, SHT_SYMTAB, 0, 8},
+      {kStrtabSection, &strtab_, SHT_STRTAB, 0, 1},
+      {kShstrtabSection, &shstrtab, SHT_STRTAB, 0, 1},
+  };
+  for (const auto &contents : kContents) {
+    EmitPadding(&file, contents.alignment, 0);
+    Elf64_Shdr *section = &sections[contents.index];
+    section->sh_type = contents.type;
+    section->sh_flags = contents.flags;
+    section->sh_offset = file.Size();
+    section->sh_size = contents.contents->Size();
+    section->sh_addralign = contents.alignment;
+    EmitBytes(&file,
+              reinterpret_cast<const void *>(contents.contents->contents()),
+              contents.contents->Size());
+  }
+  for (intptr_t i = 0; i < kNumSections; i++) {
+    sections[i].sh_name = section_names[i];
+  }
+  sections[kRelaTextSection].sh_link = kSymtabSection;
+  sections[kRelaTextSection].sh_info = kTextSection;
+  sections[kRelaTextSection].sh_entsize = sizeof(Elf64_Rela);
+  sections[kRelaEhFrameSection].sh_link = kSymtabSection;
+  sections[kRelaEhFrameSection].sh_info = kEhFrameSection;
+  sections[kRelaEhFrameSection].sh_entsize = sizeof(Elf64_Rela);
+  sections[kSymtabSection].sh_link = kStrtabSection;
+  sections[kSymtabSection].sh_info = kFirstGlobalSymbol;
+  sections[kSymtabSection].sh_entsize = sizeof(Elf64_Sym);
+  // Marks the stack as not executable.
+  sections[kNoteGnuStackSection].sh_type = SHT_PROGBITS;
+  sections[kNoteGnuStackSection].sh_offset = file.Size();
+  sections[kNoteGnuStackSection].sh_addralign = 1;
+
+  EmitPadding(&file, 8, 0);
+  const intptr_t section_headers_offset = file.Size();
+  EmitBytes(&file, sections, sizeof(sections));
+
+  Elf64_Ehdr header;
+  memset(&header, 0, sizeof(header));
+  memmove(header.e_ident, ELFMAG, SELFMAG);
+  header.e_ident[EI_CLASS] = ELFCLASS64;
+  header.e_ident[EI_DATA] = ELFDATA2LSB;
+  header.e_ident[EI_VERSION] = EV_CURRENT;
+  header.e_ident[EI_OSABI] = ELFOSABI_SYSV;
+  header.e_type = ET_REL;
+  header.e_machine = EM_X86_64;
+  header.e_version = EV_CURRENT;
+  header.e_shoff = section_headers_offset;
+  header.e_ehsize = sizeof(Elf64_Ehdr);
+  header.e_shentsize = sizeof(Elf64_Shdr);
+  header.e_shnum = kNumSections;
+  header.e_shstrndx = kShstrtabSection;
+  memmove(reinterpret_cast<void *>(file.contents()), &header, sizeof(header));
+
+  FILE *stream = fopen(path, "wb");
+  if (stream == NULL) {
+    return false;
+  }
+  bool ok = fwrite(reinterpret_cast<const void *>(file.contents()), 1,
+                   file.Size(), stream) == static_cast<size_t>(file.Size());
+  ok = (fclose(stream) == 0) && ok;
+  return ok;
+}
@@ -0,0 +1,69 @@
+// Copyright (c) 2019, the Dart project authors.  Please see the AUTHORS file
+// for details. All rights reserved. Use of this source code is governed by a
+// BSD-style license that can be found in the LICENSE file.
+
+#pragma once
+
+#include "assembler.h"
+#include "globals.h"
+
+// Writes finalized functions as an ELF64 relocatable object file (.o) for
+// the system linker, so that code generated ahead of time can be linked
+// into a normal binary.
+//
+// Functions go to .text and read-only data, such as literal pools, to
+// .rodata; both are global symbols in .symtab. Functions generated with
+// Assembler::set_track_call_frame get unwind info in .eh_frame. The
+// relocations of the functions become .rela.text entries against named
+// symbols: calls and tail calls are R_X86_64_PLT32, and addresses loaded
+// with Assembler::LoadUnRelocatedPcRelativeAddress are R_X86_64_PC32. The
+// code must be position independent: it must not have a code_address(), nor
+// use ExternalLabels, whose addresses are only valid in the generating
+// process.
+class ElfWriter : public ValueObject {
+public:
+  ElfWriter() : rodata_alignment_(1) {}
+  ~ElfWriter() {}
+
+  // Adds the code of |assembler|, which must have been finalized, as the
+  // function |name| defining the relocation symbol |symbol|.
+  void AddFunction(intptr_t symbol, const char *name, Assembler *assembler);
+  // Adds |size| bytes of read-only data as the object |name| defining the
+  // relocation symbol |symbol|.
+  void AddData(intptr_t symbol, const char *name, const void *data,
+               intptr_t size, intptr_t alignment);
+  // Names a relocation symbol defined outside of the object file.
+  void AddExternalSymbol(intptr_t symbol, const char *name);
+
+  // Returns false on I/O errors.
+  bool WriteToFile(const char *path);
+
+private:
+  struct Symbol {
+    intptr_t symbol;
+    intptr_t name; // Offset in strtab_.
+    intptr_t section_index;
+    intptr_t offset;
+    intptr_t size;
+  };
+
+  intptr_t AddName(const char *name);
+  void AddSymbol(intptr_t symbol, const char *name, intptr_t section_index,
+                 intptr_t offset, intptr_t size);
+  intptr_t SymbolCount() const { return symbols_.Size() / sizeof(Symbol); }
+  // Returns the index of |symbol| in the symbol table.
+  intptr_t LookupSymbol(intptr_t symbol);
+
+  AssemblerBuffer text_;
+  AssemblerBuffer rodata_;
+  intptr_t rodata_alignment_;
+  AssemblerBuffer eh_frame_;
+  // Pairs of intptr_t (offset of an FDE address, offset into .text).
+  AssemblerBuffer eh_frame_relocations_;
+  // Assembler::Relocations with offsets into .text.
+  AssemblerBuffer relocations_;
+  AssemblerBuffer symbols_;
+  AssemblerBuffer strtab_;
+
+  DISALLOW_COPY_AND_ASSIGN(ElfWriter);
+};
@@ -104,6 +104,11 @@ public:
   template <typename T> static inline bool IsPowerOfTwo(T x) {
     return ((x & (x - 1)) == 0) && (x != 0);
   }
+
+  template <typename T> static inline bool IsAligned(T x, intptr_t n) {
+    ASSERT(IsPowerOfTwo(n));
+    return (x & (n - 1)) == 0;
+  }
 };
 
 // Similar to bit_cast, but allows copying from types of unrelated
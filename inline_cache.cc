@@ -0,0 +1,492 @@
+// Copyright (c) 2019, the Dart project authors.  Please see the AUTHORS file
+// for details. All rights reserved. Use of this source code is governed by a
+// BSD-style license that can be found in the LICENSE file.
+
+#include "inline_cache.h"
+
+#include <stddef.h>
+
+#include "code_patcher.h"
+#include "perf_registry.h"
+
+struct InlineCacheRuntime::Veneer {
+  uword target;
+  uword code;
+  intptr_t size;
+  Veneer *next;
+};
+
+static int32_t ReceiverClassId(const InlineCacheRuntime *runtime,
+                               uword receiver) {
+  const int32_t class_id = *reinterpret_cast<const int32_t *>(
+      receiver + runtime->class_id_offset());
+  ASSERT(class_id >= 0);
+  return class_id;
+}
+
+// Entered as a call of the target, with the return address on the stack and
+// the cache that missed in R10. Calls |handler|(cache, receiver), and
+// continues into the target it returns with the arguments of the call
+// preserved.
+static void EmitMissStub(Assembler *assembler, uword handler) {
+  static const Register kArgumentRegisters[] = {RDI, RSI, RDX, RCX,
+                                                R8,  R9,  RAX};
+  static const intptr_t kNumArgumentRegisters = 7;
+  static const intptr_t kNumXmmArguments = 8;
+  // With the return address, the pushes keep the stack aligned for the
+  // call.
+  static const intptr_t kSpillSize = kNumXmmArguments * 16;
+  for (intptr_t i = 0; i < kNumArgumentRegisters; i++) {
+    assembler->pushq(kArgumentRegisters[i]);
+  }
+  assembler->subq(RSP, Immediate(kSpillSize));
+  for (intptr_t i = 0; i < kNumXmmArguments; i++) {
+    assembler->movups(Address(RSP, i * 16), static_cast<XmmRegister>(i));
+  }
+  assembler->movq(RSI, InlineCacheRuntime::kReceiverRegister);
+  assembler->movq(RDI, R10);
+  assembler->movq(RAX, Immediate(static_cast<int64_t>(handler)));
+  assembler->call(RAX);
+  assembler->movq(TMP, RAX);
+  for (intptr_t i = 0; i < kNumXmmArguments; i++) {
+    assembler->movups(static_cast<XmmRegister>(i), Address(RSP, i * 16));
+  }
+  assembler->addq(RSP, Immediate(kSpillSize));
+  for (intptr_t i = kNumArgumentRegisters - 1; i >= 0; i--) {
+    assembler->popq(kArgumentRegisters[i]);
+  }
+  assembler->jmp(TMP);
+}
+
+InlineCacheRuntime::InlineCacheRuntime(CodeHeap *heap,
+                                       intptr_t class_id_offset,
+                                       LookupFunction lookup, void *argument)
+    : heap_(heap), class_id_offset_(class_id_offset), lookup_(lookup),
+      argument_(argument), count_calls_(false), compare_size_(0),
+      thread_(heap), miss_stub_(0), miss_stub_size_(0),
+      megamorphic_miss_stub_(0), megamorphic_miss_stub_size_(0),
+      megamorphic_caches_(NULL) {
+  pthread_mutex_init(&mutex_, NULL);
+  for (intptr_t i = 0; i < kVeneerBuckets; i++) {
+    veneers_[i] = NULL;
+  }
+  {
+    Assembler assembler;
+    assembler.cmpl(Address(kReceiverRegister, class_id_offset),
+                   Immediate(InlineCache::kUnlinkedClassId));
+    compare_size_ = assembler.CodeSize();
+  }
+  {
+    Assembler assembler;
+    EmitMissStub(&assembler, reinterpret_cast<uword>(&InlineCache::HandleMiss));
+    miss_stub_ = InstallStub(&assembler, "InlineCache miss stub");
+    miss_stub_size_ = assembler.CodeSize();
+  }
+  {
+    Assembler assembler;
+    EmitMissStub(&assembler,
+                 reinterpret_cast<uword>(&MegamorphicCache::HandleMiss));
+    megamorphic_miss_stub_ =
+        InstallStub(&assembler, "MegamorphicCache miss stub");
+    megamorphic_miss_stub_size_ = assembler.CodeSize();
+  }
+}
+
+InlineCacheRuntime::~InlineCacheRuntime() {
+  while (megamorphic_caches_ != NULL) {
+    MegamorphicCache *cache = megamorphic_caches_;
+    megamorphic_caches_ = cache->next_;
+    RetireStub(cache->stub_, cache->stub_size_);
+    delete cache;
+  }
+  for (intptr_t i = 0; i < kVeneerBuckets; i++) {
+    while (veneers_[i] != NULL) {
+      Veneer *veneer = veneers_[i];
+      veneers_[i] = veneer->next;
+      RetireStub(veneer->code, veneer->size);
+      delete veneer;
+    }
+  }
+  RetireStub(miss_stub_, miss_stub_size_);
+  RetireStub(megamorphic_miss_stub_, megamorphic_miss_stub_size_);
+  pthread_mutex_destroy(&mutex_);
+}
+
+uword InlineCacheRuntime::InstallStub(Assembler *assembler,
+                                      const char *name) {
+  assembler->FinalizeCode();
+  const uword stub = thread_.Install(assembler);
+  PerfCodeRegistry::AddCode(name, stub, assembler->CodeSize());
+  return stub;
+}
+
+MegamorphicCache *InlineCacheRuntime::MegamorphicCacheFor(intptr_t selector) {
+  for (MegamorphicCache *cache = megamorphic_caches_; cache != NULL;
+       cache = cache->next_) {
+    if (cache->selector_ == selector) {
+      return cache;
+    }
+  }
+  MegamorphicCache *cache = new MegamorphicCache(this, selector);
+  cache->next_ = megamorphic_caches_;
+  megamorphic_caches_ = cache;
+  return cache;
+}
+
+uword InlineCacheRuntime::ReachableTarget(uword site, uword target) {
+  if (Utils::IsInt(32, target - (site + CodePatcher::kCallSize))) {
+    return target;
+  }
+  Veneer **bucket = &veneers_[(target >> 4) % kVeneerBuckets];
+  for (Veneer *veneer = *bucket; veneer != NULL; veneer = veneer->next) {
+    if (veneer->target == target) {
+      return veneer->code;
+    }
+  }
+  Assembler assembler;
+  ExternalLabel label(target);
+  assembler.jmp(&label);
+  Veneer *veneer = new Veneer();
+  veneer->target = target;
+  veneer->code = InstallStub(&assembler, "InlineCache veneer");
+  veneer->size = assembler.CodeSize();
+  veneer->next = *bucket;
+  *bucket = veneer;
+  return veneer->code;
+}
+
+InlineCache::InlineCache(InlineCacheRuntime *runtime, intptr_t selector)
+    : calls_(0), misses_(0), runtime_(runtime), selector_(selector),
+      state_(kUnlinked), compare_offset_(-1), jump_offset_(-1),
+      call_offset_(-1), compare_(0), jump_(0), call_(0), entry_count_(0),
+      polymorphic_stub_(0), polymorphic_stub_size_(0) {}
+
+InlineCache::~InlineCache() {
+  if (polymorphic_stub_ != 0) {
+    pthread_mutex_lock(&runtime_->mutex_);
+    runtime_->RetireStub(polymorphic_stub_, polymorphic_stub_size_);
+    pthread_mutex_unlock(&runtime_->mutex_);
+  }
+}
+
+void InlineCache::EmitCall(Assembler *assembler) {
+  ASSERT(compare_offset_ < 0);
+  ASSERT(!assembler->in_cold_region());
+  // Nothing may move the patched instructions once emitted: padding is by
+  // NOPs, and the labels bound around the site keep the code before them
+  // in place. The site is aligned here rather than by the JCC erratum
+  // mitigation, whose padding would break the alignment of its fields.
+  const bool jcc_erratum_mitigation = assembler->jcc_erratum_mitigation();
+  const Assembler::AlignPadding align_padding = assembler->align_padding();
+  assembler->set_jcc_erratum_mitigation(false);
+  assembler->set_align_padding(Assembler::kAlignWithNops);
+  Label start, miss, done;
+  assembler->Bind(&start);
+  if (runtime_->count_calls()) {
+    assembler->movq(R10, Immediate(reinterpret_cast<int64_t>(&calls_)));
+    assembler->lock();
+    assembler->incq(Address(R10, 0));
+  }
+  // Each patched field within an aligned word. For the JCC erratum
+  // mitigation, the imm32 of the cmp starts at 0 or 16 mod 32: the jne is
+  // then at 6 or 22 and the call at 19 or 35, neither crossing nor ending
+  // on a 32-byte boundary. The cmp is neither a branch nor fused with the
+  // jne.
+  const intptr_t compare_size = runtime_->compare_size_;
+  assembler->Align(jcc_erratum_mitigation ? 16 : 8, compare_size - 4);
+  compare_offset_ = assembler->CodeSize();
+  assembler->cmpl(Address(InlineCacheRuntime::kReceiverRegister,
+                          runtime_->class_id_offset()),
+                  Immediate(kUnlinkedClassId));
+  ASSERT(assembler->CodeSize() == compare_offset_ + compare_size);
+  assembler->Align(8, CodePatcher::kConditionalJumpAlignmentOffset);
+  jump_offset_ = assembler->CodeSize();
+  assembler->j(NOT_EQUAL, &miss);
+  ASSERT(assembler->CodeSize() ==
+         jump_offset_ + CodePatcher::kConditionalJumpSize);
+  assembler->Align(8, CodePatcher::kCallAlignmentOffset);
+  // Not reached until linked.
+  assembler->call(&miss);
+  call_offset_ = assembler->CodeSize() - CodePatcher::kCallSize;
+  ASSERT(!jcc_erratum_mitigation ||
+         (jump_offset_ % 32 + CodePatcher::kConditionalJumpSize < 32 &&
+          call_offset_ % 32 + CodePatcher::kCallSize < 32));
+  assembler->Bind(&done);
+  assembler->set_jcc_erratum_mitigation(jcc_erratum_mitigation);
+  assembler->set_align_padding(align_padding);
+
+  assembler->EnterColdRegion();
+  assembler->Bind(&miss);
+  assembler->movq(R10, Immediate(reinterpret_cast<int64_t>(this)));
+  ExternalLabel miss_stub(runtime_->miss_stub_);
+  assembler->call(&miss_stub);
+  assembler->jmp(&done);
+  assembler->ExitColdRegion();
+}
+
+void InlineCache::Attach(uword entry_point) {
+  ASSERT(compare_offset_ >= 0);
+  compare_ = entry_point + compare_offset_;
+  jump_ = entry_point + jump_offset_;
+  call_ = entry_point + call_offset_;
+}
+
+uword InlineCache::HandleMiss(InlineCache *cache, uword receiver) {
+  InlineCacheRuntime *runtime = cache->runtime_;
+  const int32_t class_id = ReceiverClassId(runtime, receiver);
+  cache->misses_.fetch_add(1, std::memory_order_relaxed);
+  pthread_mutex_lock(&runtime->mutex_);
+  ASSERT(cache->call_ != 0);
+  // Another thread may have added the class since.
+  uword target = cache->CachedTarget(class_id);
+  if (target == 0) {
+    target = runtime->Lookup(cache->selector_, class_id);
+    cache->AddTarget(class_id, target);
+  }
+  pthread_mutex_unlock(&runtime->mutex_);
+  return target;
+}
+
+uword InlineCache::CachedTarget(int32_t class_id) const {
+  if (state() == kMegamorphic) {
+    return runtime_->MegamorphicCacheFor(selector_)->Lookup(class_id);
+  }
+  for (intptr_t i = 0; i < entry_count_; i++) {
+    if (class_ids_[i] == class_id) {
+      return targets_[i];
+    }
+  }
+  return 0;
+}
+
+void InlineCache::AddTarget(int32_t class_id, uword target) {
+  if (state() == kMegamorphic) {
+    runtime_->MegamorphicCacheFor(selector_)->Insert(class_id, target);
+    return;
+  }
+  if (entry_count_ == kMaxPolymorphicEntries) {
+    SwitchToMegamorphic();
+    runtime_->MegamorphicCacheFor(selector_)->Insert(class_id, target);
+    return;
+  }
+  class_ids_[entry_count_] = class_id;
+  targets_[entry_count_] = target;
+  entry_count_++;
+  if (state() == kUnlinked) {
+    // The call is only reached once the cmp matches.
+    CodePatcher::PatchCall(call_, runtime_->ReachableTarget(call_, target));
+    CodePatcher::SerializeCores();
+    CodePatcher::PatchImmediate32(compare_, runtime_->compare_size_,
+                                  class_id);
+    state_.store(kMonomorphic, std::memory_order_relaxed);
+    return;
+  }
+  SwitchToPolymorphicStub();
+}
+
+void InlineCache::SwitchToPolymorphicStub() {
+  Assembler assembler;
+  EmitPolymorphicStub(&assembler);
+  const uword previous_stub = polymorphic_stub_;
+  const intptr_t previous_stub_size = polymorphic_stub_size_;
+  polymorphic_stub_ =
+      runtime_->InstallStub(&assembler, "InlineCache polymorphic stub");
+  polymorphic_stub_size_ = assembler.CodeSize();
+  CallStub(polymorphic_stub_);
+  state_.store(kPolymorphic, std::memory_order_relaxed);
+  if (previous_stub != 0) {
+    runtime_->RetireStub(previous_stub, previous_stub_size);
+  }
+}
+
+void InlineCache::SwitchToMegamorphic() {
+  MegamorphicCache *cache = runtime_->MegamorphicCacheFor(selector_);
+  for (intptr_t i = 0; i < entry_count_; i++) {
+    cache->Insert(class_ids_[i], targets_[i]);
+  }
+  CallStub(cache->stub());
+  state_.store(kMegamorphic, std::memory_order_relaxed);
+  entry_count_ = 0;
+  if (polymorphic_stub_ != 0) {
+    runtime_->RetireStub(polymorphic_stub_, polymorphic_stub_size_);
+    polymorphic_stub_ = 0;
+    polymorphic_stub_size_ = 0;
+  }
+}
+
+void InlineCache::CallStub(uword stub) {
+  // The stub dispatches the class of the cmp too, so the call goes to it
+  // before the jne falls through.
+  CodePatcher::PatchCall(call_, runtime_->ReachableTarget(call_, stub));
+  if (state() == kMonomorphic) {
+    CodePatcher::SerializeCores();
+    CodePatcher::PatchConditionalJump(
+        jump_, jump_ + CodePatcher::kConditionalJumpSize);
+  }
+}
+
+void InlineCache::EmitPolymorphicStub(Assembler *assembler) {
+  const Address class_id(InlineCacheRuntime::kReceiverRegister,
+                         runtime_->class_id_offset());
+  for (intptr_t i = 0; i < entry_count_; i++) {
+    Label next;
+    assembler->cmpl(class_id, Immediate(class_ids_[i]));
+    assembler->j(NOT_EQUAL, &next, Assembler::kNearJump);
+    ExternalLabel target(targets_[i]);
+    assembler->jmp(&target);
+    assembler->Bind(&next);
+  }
+  assembler->movq(R10, Immediate(reinterpret_cast<int64_t>(this)));
+  ExternalLabel miss_stub(runtime_->miss_stub_);
+  assembler->jmp(&miss_stub);
+}
+
+MegamorphicCache::MegamorphicCache(InlineCacheRuntime *runtime,
+                                   intptr_t selector)
+    : runtime_(runtime), selector_(selector),
+      table_(NewTable(kInitialCapacity)), stub_(0), stub_size_(0),
+      misses_(0), next_(NULL) {
+  Assembler assembler;
+  EmitStub(&assembler);
+  stub_ = runtime->InstallStub(&assembler, "MegamorphicCache stub");
+  stub_size_ = assembler.CodeSize();
+}
+
+MegamorphicCache::~MegamorphicCache() {
+  Table *table = table_.load(std::memory_order_relaxed);
+  while (table != NULL) {
+    Table *previous = table->previous;
+    free(table);
+    table = previous;
+  }
+}
+
+MegamorphicCache::Table *MegamorphicCache::NewTable(intptr_t capacity) {
+  ASSERT(Utils::IsPowerOfTwo(capacity));
+  Table *table = reinterpret_cast<Table *>(
+      malloc(offsetof(Table, entries) + capacity * sizeof(Entry)));
+  table->mask = (capacity - 1) * sizeof(Entry);
+  table->count = 0;
+  table->previous = NULL;
+  table->padding = 0;
+  for (intptr_t i = 0; i < capacity; i++) {
+    table->entries[i].class_id = kEmptyClassId;
+    table->entries[i].target = 0;
+  }
+  return table;
+}
+
+intptr_t MegamorphicCache::EntryCount() const {
+  return table_.load(std::memory_order_acquire)->count;
+}
+
+uword MegamorphicCache::HandleMiss(MegamorphicCache *cache, uword receiver) {
+  InlineCacheRuntime *runtime = cache->runtime_;
+  const int32_t class_id = ReceiverClassId(runtime, receiver);
+  cache->misses_.fetch_add(1, std::memory_order_relaxed);
+  pthread_mutex_lock(&runtime->mutex_);
+  uword target = cache->Lookup(class_id);
+  if (target == 0) {
+    target = runtime->Lookup(cache->selector_, class_id);
+    cache->Insert(class_id, target);
+  }
+  pthread_mutex_unlock(&runtime->mutex_);
+  return target;
+}
+
+// The stub computes the first probe with a 32-bit multiplication.
+intptr_t MegamorphicCache::FirstProbe(int32_t class_id) {
+  return static_cast<uint32_t>(class_id) *
+         static_cast<uint32_t>(kSpreadFactor * sizeof(Entry));
+}
+
+MegamorphicCache::Entry *MegamorphicCache::EmptyEntry(Table *table,
+                                                      intptr_t class_id) {
+  uint8_t *entries = reinterpret_cast<uint8_t *>(table->entries);
+  intptr_t probe = FirstProbe(class_id);
+  for (;;) {
+    probe &= table->mask;
+    Entry *entry = reinterpret_cast<Entry *>(entries + probe);
+    if (entry->class_id == kEmptyClassId) {
+      return entry;
+    }
+    probe += sizeof(Entry);
+  }
+}
+
+uword MegamorphicCache::Lookup(int32_t class_id) const {
+  const Table *table = table_.load(std::memory_order_acquire);
+  const uint8_t *entries = reinterpret_cast<const uint8_t *>(table->entries);
+  intptr_t probe = FirstProbe(class_id);
+  for (;;) {
+    probe &= table->mask;
+    const Entry *entry = reinterpret_cast<const Entry *>(entries + probe);
+    if (entry->class_id == class_id) {
+      return entry->target;
+    }
+    if (entry->class_id == kEmptyClassId) {
+      return 0;
+    }
+    probe += sizeof(Entry);
+  }
+}
+
+void MegamorphicCache::Insert(int32_t class_id, uword target) {
+  // Other sites of the selector may have added it.
+  if (Lookup(class_id) != 0) {
+    return;
+  }
+  Table *table = table_.load(std::memory_order_relaxed);
+  const intptr_t capacity = table->mask / sizeof(Entry) + 1;
+  // At most half full, so that misses end their probes quickly.
+  if (2 * (table->count + 1) > capacity) {
+    Table *grown = NewTable(2 * capacity);
+    for (intptr_t i = 0; i < capacity; i++) {
+      const Entry &entry = table->entries[i];
+      if (entry.class_id != kEmptyClassId) {
+        *EmptyEntry(grown, entry.class_id) = entry;
+      }
+    }
+    grown->count = table->count;
+    grown->previous = table;
+    table_.store(grown, std::memory_order_release);
+    table = grown;
+  }
+  Entry *entry = EmptyEntry(table, class_id);
+  // Stubs probing the table meanwhile see the target before the class.
+  __atomic_store_n(&entry->target, target, __ATOMIC_RELAXED);
+  __atomic_store_n(&entry->class_id, static_cast<intptr_t>(class_id),
+                   __ATOMIC_RELEASE);
+  table->count++;
+}
+
+// Probes the table as Lookup() does, with the class id in R11 and the byte
+// offset of the probe in RAX.
+void MegamorphicCache::EmitStub(Assembler *assembler) {
+  const intptr_t entries = offsetof(Table, entries);
+  Label loop, hit, miss;
+  assembler->movl(R11, Address(InlineCacheRuntime::kReceiverRegister,
+                               runtime_->class_id_offset()));
+  assembler->movq(R10, Immediate(reinterpret_cast<int64_t>(&table_)));
+  assembler->movq(R10, Address(R10, 0));
+  assembler->movl(RAX, R11);
+  assembler->imull(RAX, Immediate(kSpreadFactor * sizeof(Entry)));
+  assembler->Bind(&loop);
+  assembler->andq(RAX, Address(R10, offsetof(Table, mask)));
+  assembler->cmpq(R11, Address(R10, RAX, TIMES_1,
+                               entries + offsetof(Entry, class_id)));
+  assembler->j(EQUAL, &hit, Assembler::kNearJump);
+  assembler->cmpq(
+      Address(R10, RAX, TIMES_1, entries + offsetof(Entry, class_id)),
+      Immediate(kEmptyClassId));
+  assembler->j(EQUAL, &miss, Assembler::kNearJump);
+  assembler->addq(RAX, Immediate(sizeof(Entry)));
+  assembler->jmp(&loop, Assembler::kNearJump);
+  assembler->Bind(&hit);
+  assembler->jmp(
+      Address(R10, RAX, TIMES_1, entries + offsetof(Entry, target)));
+  assembler->Bind(&miss);
+  assembler->movq(R10, Immediate(reinterpret_cast<int64_t>(this)));
+  ExternalLabel miss_stub(runtime_->megamorphic_miss_stub_);
+  assembler->jmp(&miss_stub);
+}
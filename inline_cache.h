@@ -0,0 +1,248 @@
+// Copyright (c) 2019, the Dart project authors.  Please see the AUTHORS file
+// for details. All rights reserved. Use of this source code is governed by a
+// BSD-style license that can be found in the LICENSE file.
+
+#pragma once
+
+#include <pthread.h>
+
+#include <atomic>
+
+#include "assembler.h"
+#include "code_heap.h"
+#include "globals.h"
+
+class InlineCache;
+class MegamorphicCache;
+
+// The state shared by the inline caches of generated code: the layout of
+// receivers, the full lookup done on misses and the stubs installed in a
+// CodeHeap. Receivers hold their class id, a non-negative int32, at
+// class_id_offset().
+//
+// Dispatched calls pass the receiver in kReceiverRegister, as the first
+// argument of the C calling convention, and clobber RAX, R10 and R11 on the
+// way to the target, which takes no variable arguments.
+//
+// Stubs are freed with the epoch-based reclamation of the CodeHeap, so that
+// code containing inline cache sites must be run inside a
+// CodeHeap::CriticalSection. The runtime must outlive its inline caches.
+class InlineCacheRuntime {
+public:
+  static const Register kReceiverRegister = RDI;
+
+  // Returns the target of |selector| for receivers of class |class_id|.
+  // Called on misses, one call at a time.
+  typedef uword (*LookupFunction)(intptr_t selector, int32_t class_id,
+                                  void *argument);
+
+  InlineCacheRuntime(CodeHeap *heap, intptr_t class_id_offset,
+                     LookupFunction lookup, void *argument);
+  ~InlineCacheRuntime();
+
+  intptr_t class_id_offset() const { return class_id_offset_; }
+
+  // Whether the sites emitted from now on count their calls. Counting
+  // takes a locked increment on every call.
+  bool count_calls() const { return count_calls_; }
+  void set_count_calls(bool enable) { count_calls_ = enable; }
+
+private:
+  struct Veneer;
+
+  // Finalizes and installs the code of |assembler|, named |name| for perf.
+  uword InstallStub(Assembler *assembler, const char *name);
+  void RetireStub(uword stub, intptr_t size) { thread_.Retire(stub, size); }
+  // Creates the cache of |selector| on its first use.
+  MegamorphicCache *MegamorphicCacheFor(intptr_t selector);
+  // Returns |target|, or a jump to it within rel32 range of |site|.
+  uword ReachableTarget(uword site, uword target);
+  uword Lookup(intptr_t selector, int32_t class_id) {
+    return lookup_(selector, class_id, argument_);
+  }
+
+  CodeHeap *heap_;
+  const intptr_t class_id_offset_;
+  LookupFunction lookup_;
+  void *argument_;
+  bool count_calls_;
+  // Size of the cmp of a site, which depends on class_id_offset_.
+  intptr_t compare_size_;
+
+  // Guards the state of the inline caches, and the stubs.
+  pthread_mutex_t mutex_;
+  CodeHeap::Thread thread_;
+  // Entered with a return address on the stack and the InlineCache or
+  // MegamorphicCache that missed in R10.
+  uword miss_stub_;
+  intptr_t miss_stub_size_;
+  uword megamorphic_miss_stub_;
+  intptr_t megamorphic_miss_stub_size_;
+  MegamorphicCache *megamorphic_caches_;
+  // Jumps to targets out of reach of a call site, hashed by target.
+  static const intptr_t kVeneerBuckets = 64;
+  Veneer *veneers_[kVeneerBuckets];
+
+  friend class InlineCache;
+  friend class MegamorphicCache;
+  DISALLOW_COPY_AND_ASSIGN(InlineCacheRuntime);
+};
+
+// An inline cache for a call of a selector dispatched on the class of its
+// receiver. EmitCall() emits the patchable site:
+//
+//     cmpl [receiver + class_id_offset], imm32
+//     jne miss
+//     call target
+//
+// which goes through these states on misses:
+//
+//   - unlinked: the cmp matches no class, and every call misses;
+//   - monomorphic: the cmp checks the class of the first receiver, and the
+//     call goes to its target;
+//   - polymorphic: the jne falls through, and the call goes to a stub of
+//     this site comparing the class with up to kMaxPolymorphicEntries
+//     classes and jumping to their targets;
+//   - megamorphic: the call goes to the stub of the selector, shared by
+//     the megamorphic sites, which looks the class up in a hash table.
+//
+// Transitions happen on the thread that missed, with the site running on
+// other threads: the site is patched with the CodePatcher, in an order
+// that dispatches correctly at every step.
+class InlineCache {
+public:
+  static const intptr_t kMaxPolymorphicEntries = 4;
+  // In the cmp of an unlinked site. Keeps the imm32 form of the cmp.
+  static const int32_t kUnlinkedClassId = kMinInt32;
+
+  enum State {
+    kUnlinked,
+    kMonomorphic,
+    kPolymorphic,
+    kMegamorphic,
+  };
+
+  InlineCache(InlineCacheRuntime *runtime, intptr_t selector);
+  // The code of the site must no longer be running.
+  ~InlineCache();
+
+  // Emits the site in the hot code of |assembler|, and its miss path in the
+  // cold code. Emitted once per inline cache. With the JCC erratum
+  // mitigation of |assembler|, the jne and the call of the site neither
+  // cross nor end on a 32-byte boundary.
+  void EmitCall(Assembler *assembler);
+  // Links the site to its code, installed at |entry_point| (offset 0 of the
+  // finalized code of the assembler). Must be done before it is run. The
+  // code must be within rel32 range of the stubs of the runtime, as code
+  // installed in a CodeHeap of at most 2 GB is.
+  void Attach(uword entry_point);
+
+  intptr_t selector() const { return selector_; }
+  State state() const { return state_.load(std::memory_order_relaxed); }
+  // Calls through the site, if counted (see
+  // InlineCacheRuntime::count_calls()).
+  int64_t calls() const { return calls_.load(std::memory_order_relaxed); }
+  // Calls that missed the site or its polymorphic stub. Misses of the
+  // megamorphic stub are counted by the MegamorphicCache.
+  int64_t misses() const { return misses_.load(std::memory_order_relaxed); }
+  // Of counted sites.
+  int64_t hits() const { return calls() - misses(); }
+
+private:
+  // Called by the miss stub. Returns the target for |receiver|.
+  static uword HandleMiss(InlineCache *cache, uword receiver);
+  // Returns the target of |class_id| in the current state, or 0.
+  uword CachedTarget(int32_t class_id) const;
+  // Adds the target of a class that missed, moving to the next state.
+  void AddTarget(int32_t class_id, uword target);
+  // Installs a stub for the polymorphic entries.
+  void SwitchToPolymorphicStub();
+  void SwitchToMegamorphic();
+  // Makes the site call |stub| for every class.
+  void CallStub(uword stub);
+  void EmitPolymorphicStub(Assembler *assembler);
+
+  // Incremented by the site, when counting calls.
+  std::atomic<int64_t> calls_;
+  std::atomic<int64_t> misses_;
+  InlineCacheRuntime *runtime_;
+  const intptr_t selector_;
+  std::atomic<State> state_;
+
+  // Offsets in the code, and addresses once attached, of the cmp, jne and
+  // call of the site.
+  intptr_t compare_offset_;
+  intptr_t jump_offset_;
+  intptr_t call_offset_;
+  uword compare_;
+  uword jump_;
+  uword call_;
+
+  // The classes and targets of the monomorphic and polymorphic states.
+  int32_t class_ids_[kMaxPolymorphicEntries];
+  uword targets_[kMaxPolymorphicEntries];
+  intptr_t entry_count_;
+  uword polymorphic_stub_;
+  intptr_t polymorphic_stub_size_;
+
+  friend class InlineCacheRuntime;
+  DISALLOW_COPY_AND_ASSIGN(InlineCache);
+};
+
+// The classes and targets of a selector seen by its megamorphic sites, in
+// an open addressing hash table probed by the stub of the selector.
+// Entries are only added, under the lock of the runtime; a full table is
+// replaced by one twice its size, and kept until the cache is destroyed, as
+// stubs may still be probing it.
+class MegamorphicCache {
+public:
+  intptr_t selector() const { return selector_; }
+  uword stub() const { return stub_; }
+  intptr_t EntryCount() const;
+  int64_t misses() const { return misses_.load(std::memory_order_relaxed); }
+
+private:
+  struct Entry {
+    intptr_t class_id; // kEmptyClassId for an empty entry.
+    uword target;
+  };
+  struct Table {
+    // The capacity minus one, times sizeof(Entry): probes are byte offsets.
+    intptr_t mask;
+    intptr_t count;
+    Table *previous;
+    intptr_t padding;
+    Entry entries[1];
+  };
+  static const intptr_t kEmptyClassId = -1;
+  static const intptr_t kInitialCapacity = 16;
+  // Spreads consecutive class ids over the table.
+  static const intptr_t kSpreadFactor = 7;
+
+  MegamorphicCache(InlineCacheRuntime *runtime, intptr_t selector);
+  ~MegamorphicCache();
+
+  static Table *NewTable(intptr_t capacity);
+  // The byte offset of the first entry probed for |class_id|.
+  static intptr_t FirstProbe(int32_t class_id);
+  static Entry *EmptyEntry(Table *table, intptr_t class_id);
+  // Called by the megamorphic miss stub.
+  static uword HandleMiss(MegamorphicCache *cache, uword receiver);
+  uword Lookup(int32_t class_id) const;
+  // Adds the target of |class_id|, unless already there.
+  void Insert(int32_t class_id, uword target);
+  void EmitStub(Assembler *assembler);
+
+  InlineCacheRuntime *runtime_;
+  const intptr_t selector_;
+  // Read by the stub.
+  std::atomic<Table *> table_;
+  uword stub_;
+  intptr_t stub_size_;
+  std::atomic<int64_t> misses_;
+  MegamorphicCache *next_;
+
+  friend class InlineCache;
+  friend class InlineCacheRuntime;
+  DISALLOW_COPY_AND_ASSIGN(MegamorphicCache);
+};
@@ -0,0 +1,300 @@
+// Copyright (c) 2019, the Dart project authors.  Please see the AUTHORS file
+// for details. All rights reserved. Use of this source code is governed by a
+// BSD-style license that can be found in the LICENSE file.
+
+#include "perf_registry.h"
+
+#include <elf.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+PerfCodeRegistry *PerfCodeRegistry::instance_ = NULL;
+
+// The jitdump format, as specified in tools/perf/Documentation/
+// jitdump-specification.txt of the Linux sources.
+static const uint32_t kJitDumpMagic = 0x4A695444; // "JiTD"
+static const uint32_t kJitDumpVersion = 1;
+
+struct JitDumpHeader {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t total_size;
+  uint32_t elf_mach;
+  uint32_t pad1;
+  uint32_t pid;
+  uint64_t timestamp;
+  uint64_t flags;
+};
+
+enum JitDumpRecordId {
+  kJitCodeLoad = 0,
+  kJitCodeClose = 3,
+};
+
+struct JitDumpRecordHeader {
+  uint32_t id;
+  uint32_t total_size;
+  uint64_t timestamp;
+};
+
+// Followed by the name, with its terminating NUL, and the code.
+struct JitDumpCodeLoad {
+  JitDumpRecordHeader header;
+  uint32_t pid;
+  uint32_t tid;
+  uint64_t vma;
+  uint64_t code_address;
+  uint64_t code_size;
+  uint64_t code_index;
+};
+
+// A pending record; followed by the name and the code, padded to 8 bytes.
+struct PendingRecord {
+  uint64_t timestamp;
+  uword address;
+  intptr_t size;
+  intptr_t name_length; // Without the terminating NUL.
+  uint32_t tid;
+};
+
+// The clock of "perf record -k mono".
+static uint64_t Timestamp() {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return static_cast<uint64_t>(now.tv_sec) * 1000000000 + now.tv_nsec;
+}
+
+static bool WriteFully(int fd, const void *data, intptr_t size) {
+  const uint8_t *bytes = reinterpret_cast<const uint8_t *>(data);
+  while (size > 0) {
+    const ssize_t written = write(fd, bytes, size);
+    if (written < 0) {
+      return false;
+    }
+    bytes += written;
+    size -= written;
+  }
+  return true;
+}
+
+static void EmitBytes(AssemblerBuffer *buffer, const void *data,
+                      intptr_t size) {
+  const uint8_t *bytes = reinterpret_cast<const uint8_t *>(data);
+  for (intptr_t i = 0; i < size; i++) {
+    AssemblerBuffer::EnsureCapacity ensured(buffer);
+    buffer->Emit<uint8_t>(bytes[i]);
+  }
+}
+
+static intptr_t RoundUp(intptr_t value, intptr_t alignment) {
+  ASSERT(Utils::IsPowerOfTwo(alignment));
+  return (value + alignment - 1) & ~(alignment - 1);
+}
+
+PerfCodeRegistry::PerfCodeRegistry()
+    : stopping_(false), perf_map_(NULL), jitdump_fd_(-1),
+      jitdump_marker_(NULL), code_index_(0) {
+  pthread_mutex_init(&mutex_, NULL);
+  pthread_cond_init(&condition_, NULL);
+}
+
+PerfCodeRegistry::~PerfCodeRegistry() {
+  if (perf_map_ != NULL) {
+    fclose(perf_map_);
+  }
+  if (jitdump_marker_ != NULL) {
+    munmap(jitdump_marker_, sysconf(_SC_PAGESIZE));
+  }
+  if (jitdump_fd_ >= 0) {
+    close(jitdump_fd_);
+  }
+  pthread_cond_destroy(&condition_);
+  pthread_mutex_destroy(&mutex_);
+}
+
+bool PerfCodeRegistry::Start(intptr_t formats, const char *jitdump_directory) {
+  ASSERT(instance_ == NULL);
+  PerfCodeRegistry *registry = new PerfCodeRegistry();
+  if (!registry->Open(formats, jitdump_directory) ||
+      pthread_create(&registry->writer_, NULL, WriterMain, registry) != 0) {
+    delete registry;
+    return false;
+  }
+  instance_ = registry;
+  return true;
+}
+
+bool PerfCodeRegistry::Open(intptr_t formats, const char *jitdump_directory) {
+  char path[PATH_MAX];
+  if ((formats & kPerfMap) != 0) {
+    // perf only looks for the map in /tmp.
+    snprintf(path, sizeof(path), "/tmp/perf-%d.map", getpid());
+    perf_map_ = fopen(path, "a");
+    if (perf_map_ == NULL) {
+      return false;
+    }
+  }
+  if ((formats & kJitDump) != 0) {
+    if (snprintf(path, sizeof(path), "%s/jit-%d.dump", jitdump_directory,
+                 getpid()) >= static_cast<int>(sizeof(path))) {
+      return false;
+    }
+    jitdump_fd_ = open(path, O_CREAT | O_TRUNC | O_RDWR, 0666);
+    if (jitdump_fd_ < 0) {
+      return false;
+    }
+    JitDumpHeader header;
+    memset(&header, 0, sizeof(header));
+    header.magic = kJitDumpMagic;
+    header.version = kJitDumpVersion;
+    header.total_size = sizeof(header);
+    header.elf_mach = EM_X86_64;
+    header.pid = getpid();
+    header.timestamp = Timestamp();
+    if (!WriteFully(jitdump_fd_, &header, sizeof(header))) {
+      return false;
+    }
+    void *marker = mmap(NULL, sysconf(_SC_PAGESIZE), PROT_READ | PROT_EXEC,
+                        MAP_PRIVATE, jitdump_fd_, 0);
+    if (marker == MAP_FAILED) {
+      return false;
+    }
+    jitdump_marker_ = marker;
+  }
+  return true;
+}
+
+void PerfCodeRegistry::Stop() {
+  PerfCodeRegistry *registry = instance_;
+  ASSERT(registry != NULL);
+  pthread_mutex_lock(&registry->mutex_);
+  registry->stopping_ = true;
+  pthread_cond_signal(&registry->condition_);
+  pthread_mutex_unlock(&registry->mutex_);
+  pthread_join(registry->writer_, NULL);
+  if (registry->jitdump_fd_ >= 0) {
+    JitDumpRecordHeader close_record;
+    close_record.id = kJitCodeClose;
+    close_record.total_size = sizeof(close_record);
+    close_record.timestamp = Timestamp();
+    WriteFully(registry->jitdump_fd_, &close_record, sizeof(close_record));
+  }
+  instance_ = NULL;
+  delete registry;
+}
+
+void PerfCodeRegistry::AddCode(const char *name, Assembler *assembler) {
+  if (instance_ == NULL) {
+    return;
+  }
+  ASSERT(assembler->is_finalized());
+  ASSERT(assembler->code_address() != 0);
+  instance_->Record(
+      name, assembler->code_address(),
+      reinterpret_cast<const uint8_t *>(assembler->CodeAddress(0)),
+      assembler->CodeSize());
+}
+
+void PerfCodeRegistry::AddCode(const char *name, uword address,
+                               intptr_t size) {
+  if (instance_ == NULL) {
+    return;
+  }
+  instance_->Record(name, address, reinterpret_cast<const uint8_t *>(address),
+                    size);
+}
+
+void PerfCodeRegistry::Record(const char *name, uword address,
+                              const uint8_t *code, intptr_t size) {
+  PendingRecord record;
+  memset(&record, 0, sizeof(record));
+  record.timestamp = Timestamp();
+  record.address = address;
+  record.size = size;
+  record.name_length = strlen(name);
+  record.tid = syscall(SYS_gettid);
+  // The code bytes are only needed by the jitdump.
+  const intptr_t code_size = jitdump_fd_ >= 0 ? size : 0;
+  pthread_mutex_lock(&mutex_);
+  const bool was_empty = pending_.Size() == 0;
+  EmitBytes(&pending_, &record, sizeof(record));
+  EmitBytes(&pending_, name, record.name_length);
+  EmitBytes(&pending_, code, code_size);
+  while (!Utils::IsAligned(pending_.Size(), 8)) {
+    AssemblerBuffer::EnsureCapacity ensured(&pending_);
+    pending_.Emit<uint8_t>(0);
+  }
+  if (was_empty) {
+    pthread_cond_signal(&condition_);
+  }
+  pthread_mutex_unlock(&mutex_);
+}
+
+void *PerfCodeRegistry::WriterMain(void *argument) {
+  PerfCodeRegistry *registry = reinterpret_cast<PerfCodeRegistry *>(argument);
+  AssemblerBuffer records;
+  pthread_mutex_lock(&registry->mutex_);
+  while (true) {
+    while (registry->pending_.Size() == 0 && !registry->stopping_) {
+      pthread_cond_wait(&registry->condition_, &registry->mutex_);
+    }
+    if (registry->pending_.Size() == 0) {
+      break;
+    }
+    records.Swap(&registry->pending_);
+    pthread_mutex_unlock(&registry->mutex_);
+    registry->Write(&records);
+    pthread_mutex_lock(&registry->mutex_);
+  }
+  pthread_mutex_unlock(&registry->mutex_);
+  return NULL;
+}
+
+void PerfCodeRegistry::Write(AssemblerBuffer *records) {
+  const uint32_t pid = getpid();
+  intptr_t position = 0;
+  while (position < records->Size()) {
+    const PendingRecord record = records->Load<PendingRecord>(position);
+    const char *name =
+        reinterpret_cast<const char *>(records->Address(position)) +
+        sizeof(record);
+    const uint8_t *code =
+        reinterpret_cast<const uint8_t *>(name) + record.name_length;
+    if (perf_map_ != NULL) {
+      fprintf(perf_map_, "%" PRIxPTR " %" PRIxPTR " %.*s\n", record.address,
+              static_cast<uword>(record.size),
+              static_cast<int>(record.name_length), name);
+    }
+    intptr_t code_size = 0;
+    if (jitdump_fd_ >= 0) {
+      code_size = record.size;
+      JitDumpCodeLoad load;
+      memset(&load, 0, sizeof(load));
+      load.header.id = kJitCodeLoad;
+      load.header.total_size =
+          sizeof(load) + record.name_length + 1 + record.size;
+      load.header.timestamp = record.timestamp;
+      load.pid = pid;
+      load.tid = record.tid;
+      load.vma = record.address;
+      load.code_address = record.address;
+      load.code_size = record.size;
+      load.code_index = code_index_++;
+      const char terminator = '\0';
+      WriteFully(jitdump_fd_, &load, sizeof(load));
+      WriteFully(jitdump_fd_, name, record.name_length);
+      WriteFully(jitdump_fd_, &terminator, 1);
+      WriteFully(jitdump_fd_, code, record.size);
+    }
+    position += RoundUp(sizeof(record) + record.name_length + code_size, 8);
+  }
+  if (perf_map_ != NULL) {
+    fflush(perf_map_);
+  }
+  records->Reset();
+}
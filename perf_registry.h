@@ -0,0 +1,75 @@
+// Copyright (c) 2019, the Dart project authors.  Please see the AUTHORS file
+// for details. All rights reserved. Use of this source code is governed by a
+// BSD-style license that can be found in the LICENSE file.
+
+#pragma once
+
+#include <pthread.h>
+#include <stdio.h>
+
+#include "assembler.h"
+#include "globals.h"
+
+// Describes generated code to the Linux perf profiler, which otherwise only
+// sees anonymous executable memory.
+//
+// Two formats are supported:
+//   - the perf map, /tmp/perf-<pid>.map, with a "start size name" line per
+//     code object, read by "perf report";
+//   - the jitdump, jit-<pid>.dump, which also holds the code bytes so that
+//     "perf annotate" can disassemble them. It is merged into a profile with
+//     "perf inject --jit" and requires "perf record -k mono".
+//
+// Recording is opt-in and done off the compiling thread: AddCode() only
+// copies the record into a buffer, which a writer thread drains to the
+// files.
+class PerfCodeRegistry {
+public:
+  enum Format {
+    kPerfMap = 1 << 0,
+    kJitDump = 1 << 1,
+  };
+
+  // Starts recording code in the |formats|. The jitdump is written to
+  // |jitdump_directory|. Returns false if a file cannot be created. Must not
+  // race with AddCode() or Stop().
+  static bool Start(intptr_t formats, const char *jitdump_directory = "/tmp");
+  // Writes the pending records and closes the files. Must not race with
+  // AddCode().
+  static void Stop();
+  static bool IsEnabled() { return instance_ != NULL; }
+
+  // Records the code of |assembler|, which must have been finalized and
+  // given its code_address(). Does nothing unless started. Thread safe.
+  static void AddCode(const char *name, Assembler *assembler);
+  // Records the |size| bytes of code at |address|.
+  static void AddCode(const char *name, uword address, intptr_t size);
+
+private:
+  PerfCodeRegistry();
+  ~PerfCodeRegistry();
+
+  bool Open(intptr_t formats, const char *jitdump_directory);
+  void Record(const char *name, uword address, const uint8_t *code,
+              intptr_t size);
+  static void *WriterMain(void *registry);
+  // Writes and consumes the records in |records|.
+  void Write(AssemblerBuffer *records);
+
+  static PerfCodeRegistry *instance_;
+
+  pthread_mutex_t mutex_;
+  pthread_cond_t condition_;
+  pthread_t writer_;
+  // Records not written yet; guarded by mutex_.
+  AssemblerBuffer pending_;
+  bool stopping_;
+
+  FILE *perf_map_;
+  int jitdump_fd_;
+  // perf finds the jitdump through this executable mapping of it.
+  void *jitdump_marker_;
+  uint64_t code_index_;
+
+  DISALLOW_COPY_AND_ASSIGN(PerfCodeRegistry);
+};
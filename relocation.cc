@@ -0,0 +1,171 @@
+// Copyright (c) 2019, the Dart project authors.  Please see the AUTHORS file
+// for details. All rights reserved. Use of this source code is governed by a
+// BSD-style license that can be found in the LICENSE file.
+
+#include "relocation.h"
+
+static intptr_t RoundUp(intptr_t value, intptr_t alignment) {
+  ASSERT(Utils::IsPowerOfTwo(alignment));
+  return (value + alignment - 1) & ~(alignment - 1);
+}
+
+void CodeRelocator::AddFunction(intptr_t symbol, Assembler *assembler) {
+  ASSERT(assembler->is_finalized());
+  ASSERT(LookupFunction(symbol) == NULL);
+  const Function function = {
+      symbol,
+      assembler,
+      reinterpret_cast<const uint8_t *>(assembler->CodeAddress(0)),
+      assembler->CodeSize(),
+      NULL,
+      assembler->RelocationCount(),
+      -1};
+  AssemblerBuffer::EnsureCapacity ensured(&functions_);
+  functions_.Emit<Function>(function);
+}
+
+void CodeRelocator::AddFunction(intptr_t symbol, const uint8_t *code,
+                                intptr_t size,
+                                const Assembler::Relocation *relocations,
+                                intptr_t relocation_count) {
+  ASSERT(LookupFunction(symbol) == NULL);
+  const Function function = {
+      symbol, NULL, code, size, relocations, relocation_count, -1};
+  AssemblerBuffer::EnsureCapacity ensured(&functions_);
+  functions_.Emit<Function>(function);
+}
+
+void CodeRelocator::AddExternalSymbol(intptr_t symbol, uword address) {
+  ASSERT(address != 0);
+  ASSERT(LookupExternalSymbol(symbol) == 0);
+  const ExternalSymbol external = {symbol, address};
+  AssemblerBuffer::EnsureCapacity ensured(&external_symbols_);
+  external_symbols_.Emit<ExternalSymbol>(external);
+}
+
+CodeRelocator::Function *CodeRelocator::LookupFunction(intptr_t symbol) {
+  for (intptr_t i = 0; i < FunctionCount(); i++) {
+    if (FunctionAt(i)->symbol == symbol) {
+      return FunctionAt(i);
+    }
+  }
+  return NULL;
+}
+
+uword CodeRelocator::LookupExternalSymbol(intptr_t symbol) {
+  for (intptr_t i = 0; i < external_symbols_.Size();
+       i += sizeof(ExternalSymbol)) {
+    const ExternalSymbol external = external_symbols_.Load<ExternalSymbol>(i);
+    if (external.symbol == symbol) {
+      return external.address;
+    }
+  }
+  return 0;
+}
+
+intptr_t CodeRelocator::FunctionOffset(intptr_t symbol) {
+  Function *function = LookupFunction(symbol);
+  ASSERT(function != NULL && function->offset >= 0);
+  return function->offset;
+}
+
+intptr_t CodeRelocator::MaxSize() {
+  intptr_t size = 0;
+  intptr_t veneers = 0;
+  for (intptr_t i = 0; i < FunctionCount(); i++) {
+    Function *function = FunctionAt(i);
+    size = RoundUp(size, kFunctionAlignment) + function->size;
+    for (intptr_t j = 0; j < function->relocation_count; j++) {
+      if (LookupFunction(RelocationAt(function, j).symbol) == NULL) {
+        veneers++;
+      }
+    }
+  }
+  return RoundUp(size, kVeneerSize) + veneers * kVeneerSize;
+}
+
+intptr_t CodeRelocator::Link(uword region, intptr_t capacity) {
+  ASSERT(Utils::IsInt(32, capacity));
+  veneer_targets_.Reset();
+  intptr_t end = 0;
+  for (intptr_t i = 0; i < FunctionCount(); i++) {
+    Function *function = FunctionAt(i);
+    const intptr_t start = RoundUp(end, kFunctionAlignment);
+    if (start + function->size > capacity) {
+      FATAL("Code region too small");
+    }
+    Assembler::InitializeMemoryWithBreakpoints(region + end, start - end);
+    memmove(reinterpret_cast<void *>(region + start), function->code,
+            function->size);
+    ASSERT(function->assembler == NULL ||
+           function->assembler->code_address() == 0 ||
+           function->assembler->code_address() == region + start);
+    function->offset = start;
+    end = start + function->size;
+  }
+  veneers_offset_ = RoundUp(end, kVeneerSize);
+  if (veneers_offset_ > capacity) {
+    FATAL("Code region too small");
+  }
+  Assembler::InitializeMemoryWithBreakpoints(region + end,
+                                             veneers_offset_ - end);
+  end = veneers_offset_;
+
+  for (intptr_t i = 0; i < FunctionCount(); i++) {
+    Function *function = FunctionAt(i);
+    for (intptr_t j = 0; j < function->relocation_count; j++) {
+      const Assembler::Relocation relocation = RelocationAt(function, j);
+      uword target;
+      Function *callee = LookupFunction(relocation.symbol);
+      if (callee != NULL) {
+        target = region + callee->offset + relocation.addend;
+      } else {
+        const uword address = LookupExternalSymbol(relocation.symbol);
+        if (address == 0) {
+          FATAL("Undefined symbol");
+        }
+        target = address + relocation.addend;
+      }
+      const uword field = region + function->offset + relocation.offset;
+      int64_t distance = static_cast<int64_t>(target - (field + 4));
+      if (!Utils::IsInt(32, distance)) {
+        // Only branches can go through a veneer.
+        if (relocation.kind == Assembler::kPcRelativeAddress) {
+          FATAL("Address out of range");
+        }
+        target = LookupVeneer(target, region, &end, capacity);
+        distance = static_cast<int64_t>(target - (field + 4));
+        ASSERT(Utils::IsInt(32, distance));
+      }
+      const int32_t rel32 = static_cast<int32_t>(distance);
+      memmove(reinterpret_cast<void *>(field), &rel32, sizeof(rel32));
+    }
+  }
+  return end;
+}
+
+uword CodeRelocator::LookupVeneer(uword target, uword region, intptr_t *end,
+                                  intptr_t capacity) {
+  intptr_t index = 0;
+  while (index < veneer_targets_.Size() / 8 &&
+         veneer_targets_.Load<uint64_t>(index * 8) != target) {
+    index++;
+  }
+  const uword veneer = region + veneers_offset_ + index * kVeneerSize;
+  if (index == veneer_targets_.Size() / 8) {
+    if (*end + kVeneerSize > capacity) {
+      FATAL("Code region too small");
+    }
+    AssemblerBuffer::EnsureCapacity ensured(&veneer_targets_);
+    veneer_targets_.Emit<uint64_t>(target);
+    // jmp [rip+0], followed by the target.
+    static const uint8_t kJmpRip[] = {0xFF, 0x25, 0x00, 0x00, 0x00, 0x00};
+    const uint64_t address = target;
+    Assembler::InitializeMemoryWithBreakpoints(veneer, kVeneerSize);
+    memmove(reinterpret_cast<void *>(veneer), kJmpRip, sizeof(kJmpRip));
+    memmove(reinterpret_cast<void *>(veneer + sizeof(kJmpRip)), &address,
+            sizeof(address));
+    *end += kVeneerSize;
+  }
+  return veneer;
+}
@@ -0,0 +1,94 @@
+// Copyright (c) 2019, the Dart project authors.  Please see the AUTHORS file
+// for details. All rights reserved. Use of this source code is governed by a
+// BSD-style license that can be found in the LICENSE file.
+
+#pragma once
+
+#include "assembler.h"
+#include "globals.h"
+
+// Lays out finalized functions in one code region and resolves the
+// PC-relative calls and tail calls between them (see
+// Assembler::GenerateUnRelocatedPcRelativeCall) into direct rel32 branches.
+//
+// Targets are either functions added to the relocator or external symbols
+// at fixed addresses. A branch to an external symbol that is out of rel32
+// range goes through a veneer, "jmp [rip+0]" followed by the target address,
+// placed after the functions. Addresses loaded with
+// Assembler::LoadUnRelocatedPcRelativeAddress must be within rel32 range.
+class CodeRelocator : public ValueObject {
+public:
+  CodeRelocator() : veneers_offset_(0) {}
+  ~CodeRelocator() {}
+
+  // Functions are aligned so that alignment done by the assembler
+  // (Assembler::Align, the JCC erratum padding, the cold code) stays valid.
+  static const intptr_t kFunctionAlignment = 32;
+  static const intptr_t kVeneerSize = 16;
+
+  // Adds the code of |assembler|, which must have been finalized and must
+  // stay alive until Link(), as the function |symbol|.
+  void AddFunction(intptr_t symbol, Assembler *assembler);
+  // Adds unrelocated code and its relocations, which must stay alive until
+  // Link(), as the function |symbol|.
+  void AddFunction(intptr_t symbol, const uint8_t *code, intptr_t size,
+                   const Assembler::Relocation *relocations,
+                   intptr_t relocation_count);
+  void AddExternalSymbol(intptr_t symbol, uword address);
+
+  // The largest region Link() may need.
+  intptr_t MaxSize();
+
+  // Copies the functions into |region| and resolves their relocations.
+  // |region| is also the address the code will run at and must hold
+  // |capacity| bytes. Returns the number of bytes used.
+  intptr_t Link(uword region, intptr_t capacity);
+
+  // The offset of the function |symbol| in the region after Link().
+  intptr_t FunctionOffset(intptr_t symbol);
+
+private:
+  struct Function {
+    intptr_t symbol;
+    Assembler *assembler; // Or NULL for code added as bytes.
+    const uint8_t *code;
+    intptr_t size;
+    const Assembler::Relocation *relocations;
+    intptr_t relocation_count;
+    intptr_t offset;
+  };
+  struct ExternalSymbol {
+    intptr_t symbol;
+    uword address;
+  };
+
+  intptr_t FunctionCount() const {
+    return functions_.Size() / sizeof(Function);
+  }
+  Function *FunctionAt(intptr_t index) {
+    return reinterpret_cast<Function *>(
+        functions_.Address(index * sizeof(Function)));
+  }
+  Function *LookupFunction(intptr_t symbol);
+  static Assembler::Relocation RelocationAt(Function *function,
+                                            intptr_t index) {
+    ASSERT(0 <= index && index < function->relocation_count);
+    return function->assembler != NULL
+               ? function->assembler->RelocationAt(index)
+               : function->relocations[index];
+  }
+  // Returns 0 if |symbol| is not an external symbol.
+  uword LookupExternalSymbol(intptr_t symbol);
+  // Returns the address of the veneer for |target|, adding one at |*end| if
+  // needed.
+  uword LookupVeneer(uword target, uword region, intptr_t *end,
+                     intptr_t capacity);
+
+  AssemblerBuffer functions_;
+  AssemblerBuffer external_symbols_;
+  // Targets of the veneers emitted so far, in order.
+  AssemblerBuffer veneer_targets_;
+  intptr_t veneers_offset_;
+
+  DISALLOW_COPY_AND_ASSIGN(CodeRelocator);
+};
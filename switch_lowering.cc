@@ -0,0 +1,221 @@
+// Copyright (c) 2019, the Dart project authors.  Please see the AUTHORS file
+// for details. All rights reserved. Use of this source code is governed by a
+// BSD-style license that can be found in the LICENSE file.
+
+#include "switch_lowering.h"
+
+SwitchLowering::SwitchLowering()
+    : cases_(NULL), case_count_(0), case_capacity_(0), clusters_(NULL),
+      cluster_count_(0), assembler_(NULL), value_(kNoRegister),
+      default_label_(NULL), scratch_(kNoRegister), jump_table_count_(0),
+      compare_count_(0) {}
+
+SwitchLowering::~SwitchLowering() {
+  free(cases_);
+  free(clusters_);
+}
+
+void SwitchLowering::AddCase(int64_t value, Label *label, intptr_t weight) {
+  ASSERT(weight >= 0);
+  if (case_count_ == case_capacity_) {
+    case_capacity_ = case_capacity_ == 0 ? 16 : 2 * case_capacity_;
+    cases_ = reinterpret_cast<Case *>(
+        realloc(cases_, case_capacity_ * sizeof(Case)));
+  }
+  Case *c = &cases_[case_count_++];
+  c->value = value;
+  c->label = label;
+  c->weight = weight;
+}
+
+int SwitchLowering::CompareCases(const void *a, const void *b) {
+  const int64_t left = reinterpret_cast<const Case *>(a)->value;
+  const int64_t right = reinterpret_cast<const Case *>(b)->value;
+  return left < right ? -1 : (left > right ? 1 : 0);
+}
+
+bool SwitchLowering::IsJumpTable(intptr_t first, intptr_t last) const {
+  const intptr_t count = last - first + 1;
+  // Unsigned, as the range of int64 values may not fit in an int64.
+  const uint64_t span = static_cast<uint64_t>(cases_[last].value) -
+                        static_cast<uint64_t>(cases_[first].value);
+  return count >= kMinJumpTableCases &&
+         span < static_cast<uint64_t>(kMaxJumpTableEntries) &&
+         count * 100 >= static_cast<intptr_t>(span + 1) * kMinJumpTableDensity;
+}
+
+void SwitchLowering::BuildClusters() {
+  qsort(cases_, case_count_, sizeof(cases_[0]), CompareCases);
+  // fewest[i] is the fewest clusters covering the first i cases, the last
+  // of them starting at case start[i].
+  intptr_t *fewest = reinterpret_cast<intptr_t *>(
+      malloc((case_count_ + 1) * sizeof(intptr_t)));
+  intptr_t *start = reinterpret_cast<intptr_t *>(
+      malloc((case_count_ + 1) * sizeof(intptr_t)));
+  fewest[0] = 0;
+  for (intptr_t i = 1; i <= case_count_; i++) {
+    const intptr_t last = i - 1;
+    ASSERT(last == 0 || cases_[last - 1].value != cases_[last].value);
+    fewest[i] = fewest[i - 1] + 1;
+    start[i] = last;
+    // Cases are unique, so a table spans at least as many values as cases.
+    for (intptr_t first = last - 1;
+         first >= 0 && last - first < kMaxJumpTableEntries; first--) {
+      if (fewest[first] + 1 < fewest[i] && IsJumpTable(first, last)) {
+        fewest[i] = fewest[first] + 1;
+        start[i] = first;
+      }
+    }
+  }
+
+  cluster_count_ = fewest[case_count_];
+  clusters_ = reinterpret_cast<Cluster *>(
+      realloc(clusters_, cluster_count_ * sizeof(Cluster)));
+  intptr_t index = cluster_count_;
+  for (intptr_t i = case_count_; i > 0; i = start[i]) {
+    Cluster *cluster = &clusters_[--index];
+    cluster->first_case = start[i];
+    cluster->case_count = i - start[i];
+    cluster->low = cases_[start[i]].value;
+    cluster->high = cases_[i - 1].value;
+    cluster->weight = 0;
+    for (intptr_t j = start[i]; j < i; j++) {
+      cluster->weight += cases_[j].weight;
+    }
+    cluster->is_jump_table = cluster->case_count > 1;
+  }
+  ASSERT(index == 0);
+  free(fewest);
+  free(start);
+}
+
+void SwitchLowering::Emit(Assembler *assembler, Register value,
+                          Label *default_label, Register scratch) {
+  ASSERT(value != TMP);
+  ASSERT(value != scratch);
+  assembler_ = assembler;
+  value_ = value;
+  default_label_ = default_label;
+  scratch_ = scratch;
+  jump_table_count_ = 0;
+  compare_count_ = 0;
+  BuildClusters();
+  if (cluster_count_ == 0) {
+    assembler->jmp(default_label);
+  } else {
+    EmitTree(0, cluster_count_, kMinInt64, INT64_MAX);
+  }
+  assembler_ = NULL;
+}
+
+void SwitchLowering::EmitTree(intptr_t first, intptr_t count, int64_t lower,
+                              int64_t upper) {
+  ASSERT(count > 0);
+  bool has_jump_table = false;
+  for (intptr_t i = first; i < first + count; i++) {
+    has_jump_table = has_jump_table || clusters_[i].is_jump_table;
+  }
+  if (!has_jump_table && count <= kMaxLinearCases) {
+    EmitLinear(first, count, lower, upper);
+    return;
+  }
+  if (count == 1) {
+    EmitJumpTable(clusters_[first]);
+    return;
+  }
+
+  // Split where the weights of both sides are the closest, and then
+  // closest to the middle.
+  intptr_t total = 0;
+  for (intptr_t i = first; i < first + count; i++) {
+    total += clusters_[i].weight;
+  }
+  intptr_t pivot = first + 1;
+  intptr_t best_weight_difference = -1;
+  intptr_t best_count_difference = 0;
+  intptr_t left = 0;
+  for (intptr_t i = first + 1; i < first + count; i++) {
+    left += clusters_[i - 1].weight;
+    const intptr_t weight_difference =
+        left > total - left ? 2 * left - total : total - 2 * left;
+    const intptr_t count_difference = 2 * (i - first) > count
+                                          ? 2 * (i - first) - count
+                                          : count - 2 * (i - first);
+    if (best_weight_difference < 0 ||
+        weight_difference < best_weight_difference ||
+        (weight_difference == best_weight_difference &&
+         count_difference < best_count_difference)) {
+      pivot = i;
+      best_weight_difference = weight_difference;
+      best_count_difference = count_difference;
+    }
+  }
+
+  Label right;
+  compare_count_++;
+  assembler_->CompareAndBranch(value_, Immediate(clusters_[pivot].low),
+                               GREATER_EQUAL, &right);
+  EmitTree(first, pivot - first, lower, clusters_[pivot].low - 1);
+  assembler_->Bind(&right);
+  EmitTree(pivot, first + count - pivot, clusters_[pivot].low, upper);
+}
+
+void SwitchLowering::EmitLinear(intptr_t first, intptr_t count,
+                                int64_t lower, int64_t upper) {
+  // The heaviest first, in order of values otherwise.
+  intptr_t order[kMaxLinearCases];
+  for (intptr_t i = 0; i < count; i++) {
+    intptr_t j = i;
+    for (; j > 0 && clusters_[order[j - 1]].weight <
+                        clusters_[first + i].weight;
+         j--) {
+      order[j] = order[j - 1];
+    }
+    order[j] = first + i;
+  }
+  for (intptr_t i = 0; i < count; i++) {
+    const Cluster &cluster = clusters_[order[i]];
+    Label *label = cases_[cluster.first_case].label;
+    if (lower == upper) {
+      // The only value left.
+      ASSERT(cluster.low == lower);
+      assembler_->jmp(label);
+      return;
+    }
+    compare_count_++;
+    assembler_->CompareAndBranch(value_, Immediate(cluster.low), EQUAL,
+                                 label);
+    if (cluster.low == lower) {
+      lower++;
+    } else if (cluster.low == upper) {
+      upper--;
+    }
+  }
+  assembler_->jmp(default_label_);
+}
+
+void SwitchLowering::EmitJumpTable(const Cluster &cluster) {
+  const intptr_t entry_count = cluster.high - cluster.low + 1;
+  Label **labels =
+      reinterpret_cast<Label **>(malloc(entry_count * sizeof(Label *)));
+  for (intptr_t i = 0; i < entry_count; i++) {
+    labels[i] = default_label_;
+  }
+  for (intptr_t i = cluster.first_case;
+       i < cluster.first_case + cluster.case_count; i++) {
+    labels[cases_[i].value - cluster.low] = cases_[i].label;
+  }
+  const Immediate low(cluster.low);
+  if (cluster.low == 0) {
+    // The index is the value.
+  } else if (low.is_int32()) {
+    assembler_->subq(value_, low);
+  } else {
+    assembler_->LoadImmediate(scratch_, low);
+    assembler_->subq(value_, scratch_);
+  }
+  assembler_->JumpTable(value_, labels, entry_count, default_label_,
+                        scratch_);
+  jump_table_count_++;
+  free(labels);
+}
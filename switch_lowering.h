@@ -0,0 +1,96 @@
+// Copyright (c) 2019, the Dart project authors.  Please see the AUTHORS file
+// for details. All rights reserved. Use of this source code is governed by a
+// BSD-style license that can be found in the LICENSE file.
+
+#pragma once
+
+#include "assembler.h"
+#include "globals.h"
+
+// Lowers a switch over the signed 64-bit value of a register:
+//
+//     SwitchLowering lowering;
+//     lowering.AddCase(1, &one);
+//     lowering.AddCase(1000, &thousand, 10);
+//     ...
+//     lowering.Emit(assembler, RDI, &default_case);
+//
+// The cases are sorted and split into clusters: runs of at least
+// kMinJumpTableCases cases filling at least kMinJumpTableDensity percent of
+// their range are dispatched with an Assembler::JumpTable(), the fewest
+// clusters covering all cases being chosen. The clusters are then reached
+// through a binary tree of compares, split so that both sides have about
+// the same weight: cases given a higher weight, such as a call count, end
+// up on shorter paths. Up to kMaxLinearCases single cases are compared one
+// after the other, the heaviest first.
+//
+// The tree keeps track of the range of values left, so that no compare is
+// emitted for a case known to match.
+class SwitchLowering : public ValueObject {
+public:
+  static const intptr_t kMinJumpTableCases = 4;
+  static const intptr_t kMinJumpTableDensity = 40;
+  static const intptr_t kMaxJumpTableEntries = 4096;
+  static const intptr_t kMaxLinearCases = 3;
+
+  SwitchLowering();
+  ~SwitchLowering();
+
+  // Jumps to |label| for |value|, which must be unique. |weight| is the
+  // relative frequency of the case, zero or more.
+  void AddCase(int64_t value, Label *label, intptr_t weight = 1);
+  intptr_t CaseCount() const { return case_count_; }
+
+  // Emits the dispatch on |value| to the cases, or to |default_label| for
+  // the values without a case. Clobbers |value| and |scratch| when jumping
+  // through a jump table. |value| must not be TMP, as compares with 64-bit
+  // immediates use it.
+  void Emit(Assembler *assembler, Register value, Label *default_label,
+            Register scratch = TMP);
+
+  // Of the last Emit().
+  intptr_t jump_table_count() const { return jump_table_count_; }
+  intptr_t compare_count() const { return compare_count_; }
+
+private:
+  struct Case {
+    int64_t value;
+    Label *label;
+    intptr_t weight;
+  };
+  // A single case, or the cases of a jump table.
+  struct Cluster {
+    intptr_t first_case;
+    intptr_t case_count;
+    int64_t low;
+    int64_t high;
+    intptr_t weight;
+    bool is_jump_table;
+  };
+
+  static int CompareCases(const void *a, const void *b);
+  // Whether cases |first| to |last| (inclusive) make a jump table.
+  bool IsJumpTable(intptr_t first, intptr_t last) const;
+  void BuildClusters();
+  // Emits the dispatch to clusters |first| to |first| + |count| - 1, for a
+  // value known to be in [lower, upper].
+  void EmitTree(intptr_t first, intptr_t count, int64_t lower, int64_t upper);
+  void EmitLinear(intptr_t first, intptr_t count, int64_t lower,
+                  int64_t upper);
+  void EmitJumpTable(const Cluster &cluster);
+
+  Case *cases_;
+  intptr_t case_count_;
+  intptr_t case_capacity_;
+  Cluster *clusters_;
+  intptr_t cluster_count_;
+
+  // During Emit().
+  Assembler *assembler_;
+  Register value_;
+  Label *default_label_;
+  Register scratch_;
+
+  intptr_t jump_table_count_;
+  intptr_t compare_count_;
+};
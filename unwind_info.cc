@@ -0,0 +1,241 @@
+// Copyright (c) 2019, the Dart project authors.  Please see the AUTHORS file
+// for details. All rights reserved. Use of this source code is governed by a
+// BSD-style license that can be found in the LICENSE file.
+
+#include "unwind_info.h"
+
+// Provided by the unwinder of the C++ runtime (libgcc or libunwind).
+extern "C" void __register_frame(void *begin);
+extern "C" void __deregister_frame(void *begin);
+
+// DWARF constants (DWARF 4, section 7.23; the LSB for the pointer
+// encodings).
+enum {
+  DW_CFA_nop = 0x00,
+  DW_CFA_advance_loc1 = 0x02,
+  DW_CFA_advance_loc2 = 0x03,
+  DW_CFA_advance_loc4 = 0x04,
+  DW_CFA_def_cfa = 0x0C,
+  DW_CFA_def_cfa_register = 0x0D,
+  DW_CFA_def_cfa_offset = 0x0E,
+  DW_CFA_advance_loc = 0x40,
+  DW_CFA_offset = 0x80,
+  DW_CFA_restore = 0xC0,
+};
+
+enum {
+  DW_EH_PE_absptr = 0x00,
+  DW_EH_PE_sdata4 = 0x0B,
+  DW_EH_PE_pcrel = 0x10,
+};
+
+// DWARF register numbers (System V x86-64 psABI).
+static const uint8_t kDwarfRbx = 3;
+static const uint8_t kDwarfRbp = 6;
+static const uint8_t kDwarfRsp = 7;
+static const uint8_t kDwarfR8 = 8;
+static const uint8_t kDwarfReturnAddress = 16;
+
+static const int kDataAlignment = -8;
+
+static void EmitUleb128(AssemblerBuffer *buffer, uint64_t value) {
+  do {
+    uint8_t byte = value & 0x7F;
+    value >>= 7;
+    if (value != 0) {
+      byte |= 0x80;
+    }
+    AssemblerBuffer::EnsureCapacity ensured(buffer);
+    buffer->Emit<uint8_t>(byte);
+  } while (value != 0);
+}
+
+static void EmitSleb128(AssemblerBuffer *buffer, int64_t value) {
+  bool more = true;
+  while (more) {
+    uint8_t byte = value & 0x7F;
+    value >>= 7;
+    more = !((value == 0 && (byte & 0x40) == 0) ||
+             (value == -1 && (byte & 0x40) != 0));
+    AssemblerBuffer::EnsureCapacity ensured(buffer);
+    buffer->Emit<uint8_t>(more ? (byte | 0x80) : byte);
+  }
+}
+
+template <typename T> static void Emit(AssemblerBuffer *buffer, T value) {
+  AssemblerBuffer::EnsureCapacity ensured(buffer);
+  buffer->Emit<T>(value);
+}
+
+static uint8_t DwarfRegister(Register reg) {
+  switch (reg) {
+  case RBX:
+    return kDwarfRbx;
+  case RBP:
+    return kDwarfRbp;
+  case RSP:
+    return kDwarfRsp;
+  default:
+    // R8 to R15 are numbered in order.
+    ASSERT(reg >= R8 && reg <= R15);
+    return kDwarfR8 + (reg - R8);
+  }
+}
+
+// Describes the slot of the caller's |reg| at CFA - |offset|, or restores
+// its rule to same value if |offset| is 0.
+static void EmitSavedRegister(AssemblerBuffer *eh_frame, Register reg,
+                              intptr_t offset) {
+  if (offset == 0) {
+    Emit<uint8_t>(eh_frame, DW_CFA_restore | DwarfRegister(reg));
+  } else {
+    ASSERT(Utils::IsAligned(offset, 8));
+    Emit<uint8_t>(eh_frame, DW_CFA_offset | DwarfRegister(reg));
+    EmitUleb128(eh_frame, offset / -kDataAlignment);
+  }
+}
+
+// Pads the entry starting at |start| to the pointer size and fills in its
+// length.
+static void FinishEntry(AssemblerBuffer *eh_frame, intptr_t start) {
+  while (!Utils::IsAligned(eh_frame->Size(), 8)) {
+    Emit<uint8_t>(eh_frame, DW_CFA_nop);
+  }
+  eh_frame->Store<uint32_t>(start, eh_frame->Size() - (start + 4));
+}
+
+intptr_t UnwindInfo::WriteCie(AssemblerBuffer *eh_frame, PcEncoding encoding) {
+  ASSERT(Utils::IsAligned(eh_frame->Size(), 8));
+  const intptr_t start = eh_frame->Size();
+  Emit<uint32_t>(eh_frame, 0); // Length.
+  Emit<uint32_t>(eh_frame, 0); // CIE id.
+  Emit<uint8_t>(eh_frame, 1);  // Version.
+  // Augmentation "zR": the encoding of the FDE addresses follows.
+  Emit<uint8_t>(eh_frame, 'z');
+  Emit<uint8_t>(eh_frame, 'R');
+  Emit<uint8_t>(eh_frame, 0);
+  EmitUleb128(eh_frame, 1); // Code alignment.
+  EmitSleb128(eh_frame, kDataAlignment);
+  Emit<uint8_t>(eh_frame, kDwarfReturnAddress);
+  EmitUleb128(eh_frame, 1); // Augmentation data length.
+  Emit<uint8_t>(eh_frame, encoding == kAbsolute
+                              ? DW_EH_PE_absptr
+                              : (DW_EH_PE_pcrel | DW_EH_PE_sdata4));
+  // At entry, CFA = RSP + 8 and the return address is at CFA - 8.
+  Emit<uint8_t>(eh_frame, DW_CFA_def_cfa);
+  EmitUleb128(eh_frame, kDwarfRsp);
+  EmitUleb128(eh_frame, 8);
+  Emit<uint8_t>(eh_frame, DW_CFA_offset | kDwarfReturnAddress);
+  EmitUleb128(eh_frame, 8 / -kDataAlignment);
+  FinishEntry(eh_frame, start);
+  return start;
+}
+
+static void EmitAdvance(AssemblerBuffer *eh_frame, intptr_t delta) {
+  ASSERT(delta > 0);
+  if (delta < 0x40) {
+    Emit<uint8_t>(eh_frame, DW_CFA_advance_loc | delta);
+  } else if (Utils::IsUint(8, delta)) {
+    Emit<uint8_t>(eh_frame, DW_CFA_advance_loc1);
+    Emit<uint8_t>(eh_frame, delta);
+  } else if (Utils::IsUint(16, delta)) {
+    Emit<uint8_t>(eh_frame, DW_CFA_advance_loc2);
+    Emit<uint16_t>(eh_frame, delta);
+  } else {
+    Emit<uint8_t>(eh_frame, DW_CFA_advance_loc4);
+    Emit<uint32_t>(eh_frame, delta);
+  }
+}
+
+intptr_t UnwindInfo::WriteFde(AssemblerBuffer *eh_frame, intptr_t cie,
+                              PcEncoding encoding, Assembler *assembler,
+                              uint64_t pc_begin) {
+  ASSERT(assembler->is_finalized());
+  ASSERT(Utils::IsAligned(eh_frame->Size(), 8));
+  const intptr_t code_size = assembler->CodeSize();
+  const intptr_t start = eh_frame->Size();
+  Emit<uint32_t>(eh_frame, 0); // Length.
+  // The CIE pointer is the distance back from this field.
+  Emit<uint32_t>(eh_frame, eh_frame->Size() - cie);
+  const intptr_t pc_begin_offset = eh_frame->Size();
+  if (encoding == kAbsolute) {
+    Emit<uint64_t>(eh_frame, pc_begin);
+    Emit<uint64_t>(eh_frame, code_size);
+  } else {
+    Emit<int32_t>(eh_frame, pc_begin);
+    Emit<int32_t>(eh_frame, code_size);
+  }
+  EmitUleb128(eh_frame, 0); // Augmentation data length.
+
+  Assembler::CallFrame current = Assembler::CallFrame();
+  current.cfa_register = RSP;
+  current.cfa_offset = 8;
+  intptr_t location = 0;
+  for (intptr_t i = 0; i < assembler->CallFrameRowCount(); i++) {
+    const Assembler::CallFrameRow row = assembler->CallFrameRowAt(i);
+    const Assembler::CallFrame &frame = row.frame;
+    if (row.offset >= code_size) {
+      break;
+    }
+    // Only the last of several rows at the same offset matters.
+    if (i + 1 < assembler->CallFrameRowCount() &&
+        assembler->CallFrameRowAt(i + 1).offset == row.offset) {
+      continue;
+    }
+    if (frame.HasSameRules(current)) {
+      continue;
+    }
+    if (row.offset > location) {
+      EmitAdvance(eh_frame, row.offset - location);
+      location = row.offset;
+    }
+    if (frame.cfa_register != current.cfa_register &&
+        frame.cfa_offset != current.cfa_offset) {
+      Emit<uint8_t>(eh_frame, DW_CFA_def_cfa);
+      EmitUleb128(eh_frame, DwarfRegister(frame.cfa_register));
+      EmitUleb128(eh_frame, frame.cfa_offset);
+    } else if (frame.cfa_register != current.cfa_register) {
+      Emit<uint8_t>(eh_frame, DW_CFA_def_cfa_register);
+      EmitUleb128(eh_frame, DwarfRegister(frame.cfa_register));
+    } else if (frame.cfa_offset != current.cfa_offset) {
+      Emit<uint8_t>(eh_frame, DW_CFA_def_cfa_offset);
+      EmitUleb128(eh_frame, frame.cfa_offset);
+    }
+    if (frame.rbp_offset != current.rbp_offset) {
+      EmitSavedRegister(eh_frame, RBP, frame.rbp_offset);
+    }
+    for (intptr_t j = 0; j < Assembler::kNumSavedRegisters; j++) {
+      if (frame.saved_offsets[j] != current.saved_offsets[j]) {
+        EmitSavedRegister(eh_frame, Assembler::SavedRegisterAt(j),
+                          frame.saved_offsets[j]);
+      }
+    }
+    current = frame;
+  }
+  FinishEntry(eh_frame, start);
+  return pc_begin_offset;
+}
+
+void UnwindInfo::WriteTerminator(AssemblerBuffer *eh_frame) {
+  Emit<uint32_t>(eh_frame, 0);
+}
+
+void *UnwindInfo::Register(Assembler *assembler) {
+  ASSERT(assembler->code_address() != 0);
+  AssemblerBuffer eh_frame;
+  const intptr_t cie = WriteCie(&eh_frame, kAbsolute);
+  WriteFde(&eh_frame, cie, kAbsolute, assembler, assembler->code_address());
+  WriteTerminator(&eh_frame);
+  // The unwinder keeps pointers into the entries until unregistered.
+  void *entries = malloc(eh_frame.Size());
+  memmove(entries, reinterpret_cast<void *>(eh_frame.contents()),
+          eh_frame.Size());
+  // libgcc takes the terminated entries of a whole section.
+  __register_frame(entries);
+  return entries;
+}
+
+void UnwindInfo::Unregister(void *handle) {
+  __deregister_frame(handle);
+  free(handle);
+}
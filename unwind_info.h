@@ -0,0 +1,47 @@
+// Copyright (c) 2019, the Dart project authors.  Please see the AUTHORS file
+// for details. All rights reserved. Use of this source code is governed by a
+// BSD-style license that can be found in the LICENSE file.
+
+#pragma once
+
+#include "assembler.h"
+#include "globals.h"
+
+// Builds DWARF call frame information in the .eh_frame format from the call
+// frame rows of an assembler (see Assembler::set_track_call_frame), so that
+// debuggers, profilers and the C++ unwinder can unwind through generated
+// code.
+//
+// Each function gets a frame description entry (FDE) referring to a common
+// information entry (CIE) that describes the state at function entry:
+// CFA = RSP + 8 with the return address at CFA - 8.
+class UnwindInfo {
+public:
+  // How the FDEs refer to their code: by absolute address, or by 32-bit
+  // offset from the field, relocated by the linker.
+  enum PcEncoding {
+    kAbsolute,
+    kPcRelative,
+  };
+
+  // Appends a CIE to |eh_frame| and returns its offset.
+  static intptr_t WriteCie(AssemblerBuffer *eh_frame, PcEncoding encoding);
+  // Appends an FDE for the code of |assembler|, which must have been
+  // finalized, using the CIE at |cie|. The start of the code is |pc_begin|.
+  // Returns the offset of the field holding it.
+  static intptr_t WriteFde(AssemblerBuffer *eh_frame, intptr_t cie,
+                           PcEncoding encoding, Assembler *assembler,
+                           uint64_t pc_begin);
+  // Terminates the entries of an .eh_frame section.
+  static void WriteTerminator(AssemblerBuffer *eh_frame);
+
+  // Registers the unwind info of the code of |assembler|, which must have
+  // been finalized and placed at its code_address(), with the unwinder of
+  // the process (__register_frame). Returns a handle for Unregister(),
+  // which must be called before the code is freed.
+  static void *Register(Assembler *assembler);
+  static void Unregister(void *handle);
+
+private:
+  DISALLOW_IMPLICIT_CONSTRUCTORS(UnwindInfo);
+};